@@ -6,6 +6,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "easel.h"
 #include "esl_alphabet.h"
@@ -18,6 +22,58 @@
 #include "cachedb.h"
 #include "hmmpgmd.h"
 
+/* Binary ("pressed") sequence cache files, written by p7_seqcache_Write()
+ * and mapped by p7_seqcache_Open(). The file is the cache's memory layout
+ * with pointers replaced by offsets, in native byte order:
+ *
+ *   P7_SEQCACHE_FHDR     sizes, and offsets of the sections below
+ *   id                   id string, \0-terminated
+ *   db table             db_cnt pairs of uint32_t <count>, <K>
+ *   db lists             for each sub-database, <count> uint32_t indices into the records
+ *   records              <count> P7_SEQCACHE_FREC, in search order
+ *   header_mem           the name strings
+ *   desc_mem             the description strings
+ *   residue_mem          the digital sequences
+ *
+ * Each section starts on an 8-byte boundary.
+ */
+#define p7_SEQCACHE_MAGIC     0xe3edb0b4u            /* "seqc" + 0x80808080, v1 */
+#define p7_SEQCACHE_MAGIC_SWP 0xb4b0ede3u            /* byteswapped: wrong byte order */
+
+#define p7_SEQCACHE_NODESC   UINT64_MAX              /* desc_off of a sequence without a description */
+#define p7_SEQCACHE_ALIGN(x) (((x) + 7) & ~((uint64_t) 7))
+
+typedef struct {
+  uint32_t  magic;
+  uint32_t  db_cnt;
+  uint32_t  count;
+  uint32_t  id_len;              /* length of the id string, including \0 */
+  uint64_t  res_size;
+  uint64_t  hdr_size;
+  uint64_t  desc_size;
+  uint64_t  id_off;              /* file offsets of each section           */
+  uint64_t  dbtab_off;
+  uint64_t  dblist_off;
+  uint64_t  rec_off;
+  uint64_t  hdr_off;
+  uint64_t  desc_off;
+  uint64_t  res_off;
+  uint64_t  file_size;
+} P7_SEQCACHE_FHDR;
+
+typedef struct {
+  uint64_t  name_off;            /* offset of the name in header_mem       */
+  uint64_t  dsq_off;             /* offset of the dsq in residue_mem       */
+  int64_t   n;
+  int64_t   idx;
+  uint64_t  db_key;
+  uint64_t  desc_off;            /* offset in desc_mem, or p7_SEQCACHE_NODESC */
+} P7_SEQCACHE_FREC;
+
+static int seqcache_Map(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf);
+static int seqcache_pad(FILE *ofp, uint64_t n);
+static int seqcache_section_ok(uint64_t off, uint64_t len, uint64_t file_size);
+
 
 /* sort routines */
 static int
@@ -68,6 +124,10 @@ p7_seqcache_Open(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf)
 
   if (errbuf) errbuf[0] = '\0';	/* CURRENTLY UNUSED. FIXME */
 
+  /* A pressed cache is mapped as is, with no parsing */
+  status = seqcache_Map(seqfile, ret_cache, errbuf);
+  if (status != eslENOTFOUND) return status;
+
   /* Open the target sequence database */
   if ((status = esl_sqfile_Open(seqfile, eslSQFILE_FASTA, NULL, &sqfp)) != eslOK) return status;
 
@@ -288,18 +348,473 @@ p7_seqcache_Close(P7_SEQCACHE *cache)
     }
   if (cache->abc)         esl_alphabet_Destroy(cache->abc);
   if (cache->list)        free(cache->list);
-  if (cache->residue_mem) free(cache->residue_mem);
-  if (cache->header_mem)  free(cache->header_mem);
+  if (cache->map)
+    {  /* residues, names and descriptions all point into the pressed file */
+#ifdef HAVE_MMAP
+      munmap(cache->map, cache->mapsize);
+#else
+      free(cache->map);
+#endif
+    }
+  else
+    {
+      if (cache->residue_mem) free(cache->residue_mem);
+      if (cache->header_mem)  free(cache->header_mem);
+    }
   free(cache);
 }
 
 
+/* Function:  p7_seqcache_Replicate()
+ * Synopsis:  Make a private copy of a sequence cache.
+ *
+ * Purpose:   Copy the residues, headers and sequence lists of <src>
+ *            into a new cache, returned in <*ret_cache>. Used by
+ *            hmmpgmd --numa to keep one copy of the database on each
+ *            NUMA node: the caller runs this in a thread pinned to
+ *            the node, so the new copy is allocated there. Sequence
+ *            order and indices are the same as in <src>. The short
+ *            description strings are shared with <src>, not copied.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_seqcache_Replicate(const P7_SEQCACHE *src, P7_SEQCACHE **ret_cache)
+{
+  P7_SEQCACHE *cache = NULL;
+  uint32_t     i, j;
+  int          status;
+
+  ESL_ALLOC(cache, sizeof(P7_SEQCACHE));
+  memset(cache, 0, sizeof(P7_SEQCACHE));
+
+  if ((status = esl_strdup(src->name, -1, &cache->name)) != eslOK) goto ERROR;
+  if ((status = esl_strdup(src->id,   -1, &cache->id))   != eslOK) goto ERROR;
+  cache->db_cnt   = src->db_cnt;
+  cache->count    = src->count;
+  cache->res_size = src->res_size;
+  cache->hdr_size = src->hdr_size;
+  if ((cache->abc = esl_alphabet_Create(src->abc->type)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  ESL_ALLOC(cache->residue_mem, src->res_size);
+  ESL_ALLOC(cache->header_mem,  src->hdr_size);
+  memcpy(cache->residue_mem, src->residue_mem, src->res_size);
+  memcpy(cache->header_mem,  src->header_mem,  src->hdr_size);
+
+  /* rebase the name and residue pointers into the new memory */
+  ESL_ALLOC(cache->list, sizeof(HMMER_SEQ) * src->count);
+  for (i = 0; i < src->count; ++i) {
+    cache->list[i]      = src->list[i];
+    cache->list[i].name = cache->header_mem + (src->list[i].name - src->header_mem);
+    cache->list[i].dsq  = (ESL_DSQ *) cache->residue_mem + (src->list[i].dsq - (ESL_DSQ *) src->residue_mem);
+  }
+
+  ESL_ALLOC(cache->db, sizeof(SEQ_DB) * src->db_cnt);
+  for (i = 0; i < src->db_cnt; ++i) cache->db[i].list = NULL;
+  for (i = 0; i < src->db_cnt; ++i) {
+    cache->db[i].count = src->db[i].count;
+    cache->db[i].K     = src->db[i].K;
+    ESL_ALLOC(cache->db[i].list, sizeof(HMMER_SEQ *) * src->db[i].count);
+    for (j = 0; j < src->db[i].count; ++j)
+      cache->db[i].list[j] = cache->list + (src->db[i].list[j] - src->list);
+  }
+
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (cache != NULL) p7_seqcache_Close(cache);
+  *ret_cache = NULL;
+  return status;
+}
+
+
+
+
+/* Function:  p7_seqcache_Write()
+ * Synopsis:  Write a sequence cache in binary form, for fast loading.
+ *
+ * Purpose:   Write <cache> to the open binary stream <ofp>, in a form
+ *            that <p7_seqcache_Open()> recognizes and maps into memory
+ *            without parsing, instead of reading and digitizing every
+ *            sequence of the FASTA database. The sequence order and
+ *            indices are kept, so results are the same either way.
+ *            The file is in native byte order; a file written on a
+ *            machine of the other byte order is rejected when opened.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslEWRITE> on a write
+ *            error.
+ */
+int
+p7_seqcache_Write(const P7_SEQCACHE *cache, FILE *ofp)
+{
+  P7_SEQCACHE_FHDR  fhdr;
+  P7_SEQCACHE_FREC  rec;
+  uint32_t         *dblist = NULL;
+  uint64_t          nlist  = 0;
+  uint64_t          pos;
+  uint64_t          dpos;
+  uint32_t          dbtab[2];
+  uint32_t          i, j;
+  int               status;
+
+  memset(&fhdr, 0, sizeof(P7_SEQCACHE_FHDR));
+  fhdr.magic    = p7_SEQCACHE_MAGIC;
+  fhdr.db_cnt   = cache->db_cnt;
+  fhdr.count    = cache->count;
+  fhdr.id_len   = strlen(cache->id) + 1;
+  fhdr.res_size = cache->res_size;
+  fhdr.hdr_size = cache->hdr_size;
+  for (i = 0; i < cache->count; ++i)
+    if (cache->list[i].desc != NULL) fhdr.desc_size += strlen(cache->list[i].desc) + 1;
+  for (i = 0; i < cache->db_cnt; ++i) nlist += cache->db[i].count;
+
+  pos = p7_SEQCACHE_ALIGN(sizeof(P7_SEQCACHE_FHDR));
+  fhdr.id_off     = pos;  pos = p7_SEQCACHE_ALIGN(pos + fhdr.id_len);
+  fhdr.dbtab_off  = pos;  pos = p7_SEQCACHE_ALIGN(pos + sizeof(uint32_t) * 2 * cache->db_cnt);
+  fhdr.dblist_off = pos;  pos = p7_SEQCACHE_ALIGN(pos + sizeof(uint32_t) * nlist);
+  fhdr.rec_off    = pos;  pos = p7_SEQCACHE_ALIGN(pos + sizeof(P7_SEQCACHE_FREC) * cache->count);
+  fhdr.hdr_off    = pos;  pos = p7_SEQCACHE_ALIGN(pos + fhdr.hdr_size);
+  fhdr.desc_off   = pos;  pos = p7_SEQCACHE_ALIGN(pos + fhdr.desc_size);
+  fhdr.res_off    = pos;  pos = pos + fhdr.res_size;
+  fhdr.file_size  = pos;
+
+  if (fwrite(&fhdr, sizeof(P7_SEQCACHE_FHDR), 1, ofp) != 1)           ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (seqcache_pad(ofp, sizeof(P7_SEQCACHE_FHDR))       != eslOK)       ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (fwrite(cache->id, 1, fhdr.id_len, ofp)            != fhdr.id_len) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (seqcache_pad(ofp, fhdr.id_len)                    != eslOK)       ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  for (i = 0; i < cache->db_cnt; ++i) {
+    dbtab[0] = cache->db[i].count;
+    dbtab[1] = cache->db[i].K;
+    if (fwrite(dbtab, sizeof(uint32_t), 2, ofp) != 2) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  }
+  if (seqcache_pad(ofp, sizeof(uint32_t) * 2 * cache->db_cnt) != eslOK) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  /* sub-database lists, as indices into the records */
+  ESL_ALLOC(dblist, sizeof(uint32_t) * ESL_MAX(1, nlist));
+  for (nlist = 0, i = 0; i < cache->db_cnt; ++i)
+    for (j = 0; j < cache->db[i].count; ++j)
+      dblist[nlist++] = cache->db[i].list[j] - cache->list;
+  if (fwrite(dblist, sizeof(uint32_t), nlist, ofp)      != nlist)       ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (seqcache_pad(ofp, sizeof(uint32_t) * nlist)       != eslOK)       ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  /* records; descriptions are laid out in record order */
+  for (dpos = 0, i = 0; i < cache->count; ++i) {
+    rec.name_off = cache->list[i].name - cache->header_mem;
+    rec.dsq_off  = (char *) cache->list[i].dsq - (char *) cache->residue_mem;
+    rec.n        = cache->list[i].n;
+    rec.idx      = cache->list[i].idx;
+    rec.db_key   = cache->list[i].db_key;
+    if (cache->list[i].desc != NULL) { rec.desc_off = dpos; dpos += strlen(cache->list[i].desc) + 1; }
+    else                               rec.desc_off = p7_SEQCACHE_NODESC;
+    if (fwrite(&rec, sizeof(P7_SEQCACHE_FREC), 1, ofp) != 1) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  }
+  /* a P7_SEQCACHE_FREC is a multiple of 8 bytes, so no padding here */
+
+  if (fwrite(cache->header_mem, 1, fhdr.hdr_size, ofp)  != fhdr.hdr_size) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (seqcache_pad(ofp, fhdr.hdr_size)                  != eslOK)        ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  for (i = 0; i < cache->count; ++i)
+    if (cache->list[i].desc != NULL && fwrite(cache->list[i].desc, 1, strlen(cache->list[i].desc) + 1, ofp) != strlen(cache->list[i].desc) + 1)
+      ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+  if (seqcache_pad(ofp, fhdr.desc_size)                 != eslOK)        ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  if (fwrite(cache->residue_mem, 1, fhdr.res_size, ofp) != fhdr.res_size) ESL_XEXCEPTION_SYS(eslEWRITE, "seqcache write failed");
+
+  free(dblist);
+  return eslOK;
+
+ ERROR:
+  if (dblist != NULL) free(dblist);
+  return status;
+}
+
+/* seqcache_pad()
+ * Write the zeros that bring a section of <n> bytes up to the next
+ * 8-byte boundary. Returns <eslOK>, or <eslEWRITE> on a write error.
+ */
+static int
+seqcache_pad(FILE *ofp, uint64_t n)
+{
+  static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  size_t            npad     = p7_SEQCACHE_ALIGN(n) - n;
+
+  return (fwrite(zeros, 1, npad, ofp) == npad) ? eslOK : eslEWRITE;
+}
+
+/* seqcache_section_ok()
+ * Return TRUE if a section of <len> bytes at offset <off> lies inside
+ * a pressed cache file of <file_size> bytes, after its header and on
+ * an 8-byte boundary; FALSE if not.
+ */
+static int
+seqcache_section_ok(uint64_t off, uint64_t len, uint64_t file_size)
+{
+  if (off < sizeof(P7_SEQCACHE_FHDR) || off % 8 != 0) return FALSE;
+  return (off <= file_size && len <= file_size - off);
+}
+
+/* seqcache_Map()
+ * If <seqfile> is a pressed cache written by p7_seqcache_Write(), map
+ * it (or, without mmap(), read it) into memory and return a cache
+ * whose residues, names and descriptions point into the mapping. Only
+ * the sequence and sub-database lists are built in private memory.
+ * The mapping is shared and read-only, so workers on one machine
+ * share a single copy of the database in the page cache.
+ *
+ * Returns <eslOK> on success; <eslENOTFOUND> if <seqfile> isn't a
+ * pressed cache (including if it can't be opened), so the caller can
+ * try it as FASTA; <eslEFORMAT> if it is one, but is truncated, of
+ * the wrong byte order, or has sections or records that don't fit
+ * in the file; <eslEMEM> on allocation failure.
+ */
+static int
+seqcache_Map(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf)
+{
+  P7_SEQCACHE       *cache = NULL;
+  P7_SEQCACHE_FHDR   fhdr;
+  P7_SEQCACHE_FREC  *rec   = NULL;
+  uint32_t          *dbtab = NULL;
+  uint32_t          *dblist;
+  uint64_t           nlist = 0;
+  FILE              *fp    = NULL;
+  char              *map   = NULL;
+  uint32_t           i, j;
+  int                status;
+
+  if ((fp = fopen(seqfile, "rb")) == NULL)                                { status = eslENOTFOUND; goto ERROR; }
+  if (fread(&fhdr.magic, sizeof(uint32_t), 1, fp) != 1)                   { status = eslENOTFOUND; goto ERROR; }
+  if (fhdr.magic == p7_SEQCACHE_MAGIC_SWP) ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s is of the wrong byte order", seqfile);
+  if (fhdr.magic != p7_SEQCACHE_MAGIC)                                    { status = eslENOTFOUND; goto ERROR; }
+
+  rewind(fp);
+  if (fread(&fhdr, sizeof(P7_SEQCACHE_FHDR), 1, fp) != 1) ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s is truncated", seqfile);
+
+  /* every section must lie inside the file, before anything is mapped */
+  if (fhdr.id_len == 0                                                                               ||
+      ! seqcache_section_ok(fhdr.id_off,     fhdr.id_len,                                      fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.dbtab_off,  sizeof(uint32_t) * 2 * (uint64_t) fhdr.db_cnt,    fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.dblist_off, 0,                                                fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.rec_off,    sizeof(P7_SEQCACHE_FREC) * (uint64_t) fhdr.count, fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.hdr_off,    fhdr.hdr_size,                                    fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.desc_off,   fhdr.desc_size,                                   fhdr.file_size) ||
+      ! seqcache_section_ok(fhdr.res_off,    fhdr.res_size,                                    fhdr.file_size))
+    ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s has a bad header", seqfile);
+
+#ifdef HAVE_MMAP
+  {
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || (uint64_t) st.st_size < fhdr.file_size) ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s is truncated", seqfile);
+    map = mmap(NULL, fhdr.file_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (map == MAP_FAILED) { map = NULL; ESL_XFAIL(eslEMEM, errbuf, "failed to map pressed sequence cache %s", seqfile); }
+  }
+#else
+  ESL_ALLOC(map, fhdr.file_size);
+  rewind(fp);
+  if (fread(map, 1, fhdr.file_size, fp) != fhdr.file_size) ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s is truncated", seqfile);
+#endif
+  fclose(fp);
+  fp = NULL;
+
+  ESL_ALLOC(cache, sizeof(P7_SEQCACHE));
+  memset(cache, 0, sizeof(P7_SEQCACHE));
+  cache->map         = map;
+  cache->mapsize     = fhdr.file_size;
+  cache->db_cnt      = fhdr.db_cnt;
+  cache->count       = fhdr.count;
+  cache->res_size    = fhdr.res_size;
+  cache->hdr_size    = fhdr.hdr_size;
+  cache->residue_mem = map + fhdr.res_off;
+  cache->header_mem  = map + fhdr.hdr_off;
+  map = NULL;
+
+  /* strings must end inside their sections */
+  if (                         cache->map[fhdr.id_off   + fhdr.id_len    - 1] != '\0'  ||
+      (fhdr.hdr_size  > 0 && cache->map[fhdr.hdr_off  + fhdr.hdr_size  - 1] != '\0') ||
+      (fhdr.desc_size > 0 && cache->map[fhdr.desc_off + fhdr.desc_size - 1] != '\0'))
+    ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s has an unterminated string", seqfile);
+
+  if ((status = esl_strdup(seqfile, -1, &cache->name))                  != eslOK) goto ERROR;
+  if ((status = esl_strdup(cache->map + fhdr.id_off, -1, &cache->id))   != eslOK) goto ERROR;
+  if ((cache->abc = esl_alphabet_Create(eslAMINO)) == NULL) { status = eslEMEM; goto ERROR; }
+
+  /* rebuild the sequence list, pointing into the mapping */
+  rec = (P7_SEQCACHE_FREC *) (cache->map + fhdr.rec_off);
+  ESL_ALLOC(cache->list, sizeof(HMMER_SEQ) * ESL_MAX(1, cache->count));
+  for (i = 0; i < cache->count; ++i) {
+    if (rec[i].name_off >= fhdr.hdr_size                                           ||
+        rec[i].n < 0 || rec[i].dsq_off > fhdr.res_size                             ||
+        (uint64_t) rec[i].n + 2 > fhdr.res_size - rec[i].dsq_off                   ||
+        (rec[i].desc_off != p7_SEQCACHE_NODESC && rec[i].desc_off >= fhdr.desc_size))
+      ESL_XFAIL(eslEFORMAT, errbuf, "bad sequence record %u in pressed sequence cache %s", i, seqfile);
+    cache->list[i].name   = cache->header_mem + rec[i].name_off;
+    cache->list[i].dsq    = (ESL_DSQ *) ((char *) cache->residue_mem + rec[i].dsq_off);
+    cache->list[i].n      = rec[i].n;
+    cache->list[i].idx    = rec[i].idx;
+    cache->list[i].db_key = rec[i].db_key;
+    cache->list[i].desc   = (rec[i].desc_off == p7_SEQCACHE_NODESC) ? NULL : cache->map + fhdr.desc_off + rec[i].desc_off;
+  }
+
+  /* and the sub-database lists */
+  dbtab  = (uint32_t *) (cache->map + fhdr.dbtab_off);
+  dblist = (uint32_t *) (cache->map + fhdr.dblist_off);
+  ESL_ALLOC(cache->db, sizeof(SEQ_DB) * ESL_MAX(1, cache->db_cnt));
+  for (i = 0; i < cache->db_cnt; ++i) cache->db[i].list = NULL;
+  for (i = 0; i < cache->db_cnt; ++i) {
+    cache->db[i].count = dbtab[2*i];
+    cache->db[i].K     = dbtab[2*i+1];
+    nlist += cache->db[i].count;
+    if (! seqcache_section_ok(fhdr.dblist_off, sizeof(uint32_t) * nlist, fhdr.file_size))
+      ESL_XFAIL(eslEFORMAT, errbuf, "pressed sequence cache %s has a bad sub-database list", seqfile);
+    ESL_ALLOC(cache->db[i].list, sizeof(HMMER_SEQ *) * ESL_MAX(1, cache->db[i].count));
+    for (j = 0; j < cache->db[i].count; ++j) {
+      if (dblist[j] >= cache->count) ESL_XFAIL(eslEFORMAT, errbuf, "bad sequence index in pressed sequence cache %s", seqfile);
+      cache->db[i].list[j] = cache->list + dblist[j];
+    }
+    dblist += cache->db[i].count;
+  }
+
+  for (i = 0; i < cache->db_cnt; ++i) {
+    printf("sequence database (%d):: %d %d\n", i, cache->db[i].count, cache->db[i].count);
+  }
+  printf("\nMapped pressed sequence db file %s; %" PRIu64 " bytes\n", seqfile, fhdr.file_size);
+
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (fp    != NULL) fclose(fp);
+#ifdef HAVE_MMAP
+  if (map   != NULL) munmap(map, fhdr.file_size);
+#else
+  if (map   != NULL) free(map);
+#endif
+  if (cache != NULL) p7_seqcache_Close(cache);
+  *ret_cache = NULL;
+  return status;
+}
 
 
 /*****************************************************************
  * x. Unit test
  *****************************************************************/
 
+#ifdef p7CACHEDB_TESTDRIVE
+
+/* utest_write_fasta()
+ * Write a small hmmpgmd-format sequence database to a new tmpfile,
+ * whose name is returned in <tmpfile>: four sequences in two
+ * sub-databases, with and without descriptions.
+ */
+static void
+utest_write_fasta(char *tmpfile)
+{
+  char  msg[] = "cachedb fasta writing failed";
+  FILE *fp    = NULL;
+
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  fprintf(fp, "# 34 4 2 3 3 2 2 utest database\n");
+  fprintf(fp, ">1 11 first description\nACDEFGHIKL\n");
+  fprintf(fp, ">2 01\nMNPQ\n");
+  fprintf(fp, ">3 1 third\nRSTVWY\n");
+  fprintf(fp, ">4 10 fourth one\nACACACACAC\nACAC\n");
+  fclose(fp);
+}
+
+/* utest_press()
+ * Load the database from FASTA, press it, map the pressed file back,
+ * and check that the mapped cache is the same as the loaded one:
+ * sequence order, names, residues, keys, descriptions, and
+ * sub-database lists.
+ */
+static void
+utest_press(char *fastafile, char *pressfile)
+{
+  char         msg[] = "cachedb press unit test failed";
+  char         errbuf[eslERRBUFSIZE];
+  P7_SEQCACHE *fcache = NULL;
+  P7_SEQCACHE *mcache = NULL;
+  FILE        *fp     = NULL;
+  uint32_t     i, j;
+
+  if (p7_seqcache_Open(fastafile, &fcache, errbuf) != eslOK) esl_fatal(msg);
+  if (fcache->map != NULL)                                   esl_fatal(msg);
+
+  if (esl_tmpfile_named(pressfile, &fp)  != eslOK) esl_fatal(msg);
+  if (p7_seqcache_Write(fcache, fp)      != eslOK) esl_fatal(msg);
+  fclose(fp);
+
+  if (p7_seqcache_Open(pressfile, &mcache, errbuf) != eslOK) esl_fatal("%s: %s", msg, errbuf);
+  if (mcache->map == NULL)                                   esl_fatal(msg);
+
+  if (strcmp(mcache->id, fcache->id) != 0) esl_fatal(msg);
+  if (mcache->count  != fcache->count)      esl_fatal(msg);
+  if (mcache->db_cnt != fcache->db_cnt)     esl_fatal(msg);
+  for (i = 0; i < fcache->count; ++i)
+    {
+      if (strcmp(mcache->list[i].name, fcache->list[i].name) != 0)                 esl_fatal(msg);
+      if (mcache->list[i].n      != fcache->list[i].n)                             esl_fatal(msg);
+      if (mcache->list[i].idx    != fcache->list[i].idx)                           esl_fatal(msg);
+      if (mcache->list[i].db_key != fcache->list[i].db_key)                        esl_fatal(msg);
+      if (memcmp(mcache->list[i].dsq, fcache->list[i].dsq, fcache->list[i].n + 2) != 0) esl_fatal(msg);
+      if (esl_strcmp(mcache->list[i].desc, fcache->list[i].desc) != 0)            esl_fatal(msg);
+    }
+  for (i = 0; i < fcache->db_cnt; ++i)
+    {
+      if (mcache->db[i].count != fcache->db[i].count) esl_fatal(msg);
+      if (mcache->db[i].K     != fcache->db[i].K)     esl_fatal(msg);
+      for (j = 0; j < fcache->db[i].count; ++j)
+	if (mcache->db[i].list[j] - mcache->list != fcache->db[i].list[j] - fcache->list) esl_fatal(msg);
+    }
+
+  p7_seqcache_Close(mcache);
+  p7_seqcache_Close(fcache);
+}
+
+/* utest_badheader()
+ * A pressed file whose header puts a section outside the file, or
+ * off its 8-byte boundary, is rejected as <eslEFORMAT>, not mapped.
+ */
+static void
+utest_badheader(char *pressfile)
+{
+  char              msg[] = "cachedb bad header unit test failed";
+  char              errbuf[eslERRBUFSIZE];
+  P7_SEQCACHE_FHDR  fhdr, orig;
+  P7_SEQCACHE      *cache = NULL;
+  FILE             *fp    = NULL;
+  int               which;
+
+  if ((fp = fopen(pressfile, "r+b")) == NULL)              esl_fatal(msg);
+  if (fread(&orig, sizeof(P7_SEQCACHE_FHDR), 1, fp) != 1) esl_fatal(msg);
+
+  for (which = 0; which < 3; which++)
+    {
+      fhdr = orig;
+      switch (which) {
+      case 0: fhdr.rec_off   = fhdr.file_size;     break; /* records past the end      */
+      case 1: fhdr.res_size  = fhdr.file_size;     break; /* residues run past the end */
+      case 2: fhdr.dbtab_off = fhdr.dbtab_off + 4; break; /* misaligned                */
+      }
+      rewind(fp);
+      if (fwrite(&fhdr, sizeof(P7_SEQCACHE_FHDR), 1, fp) != 1) esl_fatal(msg);
+      fflush(fp);
+
+      if (p7_seqcache_Open(pressfile, &cache, errbuf) != eslEFORMAT) esl_fatal(msg);
+      if (cache != NULL)                                             esl_fatal(msg);
+    }
+
+  rewind(fp);
+  if (fwrite(&orig, sizeof(P7_SEQCACHE_FHDR), 1, fp) != 1) esl_fatal(msg);
+  fclose(fp);
+}
+#endif /*p7CACHEDB_TESTDRIVE*/
+
 #ifdef CACHEDB_UTEST1
 /*
  *   gcc -O3 -malign-double -msse2 -o evalues-benchmark -I. -L. -I../easel -L../easel -Dp7EVALUES_BENCHMARK evalues.c -lhmmer -leasel -lm
@@ -650,3 +1165,47 @@ main(int argc, char **argv)
 #endif /*CACHEDB_UTEST2*/
 
 
+/*****************************************************************
+ * Test driver.
+ *****************************************************************/
+#ifdef p7CACHEDB_TESTDRIVE
+
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_getopts.h"
+
+#include "hmmer.h"
+#include "cachedb.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for hmmpgmd sequence caches";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS *go            = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  char         fastafile[16] = "esltmpXXXXXX";
+  char         pressfile[16] = "esltmpXXXXXX";
+
+  fprintf(stderr, "## %s\n", argv[0]);
+
+  utest_write_fasta(fastafile);
+  utest_press(fastafile, pressfile);
+  utest_badheader(pressfile);
+
+  remove(fastafile);
+  remove(pressfile);
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7CACHEDB_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
@@ -31,12 +31,17 @@ typedef struct {
 
   uint64_t            res_size;    /* size of residue memory allocation     */
   uint64_t            hdr_size;    /* size of header memory allocation      */
+
+  char               *map;         /* pressed cache file in memory, or NULL */
+  uint64_t            mapsize;     /* size of <map>                         */
 } P7_SEQCACHE;
 
 
 
 extern int    p7_seqcache_Open(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf);
 extern void   p7_seqcache_Close(P7_SEQCACHE *cache);
+extern int    p7_seqcache_Replicate(const P7_SEQCACHE *src, P7_SEQCACHE **ret_cache);
+extern int    p7_seqcache_Write(const P7_SEQCACHE *cache, FILE *ofp);
 
 #endif /*P7_CACHEDB_INCLUDED*/
 
@@ -85,6 +85,10 @@ static ESL_OPTIONS searchOpts[] = {
   { "--hmmdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--seqdb",       "hmm database to search",                                      12 },
   { "--seqdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--hmmdb",       "protein database to search",                                  12 },
   { "--seqdb_ranges",eslARG_STRING,     NULL,  NULL,  NULL,   NULL, "--seqdb", NULL,         "range(s) of sequences within --seqdb that will be searched",  12 },
+  { "--db",         eslARG_STRING, HMMD_DEFAULT_DB, NULL, NULL, NULL,  NULL,  NULL,            "name of the resident databases to search",                    12 },
+  { "--priority",   eslARG_INT,          "0",  NULL, "n>=0",  NULL,  NULL,  NULL,            "schedule ahead of searches with a lower priority <n>",        12 },
+  { "--stream",     eslARG_NONE,       FALSE,  NULL, NULL,    NULL,"-Z,--domZ",NULL,        "send hits in batches as they are found",                      12 },
+  { "--timeout",    eslARG_INT,          "0",  NULL, "n>=0",  NULL,  NULL,  NULL,            "give up on the search after <n> seconds (0: no limit)",       12 },
 
   /* name           type        default  env  range toggles reqs incomp  help                                          docgroup*/
   { "-c",         eslARG_INT,       "1", NULL, NULL, NULL,  NULL, "--seqdb",  "use alt genetic code of NCBI transl table <n>", 15 },
@@ -176,6 +180,7 @@ usage(char *pgm)
 int main(int argc, char *argv[])
 {
   int              i, j;
+  int              q, nq;
   uint64_t         n;
   int              eod;
   int              size;
@@ -192,6 +197,7 @@ int main(int argc, char *argv[])
   int              status  = eslOK;
   char            *data    = NULL;
   char            *ptr     = NULL;
+  char            *s;
 
   ESL_GETOPTS     *go      = NULL;
   ESL_STOPWATCH   *w       = NULL;
@@ -336,7 +342,8 @@ int main(int argc, char *argv[])
         exit(1);
       }
 
-      if (sstatus.status != eslOK) {
+      /* the answer is a text message; !stats answers with its report */
+      if (sstatus.msg_size > 0) {
         char *ebuf;
         n = sstatus.msg_size;
         total += n; 
@@ -345,7 +352,8 @@ int main(int argc, char *argv[])
           fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
           exit(1);
         }
-        fprintf(stderr, "ERROR (%d): %s\n", sstatus.status, ebuf);
+        if (sstatus.status != eslOK) fprintf(stderr, "ERROR (%d): %s\n", sstatus.status, ebuf);
+        else                         fputs(ebuf, stdout);
         free(ebuf);
       }
 
@@ -439,154 +447,184 @@ int main(int argc, char *argv[])
           exit(1);
         }
 
-        n = sizeof(sstatus);
-        total += n;
-        if ((size = readn(sock, &sstatus, n)) == -1) {
-          fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-          exit(1);
-        }
+        /* a batch of sequences is answered with a result for each, in order */
+        nq = (*ptr == '>') ? 1 : 0;
+        for (s = ptr; (s = strstr(s, "\n>")) != NULL; ++s) ++nq;
+        if (nq < 1) nq = 1;
 
-        if (sstatus.status != eslOK) {
-          char *ebuf;
-          n = sstatus.msg_size;
-          total += n; 
-          ebuf = malloc(n);
-          if ((size = readn(sock, ebuf, n)) == -1) {
+        for (q = 0; q < nq; ++q) {
+          n = sizeof(sstatus);
+          total += n;
+          if ((size = readn(sock, &sstatus, n)) == -1) {
             fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
             exit(1);
           }
-          fprintf(stderr, "ERROR (%d): %s\n", sstatus.status, ebuf);
-          free(ebuf);
-          goto COMPLETE;
-        }
 
-        n = sstatus.msg_size;
-        if ((data = malloc(n)) == NULL) {
-          fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-          exit(1);
-        }
-        if ((size = readn(sock, data, n)) == -1) {
-          fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-          exit(1);
-        }
+          /* with --stream, batches of hits arrive ahead of the full results */
+          while (sstatus.status == HMMD_STATUS_PARTIAL) {
+            n = sstatus.msg_size;
+            total += n;
+            if ((data = malloc(n)) == NULL) {
+              fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+              exit(1);
+            }
+            if ((size = readn(sock, data, n)) == -1) {
+              fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+              exit(1);
+            }
+            fprintf(stdout, "Partial results: %" PRIu64 " hits\n", ((HMMD_SEARCH_STATS *) data)->nhits);
+            free(data);
+
+            n = sizeof(sstatus);
+            total += n;
+            if ((size = readn(sock, &sstatus, n)) == -1) {
+              fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+              exit(1);
+            }
+          }
 
-        pli = p7_pipeline_Create(go, 100, 100, FALSE, (esl_opt_IsUsed(go, "--seqdb")) ? p7_SEARCH_SEQS : p7_SCAN_MODELS);
-        stats = (HMMD_SEARCH_STATS *)data;
+          if (sstatus.status != eslOK) {
+            char *ebuf;
+            n = sstatus.msg_size;
+            total += n; 
+            ebuf = malloc(n);
+            if ((size = readn(sock, ebuf, n)) == -1) {
+              fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+              exit(1);
+            }
+            fprintf(stderr, "ERROR (%d): %s\n", sstatus.status, ebuf);
+            free(ebuf);
+            goto COMPLETE;
+          }
 
-        /* copy the search stats */
-        w->elapsed       = stats->elapsed;
-        w->user          = stats->user;
-        w->sys           = stats->sys;
+          n = sstatus.msg_size;
+          if ((data = malloc(n)) == NULL) {
+            fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+            exit(1);
+          }
+          if ((size = readn(sock, data, n)) == -1) {
+            fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+            exit(1);
+          }
 
-        pli->nmodels     = stats->nmodels;
-        pli->nseqs       = stats->nseqs;
-        pli->n_past_msv  = stats->n_past_msv;
-        pli->n_past_bias = stats->n_past_bias;
-        pli->n_past_vit  = stats->n_past_vit;
-        pli->n_past_fwd  = stats->n_past_fwd;
+          pli = p7_pipeline_Create(go, 100, 100, FALSE, (esl_opt_IsUsed(go, "--seqdb")) ? p7_SEARCH_SEQS : p7_SCAN_MODELS);
+          stats = (HMMD_SEARCH_STATS *)data;
 
-        pli->Z           = stats->Z;
-        pli->domZ        = stats->domZ;
-        pli->Z_setby     = stats->Z_setby;
-        pli->domZ_setby  = stats->domZ_setby;
+          /* copy the search stats */
+          w->elapsed       = stats->elapsed;
+          w->user          = stats->user;
+          w->sys           = stats->sys;
 
-        th = p7_tophits_Create(); 
+          pli->nmodels     = stats->nmodels;
+          pli->nseqs       = stats->nseqs;
+          pli->n_past_msv  = stats->n_past_msv;
+          pli->n_past_bias = stats->n_past_bias;
+          pli->n_past_vit  = stats->n_past_vit;
+          pli->n_past_fwd  = stats->n_past_fwd;
 
-        free(th->unsrt);
-        free(th->hit);
+          pli->Z           = stats->Z;
+          pli->domZ        = stats->domZ;
+          pli->Z_setby     = stats->Z_setby;
+          pli->domZ_setby  = stats->domZ_setby;
 
-        th->N         = stats->nhits;
-        th->unsrt     = (P7_HIT *)(data + sizeof(HMMD_SEARCH_STATS));
-        th->nreported = stats->nreported;
-        th->nincluded = stats->nincluded;
-        th->is_sorted_by_seqidx  = FALSE;
-        th->is_sorted_by_sortkey = TRUE;
+          th = p7_tophits_Create(); 
 
-        if ((th->hit = malloc(sizeof(void *) * stats->nhits)) == NULL) {
-          fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-          exit(1);
-        }
-        for (i = 0; i < stats->nhits; i++) th->hit[i] = th->unsrt + i;
-        
-        /* loop through the hit list adjusting the pointers */
-        for (i = 0; i < stats->nhits; ++i) {
-          char   *ptr;
-          char   *base;
-          P7_HIT *hit = th->unsrt + i;
-
-
-          /* Given the sequence header:
-           * >1 000101001 12343829483298 1234
-           * hmmpgmd hijacks the desc and acc fields to pass back domain
-           * architecture and taxonomy id information to the hmmer webserver.
-           * This means the fields are non-NULL, but don't point to real
-           * addresses, so will break any attempt to print non-NULL desc
-           * or acc fields. So we simply clear them out here
-           */
-          hit->desc = NULL;
-          hit->acc  = NULL;
-
-
-          hit->dcl = (P7_DOMAIN *)(data + ((char *)hit->dcl - (char *)NULL));
-
-          /* the hit string pointers contain the length of the string including
-           * the null terminator at the end.
-           */
-          if (hit->name != NULL) {
-            char *name = malloc(16);
-            sprintf(name, "%d", (int)(hit->name - (char *)NULL));
-            hit->name = name;
-          }
+          free(th->unsrt);
+          free(th->hit);
 
-          /* send the domains for this hit */
-          dcl  = hit->dcl;
-          base = (char *)dcl;
-          ptr  = (char *)(dcl + hit->ndom);
-          for (j = 0; j < hit->ndom; ++j) {
-            P7_ALIDISPLAY *ad = (P7_ALIDISPLAY *)ptr;
+          th->N         = stats->nhits;
+          th->unsrt     = (P7_HIT *)(data + sizeof(HMMD_SEARCH_STATS));
+          th->nreported = stats->nreported;
+          th->nincluded = stats->nincluded;
+          th->is_sorted_by_seqidx  = FALSE;
+          th->is_sorted_by_sortkey = TRUE;
 
-            dcl->ad  = ad;
-            ad->mem  = ptr + sizeof(P7_ALIDISPLAY);
+          if ((th->hit = malloc(sizeof(void *) * stats->nhits)) == NULL) {
+            fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+            exit(1);
+          }
+          for (i = 0; i < stats->nhits; i++) th->hit[i] = th->unsrt + i;
+        
+          /* loop through the hit list adjusting the pointers */
+          for (i = 0; i < stats->nhits; ++i) {
+            char   *ptr;
+            char   *base;
+            P7_HIT *hit = th->unsrt + i;
+
+
+            /* Given the sequence header:
+             * >1 000101001 12343829483298 1234
+             * hmmpgmd hijacks the desc and acc fields to pass back domain
+             * architecture and taxonomy id information to the hmmer webserver.
+             * This means the fields are non-NULL, but don't point to real
+             * addresses, so will break any attempt to print non-NULL desc
+             * or acc fields. So we simply clear them out here
+             */
+            hit->desc = NULL;
+            hit->acc  = NULL;
+
+
+            hit->dcl = (P7_DOMAIN *)(data + ((char *)hit->dcl - (char *)NULL));
+
+            /* the hit string pointers contain the length of the string including
+             * the null terminator at the end.
+             */
+            if (hit->name != NULL) {
+              char *name = malloc(16);
+              sprintf(name, "%d", (int)(hit->name - (char *)NULL));
+              hit->name = name;
+            }
+
+            /* send the domains for this hit */
+            dcl  = hit->dcl;
+            base = (char *)dcl;
+            ptr  = (char *)(dcl + hit->ndom);
+            for (j = 0; j < hit->ndom; ++j) {
+              P7_ALIDISPLAY *ad = (P7_ALIDISPLAY *)ptr;
+
+              dcl->ad  = ad;
+              ad->mem  = ptr + sizeof(P7_ALIDISPLAY);
                         
-            /* readjust all the pointers to the new memory block */
-            if (ad->rfline  != NULL) ad->rfline  = base + (ad->rfline  - (char *)NULL);
-            if (ad->mmline  != NULL) ad->mmline  = base + (ad->mmline  - (char *)NULL);
-            if (ad->csline  != NULL) ad->csline  = base + (ad->csline  - (char *)NULL);
-            if (ad->model   != NULL) ad->model   = base + (ad->model   - (char *)NULL);
-            if (ad->mline   != NULL) ad->mline   = base + (ad->mline   - (char *)NULL);
-            if (ad->aseq    != NULL) ad->aseq    = base + (ad->aseq    - (char *)NULL);
-            if (ad->ntseq   != NULL) ad->ntseq   = base + (ad->ntseq   - (char *)NULL);
-            if (ad->ppline  != NULL) ad->ppline  = base + (ad->ppline  - (char *)NULL);
-            if (ad->hmmname != NULL) ad->hmmname = base + (ad->hmmname - (char *)NULL);
-            if (ad->hmmacc  != NULL) ad->hmmacc  = base + (ad->hmmacc  - (char *)NULL);
-            if (ad->hmmdesc != NULL) ad->hmmdesc = base + (ad->hmmdesc - (char *)NULL);
-            if (ad->sqname  != NULL) ad->sqname  = base + (ad->sqname  - (char *)NULL);
-            if (ad->sqacc   != NULL) ad->sqacc   = base + (ad->sqacc   - (char *)NULL);
-            if (ad->sqdesc  != NULL) ad->sqdesc  = base + (ad->sqdesc  - (char *)NULL);
-
-            ptr += sizeof(P7_ALIDISPLAY) + ad->memsize;
-            ++dcl;
+              /* readjust all the pointers to the new memory block */
+              if (ad->rfline  != NULL) ad->rfline  = base + (ad->rfline  - (char *)NULL);
+              if (ad->mmline  != NULL) ad->mmline  = base + (ad->mmline  - (char *)NULL);
+              if (ad->csline  != NULL) ad->csline  = base + (ad->csline  - (char *)NULL);
+              if (ad->model   != NULL) ad->model   = base + (ad->model   - (char *)NULL);
+              if (ad->mline   != NULL) ad->mline   = base + (ad->mline   - (char *)NULL);
+              if (ad->aseq    != NULL) ad->aseq    = base + (ad->aseq    - (char *)NULL);
+              if (ad->ntseq   != NULL) ad->ntseq   = base + (ad->ntseq   - (char *)NULL);
+              if (ad->ppline  != NULL) ad->ppline  = base + (ad->ppline  - (char *)NULL);
+              if (ad->hmmname != NULL) ad->hmmname = base + (ad->hmmname - (char *)NULL);
+              if (ad->hmmacc  != NULL) ad->hmmacc  = base + (ad->hmmacc  - (char *)NULL);
+              if (ad->hmmdesc != NULL) ad->hmmdesc = base + (ad->hmmdesc - (char *)NULL);
+              if (ad->sqname  != NULL) ad->sqname  = base + (ad->sqname  - (char *)NULL);
+              if (ad->sqacc   != NULL) ad->sqacc   = base + (ad->sqacc   - (char *)NULL);
+              if (ad->sqdesc  != NULL) ad->sqdesc  = base + (ad->sqdesc  - (char *)NULL);
+
+              ptr += sizeof(P7_ALIDISPLAY) + ad->memsize;
+              ++dcl;
 			
+            }
           }
-        }
 
-        /* adjust the reported and included hits */
-        //th->is_sorted = FALSE;
-        //p7_tophits_Sort(th);
+          /* adjust the reported and included hits */
+          //th->is_sorted = FALSE;
+          //p7_tophits_Sort(th);
 		
-        /* Print the results.  */
-        if (scores) { p7_tophits_Targets(stdout, th, pli, 120); fprintf(stdout, "\n\n"); }
-        if (ali)    { p7_tophits_Domains(stdout, th, pli, 120); fprintf(stdout, "\n\n"); }
-        p7_pli_Statistics(stdout, pli, w);  
+          /* Print the results.  */
+          if (scores) { p7_tophits_Targets(stdout, th, pli, 120); fprintf(stdout, "\n\n"); }
+          if (ali)    { p7_tophits_Domains(stdout, th, pli, 120); fprintf(stdout, "\n\n"); }
+          p7_pli_Statistics(stdout, pli, w);  
 
-        p7_pipeline_Destroy(pli); 
-        free(th->hit);
-        free(data);
-        free(th);
+          p7_pipeline_Destroy(pli); 
+          free(th->hit);
+          free(data);
+          free(th);
 
-        fprintf(stdout, "//\n");  fflush(stdout);
+          fprintf(stdout, "//\n");  fflush(stdout);
 
-        fprintf(stdout, "Total bytes received %" PRId64 "\n", sstatus.msg_size);
+          fprintf(stdout, "Total bytes received %" PRId64 "\n", sstatus.msg_size);
+        }
       } else {
         printf("Error parsing input query\n");
       }
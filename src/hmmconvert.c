@@ -11,6 +11,9 @@
 #include "easel.h"
 #include "esl_alphabet.h"
 #include "esl_getopts.h"
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif
 
 #include "hmmer.h"
 
@@ -21,6 +24,9 @@ static ESL_OPTIONS options[] = {
   { "-b",        eslARG_NONE,   FALSE, NULL, NULL, "-a,-b,-2",      NULL,    NULL, "binary: output models in HMMER3 binary format",                    0 },
   { "-2",        eslARG_NONE,   FALSE, NULL, NULL, "-a,-b,-2",      NULL,    NULL, "HMMER2: output backward compatible HMMER2 ASCII format (ls mode)", 0 },
   { "--outfmt",  eslARG_STRING, NULL,  NULL, NULL,      NULL,       NULL,    "-2", "choose output legacy 3.x file formats by name, such as '3/a'",     0 },
+#ifdef HMMER_THREADS
+  { "--cpu",     eslARG_INT,  p7_NCPU,"HMMER_NCPU","n>=0", NULL,     NULL,    NULL, "number of parallel CPU workers for reading models",                0 },
+#endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 static char usage[]  = "[-options] <hmmfile>";
@@ -38,6 +44,9 @@ main(int argc, char **argv)
   FILE          *ofp     = stdout;
   char          *outfmt  = esl_opt_GetString(go, "--outfmt");
   int            fmtcode = -1;	/* -1 = write the current default format */
+#ifdef HMMER_THREADS
+  int            ncpus   = 0;
+#endif
   int            status;
   char           errbuf[eslERRBUFSIZE];
 
@@ -53,6 +62,11 @@ main(int argc, char **argv)
   else if (status == eslEFORMAT)   p7_Fail("File format problem in trying to open HMM file %s.\n%s\n",                hmmfile, errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",                       status, hmmfile, errbuf);  
 
+#ifdef HMMER_THREADS
+  ncpus = ESL_MIN(esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
+  if (ncpus > 0) p7_hmmfile_ReadAhead(hfp, ncpus); /* else, or for files it can't do, models are read serially */
+#endif
+
   while ((status = p7_hmmfile_Read(hfp, &abc, &hmm)) == eslOK)
     {
       if      (esl_opt_GetBoolean(go, "-a") == TRUE) p7_hmmfile_WriteASCII (ofp, fmtcode, hmm);
@@ -43,6 +43,9 @@
 #define MAX_WORKERS  64
 #define MAX_BUFFER   4096
 
+#define MAX_UNITS_PER_WORKER 64  /* smallest range handed out is 1/64th of a worker's even share */
+#define RCACHE_BUCKETS     4096    /* hash buckets of the result cache (a power of 2)               */
+
 #define CONF_FILE "/etc/hmmpgmd.conf"
 
 typedef struct {
@@ -62,12 +65,81 @@ typedef struct {
   int                 errors;
 } SEARCH_RESULTS;
 
+/* A search's complete response to the client, kept to answer repeats
+ * of the search. */
+typedef struct result_entry_s {
+  uint64_t               key;       /* hash of the query, options and database (query_key())  */
+  char                  *kdata;     /* what was hashed, compared on a hash match               */
+  uint64_t               klen;      /* length of <kdata>                                       */
+  char                  *msg;       /* the response, as sent to the client                     */
+  uint64_t               size;      /* size of <msg>                                           */
+  struct result_entry_s *prev;      /* LRU list, most recently used first                      */
+  struct result_entry_s *next;
+  struct result_entry_s *chain;     /* next entry in the same hash bucket                      */
+} RESULT_ENTRY;
+
 typedef struct {
-  int             sock_fd;
-  char            ip_addr[64];
+  RESULT_ENTRY    *bucket[RCACHE_BUCKETS];
+  RESULT_ENTRY    *head;            /* most recently used   */
+  RESULT_ENTRY    *tail;            /* least recently used  */
+  int              count;           /* number of entries    */
+  uint64_t         size;            /* bytes held           */
+  uint64_t         max_size;        /* budget; 0: disabled  */
+  uint64_t         hits;
+  uint64_t         misses;
+} RESULT_CACHE;
+
+/* Upper bounds (seconds) of the buckets of the latency histograms
+ * reported by !stats; a last bucket holds the rest.
+ */
+#define NLATENCY 13
+static const double latency_bounds[NLATENCY] = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 300.0 };
 
-  ESL_STACK      *cmdstack;	/* stack of commands that clients want done */
-} CLIENTSIDE_ARGS;
+typedef struct {
+  uint64_t         count[NLATENCY+1]; /* count[i]: observations in bucket i (not cumulative) */
+  uint64_t         n;
+  double           sum;
+} HISTOGRAM;
+
+/* The master's counters, reported by !stats (see process_stats()). */
+typedef struct {
+  time_t           started;
+  uint64_t         nok;             /* searches answered with results           */
+  uint64_t         nerrors;         /* ... with an error                        */
+  uint64_t         ncancelled;      /* ... cancelled, or timed out              */
+  uint64_t         nqueries;        /* queries in the searches; a batch counts each */
+  uint64_t         bytes_sent;      /* results sent to clients                  */
+  uint64_t         ntargets;        /* sequences or profiles searched           */
+  uint64_t         n_past_msv;      /* ... and passing each filter              */
+  uint64_t         n_past_bias;
+  uint64_t         n_past_vit;
+  uint64_t         n_past_fwd;
+  uint64_t         nhits;
+  uint64_t         nranges;         /* ranges run by the workers                */
+  uint64_t         nlost;           /* workers lost                             */
+  HISTOGRAM        search_time;     /* from queued to answered                  */
+  HISTOGRAM        range_time;      /* for a worker to run a range              */
+} METRICS;
+
+/* states of a database slot */
+#define DB_FREE      0    /* unused                                                   */
+#define DB_LOADING   1    /* the workers are loading the databases                    */
+#define DB_LIVE      2    /* searches of the name run against these databases         */
+#define DB_RETIRED   3    /* replaced or unloaded; freed once its searches are done   */
+
+/* Databases resident on the master and the workers, under a name that
+ * searches select them by.  A new version of a database is loaded into
+ * a slot of its own, next to the one it replaces, and takes over the
+ * name once all the workers have it.
+ */
+typedef struct {
+  char             name[MAX_INIT_DESC];
+  int              state;
+  uint32_t         gen;          /* generation, unique to each load; 0 if DB_FREE     */
+  int              nusers;       /* searches in flight against the databases          */
+  P7_SEQCACHE     *seq_db;
+  P7_HMMCACHE     *hmm_db;
+} DB_SLOT;
 
 typedef struct {
   int              sock_fd;
@@ -76,9 +148,11 @@ typedef struct {
   pthread_cond_t   start_cond;
   pthread_cond_t   complete_cond;
 
-  int              db_version;
-  P7_SEQCACHE     *seq_db;
-  P7_HMMCACHE     *hmm_db;
+  DB_SLOT          db[HMMD_MAX_DBS];
+  uint32_t         db_gen;       /* last generation handed out                        */
+  int              loading;      /* TRUE while a load command is running              */
+  int              load_sock;    /* socket of the client the load reports to          */
+  int              nsyncing;     /* ready workers loading databases (see stale_db())  */
 
   int              ready;
   int              failed;
@@ -91,29 +165,120 @@ typedef struct {
   int              idle_cnt;
   struct worker_s *idling;
 
-  RANGE_LIST       *range_list;  /* (optional) list of ranges searched within the seqdb */
+  struct search_job_s *jobs;     /* searches in flight, in the order they were queued */
+  uint64_t         nstarted;     /* number of ranges handed out to workers so far     */
+
+  RESULT_CACHE     rcache;       /* responses to recent searches                      */
+  METRICS          metrics;      /* counters reported by !stats                       */
 
   int              completed;
 } WORKERSIDE_ARGS;
 
+typedef struct {
+  WORKERSIDE_ARGS *parent;
+  QUEUE_DATA      *query;        /* the load command */
+} LOAD_ARGS;
+
+typedef struct {
+  int              sock_fd;
+  char             ip_addr[64];
+
+  ESL_STACK       *cmdstack;	/* stack of commands that clients want done */
+  WORKERSIDE_ARGS *workers;     /* to cancel the client's searches if it goes away */
+} CLIENTSIDE_ARGS;
+
+/* why a search was given up before it finished */
+#define CANCEL_REQUEST  1    /* the client sent !cancel            */
+#define CANCEL_HANGUP   2    /* the client's connection was lost   */
+#define CANCEL_TIMEOUT  3    /* the search ran past its --timeout  */
+
+#define CANCEL_POLL_MS  100  /* how often a worker thread waiting for a range checks for a cancel */
+
+/* A range of the database that a search hands to a worker. */
+typedef struct {
+  uint32_t             inx;         /* index of the first entry in the range                  */
+  uint32_t             cnt;         /* number of entries in the range                         */
+  uint64_t             started;     /* when the range was last handed out (<nstarted> count)  */
+  int                  nrunning;    /* number of workers running the range now                */
+  int                  nfailed;     /* number of workers lost while running the range         */
+  int                  done;        /* TRUE once results are in, or the range was given up    */
+} SEARCH_UNIT;
+
+/* A search in flight. Workers pull ranges ("units") of the database
+ * from it one at a time, as they become free, so workers can interleave
+ * the ranges of several searches, and a fast worker simply runs more
+ * ranges than a slow one. The ranges shrink as the search nears its
+ * end, and an idle worker backs up a straggler by running a copy of its
+ * range; whichever copy finishes first is used.
+ */
+typedef struct search_job_s {
+  QUEUE_DATA          *query;
+  WORKERSIDE_ARGS     *parent;
+  int                  priority;    /* searches with a higher priority are scheduled first */
+  uint64_t             key;         /* result cache key of the search: its hash,           */
+  char                *kdata;       /*   ... what was hashed (query_key())                 */
+  uint64_t             klen;        /*   ... and its length                                */
+  int                  db_slot;     /* slot of the databases searched                      */
+  uint32_t             db_gen;      /* ... and their generation                            */
+  RANGE_LIST          *range_list;  /* (optional) list of ranges searched within the seqdb */
+  ESL_STOPWATCH       *w;
+
+  uint32_t             next_inx;    /* index of the first entry not yet in any range        */
+  int                  nleft;       /* number of entries (within range_list) not yet in any range */
+  int                  min_cnt;     /* smallest range to hand out                           */
+
+  SEARCH_UNIT         *unit;        /* 0..nunits-1 ranges handed out so far                 */
+  int                 *todo;        /* stack of ranges to run again after a worker was lost */
+  int                  nunits;
+  int                  nalloc;      /* allocated size of <unit> and <todo>                  */
+  int                  ntodo;
+  int                  ndone;       /* number of ranges done                                */
+  int                  nrunning;    /* number of ranges (and copies) running on workers now */
+  int                  errors;      /* number of ranges that failed                         */
+  int                  retired;     /* TRUE once the client has been answered               */
+  int                  cancelled;   /* 0, or why the search was given up (CANCEL_*)         */
+  struct timespec      deadline;    /* when to give up (--timeout); tv_sec 0 if never       */
+
+  int                  nq;          /* number of queries: 1, or the size of a batch         */
+  SEARCH_RESULTS      *results;     /* results[q]: merged results for query q               */
+
+  struct search_job_s *next;
+} SEARCH_JOB;
+
+/* What a worker sent back for one query of the range it ran. */
+typedef struct {
+  HMMD_SEARCH_STATS     stats;
+  HMMD_SEARCH_STATUS    status;
+  char                 *err_buf;
+  P7_HIT               *hit;
+  char                 *hit_data;
+} RANGE_RESULTS;
+
 typedef struct worker_s {
   int                   sock_fd;
   char                  ip_addr[64];
   
   int                   completed;
   int                   terminated;
+  int                   active;       /* on the ready list; may be handed search ranges */
+  int                   syncing;      /* loading databases while active; counted in nsyncing */
   HMMD_COMMAND         *cmd;
 
-  uint32_t              srch_inx;
+  uint32_t              db_gen[HMMD_MAX_DBS]; /* generation loaded in each slot; 0 if none */
+
+  SEARCH_JOB           *job;          /* search the worker is running a range of, or NULL */
+  int                   unit;         /* which range of <job>                             */
+  uint32_t              srch_inx;     /* copy of the range's start and size               */
   uint32_t              srch_cnt;
 
-  HMMD_SEARCH_STATS     stats;
-  HMMD_SEARCH_STATUS    status;
-  char                 *err_buf;
-  P7_HIT               *hit;
-  void                 *hit_data;
+  RANGE_RESULTS        *res;          /* res[q]: results for query q of the range's search */
+  int                   nres;         /* allocated size of <res>                           */
   int                   total;
 
+  uint64_t              nranges;      /* ranges run, for !stats                            */
+  uint64_t              bytes_recv;   /* bytes of results received                         */
+  double                busy;         /* seconds spent running ranges                      */
+
   WORKERSIDE_ARGS      *parent;
 
   struct worker_s      *next;
@@ -127,9 +292,17 @@ static void setup_workerside_comm(ESL_GETOPTS *opts, WORKERSIDE_ARGS  *args);
 static void destroy_worker(WORKER_DATA *worker);
 
 static void init_results(SEARCH_RESULTS *results);
-static void clear_results(WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results);
-static void gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results);
-static void forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results);
+static void clear_results(SEARCH_RESULTS *results);
+static void add_results(SEARCH_JOB *job, WORKER_DATA *worker);
+static void finish_results(QUEUE_DATA *query, DB_SLOT *db, SEARCH_RESULTS *results);
+static void forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results, char **ret_msg, uint64_t *ret_size);
+static uint64_t forward_batch(QUEUE_DATA *query, HIT_LIST *batch, HMMD_SEARCH_STATS *stats);
+static void sort_hits(RANGE_RESULTS *r);
+static void clear_range(WORKER_DATA *worker);
+static int  add_query_results(SEARCH_RESULTS *results, RANGE_RESULTS *r, WORKER_DATA *worker);
+
+static void *search_thread(void *arg);
+static void *load_thread(void *arg);
 
 static void
 print_client_msg(int fd, int status, char *format, va_list ap)
@@ -228,202 +401,1329 @@ validate_workers(WORKERSIDE_ARGS *args)
     if (worker->terminated) ++failed;
     worker = worker->next;
   }
-  assert(ready  == args->ready);
-  assert(failed == args->failed);
-  assert(tail   == args->tail);
+  assert(ready  == args->ready);
+  assert(failed == args->failed);
+  assert(tail   == args->tail);
+
+  return 1;
+}
+
+static void
+update_workers(WORKERSIDE_ARGS *args)
+{
+  WORKER_DATA *worker = NULL;
+
+  assert(validate_workers(args));
+
+  /* if there are any workers waiting to join, add them */
+  while (args->pending != NULL) {
+    worker = args->pending;
+    args->pending = worker->next;
+
+    worker->next = NULL;
+    if (args->head == NULL) {
+      args->head = worker;
+      worker->prev = NULL;
+    } else {
+      args->tail->next = worker;
+      worker->prev = args->tail;
+    }
+    args->tail = worker;
+
+    args->pend_cnt--;
+    args->ready++;
+    worker->active = 1;
+  }
+
+  /* remove any workers who have failed */
+  worker = args->head;
+  while (args->failed > 0 && worker != NULL) {
+    WORKER_DATA *next =  worker->next;
+    if (worker->terminated) {
+      --args->failed;
+      --args->ready;
+      if (args->head == worker && args->tail == worker) {
+        args->head = NULL;
+        args->tail = NULL;
+      } else if (args->head == worker) {
+        args->head = worker->next;
+        worker->next->prev = NULL;
+      } else if (args->tail == worker) {
+        args->tail = worker->prev;
+        worker->prev->next = NULL;
+      } else {
+        worker->next->prev = worker->prev;
+        worker->prev->next = worker->next;
+      }
+      destroy_worker(worker);
+    }
+    worker = next;
+  }
+
+  assert(validate_workers(args));
+}
+
+/* find_db()
+ * Called with the work_mutex held.  Return the slot of the live
+ * databases called <name>, or -1 if there are none.
+ */
+static int
+find_db(WORKERSIDE_ARGS *args, const char *name)
+{
+  int s;
+
+  for (s = 0; s < HMMD_MAX_DBS; s++)
+    if (args->db[s].state == DB_LIVE && strcmp(args->db[s].name, name) == 0) return s;
+  return -1;
+}
+
+/* free_db()
+ * Called with the work_mutex held, once nothing searches the databases
+ * in <db> any more.  Empties the slot, moving the databases to <ret_db>
+ * for the caller to close with close_db() after releasing the mutex.
+ * The workers drop their copies as they next come free.
+ */
+static void
+free_db(WORKERSIDE_ARGS *args, DB_SLOT *db, DB_SLOT *ret_db)
+{
+  int n;
+
+  *ret_db = *db;
+  memset(db, 0, sizeof(DB_SLOT));
+  if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+}
+
+static void
+close_db(DB_SLOT *db)
+{
+  if (db->seq_db != NULL) p7_seqcache_Close(db->seq_db);
+  if (db->hmm_db != NULL) p7_hmmcache_Close(db->hmm_db);
+  db->seq_db = NULL;
+  db->hmm_db = NULL;
+}
+
+/* stale_db()
+ * Called with the work_mutex held.  Return a slot whose databases
+ * <worker> has to load or drop to match the master, and set <*ret_gen>
+ * to the generation it should have there (0: none); or return -1 if
+ * the worker is up to date.  A worker keeps a retired version of a
+ * database for the searches still running against it, but doesn't
+ * load one it lacks.  Ready workers load one at a time, so the others
+ * go on serving searches meanwhile; workers that have yet to join, and
+ * databases to drop, don't wait.
+ */
+static int
+stale_db(WORKERSIDE_ARGS *args, WORKER_DATA *worker, uint32_t *ret_gen)
+{
+  DB_SLOT  *db;
+  uint32_t  want;
+  int       s;
+
+  for (s = 0; s < HMMD_MAX_DBS; s++) {
+    db = args->db + s;
+    if      (db->state == DB_LOADING || db->state == DB_LIVE) want = db->gen;
+    else if (db->state == DB_RETIRED && worker->db_gen[s] == db->gen) want = db->gen;
+    else    want = 0;
+    if (worker->db_gen[s] == want) continue;
+    if (want != 0 && worker->active && args->nsyncing > 0) continue;
+    *ret_gen = want;
+    return s;
+  }
+  return -1;
+}
+
+/* db_loaded()
+ * Called with the work_mutex held.  Returns TRUE once every connected
+ * worker has loaded the databases in slot <s>.
+ */
+static int
+db_loaded(WORKERSIDE_ARGS *args, int s)
+{
+  WORKER_DATA *worker;
+
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (!worker->terminated && worker->db_gen[s] != args->db[s].gen) return FALSE;
+  for (worker = args->pending; worker != NULL; worker = worker->next)
+    if (!worker->terminated && worker->db_gen[s] != args->db[s].gen) return FALSE;
+  return TRUE;
+}
+
+/* db_command()
+ * Called with the work_mutex held.  Build the command that brings slot
+ * <s> of a worker to generation <gen> (from stale_db()): load the
+ * slot's databases, or drop them if <gen> is 0.
+ */
+static HMMD_COMMAND *
+db_command(WORKERSIDE_ARGS *args, int s, uint32_t gen)
+{
+  DB_SLOT      *db  = args->db + s;
+  HMMD_COMMAND *cmd = NULL;
+  char         *p;
+  int           n;
+
+  n = sizeof(HMMD_COMMAND);
+  if (gen != 0) {
+    if (db->seq_db != NULL) n += strlen(db->seq_db->name) + 1;
+    if (db->hmm_db != NULL) n += strlen(db->hmm_db->name) + 1;
+  }
+
+  if ((cmd = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memset(cmd, 0, n);
+
+  cmd->hdr.length   = n - sizeof(HMMD_HEADER);
+  cmd->hdr.command  = (gen == 0) ? HMMD_CMD_DROP : HMMD_CMD_INIT;
+  cmd->init.db_slot = s;
+  if (gen == 0) return cmd;
+
+  strcpy(cmd->init.name, db->name);
+  p = cmd->init.data;
+
+  if (db->seq_db != NULL) {
+    cmd->init.db_cnt      = db->seq_db->db_cnt;
+    cmd->init.seq_cnt     = db->seq_db->count;
+    cmd->init.seqdb_off   = p - cmd->init.data;
+
+    strncpy(cmd->init.sid, db->seq_db->id, sizeof(cmd->init.sid));
+    cmd->init.sid[sizeof(cmd->init.sid)-1] = 0;
+
+    strcpy(p, db->seq_db->name);
+    p += strlen(db->seq_db->name) + 1;
+  }
+
+  if (db->hmm_db != NULL) {
+    cmd->init.hmm_cnt     = 1;
+    cmd->init.model_cnt   = db->hmm_db->n;
+    cmd->init.hmmdb_off   = p - cmd->init.data;
+
+    strcpy(p, db->hmm_db->name);
+    p += strlen(db->hmm_db->name) + 1;
+  }
+
+  return cmd;
+}
+
+/* sync_db()
+ * Send <worker> a command built by db_command(), and wait for it to be
+ * done; loading a database takes a while.  Returns <eslOK>, or
+ * <eslFAIL> if the worker failed or has gone away.
+ */
+static int
+sync_db(WORKER_DATA *worker, HMMD_COMMAND *cmd)
+{
+  HMMD_HEADER  hdr;
+  char        *buf = NULL;
+  int          n;
+
+  n = MSG_SIZE(cmd);
+  if (writen(worker->sock_fd, cmd, n) != n) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+
+  /* the worker echoes the command back once it is done */
+  if (readn(worker->sock_fd, &hdr, sizeof(hdr)) == -1) {
+    p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+  if ((buf = malloc(ESL_MAX(1, hdr.length))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if (hdr.length > 0 && readn(worker->sock_fd, buf, hdr.length) == -1) {
+    p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    free(buf);
+    return eslFAIL;
+  }
+  free(buf);
+
+  if (hdr.command != cmd->hdr.command || hdr.status != eslOK) {
+    p7_syslog(LOG_ERR,"[%s:%d] - %s failed command %d: %d status %d\n", __FILE__, __LINE__, worker->ip_addr, cmd->hdr.command, hdr.command, hdr.status);
+    return eslFAIL;
+  }
+  return eslOK;
+}
+
+/* check_version()
+ * Ask a newly connected <worker> for the version of the commands it
+ * understands, before anything else is sent to it: a worker of
+ * another version would misread them. A worker older than the check
+ * doesn't answer it. Returns <eslOK> if the versions match,
+ * <eslEINCOMPAT> if they don't, or <eslFAIL> if the worker fails or
+ * has gone away; either error is logged.
+ */
+static int
+check_version(WORKER_DATA *worker)
+{
+  HMMD_COMMAND      cmd;
+  HMMD_HEADER       hdr;
+  HMMD_VERSION_CMD  vers;
+  fd_set            rset;
+  struct timeval    tv;
+  int               n;
+
+  memset(&cmd, 0, sizeof(HMMD_COMMAND));
+  cmd.hdr.command  = HMMD_CMD_VERSION;
+  cmd.hdr.length   = sizeof(HMMD_VERSION_CMD);
+  cmd.vers.version = HMMD_PROTOCOL_VERSION;
+
+  n = MSG_SIZE(&cmd);
+  if (writen(worker->sock_fd, &cmd, n) != n) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+
+  FD_ZERO(&rset);
+  FD_SET(worker->sock_fd, &rset);
+  tv.tv_sec  = HMMD_VERSION_WAIT;
+  tv.tv_usec = 0;
+  if ((n = select(worker->sock_fd + 1, &rset, NULL, NULL, &tv)) < 0) {
+    p7_syslog(LOG_ERR,"[%s:%d] - select %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+  if (n == 0) {
+    p7_syslog(LOG_ERR,"[%s:%d] - worker %s doesn't answer the version check: it is older than command version %d\n", __FILE__, __LINE__, worker->ip_addr, HMMD_PROTOCOL_VERSION);
+    return eslEINCOMPAT;
+  }
+
+  if (readn(worker->sock_fd, &hdr, sizeof(hdr)) == -1) {
+    p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+  if (hdr.command != HMMD_CMD_VERSION || hdr.length != sizeof(HMMD_VERSION_CMD) || readn(worker->sock_fd, &vers, sizeof(vers)) == -1) {
+    p7_syslog(LOG_ERR,"[%s:%d] - %s answered the version check with command %d, length %d\n", __FILE__, __LINE__, worker->ip_addr, hdr.command, hdr.length);
+    return eslFAIL;
+  }
+  if (vers.version != HMMD_PROTOCOL_VERSION) {
+    p7_syslog(LOG_ERR,"[%s:%d] - worker %s uses command version %d, the master %d\n", __FILE__, __LINE__, worker->ip_addr, vers.version, HMMD_PROTOCOL_VERSION);
+    return eslEINCOMPAT;
+  }
+  return eslOK;
+}
+
+/* fnv_hash()
+ * Continue the 64-bit FNV-1a hash <h> over <n> bytes of <data>.
+ */
+static uint64_t
+fnv_hash(uint64_t h, const void *data, size_t n)
+{
+  const unsigned char *p = data;
+
+  while (n-- > 0) { h ^= *p++; h *= 0x100000001b3ULL; }
+  return h;
+}
+
+/* key_add()
+ * Append <n> bytes of <data> to the key material <*kdata> of length
+ * <*klen>, allocated to <*kalloc> bytes.
+ */
+static void
+key_add(char **kdata, uint64_t *klen, uint64_t *kalloc, const void *data, size_t n)
+{
+  if (*klen + n > *kalloc) {
+    *kalloc = ESL_MAX(*kalloc * 2, *klen + n);
+    if ((*kdata = realloc(*kdata, *kalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+  }
+  memcpy(*kdata + *klen, data, n);
+  *klen += n;
+}
+
+/* query_key()
+ * Lay out everything a search's results depend on: the query
+ * (sequence or HMM), its parsed options, and the databases it is run
+ * against (by name and generation). Options that only affect how the
+ * search is run are left out. The bytes are returned in <*ret_kdata>
+ * (which the caller frees) and <*ret_klen>, and their hash is
+ * returned. The result cache looks them up by the hash, and compares
+ * the bytes themselves, so a hash collision can't return the results
+ * of another search.
+ */
+static uint64_t
+query_key(WORKERSIDE_ARGS *args, QUEUE_DATA *query, char **ret_kdata, uint64_t *ret_klen)
+{
+  ESL_GETOPTS *go     = query->opts;
+  DB_SLOT     *db     = args->db + query->db_slot;
+  P7_HMM      *hmm;
+  ESL_SQ      *sq;
+  char        *kd     = NULL;
+  uint64_t     kl     = 0;
+  uint64_t     ka     = 0;
+  int          K;
+  int          i;
+
+#define KEY_ADD(x, n) key_add(&kd, &kl, &ka, (x), (n))
+#define KEY_STR(x)    KEY_ADD((x) ? (x) : "", (x) ? strlen(x) + 1 : 1)
+
+  KEY_ADD(&query->cmd_type, sizeof(query->cmd_type));
+  KEY_ADD(&query->dbx,      sizeof(query->dbx));
+  KEY_ADD(&db->gen,         sizeof(db->gen));
+  KEY_STR(db->name);
+
+  if ((sq = query->seq) != NULL) {
+    KEY_STR(sq->name);
+    KEY_STR(sq->desc);
+    KEY_ADD(&sq->n, sizeof(sq->n));
+    KEY_ADD(sq->dsq, sq->n + 2);
+  } else {
+    hmm = query->hmm;
+    K   = hmm->abc->K;
+    KEY_STR(hmm->name);
+    KEY_STR(hmm->acc);
+    KEY_STR(hmm->desc);
+    KEY_ADD(&hmm->M,          sizeof(hmm->M));
+    KEY_ADD(&hmm->flags,      sizeof(hmm->flags));
+    KEY_ADD(&hmm->max_length, sizeof(hmm->max_length));
+    KEY_ADD(hmm->t[0],   sizeof(float) * (hmm->M + 1) * p7H_NTRANSITIONS);
+    KEY_ADD(hmm->mat[0], sizeof(float) * (hmm->M + 1) * K);
+    KEY_ADD(hmm->ins[0], sizeof(float) * (hmm->M + 1) * K);
+    KEY_ADD(hmm->evparam, sizeof(float) * p7_NEVPARAM);
+    KEY_ADD(hmm->cutoff,  sizeof(float) * p7_NCUTOFFS);
+    KEY_ADD(hmm->compo,   sizeof(float) * p7_MAXABET);
+    if (hmm->flags & p7H_RF)    KEY_ADD(hmm->rf,        hmm->M + 2);
+    if (hmm->flags & p7H_MMASK) KEY_ADD(hmm->mm,        hmm->M + 2);
+    if (hmm->flags & p7H_CONS)  KEY_ADD(hmm->consensus, hmm->M + 2);
+    if (hmm->flags & p7H_CS)    KEY_ADD(hmm->cs,        hmm->M + 2);
+  }
+
+  /* every option's value, defaults included, so equivalent command lines match */
+  for (i = 0; i < go->nopts; ++i) {
+    if (strcmp(go->opt[i].name, "--priority") == 0 || strcmp(go->opt[i].name, "--stream") == 0 ||
+        strcmp(go->opt[i].name, "--timeout")  == 0) continue;
+    KEY_STR(go->opt[i].name);
+    KEY_STR(go->val[i]);
+  }
+
+#undef KEY_STR
+#undef KEY_ADD
+  *ret_kdata = kd;
+  *ret_klen  = kl;
+  return fnv_hash(0xcbf29ce484222325ULL, kd, kl);
+}
+
+/* rcache_Match()
+ * TRUE if cache entry <e> is for the search with key <key>, whose
+ * material is <kdata> of length <klen>.
+ */
+static int
+rcache_Match(const RESULT_ENTRY *e, uint64_t key, const char *kdata, uint64_t klen)
+{
+  return (e->key == key && e->klen == klen && memcmp(e->kdata, kdata, klen) == 0);
+}
+
+static void
+rcache_Init(RESULT_CACHE *rc, uint64_t max_size)
+{
+  memset(rc, 0, sizeof(RESULT_CACHE));
+  rc->max_size = max_size;
+}
+
+static void
+rcache_Unlink(RESULT_CACHE *rc, RESULT_ENTRY *e)
+{
+  RESULT_ENTRY **pp = &rc->bucket[e->key & (RCACHE_BUCKETS - 1)];
+
+  while (*pp != e) pp = &(*pp)->chain;
+  *pp = e->chain;
+
+  if (e->prev) e->prev->next = e->next; else rc->head = e->next;
+  if (e->next) e->next->prev = e->prev; else rc->tail = e->prev;
+
+  rc->count--;
+  rc->size -= e->size + e->klen + sizeof(RESULT_ENTRY);
+}
+
+/* rcache_Clear()
+ * Drop every cached result, when the databases change.  The hit and
+ * miss counts are kept.
+ */
+static void
+rcache_Clear(RESULT_CACHE *rc)
+{
+  RESULT_ENTRY *e;
+
+  while ((e = rc->head) != NULL) {
+    rcache_Unlink(rc, e);
+    free(e->kdata);
+    free(e->msg);
+    free(e);
+  }
+}
+
+/* rcache_Find()
+ * Called with the work_mutex held.  If the response to the search with
+ * key <key> and key material <kdata> of <klen> bytes (query_key()) is
+ * cached, return a copy of it in <*ret_msg> (which the caller frees)
+ * and TRUE; else FALSE.
+ */
+static int
+rcache_Find(RESULT_CACHE *rc, uint64_t key, const char *kdata, uint64_t klen, char **ret_msg, uint64_t *ret_size)
+{
+  RESULT_ENTRY *e;
+
+  for (e = rc->bucket[key & (RCACHE_BUCKETS - 1)]; e != NULL; e = e->chain)
+    if (rcache_Match(e, key, kdata, klen)) break;
+
+  if (e == NULL) { rc->misses++; return FALSE; }
+  rc->hits++;
+
+  /* move it to the front of the LRU list */
+  if (e != rc->head) {
+    e->prev->next = e->next;
+    if (e->next) e->next->prev = e->prev; else rc->tail = e->prev;
+    e->prev = NULL;
+    e->next = rc->head;
+    rc->head->prev = e;
+    rc->head = e;
+  }
+
+  if ((*ret_msg = malloc(e->size)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memcpy(*ret_msg, e->msg, e->size);
+  *ret_size = e->size;
+  return TRUE;
+}
+
+/* rcache_Add()
+ * Called with the work_mutex held.  Cache the response <msg> of <size>
+ * bytes to the search with key <key> and key material <kdata> of
+ * <klen> bytes, evicting the least recently used results to stay
+ * within the budget.  The cache takes over <msg>, and keeps its own
+ * copy of <kdata>.
+ */
+static void
+rcache_Add(RESULT_CACHE *rc, uint64_t key, const char *kdata, uint64_t klen, char *msg, uint64_t size)
+{
+  RESULT_ENTRY *e;
+
+  if (size + klen + sizeof(RESULT_ENTRY) > rc->max_size) { free(msg); return; }
+
+  /* a concurrent run of the same search may have got here first */
+  for (e = rc->bucket[key & (RCACHE_BUCKETS - 1)]; e != NULL; e = e->chain)
+    if (rcache_Match(e, key, kdata, klen)) { free(msg); return; }
+
+  while (rc->size + size + klen + sizeof(RESULT_ENTRY) > rc->max_size) {
+    e = rc->tail;
+    rcache_Unlink(rc, e);
+    free(e->kdata);
+    free(e->msg);
+    free(e);
+  }
+
+  if ((e = malloc(sizeof(RESULT_ENTRY))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if ((e->kdata = malloc(ESL_MAX(1, klen))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memcpy(e->kdata, kdata, klen);
+  e->klen  = klen;
+  e->key   = key;
+  e->msg   = msg;
+  e->size  = size;
+  e->prev  = NULL;
+  e->next  = rc->head;
+  e->chain = rc->bucket[key & (RCACHE_BUCKETS - 1)];
+  rc->bucket[key & (RCACHE_BUCKETS - 1)] = e;
+  if (rc->head) rc->head->prev = e; else rc->tail = e;
+  rc->head = e;
+
+  rc->count++;
+  rc->size += size + klen + sizeof(RESULT_ENTRY);
+}
+
+/* observe()
+ * Count a latency of <x> seconds in histogram <h>.
+ */
+static void
+observe(HISTOGRAM *h, double x)
+{
+  int i;
+
+  for (i = 0; i < NLATENCY && x > latency_bounds[i]; i++) ;
+  h->count[i]++;
+  h->n++;
+  h->sum += x;
+}
+
+static void
+destroy_job(SEARCH_JOB *job)
+{
+  int q;
+
+  if (job == NULL) return;
+
+  if (job->range_list) {
+    if (job->range_list->starts) free(job->range_list->starts);
+    if (job->range_list->ends)   free(job->range_list->ends);
+    free(job->range_list);
+  }
+
+  if (job->results != NULL) {
+    for (q = 0; q < job->nq; ++q) clear_results(job->results + q);
+    free(job->results);
+  }
+
+  if (job->unit  != NULL) free(job->unit);
+  if (job->todo  != NULL) free(job->todo);
+  if (job->kdata != NULL) free(job->kdata);
+  if (job->w     != NULL) esl_stopwatch_Destroy(job->w);
+  if (job->query != NULL) free_QueueData(job->query);
+
+  free(job);
+}
+
+/* new_unit()
+ * Called with the work_mutex held.  Cut the next range off the part of
+ * the database that <job> has not handed out yet, and return its index.
+ * Each range is a share of what is left, split between twice the number
+ * of workers, so ranges start large and shrink as the search nears its
+ * end; no range is smaller than <job->min_cnt> entries (unless that is
+ * all there is left).
+ */
+static int
+new_unit(WORKERSIDE_ARGS *args, SEARCH_JOB *job)
+{
+  SEARCH_UNIT *unit = NULL;
+  int          goal;
+  int          curr;
+
+  if (job->nunits == job->nalloc) {
+    job->nalloc *= 2;
+    if ((job->unit = realloc(job->unit, sizeof(SEARCH_UNIT) * job->nalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+    if ((job->todo = realloc(job->todo, sizeof(int)         * job->nalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+  }
+
+  goal = job->nleft / (2 * ESL_MAX(1, args->ready));
+  goal = ESL_MIN(job->nleft, ESL_MAX(job->min_cnt, goal));
+
+  unit = job->unit + job->nunits;
+  memset(unit, 0, sizeof(SEARCH_UNIT));
+  unit->inx = job->next_inx;
+
+  if (job->range_list) {
+    // if ranges are given, need to split the db list based on which elements in the list are within the given range(s)
+    curr = 0; //how many within-range sequences have I seen since the start of this range
+    while (curr < goal) {
+      if ( hmmpgmd_IsWithinRanges (args->db[job->db_slot].seq_db->list[job->next_inx].idx, job->range_list ) )
+        curr++;
+      unit->cnt++;
+      job->next_inx++;
+    }
+  } else {
+    unit->cnt      = goal;
+    job->next_inx += goal;
+  }
+  job->nleft -= goal;
+
+  return job->nunits++;
+}
+
+/* schedule_unit()
+ * Called with the work_mutex held, by a worker looking for work.
+ * Searches with a higher --priority are served first.  Among searches
+ * of equal priority, the one with the fewest ranges running gets the
+ * worker, so concurrent searches share the workers evenly and a small
+ * search is not stuck behind a large one.  A search is held back until
+ * any earlier search from the same client has been answered, so each
+ * client gets its results back in order, one at a time.
+ *
+ * If no search has a range left to hand out, the worker backs up the
+ * range that has been running longest on a single worker, so that one
+ * slow or overloaded worker does not hold up the whole search.
+ *
+ * A worker only gets ranges of searches whose databases it has loaded.
+ *
+ * Returns the search and sets <*ret_unit> to the range to run, or
+ * returns NULL if there is nothing to do.
+ */
+static SEARCH_JOB *
+schedule_unit(WORKERSIDE_ARGS *args, WORKER_DATA *worker, int *ret_unit)
+{
+  SEARCH_JOB  *job  = NULL;
+  SEARCH_JOB  *prev = NULL;
+  SEARCH_JOB  *best = NULL;
+  SEARCH_UNIT *unit = NULL;
+  int          u;
+  int          best_u = -1;
+
+  for (job = args->jobs; job != NULL; job = job->next) {
+    if (job->ntodo == 0 && job->nleft == 0) continue;
+    if (worker->db_gen[job->db_slot] != job->db_gen) continue;
+
+    for (prev = args->jobs; prev != job; prev = prev->next)
+      if (prev->query->sock == job->query->sock) break;
+    if (prev != job) continue;
+
+    if (best == NULL || job->priority > best->priority ||
+        (job->priority == best->priority && job->nrunning < best->nrunning)) {
+      best = job;
+    }
+  }
+
+  if (best != NULL) {
+    best_u = (best->ntodo > 0) ? best->todo[--best->ntodo] : new_unit(args, best);
+  } else {
+    /* nothing new to run; look for a straggler to back up */
+    for (job = args->jobs; job != NULL; job = job->next) {
+      if (worker->db_gen[job->db_slot] != job->db_gen) continue;
+      for (u = 0; u < job->nunits; u++) {
+        unit = job->unit + u;
+        if (unit->done || unit->nrunning != 1) continue;
+        if (best == NULL || unit->started < best->unit[best_u].started) {
+          best   = job;
+          best_u = u;
+        }
+      }
+    }
+    if (best == NULL) return NULL;
+  }
+
+  unit = best->unit + best_u;
+  unit->started = ++args->nstarted;
+  unit->nrunning++;
+  best->nrunning++;
+
+  *ret_unit = best_u;
+  return best;
+}
+
+/* clear_range()
+ * Free what is left of the results <worker> sent back for its range.
+ */
+static void
+clear_range(WORKER_DATA *worker)
+{
+  RANGE_RESULTS *r;
+  int            q;
+
+  for (q = 0; q < worker->nres; ++q) {
+    r = worker->res + q;
+    if (r->hit      != NULL) free(r->hit);
+    if (r->hit_data != NULL) free(r->hit_data);
+    if (r->err_buf  != NULL) free(r->err_buf);
+    r->hit      = NULL;
+    r->hit_data = NULL;
+    r->err_buf  = NULL;
+  }
+}
+
+/* finish_unit()
+ * Called with the work_mutex held, when <worker> has finished its range
+ * of a search.  The first copy of a range to finish supplies its results;
+ * those of any backup copy finishing later are thrown away.  Returns the
+ * search if it has been answered and this was the last range running for
+ * it, so the caller can free it after releasing the mutex; else NULL.
+ */
+static SEARCH_JOB *
+finish_unit(WORKER_DATA *worker)
+{
+  SEARCH_JOB  *job  = worker->job;
+  SEARCH_UNIT *unit = job->unit + worker->unit;
+
+  unit->nrunning--;
+  job->nrunning--;
+
+  if (!unit->done && !job->retired) {
+    add_results(job, worker);
+    unit->done = TRUE;
+    job->ndone++;
+  }
+
+  clear_range(worker);
+  worker->job      = NULL;
+
+  return (job->retired && job->nrunning == 0) ? job : NULL;
+}
+
+/* release_worker()
+ * Called with the work_mutex held when a worker's connection has been
+ * lost.  Unless a backup copy is still running, the range it was running
+ * goes back to its search, to be tried once more on another worker.  If
+ * no workers are left to run anything, all the searches in flight fail.
+ * Returns the search if it has been answered and this was the last range
+ * running for it, so the caller can free it; else NULL.
+ */
+static SEARCH_JOB *
+release_worker(WORKERSIDE_ARGS *args, WORKER_DATA *worker)
+{
+  SEARCH_JOB  *job  = worker->job;
+  SEARCH_JOB  *ret  = NULL;
+  SEARCH_UNIT *unit = NULL;
+  WORKER_DATA *live = NULL;
+  int          u;
+
+  if (job != NULL) {
+    unit = job->unit + worker->unit;
+    unit->nrunning--;
+    job->nrunning--;
+
+    if (!unit->done && unit->nrunning == 0 && !job->retired) {
+      if (++unit->nfailed < 2) {
+        job->todo[job->ntodo++] = worker->unit;
+      } else {
+        unit->done = TRUE;
+        job->ndone++;
+        job->errors++;
+      }
+    }
+
+    if (job->retired && job->nrunning == 0) ret = job;
+    worker->job = NULL;
+  }
+
+  clear_range(worker);
+
+  for (live = args->head; live != NULL; live = live->next)
+    if (live->active && !live->terminated) break;
+
+  if (live == NULL) {
+    for (job = args->jobs; job != NULL; job = job->next) {
+      for (u = 0; u < job->nunits; u++) {
+        unit = job->unit + u;
+        if (unit->done || unit->nrunning > 0) continue;
+        unit->done = TRUE;
+        job->ndone++;
+        job->errors++;
+      }
+      if (job->nleft > 0) job->errors++;
+      job->nleft = 0;
+      job->ntodo = 0;
+    }
+  }
+
+  return ret;
+}
+
+/* cancel_job()
+ * Called with the work_mutex held.  Give up on a search for reason <why>
+ * (CANCEL_*): no more of its ranges are handed out, and the workers
+ * running one are told to stop at their next block of the database (see
+ * workerside_loop()).  Its search_thread() then answers the client.
+ */
+static void
+cancel_job(WORKERSIDE_ARGS *args, SEARCH_JOB *job, int why)
+{
+  SEARCH_UNIT *unit = NULL;
+  int          u;
+  int          n;
+
+  if (job->cancelled || job->retired) return;
+  job->cancelled = why;
+
+  for (u = 0; u < job->nunits; u++) {
+    unit = job->unit + u;
+    if (unit->done) continue;
+    unit->done = TRUE;
+    job->ndone++;
+  }
+  job->nleft = 0;
+  job->ntodo = 0;
+
+  if ((n = pthread_cond_broadcast(&args->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+}
+
+/* wait_for_searches()
+ * Called with the work_mutex held.  Wait until every search in flight
+ * has been answered, before the workers or databases are changed.
+ */
+static void
+wait_for_searches(WORKERSIDE_ARGS *args)
+{
+  int n;
+
+  while (args->jobs != NULL) {
+    if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+  }
+}
+
+/* process_search()
+ * Queue a search (or scan) for the workers, which pull ranges of the
+ * database from it as they go; takes ownership of <query>.  It runs alongside any
+ * other searches already in flight.  A search_thread() waits for it to
+ * finish and sends the results back to the client.  The search runs
+ * against the version of its databases (--db) live when it is queued,
+ * even if a newer one is loaded before it finishes.
+ */
+static void
+process_search(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+{
+  SEARCH_JOB     *job        = NULL;
+  SEARCH_JOB     *tail       = NULL;
+  DB_SLOT        *db         = NULL;
+  RESULT_CACHE   *rc         = &args->rcache;
+  char           *msg        = NULL;
+  uint64_t        msg_size   = 0;
+  pthread_t       thread_id;
+  int n;
+  int cnt;
+  int i;
+
+  if ((job = malloc(sizeof(SEARCH_JOB))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memset(job, 0, sizeof(SEARCH_JOB));
+
+  job->query    = query;
+  job->parent   = args;
+  job->priority = esl_opt_GetInteger(query->opts, "--priority");
+
+  job->w = esl_stopwatch_Create();
+  esl_stopwatch_Start(job->w);
+
+  /* the time spent queued counts against --timeout too */
+  if (esl_opt_GetInteger(query->opts, "--timeout") > 0) {
+    clock_gettime(CLOCK_REALTIME, &job->deadline);
+    job->deadline.tv_sec += esl_opt_GetInteger(query->opts, "--timeout");
+  }
+
+  job->nq = query->nq;
+  if ((job->results = malloc(sizeof(SEARCH_RESULTS) * job->nq)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  for (i = 0; i < job->nq; ++i) init_results(job->results + i);
+
+  if (esl_opt_IsUsed(query->opts, "--seqdb_ranges")) {
+    if ((job->range_list = malloc(sizeof(RANGE_LIST))) == NULL) LOG_FATAL_MSG("malloc", errno);
+    hmmpgmd_GetRanges(job->range_list, esl_opt_GetString(query->opts, "--seqdb_ranges"));
+  }
+
+  /* process any changes to the available workers */
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+
+  /* build a list of the currently available workers */
+  update_workers(args);
+
+  /* look up the databases to search */
+  if ((query->db_slot = find_db(args, esl_opt_GetString(query->opts, "--db"))) < 0) {
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    client_msg(query->sock, eslENOTFOUND, "Database %s is not loaded\n", esl_opt_GetString(query->opts, "--db"));
+    destroy_job(job);
+    return;
+  }
+  db = args->db + query->db_slot;
+  if ((query->cmd_type == HMMD_CMD_SEARCH && (db->seq_db == NULL || query->dbx < 0 || query->dbx >= db->seq_db->db_cnt)) ||
+      (query->cmd_type == HMMD_CMD_SCAN   &&  db->hmm_db == NULL)) {
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    client_msg(query->sock, eslENOTFOUND, "Database %s has no %s database %d\n", db->name,
+               (query->cmd_type == HMMD_CMD_SEARCH) ? "sequence" : "hmm", query->dbx + 1);
+    destroy_job(job);
+    return;
+  }
+  job->db_slot = query->db_slot;
+  job->db_gen  = db->gen;
+  query->cmd->srch.db_slot = query->db_slot;
+
+  /* Answer a repeat of a recent search from the result cache.  Not
+   * while the client still has a search in flight, since that one's
+   * results have to reach the client first.  Batches aren't cached.
+   */
+  if (rc->max_size > 0 && job->nq == 1) {
+    job->key = query_key(args, query, &job->kdata, &job->klen);
+    for (tail = args->jobs; tail != NULL; tail = tail->next)
+      if (tail->query->sock == query->sock) break;
+    if (tail == NULL && rcache_Find(rc, job->key, job->kdata, job->klen, &msg, &msg_size)) {
+      printf("Result cache: %" PRIu64 " hits, %" PRIu64 " misses, %d results in %" PRIu64 " bytes\n", rc->hits, rc->misses, rc->count, rc->size);
+      args->metrics.bytes_sent += msg_size;
+      if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+      if (writen(query->sock, msg, msg_size) != msg_size) {
+        p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
+      } else {
+        printf("Cached results for %s (%d) sent\n", query->ip_addr, query->sock);
+      }
+      fflush(stdout);
+
+      free(msg);
+      destroy_job(job);
+      return;
+    }
+    tail = NULL;
+  }
+
+  /* if there are no workers, report an error */
+  if (args->ready == 0) {
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    client_msg(query->sock, eslFAIL, "No compute nodes available\n");
+    destroy_job(job);
+    return;
+  }
+
+  /* figure out the size of the database we are searching */
+  if (query->cmd_type == HMMD_CMD_SEARCH) {
+    cnt = db->seq_db->db[query->dbx].count;
+  } else {
+    cnt = db->hmm_db->n;
+  }
+
+  //if range(s) are given, count how many of the seqdb's sequences are within supplied range(s)
+  if (job->range_list) { // can only happen in HMMD_CMD_SEARCH case
+    int range_cnt = 0; // this will now count how many of the seqs in the db are within the range
+    for (i=0; i<cnt; i++) {
+      if ( hmmpgmd_IsWithinRanges(db->seq_db->list[i].idx, job->range_list ) )
+        range_cnt++;
+    }
+    cnt = range_cnt;
+  }
+
+  /* the workers pull ranges of the database from the search as they go */
+  job->next_inx = 0;
+  job->nleft    = cnt;
+  job->min_cnt  = ESL_MAX(1, cnt / (args->ready * MAX_UNITS_PER_WORKER));
+  job->nalloc   = 2 * args->ready;
+  if ((job->unit = malloc(sizeof(SEARCH_UNIT) * job->nalloc)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if ((job->todo = malloc(sizeof(int)         * job->nalloc)) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+  /* add the search to the end of the list of searches in flight */
+  db->nusers++;
+  if (args->jobs == NULL) {
+    args->jobs = job;
+  } else {
+    for (tail = args->jobs; tail->next != NULL; tail = tail->next) ;
+    tail->next = job;
+  }
+
+  /* notify all the worker threads of the new query */
+  if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
+
+  if ((n = pthread_create(&thread_id, NULL, search_thread, job)) != 0) LOG_FATAL_MSG("thread create", n);
+}
+
+/* search_thread()
+ * Wait for all the ranges of a search to be run, then send the merged
+ * results to the client and retire the search.  A search that runs past
+ * its --timeout is cancelled.
+ */
+static void *
+search_thread(void *arg)
+{
+  SEARCH_JOB        *job    = (SEARCH_JOB *) arg;
+  WORKERSIDE_ARGS   *args   = job->parent;
+  QUEUE_DATA        *query  = job->query;
+  SEARCH_JOB        *prev   = NULL;
+  DB_SLOT           *db     = args->db + job->db_slot;
+  DB_SLOT            old;
+  HIT_LIST           batch;
+  HMMD_SEARCH_STATS  stats;
+  int                stream = esl_opt_GetBoolean(query->opts, "--stream");
+  int                nsent  = 0;   /* number of batches streamed to the client */
+  char              *msg    = NULL;
+  uint64_t           msg_size;
+  uint64_t           sent   = 0;   /* bytes of results sent to the client */
+  int                running;
+  int                q;
+  int                n;
+
+  /* Guarantees that thread resources are deallocated upon return */
+  pthread_detach(pthread_self());
+
+  /* Wait for all the ranges to complete */
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+
+  while (job->nleft > 0 || job->ndone < job->nunits) {
+    /* with --stream, pass each range's hits on to the client as they come in */
+    if (stream && job->errors == 0 && nsent < job->results[0].nhits) {
+      batch = job->results[0].hits[nsent++];
+      stats = job->results[0].stats;
+      if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+      sent += forward_batch(query, &batch, &stats);
+      if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+      continue;
+    }
+    if (job->deadline.tv_sec == 0) {
+      if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+    } else if ((n = pthread_cond_timedwait (&args->complete_cond, &args->work_mutex, &job->deadline)) == ETIMEDOUT) {
+      cancel_job(args, job, CANCEL_TIMEOUT);
+    } else if (n != 0) {
+      LOG_FATAL_MSG("cond timedwait", n);
+    }
+  }
+
+  for (q = 0; q < job->nq; ++q) finish_results(query, db, job->results + q);
+
+  /* the filter pass rates of the searches that finished */
+  for (q = 0; q < job->nq && !job->cancelled && job->errors == 0; ++q) {
+    stats = job->results[q].stats;
+    args->metrics.ntargets    += (query->cmd_type == HMMD_CMD_SEARCH) ? stats.nseqs : stats.nmodels;
+    args->metrics.n_past_msv  += stats.n_past_msv;
+    args->metrics.n_past_bias += stats.n_past_bias;
+    args->metrics.n_past_vit  += stats.n_past_vit;
+    args->metrics.n_past_fwd  += stats.n_past_fwd;
+    args->metrics.nhits       += stats.nhits;
+  }
+
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  esl_stopwatch_Stop(job->w);
+
+  /* copy the search stats */
+  for (q = 0; q < job->nq; ++q) {
+    job->results[q].stats.elapsed = job->w->elapsed;
+    job->results[q].stats.user    = job->w->user;
+    job->results[q].stats.sys     = job->w->sys;
+  }
+
+  if (job->cancelled == CANCEL_HANGUP) {
+    printf("Search for %s (%d) cancelled; client gone\n", query->ip_addr, query->sock);
+    fflush(stdout);
+  } else if (job->cancelled == CANCEL_TIMEOUT) {
+    client_msg(query->sock, HMMD_STATUS_CANCELLED, "Search ran past its timeout of %d seconds\n", esl_opt_GetInteger(query->opts, "--timeout"));
+  } else if (job->cancelled) {
+    client_msg(query->sock, HMMD_STATUS_CANCELLED, "Search cancelled\n");
+  } else if (job->errors > 0) {
+    client_msg(query->sock, eslFAIL, "Errors running search\n");
+  } else {
+    /* a batch is answered with the results of each of its queries in turn */
+    for (q = 0; q < job->nq; ++q) {
+      forward_results(query, job->results + q, (job->nq == 1) ? &msg : NULL, &msg_size);
+      sent += msg_size;
+    }
+  }
+
+  printf("SEARCH client=%s:%d queries=%d outcome=%s elapsed=%.3f bytes=%" PRIu64 "\n", query->ip_addr, query->sock, job->nq,
+         job->cancelled ? "cancelled" : (job->errors > 0) ? "error" : "ok", job->w->elapsed, sent);
+  fflush(stdout);
+
+  /* retire the search; any search queued behind it by the same client can now run */
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+
+  if (args->jobs == job) {
+    args->jobs = job->next;
+  } else {
+    for (prev = args->jobs; prev->next != job; prev = prev->next) ;
+    prev->next = job->next;
+  }
 
-  return 1;
+  /* backup copies of ranges may still be running; the last one to finish frees the search */
+  job->retired = TRUE;
+  running      = job->nrunning;
+
+  if      (job->cancelled)   args->metrics.ncancelled++;
+  else if (job->errors > 0)  args->metrics.nerrors++;
+  else                       args->metrics.nok++;
+  args->metrics.nqueries   += job->nq;
+  args->metrics.bytes_sent += sent;
+  observe(&args->metrics.search_time, job->w->elapsed);
+
+  /* keep the response for repeats of the search, unless the databases changed under it */
+  if (msg != NULL) {
+    if (args->rcache.max_size > 0 && db->state == DB_LIVE) rcache_Add(&args->rcache, job->key, job->kdata, job->klen, msg, msg_size);
+    else                                                   free(msg);
+  }
+
+  /* the last search of a replaced version of a database frees it */
+  memset(&old, 0, sizeof(DB_SLOT));
+  if (--db->nusers == 0 && db->state == DB_RETIRED) free_db(args, db, &old);
+
+  if ((n = pthread_cond_broadcast(&args->start_cond))    != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_cond_broadcast(&args->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  if (running == 0) destroy_job(job);
+  close_db(&old);
+
+  pthread_exit(NULL);
 }
 
+/* A growing text buffer for the !stats report. */
+typedef struct {
+  char    *buf;
+  size_t   len;
+  size_t   nalloc;
+} TEXT_BUF;
+
 static void
-update_workers(WORKERSIDE_ARGS *args)
+text_printf(TEXT_BUF *t, const char *format, ...)
 {
-  WORKER_DATA *worker = NULL;
-
-  assert(validate_workers(args));
+  va_list ap;
+  int     n;
 
-  /* if there are any workers waiting to join, add them */
-  while (args->pending != NULL) {
-    worker = args->pending;
-    args->pending = worker->next;
+  for ( ; ; ) {
+    va_start(ap, format);
+    n = vsnprintf(t->buf + t->len, t->nalloc - t->len, format, ap);
+    va_end(ap);
+    if (n < 0) LOG_FATAL_MSG("vsnprintf", errno);
+    if (t->len + n < t->nalloc) break;
+
+    t->nalloc = ESL_MAX(t->nalloc * 2, t->len + n + 1);
+    if ((t->buf = realloc(t->buf, t->nalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+  }
+  t->len += n;
+}
 
-    worker->next = NULL;
-    if (args->head == NULL) {
-      args->head = worker;
-      worker->prev = NULL;
-    } else {
-      args->tail->next = worker;
-      worker->prev = args->tail;
-    }
-    args->tail = worker;
+static void
+print_metric(TEXT_BUF *t, const char *name, const char *type, const char *help)
+{
+  text_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
 
-    args->pend_cnt--;
-    args->ready++;
-  }
+static void
+print_histogram(TEXT_BUF *t, const char *name, const char *help, HISTOGRAM *h)
+{
+  uint64_t cnt = 0;
+  int      i;
 
-  /* remove any workers who have failed */
-  worker = args->head;
-  while (args->failed > 0 && worker != NULL) {
-    WORKER_DATA *next =  worker->next;
-    if (worker->terminated) {
-      --args->failed;
-      --args->ready;
-      if (args->head == worker && args->tail == worker) {
-        args->head = NULL;
-        args->tail = NULL;
-      } else if (args->head == worker) {
-        args->head = worker->next;
-        worker->next->prev = NULL;
-      } else if (args->tail == worker) {
-        args->tail = worker->prev;
-        worker->prev->next = NULL;
-      } else {
-        worker->next->prev = worker->prev;
-        worker->prev->next = worker->next;
-      }
-      destroy_worker(worker);
-    }
-    worker = next;
+  print_metric(t, name, "histogram", help);
+  for (i = 0; i < NLATENCY; i++) {
+    cnt += h->count[i];
+    text_printf(t, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, latency_bounds[i], cnt);
   }
-
-  assert(validate_workers(args));
+  text_printf(t, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, h->n);
+  text_printf(t, "%s_sum %.6f\n", name, h->sum);
+  text_printf(t, "%s_count %" PRIu64 "\n", name, h->n);
 }
 
+/* process_stats()
+ * Answer !stats with the master's counters and those of its workers,
+ * in the Prometheus text format, as the text of an eslOK message.
+ */
 static void
-process_search(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+process_stats(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 {
-  ESL_STOPWATCH  *w          = NULL;      /* timer used for profiling statistics             */
-  WORKER_DATA    *worker     = NULL;
-  SEARCH_RESULTS  results;
-  int n;
-  int cnt;
-  int inx;
-  int ready_workers;    /* counter variable used to track the number of workers currently available to receive work; short for "remaining", I imagine */
-  int tries;
-  int i;
+  static const char *state[] = { "free", "loading", "live", "retired" };
 
+  METRICS            *m       = &args->metrics;
+  RESULT_CACHE       *rc      = &args->rcache;
+  WORKER_DATA        *worker;
+  SEARCH_JOB         *job;
+  TEXT_BUF            t;
+  HMMD_SEARCH_STATUS  sstatus;
+  int                 njobs   = 0;
+  int                 nranges = 0;
+  int                 nready  = 0;
+  int                 npend   = 0;
+  int                 s;
+  int                 n;
 
-  memset(&results, 0, sizeof(SEARCH_RESULTS)); /* avoid valgrind bitching about uninit bytes; remove, if we ever serialize structs properly */
+  t.len    = 0;
+  t.nalloc = 4096;
+  if ((t.buf = malloc(t.nalloc)) == NULL) LOG_FATAL_MSG("malloc", errno);
 
-  w = esl_stopwatch_Create();
-  esl_stopwatch_Start(w);
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-  /* figure out the size of the database we are searching */
-  if (query->cmd_type == HMMD_CMD_SEARCH) {
-    cnt = args->seq_db->db[query->dbx].count;
-  } else {
-    cnt = args->hmm_db->n;
+  for (job = args->jobs; job != NULL; job = job->next) {
+    njobs++;
+    nranges += job->nrunning;
   }
+  for (worker = args->head;    worker != NULL; worker = worker->next) nready += !worker->terminated;
+  for (worker = args->pending; worker != NULL; worker = worker->next) npend  += !worker->terminated;
 
-  init_results(&results);
+  print_metric(&t, "hmmpgmd_uptime_seconds", "gauge", "Seconds since the master started.");
+  text_printf(&t, "hmmpgmd_uptime_seconds %.0f\n", difftime(time(NULL), m->started));
 
-  //if range(s) are given, count how many of the seqdb's sequences are within supplied range(s)
-  if (args->range_list) { // can only happen in HMMD_CMD_SEARCH case
-    int range_cnt = 0; // this will now count how many of the seqs in the db are within the range
-    for (i=0; i<cnt; i++) {
-      if ( hmmpgmd_IsWithinRanges(args->seq_db->list[i].idx, args->range_list ) )
-        range_cnt++;
-    }
-    cnt = range_cnt;
-  }
+  print_metric(&t, "hmmpgmd_searches_total", "counter", "Searches answered, by outcome.");
+  text_printf(&t, "hmmpgmd_searches_total{outcome=\"ok\"} %" PRIu64 "\n",        m->nok);
+  text_printf(&t, "hmmpgmd_searches_total{outcome=\"cached\"} %" PRIu64 "\n",    rc->hits);
+  text_printf(&t, "hmmpgmd_searches_total{outcome=\"error\"} %" PRIu64 "\n",     m->nerrors);
+  text_printf(&t, "hmmpgmd_searches_total{outcome=\"cancelled\"} %" PRIu64 "\n", m->ncancelled);
 
+  print_metric(&t, "hmmpgmd_queries_total", "counter", "Queries in the searches run; a batch counts each of its queries.");
+  text_printf(&t, "hmmpgmd_queries_total %" PRIu64 "\n", m->nqueries);
 
-  inx = 0;
-  tries = 0;
-  do {
-    /* process any changes to the available workers */
-    if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  print_metric(&t, "hmmpgmd_searches_in_flight", "gauge", "Searches queued or running.");
+  text_printf(&t, "hmmpgmd_searches_in_flight %d\n", njobs);
 
-    /* build a list of the currently available workers */
-    update_workers(args);
-
-    /* if there are no workers, report an error */
-    if (args->ready > 0) {
-      ready_workers = args->ready;
-
-      /* update the workers search information */
-      worker = args->head;
-
-      while (worker != NULL) {
-        worker->cmd        = query->cmd;
-        worker->completed  = 0;
-        worker->total      = 0;
-
-        /* assign each worker a portion of the database */
-        worker->srch_inx = inx;
-        if (args->range_list) {
-          // if ranges are given, need to split the db list based on which elements in the list are within the given range(s)
-          int goal = cnt / ready_workers; //how many within-range sequences do I want to ask this worker to handle
-          int curr = 0;                   //how many within-range sequences have I seen since the start of this full-db range
-          worker->srch_cnt = 0;
-          while (curr < goal) {
-            if ( hmmpgmd_IsWithinRanges (args->seq_db->list[inx].idx, args->range_list ) )
-                curr++;
-            worker->srch_cnt++;
-            inx++;
-          }
-          cnt -= curr;
-        } else {
-          // default - split evenly among workers
-          worker->srch_cnt = cnt / ready_workers;
-          inx += worker->srch_cnt;
-          cnt -= worker->srch_cnt;
-        }
+  print_metric(&t, "hmmpgmd_ranges_running", "gauge", "Ranges of searches running on workers, backup copies included.");
+  text_printf(&t, "hmmpgmd_ranges_running %d\n", nranges);
 
-        --ready_workers;
-        worker            = worker->next;
-      }
+  print_histogram(&t, "hmmpgmd_search_seconds", "Time from a search being queued to its answer.", &m->search_time);
 
-      args->completed = 0;
+  print_metric(&t, "hmmpgmd_sent_bytes_total", "counter", "Bytes of results sent to clients.");
+  text_printf(&t, "hmmpgmd_sent_bytes_total %" PRIu64 "\n", m->bytes_sent);
 
-      /* notify all the worker threads of the new query */
-      if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
-    }
+  print_metric(&t, "hmmpgmd_targets_total", "counter", "Target sequences or profiles of the searches that finished.");
+  text_printf(&t, "hmmpgmd_targets_total %" PRIu64 "\n", m->ntargets);
 
-    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
+  print_metric(&t, "hmmpgmd_filter_passed_total", "counter", "Targets passing each stage of the pipeline.");
+  text_printf(&t, "hmmpgmd_filter_passed_total{stage=\"msv\"} %" PRIu64 "\n",  m->n_past_msv);
+  text_printf(&t, "hmmpgmd_filter_passed_total{stage=\"bias\"} %" PRIu64 "\n", m->n_past_bias);
+  text_printf(&t, "hmmpgmd_filter_passed_total{stage=\"vit\"} %" PRIu64 "\n",  m->n_past_vit);
+  text_printf(&t, "hmmpgmd_filter_passed_total{stage=\"fwd\"} %" PRIu64 "\n",  m->n_past_fwd);
 
-    if (args->ready > 0) {
-      /* Wait for all the workers to complete */
-      if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  print_metric(&t, "hmmpgmd_hits_total", "counter", "Hits found, before thresholds.");
+  text_printf(&t, "hmmpgmd_hits_total %" PRIu64 "\n", m->nhits);
 
-      while (args->completed < args->ready) {
-        if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
-      }
+  print_metric(&t, "hmmpgmd_rcache_misses_total", "counter", "Searches not found in the result cache.");
+  text_printf(&t, "hmmpgmd_rcache_misses_total %" PRIu64 "\n", rc->misses);
+  print_metric(&t, "hmmpgmd_rcache_entries", "gauge", "Results held in the result cache.");
+  text_printf(&t, "hmmpgmd_rcache_entries %d\n", rc->count);
+  print_metric(&t, "hmmpgmd_rcache_bytes", "gauge", "Bytes held in the result cache.");
+  text_printf(&t, "hmmpgmd_rcache_bytes %" PRIu64 "\n", rc->size);
 
-      if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
-    }
+  print_metric(&t, "hmmpgmd_db_searches", "gauge", "Searches in flight against each set of resident databases.");
+  for (s = 0; s < HMMD_MAX_DBS; s++) {
+    if (args->db[s].state == DB_FREE) continue;
+    text_printf(&t, "hmmpgmd_db_searches{db=\"%s\",slot=\"%d\",state=\"%s\"} %d\n", args->db[s].name, s, state[args->db[s].state], args->db[s].nusers);
+  }
 
-    /* gather up the results from all the workers */
-    gather_results(query, args, &results);
+  print_metric(&t, "hmmpgmd_workers", "gauge", "Workers connected, by state.");
+  text_printf(&t, "hmmpgmd_workers{state=\"ready\"} %d\n",   nready);
+  text_printf(&t, "hmmpgmd_workers{state=\"pending\"} %d\n", npend);
+  print_metric(&t, "hmmpgmd_workers_lost_total", "counter", "Workers whose connection was lost.");
+  text_printf(&t, "hmmpgmd_workers_lost_total %" PRIu64 "\n", m->nlost);
+
+  print_metric(&t, "hmmpgmd_ranges_total", "counter", "Ranges of searches run by the workers.");
+  text_printf(&t, "hmmpgmd_ranges_total %" PRIu64 "\n", m->nranges);
+  print_histogram(&t, "hmmpgmd_range_seconds", "Time for a worker to run a range of a search.", &m->range_time);
+
+  print_metric(&t, "hmmpgmd_worker_ranges_total", "counter", "Ranges run by each worker.");
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (!worker->terminated) text_printf(&t, "hmmpgmd_worker_ranges_total{worker=\"%s:%d\"} %" PRIu64 "\n", worker->ip_addr, worker->sock_fd, worker->nranges);
+  print_metric(&t, "hmmpgmd_worker_busy_seconds_total", "counter", "Seconds each worker spent running ranges; its utilization is the rate.");
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (!worker->terminated) text_printf(&t, "hmmpgmd_worker_busy_seconds_total{worker=\"%s:%d\"} %.3f\n", worker->ip_addr, worker->sock_fd, worker->busy);
+  print_metric(&t, "hmmpgmd_worker_received_bytes_total", "counter", "Bytes of results received from each worker.");
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (!worker->terminated) text_printf(&t, "hmmpgmd_worker_received_bytes_total{worker=\"%s:%d\"} %" PRIu64 "\n", worker->ip_addr, worker->sock_fd, worker->bytes_recv);
+  print_metric(&t, "hmmpgmd_worker_running", "gauge", "1 if the worker is running a range now.");
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (!worker->terminated) text_printf(&t, "hmmpgmd_worker_running{worker=\"%s:%d\"} %d\n", worker->ip_addr, worker->sock_fd, (worker->job != NULL));
 
-    /* we can recover from one worker crashing.  get the block that worker ran on
-     * and redistribute its load to all the remaining workers.
-     */
-    inx = results.db_inx;
-    cnt = results.db_cnt;
-    ++tries;
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  } while (args->ready > 0 && results.errors == 1 && tries < 2);
+  memset(&sstatus, 0, sizeof(HMMD_SEARCH_STATUS));
+  sstatus.status   = eslOK;
+  sstatus.msg_size = t.len + 1;   /* with the \0 */
 
+  n = sizeof(sstatus);
+  if (writen(query->sock, &sstatus, n) != n || writen(query->sock, t.buf, sstatus.msg_size) != sstatus.msg_size)
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
 
-  esl_stopwatch_Stop(w);
+  free(t.buf);
+}
 
-  /* copy the search stats */
-  results.stats.elapsed = w->elapsed;
-  results.stats.user    = w->user;
-  results.stats.sys     = w->sys;
+/* process_cancel()
+ * Cancel the client's searches in flight; each is answered with a
+ * HMMD_STATUS_CANCELLED message.
+ */
+static void
+process_cancel(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+{
+  SEARCH_JOB *job;
+  int         cnt = 0;
+  int         n;
 
-  /* TODO: check for errors */
-  if (args->ready == 0) {
-    client_msg(query->sock, eslFAIL, "No compute nodes available\n");
-  } else if (args->failed > 0) {
-    client_msg(query->sock, eslFAIL, "Errors running search\n");
-    clear_results(args, &results);
-  } else {
-    forward_results(query, &results);  
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  for (job = args->jobs; job != NULL; job = job->next) {
+    if (job->query->sock != query->sock || job->cancelled) continue;
+    cancel_job(args, job, CANCEL_REQUEST);
+    ++cnt;
   }
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  esl_stopwatch_Destroy(w);
+  /* the cancelled searches answer for themselves */
+  if (cnt == 0) client_msg(query->sock, eslENOTFOUND, "No searches to cancel\n");
+}
+
+/* cancel_client()
+ * The connection to a client was lost: cancel its searches, and wait
+ * for them to be retired, and for any load it started to stop writing
+ * to it, so the socket can be closed.
+ */
+static void
+cancel_client(WORKERSIDE_ARGS *args, int fd)
+{
+  SEARCH_JOB *job;
+  int         n;
+
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  for ( ;; ) {
+    for (job = args->jobs; job != NULL; job = job->next)
+      if (job->query->sock == fd) break;
+    if (job == NULL && !(args->loading && args->load_sock == fd)) break;
+
+    for (job = args->jobs; job != NULL; job = job->next)
+      if (job->query->sock == fd) cancel_job(args, job, CANCEL_HANGUP);
+    if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+  }
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 }
 
 static void
@@ -437,6 +1737,12 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   /* process any changes to the available workers */
   if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
+  /* let the searches in flight finish first */
+  wait_for_searches(args);
+
+  /* the workers reload their databases, which may have changed on disk */
+  rcache_Clear(&args->rcache);
+
   /* build a list of the currently available workers */
   update_workers(args);
 
@@ -497,6 +1803,7 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
     HMMD_SEARCH_STATUS status;
 
     status.status     = eslOK;
+    status.version    = 0;
     status.msg_size   = 0;
 
     /* send back a successful status message */
@@ -507,124 +1814,188 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   }
 }
 
+/* process_load()
+ * Load new databases in a load_thread(), so that searches keep being
+ * queued and run meanwhile; takes ownership of <query>.  One load runs
+ * at a time.
+ */
 static void
 process_load(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 {
-  void          *tmp;
-  P7_SEQCACHE   *seq_db  = NULL;
-  P7_HMMCACHE   *hmm_db  = NULL;
-  WORKER_DATA   *worker  = NULL;
-  HMMD_COMMAND   cmd;
-  int            n, cnt;
-  char           errbuf[eslERRBUFSIZE];
-  int            status;
+  LOAD_ARGS     *load    = NULL;
+  pthread_t      thread_id;
+  int            busy;
+  int            n;
+
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  busy = args->loading;
+  if (!busy) {
+    args->loading   = TRUE;
+    args->load_sock = query->sock;
+  }
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  if (busy) {
+    client_msg(query->sock, eslFAIL, "Another load is in progress\n");
+    free_QueueData(query);
+    return;
+  }
+
+  if ((load = malloc(sizeof(LOAD_ARGS))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  load->parent = args;
+  load->query  = query;
+
+  if ((n = pthread_create(&thread_id, NULL, load_thread, load)) != 0) LOG_FATAL_MSG("thread create", n);
+}
+
+/* load_thread()
+ * Load the databases of a load command into a free slot, next to those
+ * in use, and have the workers load them too as they come free between
+ * search ranges.  Once all the workers have them, new searches of the
+ * name switch over to the new databases; the version they replace is
+ * freed when the last search still running against it is done.
+ */
+static void *
+load_thread(void *arg)
+{
+  LOAD_ARGS       *load   = (LOAD_ARGS *) arg;
+  WORKERSIDE_ARGS *args   = load->parent;
+  QUEUE_DATA      *query  = load->query;
+  HMMD_INIT_CMD   *init   = &query->cmd->init;
+  DB_SLOT         *db     = NULL;
+  DB_SLOT          new;
+  DB_SLOT          old;
+  char            *name;
+  char             errbuf[eslERRBUFSIZE];
+  int              prev;
+  int              s;
+  int              n;
+  int              status;
+
+  /* Guarantees that thread resources are deallocated upon return */
+  pthread_detach(pthread_self());
+
+  memset(&new, 0, sizeof(DB_SLOT));
+  memset(&old, 0, sizeof(DB_SLOT));
+  strcpy(new.name, init->name);
 
   client_msg(query->sock, eslOK, "Loading databases...\n");
 
-  if (query->cmd->init.seqdb_off) {
-    char *name = (char *)&query->cmd;
-    name += query->cmd->init.seqdb_off;
+  if (init->db_cnt) {
+    name = init->data + init->seqdb_off;
 
-    if ((status = p7_seqcache_Open(name, &seq_db, errbuf)) != eslOK) {
+    if ((status = p7_seqcache_Open(name, &new.seq_db, errbuf)) != eslOK) {
       client_msg(query->sock, status, "Failed to load sequence database %s\n  %s", name, errbuf);
-      return;
+      goto ERROR;
     }
   }
 
-  if (query->cmd->init.hmmdb_off) {
-    char *name = (char *)&query->cmd;
-    name += query->cmd->init.hmmdb_off;
+  if (init->hmm_cnt) {
+    name = init->data + init->hmmdb_off;
 
-    status = p7_hmmcache_Open(name, &hmm_db, errbuf);
+    status = p7_hmmcache_Open(name, &new.hmm_db, errbuf);
     if      (status == eslENOTFOUND) { client_msg(query->sock, status, "Failed to open profile database %s\n  %s\n",    name, errbuf); goto ERROR; }
     else if (status == eslEFORMAT)   { client_msg(query->sock, status, "Failed to parse profile database %s\n  %s\n",   name, errbuf); goto ERROR; }
     else if (status == eslEINCOMPAT) { client_msg(query->sock, status, "Mismatched alphabets in profile db %s\n  %s\n", name, errbuf); goto ERROR; }
     else if (status != eslOK)        { client_msg(query->sock, status, "Failed to load profile db %s : code %d\n",      name, status); goto ERROR; }
 
-    if ( (status = p7_hmmcache_SetNumericNames(hmm_db)) != eslOK) goto ERROR;
+    if ( (status = p7_hmmcache_SetNumericNames(new.hmm_db)) != eslOK) goto ERROR;
 
     client_msg(query->sock, eslOK, "Loaded profile db %s;  models: %d  memory: %" PRId64 "\n",
-	       name, hmm_db->n, p7_hmmcache_Sizeof(hmm_db));
+	       name, new.hmm_db->n, p7_hmmcache_Sizeof(new.hmm_db));
   }
 
-  /* process any changes to the available workers */
   if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-  /* swap in the new cached databases */
-  tmp = args->seq_db;
-  args->seq_db = seq_db;
-  seq_db = tmp;
+  for (s = 0; s < HMMD_MAX_DBS; s++)
+    if (args->db[s].state == DB_FREE) break;
+  if (s == HMMD_MAX_DBS) {
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    client_msg(query->sock, eslFAIL, "No room for more databases; unload some first\n");
+    goto ERROR;
+  }
 
-  tmp = args->seq_db;
-  args->seq_db = seq_db;
-  seq_db = tmp;
+  db        = args->db + s;
+  *db       = new;
+  db->state = DB_LOADING;
+  db->gen   = ++args->db_gen;
+  new.seq_db = NULL;
+  new.hmm_db = NULL;
+
+  /* the workers pick up the new databases as they come free */
+  if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  while (!db_loaded(args, s)) {
+    if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+  }
 
-  args->db_version++;
+  /* switch the name over */
+  if ((prev = find_db(args, db->name)) >= 0) {
+    args->db[prev].state = DB_RETIRED;
+    if (args->db[prev].nusers == 0) free_db(args, args->db + prev, &old);
+  }
+  db->state = DB_LIVE;
 
-  /* build a list of the currently available workers */
-  update_workers(args);
+  /* cached results are for the old databases */
+  rcache_Clear(&args->rcache);
 
-  /* reset all the idle and active workers */
-  cnt = 0;
+  if ((n = pthread_cond_broadcast(&args->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  /* build a reset command */
-  cmd.hdr.length  = 0;
-  cmd.hdr.command = HMMD_CMD_RESET;
+  close_db(&old);
 
-  /* look for the active workers to reset */
-  worker = args->head;
-  while (worker != NULL) {
-    worker->cmd        = &cmd;
-    worker->completed  = 0;
-    worker->total      = 0;
+  client_msg(query->sock, eslOK, "Load complete\n");
 
-    worker = worker->next;
-    ++cnt;
-  }
+  /* done with the client's socket; cancel_client() may close it now */
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  args->loading   = FALSE;
+  args->load_sock = -1;
+  if ((n = pthread_cond_broadcast(&args->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  /* look for the idle workers to reset */
-  worker = args->idling;
-  while (worker != NULL) {
-    worker->cmd        = &cmd;
-    worker->completed  = 0;
-    worker->total      = 0;
+  free_QueueData(query);
+  free(load);
+  pthread_exit(NULL);
 
-    worker = worker->next;
-    ++cnt;
-  }
+ ERROR:
+  close_db(&new);
 
-  /* check if there are any worker matching the ip address */
-  if (cnt > 0) {
-    args->completed = 0;
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  args->loading   = FALSE;
+  args->load_sock = -1;
+  if ((n = pthread_cond_broadcast(&args->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-    /* notify all the worker threads of the new query */
-    if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
-    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
+  free_QueueData(query);
+  free(load);
+  pthread_exit(NULL);
+}
 
-    /* Wait for all the workers to complete */
-    if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+/* process_unload()
+ * Unload the databases named in the command.  Searches already running
+ * against them finish first.
+ */
+static void
+process_unload(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+{
+  DB_SLOT  old;
+  int      s;
+  int      n;
 
-    while (args->completed < cnt) {
-      if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
-    }
-  }
+  memset(&old, 0, sizeof(DB_SLOT));
 
-  /* build a list of the currently available workers */
-  update_workers(args);
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+  if ((s = find_db(args, query->cmd->init.name)) >= 0) {
+    args->db[s].state = DB_RETIRED;
+    if (args->db[s].nusers == 0) free_db(args, args->db + s, &old);
+  }
 
-  /* free up the old copies */
-  if (seq_db != NULL) p7_seqcache_Close(seq_db);
-  if (hmm_db != NULL) p7_hmmcache_Close(hmm_db);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  client_msg(query->sock, eslOK, "Load complete\n");
-  return;
+  close_db(&old);
 
- ERROR:
-  if (seq_db) p7_seqcache_Close(seq_db);
-  if (hmm_db) p7_hmmcache_Close(hmm_db);
-  return;
+  if (s < 0) client_msg(query->sock, eslENOTFOUND, "Database %s is not loaded\n", query->cmd->init.name);
+  else       client_msg(query->sock, eslOK,        "Unloaded %s\n",              query->cmd->init.name);
 }
 
 static void
@@ -640,6 +2011,12 @@ process_shutdown(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   /* process any changes to the available workers */
   if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
+  /* let the searches in flight, and any load, finish first */
+  wait_for_searches(args);
+  while (args->loading) {
+    if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+  }
+
   /* build a list of the currently available workers */
   update_workers(args);
 
@@ -705,6 +2082,7 @@ master_process(ESL_GETOPTS *go)
   CLIENTSIDE_ARGS     client_comm;
   WORKERSIDE_ARGS     worker_comm;
   int                 n;
+  int                 s;
   int                 shutdown;
   char                errbuf[eslERRBUFSIZE]; 
   int                 status     = eslOK;
@@ -747,10 +2125,6 @@ master_process(ESL_GETOPTS *go)
   esl_stack_UseMutex(cmdstack);
   esl_stack_UseCond(cmdstack);
 
-  /* start the communications with the web clients */
-  client_comm.cmdstack = cmdstack;
-  setup_clientside_comm(go, &client_comm);
-
   /* initialize the worker structure */
   if ((n = pthread_mutex_init(&worker_comm.work_mutex, NULL)) != 0)   LOG_FATAL_MSG("mutex init", n);
   if ((n = pthread_cond_init(&worker_comm.start_cond, NULL)) != 0)    LOG_FATAL_MSG("cond init", n);
@@ -761,9 +2135,24 @@ master_process(ESL_GETOPTS *go)
   worker_comm.tail       = NULL;
   worker_comm.pending    = NULL;
   worker_comm.idling     = NULL;
-  worker_comm.seq_db     = seq_db;
-  worker_comm.hmm_db     = hmm_db;
-  worker_comm.db_version = 1;
+  worker_comm.jobs       = NULL;
+  worker_comm.nstarted   = 0;
+  worker_comm.loading    = FALSE;
+  worker_comm.nsyncing   = 0;
+  worker_comm.load_sock  = -1;
+
+  /* the databases on the command line go in the first slot */
+  memset(worker_comm.db, 0, sizeof(worker_comm.db));
+  strcpy(worker_comm.db[0].name, HMMD_DEFAULT_DB);
+  worker_comm.db[0].state  = DB_LIVE;
+  worker_comm.db[0].gen    = worker_comm.db_gen = 1;
+  worker_comm.db[0].seq_db = seq_db;
+  worker_comm.db[0].hmm_db = hmm_db;
+
+  rcache_Init(&worker_comm.rcache, (uint64_t) esl_opt_GetInteger(go, "--rcache_mb") << 20);
+
+  memset(&worker_comm.metrics, 0, sizeof(METRICS));
+  worker_comm.metrics.started = time(NULL);
 
   worker_comm.ready      = 0;
   worker_comm.failed     = 0;
@@ -772,6 +2161,11 @@ master_process(ESL_GETOPTS *go)
 
   setup_workerside_comm(go, &worker_comm);
 
+  /* start the communications with the web clients */
+  client_comm.cmdstack = cmdstack;
+  client_comm.workers  = &worker_comm;
+  setup_clientside_comm(go, &client_comm);
+
   /* read query hmm/sequence 
    * the PPop() will wait until a client pushes a command to the queue
    */
@@ -780,18 +2174,15 @@ master_process(ESL_GETOPTS *go)
     printf("Processing command %d from %s\n", query->cmd_type, query->ip_addr);
     fflush(stdout);
 
-    worker_comm.range_list = NULL;
-    if (esl_opt_IsUsed(query->opts, "--seqdb_ranges")) {
-      ESL_ALLOC(worker_comm.range_list, sizeof(RANGE_LIST));
-      hmmpgmd_GetRanges(worker_comm.range_list, esl_opt_GetString(query->opts, "--seqdb_ranges"));
-    }
-
-
+    /* searches and loads are handed off and run concurrently, and own the query from here on */
     switch(query->cmd_type) {
-    case HMMD_CMD_SEARCH:      process_search(&worker_comm, query); break;
-    case HMMD_CMD_SCAN:        process_search(&worker_comm, query); break;
-    case HMMD_CMD_INIT:        process_load  (&worker_comm, query); break;
+    case HMMD_CMD_SEARCH:      process_search(&worker_comm, query); query = NULL; break;
+    case HMMD_CMD_SCAN:        process_search(&worker_comm, query); query = NULL; break;
+    case HMMD_CMD_INIT:        process_load  (&worker_comm, query); query = NULL; break;
+    case HMMD_CMD_DROP:        process_unload(&worker_comm, query); break;
+    case HMMD_CMD_CANCEL:      process_cancel(&worker_comm, query); break;
     case HMMD_CMD_RESET:       process_reset (&worker_comm, query); break;
+    case HMMD_CMD_STATS:       process_stats (&worker_comm, query); break;
     case HMMD_CMD_SHUTDOWN:    
       process_shutdown(&worker_comm, query);
       p7_syslog(LOG_ERR,"[%s:%d] - shutting down...\n", __FILE__, __LINE__);
@@ -802,33 +2193,21 @@ master_process(ESL_GETOPTS *go)
       break;
     }
 
-    free_QueueData(query);
+    if (query != NULL) free_QueueData(query);
   }
 
   esl_stack_ReleaseCond(cmdstack);
 
-  if (hmm_db) p7_hmmcache_Close(hmm_db);
-  if (seq_db) p7_seqcache_Close(seq_db);
+  for (s = 0; s < HMMD_MAX_DBS; s++) close_db(&worker_comm.db[s]);
 
+  rcache_Clear(&worker_comm.rcache);
   esl_stack_Destroy(cmdstack);
 
   pthread_mutex_destroy(&worker_comm.work_mutex);
   pthread_cond_destroy(&worker_comm.start_cond);
   pthread_cond_destroy(&worker_comm.complete_cond);
 
-
-  if (worker_comm.range_list) {
-    if (worker_comm.range_list->starts)  free(worker_comm.range_list->starts);
-    if (worker_comm.range_list->ends)    free(worker_comm.range_list->ends);
-    free (worker_comm.range_list);
-  }
-
   return;
-
-
-ERROR:
-  p7_Fail("Memory allocation error. Code: %d\n",    status);
-
 }
 
 static int
@@ -849,6 +2228,7 @@ static void
 init_results(SEARCH_RESULTS *results)
 {
   results->status.status     = eslOK;
+  results->status.version    = 0;
   results->status.msg_size   = 0;
 
   results->stats.nhits       = 0;
@@ -870,225 +2250,326 @@ init_results(SEARCH_RESULTS *results)
   results->errors            = 0;
 }
 
+/* add_results()
+ * Called with the work_mutex held, when <worker> has finished a range of
+ * <job>.  Move the worker's hits and stats into the job's results, query
+ * by query for a batch.
+ */
 static void
-gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results)
+add_results(SEARCH_JOB *job, WORKER_DATA *worker)
 {
-  int cnt;
-  int n;
-
-  WORKER_DATA        *worker;
+  int q;
 
-  /* allocate spaces to hold all the hits */
-  cnt = results->nhits + MAX_WORKERS;
-  if ((results->hits = realloc(results->hits, sizeof(HIT_LIST) * cnt)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  for (q = 0; q < job->nq; ++q)
+    if (add_query_results(job->results + q, worker->res + q, worker) != eslOK) job->errors++;
+}
 
-  /* lock the workers until we have merged the results */
-  if ((n = pthread_mutex_lock (&comm->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+/* add_query_results()
+ * Move <worker>'s hits and stats <r> for one query of its range into
+ * the query's <results>.  Returns <eslFAIL> if the query failed on the
+ * worker.
+ */
+static int
+add_query_results(SEARCH_RESULTS *results, RANGE_RESULTS *r, WORKER_DATA *worker)
+{
+  int             cnt     = results->nhits;
 
-  /* count the number of hits */
-  cnt = results->nhits;
-  worker = comm->head;
-  while (worker != NULL) {
-    if (worker->completed) {
-      results->stats.nhits        += worker->stats.nhits;
-      results->stats.nreported    += worker->stats.nreported;
-      results->stats.nincluded    += worker->stats.nincluded;
+  if (r->status.status != eslOK) {
+    p7_syslog(LOG_ERR,"[%s:%d] - search failed on %s: %s\n", __FILE__, __LINE__, worker->ip_addr, (r->err_buf ? r->err_buf : ""));
+    if (r->err_buf != NULL) free(r->err_buf);
+    r->err_buf = NULL;
+    return eslFAIL;
+  }
 
-      results->stats.n_past_msv   += worker->stats.n_past_msv;
-      results->stats.n_past_bias  += worker->stats.n_past_bias;
-      results->stats.n_past_vit   += worker->stats.n_past_vit;
-      results->stats.n_past_fwd   += worker->stats.n_past_fwd;
+  if ((results->hits = realloc(results->hits, sizeof(HIT_LIST) * (cnt + 1))) == NULL) LOG_FATAL_MSG("realloc", errno);
 
-      results->stats.Z_setby       = worker->stats.Z_setby;
-      results->stats.domZ_setby    = worker->stats.domZ_setby;
-      results->stats.domZ          = worker->stats.domZ;
-      results->stats.Z             = worker->stats.Z;
+  results->stats.nhits        += r->stats.nhits;
+  results->stats.nreported    += r->stats.nreported;
+  results->stats.nincluded    += r->stats.nincluded;
 
-      results->status.msg_size    += worker->status.msg_size - sizeof(HMMD_SEARCH_STATS);
+  results->stats.n_past_msv   += r->stats.n_past_msv;
+  results->stats.n_past_bias  += r->stats.n_past_bias;
+  results->stats.n_past_vit   += r->stats.n_past_vit;
+  results->stats.n_past_fwd   += r->stats.n_past_fwd;
 
-      results->hits[cnt].count     = worker->stats.nhits;
-      results->hits[cnt].data_size = worker->status.msg_size - sizeof(HMMD_SEARCH_STATS) - sizeof(P7_HIT) * worker->stats.nhits;
-      results->hits[cnt].hit       = worker->hit;
-      results->hits[cnt].data      = worker->hit_data;
+  results->stats.Z_setby       = r->stats.Z_setby;
+  results->stats.domZ_setby    = r->stats.domZ_setby;
+  results->stats.domZ          = r->stats.domZ;
+  results->stats.Z             = r->stats.Z;
 
-      worker->hit         = NULL;
-      worker->hit_data    = NULL;
+  results->status.msg_size    += r->status.msg_size - sizeof(HMMD_SEARCH_STATS);
 
-      worker->completed   = 0;
-      ++cnt;
-    } else {
-      results->errors++;
-      results->db_inx            = worker->srch_inx;
-      results->db_cnt            = worker->srch_cnt;
-    }
+  results->hits[cnt].count     = r->stats.nhits;
+  results->hits[cnt].data_size = r->status.msg_size - sizeof(HMMD_SEARCH_STATS) - sizeof(P7_HIT) * r->stats.nhits;
+  results->hits[cnt].hit       = r->hit;
+  results->hits[cnt].data      = r->hit_data;
 
-    worker = worker->next;
-  }
+  r->hit         = NULL;
+  r->hit_data    = NULL;
 
-  if ((n = pthread_mutex_unlock (&comm->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+  results->nhits = cnt + 1;
+  return eslOK;
+}
 
+/* finish_results()
+ * Called with the work_mutex held, once all ranges of a search are done.
+ */
+static void
+finish_results(QUEUE_DATA *query, DB_SLOT *db, SEARCH_RESULTS *results)
+{
   if (query->cmd_type == HMMD_CMD_SEARCH) {
     results->stats.nmodels = 1;
-    results->stats.nseqs   = comm->seq_db->db[query->dbx].K;
+    results->stats.nseqs   = db->seq_db->db[query->dbx].K;
   } else {
     results->stats.nseqs   = 1;
-    results->stats.nmodels = comm->hmm_db->n;
+    results->stats.nmodels = db->hmm_db->n;
   }
     
   if (results->stats.Z_setby == p7_ZSETBY_NTARGETS) {
     results->stats.Z = (query->cmd_type == HMMD_CMD_SEARCH) ? results->stats.nseqs : results->stats.nmodels;
   }
+}
+
+/* sort_hits()
+ * Point each of the hits a worker just sent for a query at its domains
+ * in <r->hit_data>, and sort them, outside the work_mutex. Each
+ * range's hits are then a sorted batch: they can be streamed to the
+ * client as they are, and merged rather than sorted again at the end.
+ */
+static void
+sort_hits(RANGE_RESULTS *r)
+{
+  P7_HIT   *h1;
+  uint64_t  i;
 
-  results->nhits = cnt;
+  for (i = 0; i < r->stats.nhits; ++i) {
+    h1 = r->hit + i;
+    h1->dcl = (P7_DOMAIN *)((char *) r->hit_data + (h1->offset - sizeof(HMMD_SEARCH_STATS) - sizeof(P7_HIT) * r->stats.nhits));
+  }
+  qsort(r->hit, r->stats.nhits, sizeof(P7_HIT), hit_sorter);
 }
 
+/* merge_hits()
+ * Merge the <nlists> sorted batches of hits in <list> into <hits>,
+ * by keeping the next hit of each batch in a heap.
+ */
 static void
-forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
+merge_hits(HIT_LIST *list, int nlists, P7_HIT *hits)
 {
-  uint32_t           adj;
-  esl_pos_t          offset;
-  P7_TOPHITS         th;
-  P7_PIPELINE        *pli   = NULL;
-  P7_DOMAIN         **dcl   = NULL;
-  P7_HIT             *hits  = NULL;
-  HIT_LIST           *list  = NULL;
-  int fd;
-  int i, j;
-  int n;
-  enum p7_pipemodes_e mode;
+  int      *heap = NULL;      /* batches, by their next hit; heap[0] is first */
+  uint32_t *next = NULL;      /* index of the next hit of each batch          */
+  int       nheap = 0;
+  int       i, j, c, t;
 
-  fd    = query->sock;
-  list  = results->hits;
+  if ((heap = malloc(sizeof(int)      * ESL_MAX(1, nlists))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if ((next = calloc(ESL_MAX(1, nlists), sizeof(uint32_t)))  == NULL) LOG_FATAL_MSG("calloc", errno);
+
+#define HEAD(k)     (&list[heap[k]].hit[next[heap[k]]])
+#define BEFORE(a,b) (hit_sorter(HEAD(a), HEAD(b)) < 0)
+
+  for (i = 0; i < nlists; ++i) {
+    if (list[i].count == 0) continue;
+    heap[j = nheap++] = i;
+    while (j > 0 && BEFORE(j, (j-1)/2)) { t = heap[j]; heap[j] = heap[(j-1)/2]; heap[(j-1)/2] = t; j = (j-1)/2; }
+  }
+
+  while (nheap > 0) {
+    memcpy(hits++, HEAD(0), sizeof(P7_HIT));
+    if (++next[heap[0]] == list[heap[0]].count) heap[0] = heap[--nheap];
+
+    for (j = 0; (c = 2*j+1) < nheap; j = c) {
+      if (c+1 < nheap && BEFORE(c+1, c)) ++c;
+      if (!BEFORE(c, j)) break;
+      t = heap[j]; heap[j] = heap[c]; heap[c] = t;
+    }
+  }
+
+#undef HEAD
+#undef BEFORE
+
+  free(heap);
+  free(next);
+}
+
+/* threshold_hits()
+ * Apply the search's reporting and inclusion thresholds to the <nhits>
+ * (sorted) <hits>, setting their flags and the number reported and
+ * included in <stats>.
+ */
+static void
+threshold_hits(QUEUE_DATA *query, HMMD_SEARCH_STATS *stats, P7_HIT *hits, uint64_t nhits)
+{
+  P7_TOPHITS           th;
+  P7_PIPELINE         *pli;
+  uint64_t             i;
+  enum p7_pipemodes_e  mode;
 
   if (query->cmd_type == HMMD_CMD_SEARCH) mode = p7_SEARCH_SEQS;
   else                                    mode = p7_SCAN_MODELS;
-    
-  /* sort the hits and apply score and E-value thresholds */
-  if (results->nhits > 0) {
-    P7_HIT *h1;
 
-    /* at this point h1->offset's are the offset of the domain structure
-     * in the block of memory pointed to by "list[n]->data".  now we will change
-     * that offset to be the true pointers back to the dcl data.
-     */
-    for (i = 0; i < results->nhits; ++i) {
-      h1 = list[i].hit;
-      for (j = 0; j < list[i].count; ++j) {
-        esl_pos_t off = h1->offset - sizeof(HMMD_SEARCH_STATS) - (sizeof(P7_HIT) * list[i].count);
-        h1->dcl = (P7_DOMAIN *)(list[i].data + off);
-        ++h1;
-      }
-    }
+  th.unsrt     = NULL;
+  th.N         = nhits;
+  th.nreported = 0;
+  th.nincluded = 0;
+  th.is_sorted_by_sortkey = 0;
+  th.is_sorted_by_seqidx  = 0;
+
+  pli = p7_pipeline_Create(query->opts, 100, 100, FALSE, mode);
+  pli->nmodels     = stats->nmodels;
+  pli->nseqs       = stats->nseqs;
+  pli->n_past_msv  = stats->n_past_msv;
+  pli->n_past_bias = stats->n_past_bias;
+  pli->n_past_vit  = stats->n_past_vit;
+  pli->n_past_fwd  = stats->n_past_fwd;
+
+  pli->Z           = stats->Z;
+  pli->domZ        = stats->domZ;
+  pli->Z_setby     = stats->Z_setby;
+  pli->domZ_setby  = stats->domZ_setby;
+
+  if ((th.hit = malloc(sizeof(P7_HIT *) * ESL_MAX(1, nhits))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  for (i = 0; i < nhits; ++i) th.hit[i] = hits + i;
+  p7_tophits_Threshold(&th, pli);
+
+  /* after the top hits thresholds are checked, the number of sequences
+   * and domains to be reported can change. */
+  stats->nreported = th.nreported;
+  stats->nincluded = th.nincluded;
+  stats->domZ      = pli->domZ;
+  stats->Z         = pli->Z;
+
+  free(th.hit);
+  p7_pipeline_Destroy(pli);
+}
 
-    /* combine all the hits into a single list */
-    offset = 0;
-    if ((hits = malloc(sizeof(P7_HIT) * results->stats.nhits)) == NULL) LOG_FATAL_MSG("malloc", errno);
-    memset(hits, 0, sizeof(P7_HIT) * results->stats.nhits); /* avoiding valgrind bitching; remove if structs serialized properly */
-    for (i = 0; i < results->nhits; ++i) {
-      memcpy(hits + offset, list[i].hit, sizeof(P7_HIT) * list[i].count);
-      offset += list[i].count;
-    }
+/* send_hits()
+ * Send the client a result message: a HMMD_SEARCH_STATUS with status
+ * <code>, the <stats>, the <stats->nhits> <hits>, and each hit's
+ * domains and alignments. The hits' domain pointers are replaced by the
+ * offset of their domains in the message. If <ret_msg> is non-NULL,
+ * the message and its size are returned in <*ret_msg> and <*ret_size>
+ * (whether or not it could be sent), for the caller to free. Returns
+ * <eslOK>, or <eslEWRITE> if the client has gone away.
+ */
+static int
+send_hits(QUEUE_DATA *query, uint32_t code, HMMD_SEARCH_STATS *stats, P7_HIT *hits, char **ret_msg, uint64_t *ret_size)
+{
+  HMMD_SEARCH_STATUS  status;
+  P7_DOMAIN         **dcl  = NULL;
+  uint64_t           *size = NULL;
+  uint64_t            total;
+  uint64_t            i;
+  char               *msg  = NULL;
+  char               *ptr;
+  int                 ret  = eslOK;
+  int                 j;
+  int                 n;
 
-    qsort(hits, results->stats.nhits, sizeof(P7_HIT), hit_sorter);
+  memset(&status, 0, sizeof(HMMD_SEARCH_STATUS));
+  status.status   = code;
+  status.version  = 0;
+  status.msg_size = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * stats->nhits;
 
-    th.unsrt     = NULL;
-    th.N         = results->stats.nhits;
-    th.nreported = 0;
-    th.nincluded = 0;
-    th.is_sorted_by_sortkey = 0;
-    th.is_sorted_by_seqidx  = 0;
-      
-    pli = p7_pipeline_Create(query->opts, 100, 100, FALSE, mode);
-    pli->nmodels     = results->stats.nmodels;
-    pli->nseqs       = results->stats.nseqs;
-    pli->n_past_msv  = results->stats.n_past_msv;
-    pli->n_past_bias = results->stats.n_past_bias;
-    pli->n_past_vit  = results->stats.n_past_vit;
-    pli->n_past_fwd  = results->stats.n_past_fwd;
-
-    pli->Z           = results->stats.Z;
-    pli->domZ        = results->stats.domZ;
-    pli->Z_setby     = results->stats.Z_setby;
-    pli->domZ_setby  = results->stats.domZ_setby;
-
-    if ((dcl = malloc(sizeof(void *) * results->stats.nhits)) == NULL) LOG_FATAL_MSG("malloc", errno);
-    th.hit = (P7_HIT **)dcl;
-
-    for (i = 0; i < th.N; ++i) th.hit[i] = hits + i;
-    p7_tophits_Threshold(&th, pli);
-
-    /* after the top hits thresholds are checked, the number of sequences
-     * and domains to be reported can change. */
-    results->stats.nreported = th.nreported;
-    results->stats.nincluded = th.nincluded;
-    results->stats.domZ      = pli->domZ;
-    results->stats.Z         = pli->Z;
-
-    /* at this point the domain pointers need to be converted back to offsets
-     * within the binary data stream.
-     */
-    adj = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * results->stats.nhits;
-    h1 = hits;
-    for (i = 0; i < results->stats.nhits; ++i) {
-      char *ptr;
-
-      dcl[i] = h1->dcl;
-      h1->dcl = (P7_DOMAIN *)(((char *)NULL) + adj);
-
-      /* figure out the size of the domain and alignment info */
-      adj += sizeof(P7_DOMAIN) * h1->ndom;
-      ptr = (char *)(dcl[i] + h1->ndom);
-      for (j = 0; j < h1->ndom; ++j) {
-        n = sizeof(P7_ALIDISPLAY) + ((P7_ALIDISPLAY *)ptr)->memsize;
-        adj += n;
-        ptr += n;
-      }
-      ++h1;
+  if ((dcl  = malloc(sizeof(P7_DOMAIN *) * ESL_MAX(1, stats->nhits))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if ((size = malloc(sizeof(uint64_t)    * ESL_MAX(1, stats->nhits))) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+  /* the domain pointers need to be converted to offsets within the
+   * binary data stream.
+   */
+  for (i = 0; i < stats->nhits; ++i) {
+    dcl[i]  = hits[i].dcl;
+    size[i] = sizeof(P7_DOMAIN) * hits[i].ndom;
+    ptr     = (char *)(dcl[i] + hits[i].ndom);
+    for (j = 0; j < hits[i].ndom; ++j) {
+      n        = sizeof(P7_ALIDISPLAY) + ((P7_ALIDISPLAY *)ptr)->memsize;
+      size[i] += n;
+      ptr     += n;
     }
+    hits[i].dcl      = (P7_DOMAIN *)(((char *)NULL) + status.msg_size);
+    status.msg_size += size[i];
   }
 
-  /* add the size of the status structure to the message size */
-  results->status.msg_size += sizeof(HMMD_SEARCH_STATS);
-
-  /* send back a successful status message */
-  n = sizeof(HMMD_SEARCH_STATUS);
-  if (writen(fd, &results->status, n) != n) {
-    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-    goto CLEAR;
+  /* lay the whole message out in one buffer and send it in one write */
+  total = sizeof(HMMD_SEARCH_STATUS) + status.msg_size;
+  if ((msg = malloc(total)) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+  ptr = msg;
+  memcpy(ptr, &status, sizeof(HMMD_SEARCH_STATUS));    ptr += sizeof(HMMD_SEARCH_STATUS);
+  memcpy(ptr, stats,   sizeof(HMMD_SEARCH_STATS));     ptr += sizeof(HMMD_SEARCH_STATS);
+  memcpy(ptr, hits,    sizeof(P7_HIT) * stats->nhits); ptr += sizeof(P7_HIT) * stats->nhits;
+  for (i = 0; i < stats->nhits; ++i) {
+    memcpy(ptr, dcl[i], size[i]);
+    ptr += size[i];
   }
 
-  n = sizeof(HMMD_SEARCH_STATS);
-  if (writen(fd, &results->stats, n) != n) {
+  if (writen(query->sock, msg, total) != total) {
     p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-    goto CLEAR;
+    ret = eslEWRITE;
   }
 
-  if (results->stats.nhits > 0) {
-    /* send all the hit data */
-    n = sizeof(P7_HIT) * results->stats.nhits;
-    if (writen(fd, hits, n) != n) {
-      p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-      goto CLEAR;
-    }
+  if (ret_size != NULL) *ret_size = total;
+  if (ret_msg  != NULL) *ret_msg  = msg;
+  else                  free(msg);
 
-    for (i = 0; i < results->stats.nhits; ++i) {
-      if (i + 1 < results->stats.nhits) {
-        n = (char *)hits[i+1].dcl - (char *)hits[i].dcl;
-      } else {
-        n = ((char *)NULL) + results->status.msg_size - (char *)hits[i].dcl;
-      }
-      if (writen(fd, dcl[i], n) != n) {
-        p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-        goto CLEAR;
-      }
-    }
+  free(dcl);
+  free(size);
+  return ret;
+}
+
+/* forward_batch()
+ * For --stream: send the client one range's <batch> of hits, already
+ * sorted, as a HMMD_STATUS_PARTIAL message. -Z and --domZ are set,
+ * so the E-values and the reporting and inclusion flags of the hits
+ * are already final; <stats> are the search's totals so far.
+ * Returns the number of bytes sent.
+ */
+static uint64_t
+forward_batch(QUEUE_DATA *query, HIT_LIST *batch, HMMD_SEARCH_STATS *stats)
+{
+  P7_HIT   *hits = NULL;
+  uint64_t  size = 0;
+
+  if (batch->count == 0) return 0;
+
+  if ((hits = malloc(sizeof(P7_HIT) * batch->count)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memcpy(hits, batch->hit, sizeof(P7_HIT) * batch->count);
+
+  stats->nhits = batch->count;
+  threshold_hits(query, stats, hits, batch->count);
+  send_hits(query, HMMD_STATUS_PARTIAL, stats, hits, NULL, &size);
+
+  free(hits);
+  return size;
+}
+
+/* forward_results()
+ * Merge and threshold the hits of a finished search and send them to
+ * the client. The size of the message sent is returned in <*ret_size>
+ * and, unless <ret_msg> is NULL, the message itself in <*ret_msg>, for
+ * the result cache; the caller frees it.
+ */
+static void
+forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results, char **ret_msg, uint64_t *ret_size)
+{
+  P7_HIT             *hits  = NULL;
+  HIT_LIST           *list  = NULL;
+  int i;
+
+  list  = results->hits;
+
+  /* merge the hits and apply score and E-value thresholds */
+  if (results->stats.nhits > 0) {
+    if ((hits = malloc(sizeof(P7_HIT) * results->stats.nhits)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    merge_hits(list, results->nhits, hits);
+    threshold_hits(query, &results->stats, hits, results->stats.nhits);
   }
 
-  printf("Results for %s (%d) sent %" PRId64 " bytes\n", query->ip_addr, fd, results->status.msg_size);
-  printf("Hits:%"PRId64 "  reported:%" PRId64 "  included:%"PRId64 "\n", results->stats.nhits, results->stats.nreported, results->stats.nincluded);
-  fflush(stdout);
+  if (send_hits(query, eslOK, &results->stats, hits, ret_msg, ret_size) == eslOK) {
+    printf("Results for %s (%d) sent\n", query->ip_addr, query->sock);
+    printf("Hits:%"PRId64 "  reported:%" PRId64 "  included:%"PRId64 "\n", results->stats.nhits, results->stats.nreported, results->stats.nincluded);
+    fflush(stdout);
+  }
 
- CLEAR:
   /* free all the data */
   for (i = 0; i < results->nhits; ++i) {
     if (list[i].hit  != NULL) free(list[i].hit);
@@ -1097,10 +2578,8 @@ forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
     list[i].data = NULL;
   }
 
-  if (pli)  p7_pipeline_Destroy(pli);
   if (list) free(list);
   if (hits) free(hits);
-  if (dcl)  free(dcl);
 
   init_results(results);
 }
@@ -1108,10 +2587,9 @@ forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
 static void
 destroy_worker(WORKER_DATA *worker)
 {
-  if (worker == NULL) {
-    if (worker->hit      != NULL) free(worker->hit);
-    if (worker->hit_data != NULL) free(worker->hit_data);
-    if (worker->err_buf  != NULL) free(worker->err_buf);
+  if (worker != NULL) {
+    clear_range(worker);
+    if (worker->res != NULL) free(worker->res);
 
     memset(worker, 0, sizeof(WORKER_DATA));
     free(worker);
@@ -1119,33 +2597,9 @@ destroy_worker(WORKER_DATA *worker)
 }
 
 static void
-clear_results(WORKERSIDE_ARGS *args, SEARCH_RESULTS *results)
+clear_results(SEARCH_RESULTS *results)
 {
   int i;
-  int n;
-  WORKER_DATA *worker;
-
-  /* lock the workers until we have freed the results */
-  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
-
-  assert(validate_workers(args));
-
-  /* free all the results */
-  worker = args->head;
-  while (worker != NULL) {
-    if (worker->hit      != NULL) free(worker->hit);
-    if (worker->hit_data != NULL) free(worker->hit_data);
-    if (worker->err_buf  != NULL) free(worker->err_buf);
-
-    worker->hit      = NULL;
-    worker->hit_data = NULL;
-    worker->err_buf  = NULL;
-      
-    worker->completed = 0;
-    worker = worker->next;
-  }
-
-  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
 
   for (i = 0; i < results->nhits; ++i) {
     if (results->hits[i].hit  != NULL) free(results->hits[i].hit);
@@ -1193,6 +2647,7 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
       char **db;
       char  *hmmdb = NULL;
       char  *seqdb = NULL;
+      char  *name  = NULL;
 
       /* skip leading white spaces */
       while (*ptr == ' ' || *ptr == '\t') ++ptr;
@@ -1209,6 +2664,7 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 	  db = NULL;
 	  if      (strcmp (s, "--seqdb") == 0) db = &seqdb;
 	  else if (strcmp (s, "--hmmdb") == 0) db = &hmmdb;
+	  else if (strcmp (s, "--name")  == 0) db = &name;
     
 	  if       (db == NULL) { client_msg(fd, eslEINVAL, "Unknown option %s for load command\n", s);         return; }
 	  else if (*db != NULL) { client_msg(fd, eslEINVAL, "Option %s for load command specified twice\n", s); return; }
@@ -1222,6 +2678,10 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 	  while (*ptr == ' ' || *ptr == '\t') ++ptr;
 	}
 
+      if (seqdb == NULL && hmmdb == NULL) { client_msg(fd, eslEINVAL, "Load command missing --seqdb or --hmmdb option\n"); return; }
+      if (name == NULL) name = HMMD_DEFAULT_DB;
+      if (strlen(name) >= MAX_INIT_DESC)  { client_msg(fd, eslEINVAL, "Database name %s is too long\n", name);            return; }
+
       n = sizeof(HMMD_COMMAND);
       if (seqdb) n += strlen(seqdb) + 1;
       if (hmmdb) n += strlen(hmmdb) + 1;
@@ -1231,21 +2691,55 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
       cmd->hdr.length  = n - sizeof(HMMD_HEADER);
       cmd->hdr.command = HMMD_CMD_INIT;
 
+      strcpy(cmd->init.name, name);
       s = cmd->init.data;
 
       if (seqdb != NULL) {
+	cmd->init.db_cnt    = 1;
 	cmd->init.seqdb_off = s - cmd->init.data;
 	strcpy(s, seqdb);
 	s += strlen(seqdb) + 1;
       }
 
       if (hmmdb != NULL) {
+	cmd->init.hmm_cnt   = 1;
 	cmd->init.hmmdb_off = s - cmd->init.data;
 	strcpy(s, hmmdb);
 	s += strlen(hmmdb) + 1;
       }
       
     } 
+  else if (strcmp(s, "unload") == 0) 
+    {
+      /* skip leading white spaces */
+      while (*ptr == ' ' || *ptr == '\t') ++ptr;
+      if (!*ptr) { client_msg(fd, eslEINVAL, "Unload command missing database name\n"); return; }
+
+      s = strsep(&ptr, " \t");
+      if (strlen(s) >= MAX_INIT_DESC) { client_msg(fd, eslEINVAL, "Database name %s is too long\n", s); return; }
+
+      n = sizeof(HMMD_COMMAND);
+      if ((cmd = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+      memset(cmd, 0, n);
+      cmd->hdr.length  = n - sizeof(HMMD_HEADER);
+      cmd->hdr.command = HMMD_CMD_DROP;
+      strcpy(cmd->init.name, s);
+
+    } 
+  else if (strcmp(s, "cancel") == 0) 
+    {
+      if ((cmd = malloc(sizeof(HMMD_HEADER))) == NULL) LOG_FATAL_MSG("malloc", errno);
+      memset(cmd, 0, sizeof(HMMD_HEADER));
+      cmd->hdr.length  = 0;
+      cmd->hdr.command = HMMD_CMD_CANCEL;
+    } 
+  else if (strcmp(s, "stats") == 0) 
+    {
+      if ((cmd = malloc(sizeof(HMMD_HEADER))) == NULL) LOG_FATAL_MSG("malloc", errno);
+      memset(cmd, 0, sizeof(HMMD_HEADER));
+      cmd->hdr.length  = 0;
+      cmd->hdr.command = HMMD_CMD_STATS;
+    } 
   else if (strcmp(s, "reset") == 0) 
     {
       char *ip_addr = NULL;
@@ -1324,9 +2818,17 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   ESL_ALPHABET      *abc     = NULL;     /* digital alphabet               */
   ESL_GETOPTS       *opts    = NULL;     /* search specific options        */
   HMMD_COMMAND      *cmd     = NULL;     /* search cmd to send to workers  */
+  ESL_SQ           **seqs    = NULL;     /* query sequences of a batch     */
+  char              *rec     = NULL;     /* one sequence of a batch        */
+  char              *beg;
+  char              *end;
+  int                nq      = 1;        /* number of queries              */
+  int                q;
+  uint32_t           len;
 
   ESL_STACK         *cmdstack = data->cmdstack;
   QUEUE_DATA        *parms;
+  QUEUE_DATA        *node;
   jmp_buf            jmp_env;
   time_t             date;
   char               timestamp[32];
@@ -1439,12 +2941,37 @@ clientside_loop(CLIENTSIDE_ARGS *data)
     hmm = NULL;
 
     if (*ptr == '>') {
-      /* try to parse the input buffer as a FASTA sequence */
-      seq = esl_sq_CreateDigital(abc);
-      /* try to parse the input buffer as a FASTA sequence */
-      status = esl_sqio_Parse(ptr, strlen(ptr), seq, eslSQFILE_DAEMON);
-      if (status != eslOK) client_msg_longjmp(data->sock_fd, status, &jmp_env, "Error parsing FASTA sequence");
-      if (seq->n < 1) client_msg_longjmp(data->sock_fd, eslEFORMAT, &jmp_env, "Error zero length FASTA sequence");
+      /* several FASTA sequences make a batch of queries, searched together */
+      for (end = strstr(ptr, "\n>"), nq = 1; end != NULL; end = strstr(end + 1, "\n>")) ++nq;
+      if (nq > HMMD_MAX_BATCH) {
+        client_msg_longjmp(data->sock_fd, eslEINVAL, &jmp_env, "Too many queries in a batch: %d (max %d)", nq, HMMD_MAX_BATCH);
+      }
+      if (nq > 1 && esl_opt_GetBoolean(opts, "--stream")) {
+        client_msg_longjmp(data->sock_fd, eslEINVAL, &jmp_env, "--stream cannot be used with a batch of queries");
+      }
+
+      if ((seqs = malloc(sizeof(ESL_SQ *) * nq)) == NULL) LOG_FATAL_MSG("malloc", errno);
+      for (q = 0; q < nq; ++q) seqs[q] = NULL;
+      if (nq > 1 && (rec = malloc(strlen(ptr) + 4)) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+      for (q = 0, beg = ptr; q < nq; ++q, beg = end + 1) {
+        seqs[q] = esl_sq_CreateDigital(abc);
+
+        /* try to parse the input buffer as a FASTA sequence; each
+         * sequence of a batch is parsed on its own, as if sent alone
+         */
+        if (q == nq - 1) {
+          status = esl_sqio_Parse(beg, strlen(beg), seqs[q], eslSQFILE_DAEMON);
+        } else {
+          end = strstr(beg, "\n>");
+          memcpy(rec, beg, end + 1 - beg);
+          strcpy(rec + (end + 1 - beg), "//\n");
+          status = esl_sqio_Parse(rec, strlen(rec), seqs[q], eslSQFILE_DAEMON);
+        }
+        if (status != eslOK)    client_msg_longjmp(data->sock_fd, status,     &jmp_env, "Error parsing FASTA sequence %d", q + 1);
+        if (seqs[q]->n < 1)     client_msg_longjmp(data->sock_fd, eslEFORMAT, &jmp_env, "Error zero length FASTA sequence %d", q + 1);
+      }
+      seq = seqs[0];
 
     } else if (strncmp(ptr, "HMM", 3) == 0) {
       if (esl_opt_IsUsed(opts, "--hmmdb")) {
@@ -1469,12 +2996,17 @@ clientside_loop(CLIENTSIDE_ARGS *data)
     if (opts != NULL) esl_getopts_Destroy(opts);
     if (abc  != NULL) esl_alphabet_Destroy(abc);
     if (hmm  != NULL) p7_hmm_Destroy(hmm);
-    if (seq  != NULL) esl_sq_Destroy(seq);
     if (sco  != NULL) esl_scorematrix_Destroy(sco);
+    if (seqs != NULL) {
+      for (q = 0; q < nq; ++q) if (seqs[q] != NULL) esl_sq_Destroy(seqs[q]);
+      free(seqs);
+    }
+    if (rec  != NULL) free(rec);
 
     free(buffer);
     return 0;
   }
+  if (rec != NULL) free(rec);
 
   if ((parms = malloc(sizeof(QUEUE_DATA))) == NULL) LOG_FATAL_MSG("malloc", errno);
 
@@ -1483,9 +3015,12 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   n = n + strlen(opt_str) + 1;
 
   if (seq != NULL) {
-    n = n + strlen(seq->name) + 1;
-    n = n + strlen(seq->desc) + 1;
-    n = n + seq->n + 2;
+    for (q = 0; q < nq; ++q) {
+      if (q > 0) n = n + sizeof(uint32_t);
+      n = n + strlen(seqs[q]->name) + 1;
+      n = n + strlen(seqs[q]->desc) + 1;
+      n = n + seqs[q]->n + 2;
+    }
   } else {
     n = n + sizeof(P7_HMM);
     n = n + sizeof(float) * (hmm->M + 1) * p7H_NTRANSITIONS;
@@ -1508,6 +3043,7 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   cmd->hdr.command      = (esl_opt_IsUsed(opts, "--seqdb")) ? HMMD_CMD_SEARCH : HMMD_CMD_SCAN;
   cmd->srch.db_inx      = dbx - 1;   /* the program indexes databases 0 .. n-1 */
   cmd->srch.opts_length = strlen(opt_str) + 1;
+  cmd->srch.query_cnt   = nq;
 
   ptr = cmd->srch.data;
 
@@ -1518,17 +3054,25 @@ clientside_loop(CLIENTSIDE_ARGS *data)
     cmd->srch.query_type   = HMMD_SEQUENCE;
     cmd->srch.query_length = seq->n + 2;
 
-    n = strlen(seq->name) + 1;
-    memcpy(ptr, seq->name, n);
-    ptr += n;
+    for (q = 0; q < nq; ++q) {
+      if (q > 0) {
+        len = seqs[q]->n + 2;
+        memcpy(ptr, &len, sizeof(uint32_t));
+        ptr += sizeof(uint32_t);
+      }
 
-    n = strlen(seq->desc) + 1;
-    memcpy(ptr, seq->desc, n);
-    ptr += n;
+      n = strlen(seqs[q]->name) + 1;
+      memcpy(ptr, seqs[q]->name, n);
+      ptr += n;
 
-    n = seq->n + 2;
-    memcpy(ptr, seq->dsq, n);
-    ptr += n;
+      n = strlen(seqs[q]->desc) + 1;
+      memcpy(ptr, seqs[q]->desc, n);
+      ptr += n;
+
+      n = seqs[q]->n + 2;
+      memcpy(ptr, seqs[q]->dsq, n);
+      ptr += n;
+    }
   } else {
     cmd->srch.query_type   = HMMD_HMM;
     cmd->srch.query_length = hmm->M;
@@ -1571,17 +3115,31 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   parms->opts = opts;
   parms->dbx  = dbx - 1;
   parms->cmd  = cmd;
+  parms->nq   = nq;
+  parms->next = NULL;
 
   strcpy(parms->ip_addr, data->ip_addr);
   parms->sock       = data->sock_fd;
   parms->cmd_type   = cmd->hdr.command;
   parms->query_type = (seq != NULL) ? HMMD_SEQUENCE : HMMD_HMM;
 
+  /* the rest of a batch hangs off the first query */
+  for (q = nq - 1; q > 0; --q) {
+    if ((node = malloc(sizeof(QUEUE_DATA))) == NULL) LOG_FATAL_MSG("malloc", errno);
+    memset(node, 0, sizeof(QUEUE_DATA));
+    node->seq   = seqs[q];
+    node->next  = parms->next;
+    parms->next = node;
+  }
+  if (seqs != NULL) free(seqs);
+
   date = time(NULL);
   ctime_r(&date, timestamp);
   printf("\n%s", timestamp);	/* note ctime_r() leaves \n on end of timestamp */
 
-  if (parms->seq != NULL) {
+  if (parms->nq > 1) {
+    printf("Queuing %s of a batch of %d sequences from %s (%d)\n", (cmd->hdr.command == HMMD_CMD_SEARCH) ? "search" : "scan", parms->nq, parms->ip_addr, parms->sock);
+  } else if (parms->seq != NULL) {
     printf("Queuing %s %s from %s (%d)\n", (cmd->hdr.command == HMMD_CMD_SEARCH) ? "search" : "scan", parms->seq->name, parms->ip_addr, parms->sock);
   } else {
     printf("Queuing hmm %s from %s (%d)\n", parms->hmm->name, parms->ip_addr, parms->sock);
@@ -1634,6 +3192,9 @@ clientside_thread(void *arg)
   /* remove any commands in stack associated with this client's socket */
   esl_stack_DiscardSelected(data->cmdstack, discard_function, &(data->sock_fd));
 
+  /* stop its searches; nobody is waiting for the results */
+  cancel_client(data->workers, data->sock_fd);
+
   printf("Closing %s (%d)\n", data->ip_addr, data->sock_fd);
   fflush(stdout);
 
@@ -1664,6 +3225,7 @@ client_comm_thread(void *arg)
 
     if ((targs = malloc(sizeof(CLIENTSIDE_ARGS))) == NULL) LOG_FATAL_MSG("malloc", errno);
     targs->cmdstack   = data->cmdstack;
+    targs->workers    = data->workers;
     targs->sock_fd    = fd;
 
     addrlen = sizeof(targs->ip_addr);
@@ -1719,15 +3281,150 @@ setup_clientside_comm(ESL_GETOPTS *opts, CLIENTSIDE_ARGS *args)
   if ((n = pthread_create(&thread_id, NULL, client_comm_thread, (void *)args)) != 0) LOG_FATAL_MSG("socket", n);
 }
 
+/* read_results()
+ * Read what <worker> sent back for one query of its range into <r>, and
+ * add the number of bytes read to <*ret_total>.  Returns <eslOK>, or
+ * <eslFAIL> if the connection failed or the results are unreadable.
+ */
+static int
+read_results(WORKER_DATA *worker, RANGE_RESULTS *r, int *ret_total)
+{
+  HMMD_SEARCH_STATS  *stats = NULL;
+  int                 size;
+  int                 n;
+  int                 status;
+
+  n = sizeof(r->status);
+  *ret_total += n;
+  if ((size = readn(worker->sock_fd, &r->status, n)) == -1) {
+    p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+    return eslFAIL;
+  }
+
+  if (r->status.status != eslOK) {
+    n = r->status.msg_size;
+    *ret_total += n;
+    if ((r->err_buf = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    r->err_buf[0] = 0;
+    if ((size = readn(worker->sock_fd, r->err_buf, n)) == -1) {
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      return eslFAIL;
+    }
+  } else if (r->status.version == HMMD_RESULTS_VERSION) {
+    char     *buf;
+    uint64_t  datasize;
+
+    n = r->status.msg_size;
+    *ret_total += n;
+    if ((buf = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    if ((size = readn(worker->sock_fd, buf, n)) == -1) {
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      free(buf);
+      return eslFAIL;
+    }
+
+    /* unpack into the original layout, as if the worker had sent raw structs */
+    if ((status = hmmpgmd_DecodeResults(buf, n, &r->stats, &r->hit, &r->hit_data, &datasize)) != eslOK) {
+      p7_syslog(LOG_ERR,"[%s:%d] - bad results from %s error %d\n", __FILE__, __LINE__, worker->ip_addr, status);
+      free(buf);
+      return eslFAIL;
+    }
+    r->status.msg_size = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * r->stats.nhits + datasize;
+    free(buf);
+  } else if (r->status.version != 0) {
+    /* a worker newer than we are; its results are unreadable */
+    p7_syslog(LOG_ERR,"[%s:%d] - %s sent results in unknown format %d\n", __FILE__, __LINE__, worker->ip_addr, r->status.version);
+    return eslFAIL;
+  } else {
+
+    /* a worker predating HMMD_RESULTS_VERSION: raw structs */
+    n = sizeof(r->stats);
+    *ret_total += n;
+    if ((size = readn(worker->sock_fd, &r->stats, n)) == -1) {
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      return eslFAIL;
+    }
+
+    stats = &r->stats;
+
+    /* read in the hits */
+    n = sizeof(P7_HIT) * stats->nhits;
+    if ((r->hit = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    if ((size = readn(worker->sock_fd, r->hit, n)) == -1) {
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      return eslFAIL;
+    }
+
+    /* read in the domain and alignment info */
+    n = r->status.msg_size - sizeof(r->stats) - n;
+    if ((r->hit_data = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    if ((size = readn(worker->sock_fd, r->hit_data, n)) == -1) {
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      return eslFAIL;
+    }
+  }
+
+  return eslOK;
+}
+
+/* wait_for_range()
+ * Wait for <worker> to send back the results of its range.  If the
+ * search is cancelled meanwhile, tell the worker to stop early; it then
+ * answers with HMMD_STATUS_CANCELLED.  Returns <eslOK> once the results
+ * are ready to be read, or <eslFAIL> if the worker has gone away.
+ */
+static int
+wait_for_range(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
+{
+  HMMD_HEADER     hdr;
+  fd_set          rset;
+  struct timeval  tv;
+  int             cancelled = FALSE;
+  int             n;
+
+  for ( ;; ) {
+    FD_ZERO(&rset);
+    FD_SET(worker->sock_fd, &rset);
+
+    tv.tv_sec  = 0;
+    tv.tv_usec = CANCEL_POLL_MS * 1000;
+
+    if ((n = select(worker->sock_fd + 1, &rset, NULL, NULL, &tv)) > 0) return eslOK;
+    if (n < 0 && errno != EINTR) {
+      p7_syslog(LOG_ERR,"[%s:%d] - select %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      return eslFAIL;
+    }
+    if (cancelled) continue;
+
+    if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+    cancelled = (worker->job->cancelled != 0);
+    if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+    if (cancelled) {
+      memset(&hdr, 0, sizeof(HMMD_HEADER));
+      hdr.command = HMMD_CMD_CANCEL;
+      if (writen(worker->sock_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+        return eslFAIL;
+      }
+    }
+  }
+}
+
 static void
 workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
 {
   ESL_STOPWATCH      *w     = NULL;
-  HMMD_SEARCH_STATS  *stats = NULL;
+  SEARCH_JOB         *job   = NULL;
+  HMMD_COMMAND       *dbcmd = NULL;
   HMMD_COMMAND        cmd;
+  uint32_t            gen;
   int    n;
+  int    q;
+  int    s;
   int    size;
   int    total;
+  int    status;
   char  *ptr;
 
   memset(&cmd, 0, sizeof(HMMD_COMMAND)); /* silence valgrind. if we ever serialize structs properly, remove */
@@ -1738,17 +3435,54 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
     /* wait for the next search object */
     if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-    /* wait for the master's signal to start the calculations */
+    /* wait for a command from the master, for databases to load or drop,
+     * or for a range of a search to run
+     */
+    job = NULL;
+    s   = -1;
     while (worker->cmd == NULL) {
+      if ((s = stale_db(data, worker, &gen)) >= 0) break;
+      if (worker->active && (job = schedule_unit(data, worker, &worker->unit)) != NULL) break;
       if ((n = pthread_cond_wait(&data->start_cond, &data->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
     }
+    worker->job = job;
+    if (job != NULL) {
+      worker->srch_inx = job->unit[worker->unit].inx;
+      worker->srch_cnt = job->unit[worker->unit].cnt;
+    }
+    if (s >= 0) dbcmd = db_command(data, s, gen);
+    if (s >= 0 && gen != 0 && worker->active) {
+      worker->syncing = TRUE;
+      data->nsyncing++;
+    }
 
     if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
+    /* bring the worker's databases up to date; its other databases stay in use meanwhile */
+    if (s >= 0) {
+      status = sync_db(worker, dbcmd);
+      free(dbcmd);
+      if (status != eslOK) break;
+
+      if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+      worker->db_gen[s] = gen;
+      if (worker->syncing) {
+        worker->syncing = FALSE;
+        data->nsyncing--;
+        if ((n = pthread_cond_broadcast(&data->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+      }
+      if ((n = pthread_cond_broadcast(&data->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+      if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+      printf("WORKER %s %s databases in slot %d\n", worker->ip_addr, (gen == 0) ? "dropped" : "loaded", s);
+      fflush(stdout);
+      continue;
+    }
+
     /* terminate the connection */
-    if (worker->cmd->hdr.command == HMMD_CMD_RESET) {
+    if (job == NULL && worker->cmd->hdr.command == HMMD_CMD_RESET) {
       break;
-    } else if (worker->cmd->hdr.command == HMMD_CMD_SHUTDOWN) {
+    } else if (job == NULL && worker->cmd->hdr.command == HMMD_CMD_SHUTDOWN) {
       fd_set rset;
       struct timeval tv;
       
@@ -1790,7 +3524,7 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
 
     /* write search message in two parts */
     n = sizeof(HMMD_HEADER) + sizeof(HMMD_SEARCH_CMD);
-    memcpy(&cmd, worker->cmd, n);
+    memcpy(&cmd, job->query->cmd, n);
     cmd.srch.inx = worker->srch_inx;
     cmd.srch.cnt = worker->srch_cnt;
     if (writen(worker->sock_fd, &cmd, n) != n) {
@@ -1799,75 +3533,53 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
     }
 
     /* write remaining data, i.e. sequence, options etc. */
-    ptr = (char *)worker->cmd;
+    ptr = (char *)job->query->cmd;
     ptr += n;
-    n = MSG_SIZE(worker->cmd) - n;
+    n = MSG_SIZE(job->query->cmd) - n;
     if (writen(worker->sock_fd, ptr, n) != n) {
       p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
       break;
     }
-    
-    total = 0;
-    worker->total = 0;
-
-    n = sizeof(worker->status);
-    total += n;
-    if ((size = readn(worker->sock_fd, &worker->status, n)) == -1) {
-      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-      break;
-    }
-
-    if (worker->status.status != eslOK) {
-      n = worker->status.msg_size;
-      total += n; 
-      if ((worker->err_buf = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-      worker->err_buf[0] = 0;
-      if ((size = readn(worker->sock_fd, worker->err_buf, n)) == -1) {
-        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-        break;
-      }
-    } else {
-
-      n = sizeof(worker->stats);
-      total += n;
-      if ((size = readn(worker->sock_fd, &worker->stats, n)) == -1) {
-        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-        break;
-      }
-
-      stats = &worker->stats;
 
-      /* read in the hits */
-      n = sizeof(P7_HIT) * stats->nhits;
-      if ((worker->hit = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-      if ((size = readn(worker->sock_fd, worker->hit, n)) == -1) {
-        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-        break;
-      }
+    if (wait_for_range(data, worker) != eslOK) break;
 
-      /* read in the domain and alignment info */
-      n = worker->status.msg_size - sizeof(worker->stats) - n;
-      if ((worker->hit_data = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-      if ((size = readn(worker->sock_fd, worker->hit_data, n)) == -1) {
-        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-        break;
-      }
+    /* one set of results for each query of the search */
+    if (worker->nres < job->nq) {
+      if ((worker->res = realloc(worker->res, sizeof(RANGE_RESULTS) * job->nq)) == NULL) LOG_FATAL_MSG("realloc", errno);
+      memset(worker->res + worker->nres, 0, sizeof(RANGE_RESULTS) * (job->nq - worker->nres));
+      worker->nres = job->nq;
     }
 
+    total = 0;
+    worker->total = 0;
+    for (q = 0; q < job->nq; ++q)
+      if (read_results(worker, worker->res + q, &total) != eslOK) break;
+    if (q < job->nq) break;
+
     esl_stopwatch_Stop(w);
 
+    for (q = 0; q < job->nq; ++q)
+      if (worker->res[q].status.status == eslOK) sort_hits(worker->res + q);
+
     if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-    /* set the state of the worker to completed */
-    worker->cmd       = NULL;
-    worker->completed = 1;
-    worker->total     = total;
-    ++data->completed;
+    /* hand the results of the range to its search */
+    job           = finish_unit(worker);
+    worker->total = total;
 
-    /* notify the master that a worker has completed */
+    worker->nranges++;
+    worker->bytes_recv += total;
+    worker->busy       += w->elapsed;
+    data->metrics.nranges++;
+    observe(&data->metrics.range_time, w->elapsed);
+
+    /* notify the search that a range has completed */
     if ((n = pthread_cond_broadcast(&data->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
     if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
+    /* a backup copy outlived its search */
+    if (job != NULL) destroy_job(job);
+
     printf ("WORKER %s COMPLETED: %.2f sec received %d bytes\n", worker->ip_addr, w->elapsed, total);
     fflush(stdout);
   }
@@ -1880,18 +3592,12 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
 static void *
 workerside_thread(void *arg)
 {
-  HMMD_COMMAND     *cmd     = NULL;
   WORKER_DATA      *worker  = (WORKER_DATA *)arg;
   WORKERSIDE_ARGS  *parent  = (WORKERSIDE_ARGS *)worker->parent;
-  HMMD_HEADER       hdr;
+  SEARCH_JOB       *job     = NULL;
+  char              ip_addr[64];
   int               n;
   int               fd = 0;
-  int               version;
-  int               updated;
-  int               status = eslOK;
-  char             *p;
-
-  memset(&hdr, 0, sizeof(HMMD_HEADER)); /* silence valgrind; remove if/when we serialize structs properly */
 
   /* Guarantees that thread resources are deallocated upon return */
   pthread_detach(pthread_self()); 
@@ -1899,119 +3605,28 @@ workerside_thread(void *arg)
   printf("Handling worker %s (%d)\n", worker->ip_addr, worker->sock_fd);
   fflush(stdout);
 
-  updated = 0;
-  while (!updated) {
-    /* get the database version to load */
-    if ((n = pthread_mutex_lock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
-    version = parent->db_version;
-    if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
-
-    n = sizeof(HMMD_COMMAND);
-    if (parent->seq_db != NULL) n += strlen(parent->seq_db->name) + 1;
-    if (parent->hmm_db != NULL) n += strlen(parent->hmm_db->name) + 1;
-
-    cmd = malloc(n);
-    if (cmd == NULL) {
-      p7_syslog(LOG_ERR,"[%s:%d] - malloc %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-      goto EXIT;
-    }
-    memset(cmd, 0, n);
-
-    cmd->hdr.length  = n - sizeof(HMMD_HEADER);
-    cmd->hdr.command = HMMD_CMD_INIT;
-
-    p = cmd->init.data;
-
-    if (parent->seq_db != NULL) {
-      cmd->init.db_cnt      = parent->seq_db->db_cnt;
-      cmd->init.seq_cnt     = parent->seq_db->count;
-      cmd->init.seqdb_off   = p - cmd->init.data;
-
-      strncpy(cmd->init.sid, parent->seq_db->id, sizeof(cmd->init.sid));
-      cmd->init.sid[sizeof(cmd->init.sid)-1] = 0;
-
-      strcpy(p, parent->seq_db->name);
-      p += strlen(parent->seq_db->name) + 1;
-    }
-
-    if (parent->hmm_db != NULL) {
-      cmd->init.hmm_cnt     = 1;
-      cmd->init.model_cnt   = parent->hmm_db->n;
-      cmd->init.hmmdb_off   = p - cmd->init.data;
-
-      //strncpy(cmd->init.hid, parent->hmm_db->id, sizeof(cmd->init.hid));
-      //cmd->init.hid[sizeof(cmd->init.hid)-1] = 0;
-
-      strcpy(p, parent->hmm_db->name);
-      p += strlen(parent->hmm_db->name) + 1;
-    }
-
-    if (writen(worker->sock_fd, cmd, n) != n) {
-      p7_syslog(LOG_ERR,"[%s:%d] - writing (%d) error %d - %s\n", __FILE__, __LINE__, worker->sock_fd, errno, strerror(errno));
-      status = eslFAIL;
-    }
-
-    /* process the init command first */
-    if (readn(worker->sock_fd, &hdr, sizeof(hdr)) == -1) {
-      p7_syslog(LOG_ERR,"[%s:%d] - reading (%d) error %d - %s\n", __FILE__, __LINE__, worker->sock_fd, errno, strerror(errno));
-      status = eslFAIL;
-    }
-
-    /* cmd is a HMMD_COMMAND.
-     *    consists of HMMD_HEADER:  length, command, status
-     *    and a union of HMMD_INIT_CMD, HMMD_SEARCH_COMMAND, HMMD_INIT_RESET.
-     *    we know which is valid, from hdr.command
-     *    the total malloc size for an HMMD_COMMAND is calculated from the header, using MSG_SIZE(cmd)
-     */
-    n = MSG_SIZE(&hdr);
-    if ((cmd = realloc(cmd, n)) == NULL) {
-      p7_syslog(LOG_ERR,"[%s:%d] - realloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
-      status = eslFAIL;
-    }
-    if (readn(worker->sock_fd, &(cmd->init), hdr.length) == -1) {
-      p7_syslog(LOG_ERR,"[%s:%d] - reading (%d) error %d - %s\n", __FILE__, __LINE__, worker->sock_fd, errno, strerror(errno));
-      status = eslFAIL;
-    }
-
-    /* validate the database of the worker before adding him to the list */
-    if (hdr.command != HMMD_CMD_INIT) {
-      p7_syslog(LOG_ERR,"[%s:%d] - expecting HMMD_CMD_INIT %d\n", __FILE__, __LINE__, hdr.command);
-      status = eslFAIL;
-    }
-    if (cmd->hdr.status != eslOK) {
-      p7_syslog(LOG_ERR,"[%s:%d] - workers init status failed %d\n", __FILE__, __LINE__, cmd->hdr.status);
-      status = eslFAIL;
-    }
+  /* turn away a worker of another version; nothing refers to it yet */
+  if (check_version(worker) != eslOK) {
+    printf("Rejected worker %s (%d): see the log\n", worker->ip_addr, worker->sock_fd);
+    fflush(stdout);
+    close(worker->sock_fd);
+    free(worker);
+    pthread_exit(NULL);
+  }
 
-    worker->next = NULL;
-    worker->prev = NULL;
+  /* the worker loads the databases before it is handed any searches of them (see stale_db()) */
+  worker->next = NULL;
+  worker->prev = NULL;
 
-    /* add the worker to the pending list */
-    if ((n = pthread_mutex_lock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  if ((n = pthread_mutex_lock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  assert(validate_workers(parent));
 
-    assert(validate_workers(parent));
-    
-    /* make sure the master has not loaded a new database while we were waiting
-     * for the worker to load and verify the database we started out this.  If
-     * the version has changed, force the worker to reload and verify.
-     */
-    if (version == parent->db_version) {
-      if (status == eslOK) {
-        worker->next    = parent->pending;
-        parent->pending = worker;
-        ++parent->pend_cnt;
-      } else {
-        worker->next   = parent->idling;
-        parent->idling = worker;
-        ++parent->idle_cnt;
-      }
-      updated = 1;
-    }
-   
-    assert(validate_workers(parent));
+  worker->next    = parent->pending;
+  parent->pending = worker;
+  ++parent->pend_cnt;
 
-    if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
-  }
+  assert(validate_workers(parent));
+  if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
 
   printf("Pending worker %s (%d)\n", worker->ip_addr, worker->sock_fd);
   fflush(stdout);
@@ -2021,25 +3636,36 @@ workerside_thread(void *arg)
   if ((n = pthread_mutex_lock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
   fd = worker->sock_fd;
+  strcpy(ip_addr, worker->ip_addr);
 
   ++parent->failed;
   ++parent->completed;
+  ++parent->metrics.nlost;
 
   worker->terminated = 1;
   worker->total      = 0;
   worker->sock_fd    = -1;
 
+  /* let the next ready worker load, if this one died loading */
+  if (worker->syncing) parent->nsyncing--;
+  worker->syncing = FALSE;
+
+  /* give any range the worker was running back to its search */
+  job = release_worker(parent, worker);
+
   assert(validate_workers(parent));
 
-  /* notify the master that a worker has completed */
+  /* notify the master that a worker has completed, and the other workers of any range to retry */
   if ((n = pthread_cond_broadcast(&parent->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  if ((n = pthread_cond_broadcast(&parent->start_cond))    != 0) LOG_FATAL_MSG("cond broadcast", n);
   if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
- EXIT:
-  printf("Closing worker %s (%d)\n", worker->ip_addr, fd);
+  if (job != NULL) destroy_job(job);
+
+  /* once it is marked terminated, update_workers() may free <worker> */
+  printf("Closing worker %s (%d)\n", ip_addr, fd);
   fflush(stdout);
 
-  if (cmd != NULL) free(cmd);
   close(fd);
 
   pthread_exit(NULL);
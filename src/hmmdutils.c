@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
@@ -93,6 +94,10 @@ static ESL_OPTIONS searchOpts[] = {
   { "--hmmdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--seqdb",       "hmm database to search",                                      12 },
   { "--seqdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--hmmdb",       "protein database to search",                                  12 },
   { "--seqdb_ranges",eslARG_STRING,     NULL,  NULL,  NULL,   NULL, "--seqdb", NULL,         "range(s) of sequences within --seqdb that will be searched",  12 },
+  { "--db",         eslARG_STRING, HMMD_DEFAULT_DB, NULL, NULL, NULL,  NULL,  NULL,            "name of the resident databases to search",                    12 },
+  { "--priority",   eslARG_INT,          "0",  NULL, "n>=0",  NULL,  NULL,  NULL,            "schedule ahead of searches with a lower priority <n>",        12 },
+  { "--stream",     eslARG_NONE,       FALSE,  NULL, NULL,    NULL,"-Z,--domZ",NULL,        "send hits in batches as they are found",                      12 },
+  { "--timeout",    eslARG_INT,          "0",  NULL, "n>=0",  NULL,  NULL,  NULL,            "give up on the search after <n> seconds (0: no limit)",       12 },
 
   /* name           type        default  env  range toggles reqs incomp  help                                          docgroup*/
   { "-c",         eslARG_INT,       "1", NULL, NULL, NULL,  NULL, NULL,  "use alt genetic code of NCBI transl table <n>", 99 },
@@ -206,15 +211,23 @@ process_searchopts(int fd, char *cmdstr, ESL_GETOPTS **ret_opts)
 void
 free_QueueData(QUEUE_DATA *data)
 {
-  /* free the query data */
-  esl_getopts_Destroy(data->opts);
-
-  if (data->abc != NULL) esl_alphabet_Destroy(data->abc);
-  if (data->hmm != NULL) p7_hmm_Destroy(data->hmm);
-  if (data->seq != NULL) esl_sq_Destroy(data->seq);
-  if (data->cmd != NULL) free(data->cmd);
-  memset(data, 0, sizeof(*data));
-  free(data);
+  QUEUE_DATA *next;
+
+  /* free the query data, and the rest of a batch */
+  while (data != NULL) {
+    next = data->next;
+
+    if (data->opts != NULL) esl_getopts_Destroy(data->opts);
+
+    if (data->abc != NULL) esl_alphabet_Destroy(data->abc);
+    if (data->hmm != NULL) p7_hmm_Destroy(data->hmm);
+    if (data->seq != NULL) esl_sq_Destroy(data->seq);
+    if (data->cmd != NULL) free(data->cmd);
+    memset(data, 0, sizeof(*data));
+    free(data);
+
+    data = next;
+  }
 }
 
 /* Function:  hmmpgmd_IsWithinRanges()
@@ -285,4 +298,634 @@ ERROR:
   return eslEMEM;
 }
 
+/*****************************************************************
+ * Search results between workers and the master
+ *****************************************************************/
+
+/* A worker's results are sent to the master as a HMMD_SEARCH_STATUS
+ * whose <version> is HMMD_RESULTS_VERSION, followed by <msg_size>
+ * bytes in the format below. The format carries no pointers or
+ * padding and does not depend on the machine's byte order or struct
+ * layout, so a worker doesn't have to be built the same way as the
+ * master. Integers are LEB128 varints ("u"), zigzag coded when they
+ * may be negative ("s"); floats ("f") and doubles ("d") are their IEEE
+ * bits, least significant byte first.
+ *
+ *   stats:      d elapsed, user, sys, Z, domZ; u Z_setby, domZ_setby;
+ *               u nmodels, nseqs, n_past_msv, n_past_bias, n_past_vit,
+ *                 n_past_fwd, nhits, nreported, nincluded
+ *   each hit:   s name; u has_desc; if has_desc: s desc, acc;
+ *               s window_length; d sortkey; f score, pre_score, sum_score;
+ *               d lnP, pre_lnP, sum_lnP; f nexpected;
+ *               u nregions, nclustered, noverlaps, nenvelopes, ndom, flags;
+ *               s nreported, nincluded, best_domain, seqidx, subseq_start
+ *   each dom:   s ienv, jenv, iali, jali, iorf, jorf;
+ *               f envsc, domcorrection, dombias, oasc, bitscore; d lnP;
+ *               u is_reported, is_included;
+ *               s N, hmmfrom, hmmto, M, sqfrom, sqto, L; u memsize;
+ *               u 14 string offsets into mem, +1 (0 for NULL), in the
+ *                 order of the P7_ALIDISPLAY fields; memsize bytes of mem
+ *
+ * The hit's name, desc and acc are not strings: the name is the
+ * numeric name of the target, and desc and acc are the domain
+ * architecture and taxonomy id that hmmpgmd databases carry in their
+ * description lines (see hmmpgmd_EncodeResults()).
+ *
+ * A status with <version> 0 is followed by the original format, raw
+ * HMMD_SEARCH_STATS, P7_HIT, P7_DOMAIN and P7_ALIDISPLAY structs; the
+ * master still reads it from older workers, and sends it to clients.
+ */
+
+typedef struct {
+  unsigned char *buf;
+  uint64_t       n;
+  uint64_t       nalloc;
+  int            status;        /* eslOK, or eslEMEM once an allocation failed */
+} WIRE_BUF;
+
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+  int                  status;  /* eslOK, or eslEFORMAT once we've read past <end> */
+} WIRE_CUR;
+
+static unsigned char *
+wire_reserve(WIRE_BUF *b, uint64_t n)
+{
+  unsigned char *tmp;
+
+  if (b->status != eslOK) return NULL;
+  if (b->n + n > b->nalloc) {
+    uint64_t nalloc = ESL_MAX(b->nalloc * 2, b->n + n);
+    if ((tmp = realloc(b->buf, nalloc)) == NULL) { b->status = eslEMEM; return NULL; }
+    b->buf    = tmp;
+    b->nalloc = nalloc;
+  }
+  tmp   = b->buf + b->n;
+  b->n += n;
+  return tmp;
+}
+
+static void
+put_uint(WIRE_BUF *b, uint64_t v)
+{
+  unsigned char  tmp[10];
+  unsigned char *p;
+  int            n = 0;
+
+  do {
+    tmp[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+  } while (v);
+  if ((p = wire_reserve(b, n)) != NULL) memcpy(p, tmp, n);
+}
+
+static void put_sint  (WIRE_BUF *b, int64_t v) { put_uint(b, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63)); }
+
+static void
+put_bits(WIRE_BUF *b, uint64_t v, int nbytes)
+{
+  unsigned char *p;
+  int            i;
+
+  if ((p = wire_reserve(b, nbytes)) == NULL) return;
+  for (i = 0; i < nbytes; ++i) { p[i] = v & 0xff; v >>= 8; }
+}
+
+static void put_double(WIRE_BUF *b, double v) { uint64_t u; memcpy(&u, &v, sizeof(u)); put_bits(b, u, 8); }
+static void put_float (WIRE_BUF *b, float  v) { uint32_t u; memcpy(&u, &v, sizeof(u)); put_bits(b, u, 4); }
+
+static void
+put_bytes(WIRE_BUF *b, const void *v, uint64_t n)
+{
+  unsigned char *p;
+  if ((p = wire_reserve(b, n)) != NULL) memcpy(p, v, n);
+}
+
+static uint64_t
+get_uint(WIRE_CUR *c)
+{
+  uint64_t v     = 0;
+  int      shift = 0;
+
+  while (c->p < c->end && shift < 64) {
+    v |= (uint64_t) (*c->p & 0x7f) << shift;
+    if ((*c->p++ & 0x80) == 0) return v;
+    shift += 7;
+  }
+  c->status = eslEFORMAT;
+  return 0;
+}
+
+static int64_t get_sint(WIRE_CUR *c) { uint64_t u = get_uint(c); return (int64_t) (u >> 1) ^ -(int64_t) (u & 1); }
+
+static uint64_t
+get_bits(WIRE_CUR *c, int nbytes)
+{
+  uint64_t v = 0;
+  int      i;
+
+  if (c->end - c->p < nbytes) { c->status = eslEFORMAT; c->p = c->end; return 0; }
+  for (i = nbytes-1; i >= 0; --i) v = (v << 8) | c->p[i];
+  c->p += nbytes;
+  return v;
+}
+
+static double get_double(WIRE_CUR *c) { uint64_t u = get_bits(c, 8); double v; memcpy(&v, &u, sizeof(v)); return v; }
+static float  get_float (WIRE_CUR *c) { uint32_t u = get_bits(c, 4); float  v; memcpy(&v, &u, sizeof(v)); return v; }
+
+/* The P7_ALIDISPLAY string fields, in wire order. */
+#define AD_NSTRINGS 14
+static void
+ad_strings(P7_ALIDISPLAY *ad, char ***s)
+{
+  s[0]  = &ad->rfline;  s[1]  = &ad->mmline;  s[2]  = &ad->csline;  s[3]  = &ad->model;
+  s[4]  = &ad->mline;   s[5]  = &ad->aseq;    s[6]  = &ad->ntseq;   s[7]  = &ad->ppline;
+  s[8]  = &ad->hmmname; s[9]  = &ad->hmmacc;  s[10] = &ad->hmmdesc; s[11] = &ad->sqname;
+  s[12] = &ad->sqacc;   s[13] = &ad->sqdesc;
+}
+
+/* Function:  hmmpgmd_EncodeResults()
+ * Synopsis:  Serialize a worker's search results for the master.
+ *
+ * Purpose:   Encode the search statistics <stats> and the hits in <th>
+ *            (in <th->unsrt> order) in the HMMD_RESULTS_VERSION format,
+ *            in a new buffer <*ret_buf> of <*ret_n> bytes that the caller
+ *            frees.
+ *
+ *            The hit names are converted to their numeric value. A hit's
+ *            description is converted to the leading number on it (the
+ *            domain architecture), and the number following that (the
+ *            taxonomy id) is sent as its accession.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <*ret_buf> is NULL.
+ */
+int
+hmmpgmd_EncodeResults(const HMMD_SEARCH_STATS *stats, const P7_TOPHITS *th, char **ret_buf, uint64_t *ret_n)
+{
+  WIRE_BUF       b = { NULL, 0, 0, eslOK };
+  P7_HIT        *hit;
+  P7_DOMAIN     *dom;
+  P7_ALIDISPLAY *ad;
+  char         **str[AD_NSTRINGS];
+  char          *pEnd;
+  int64_t        arch, taxid;
+  uint64_t       i;
+  int            j, k;
+
+  put_double(&b, stats->elapsed);  put_double(&b, stats->user);  put_double(&b, stats->sys);
+  put_double(&b, stats->Z);        put_double(&b, stats->domZ);
+  put_uint  (&b, stats->Z_setby);  put_uint  (&b, stats->domZ_setby);
+  put_uint  (&b, stats->nmodels);     put_uint(&b, stats->nseqs);
+  put_uint  (&b, stats->n_past_msv);  put_uint(&b, stats->n_past_bias);
+  put_uint  (&b, stats->n_past_vit);  put_uint(&b, stats->n_past_fwd);
+  put_uint  (&b, stats->nhits);       put_uint(&b, stats->nreported);  put_uint(&b, stats->nincluded);
+
+  for (i = 0; i < stats->nhits; ++i) {
+    hit = &th->unsrt[i];
+
+    put_sint(&b, strtol(hit->name, NULL, 10));
+    put_uint(&b, hit->desc != NULL);
+    if (hit->desc != NULL) {
+      /* Given the sequence header:
+       * >1 000101001 12343829483298 1234
+       * the description is the domain architecture (12343829483298),
+       * optionally followed by the taxonomy id (1234).
+       */
+      arch  = strtol(hit->desc, &pEnd, 10);
+      taxid = strtol(pEnd, &pEnd, 10);
+      put_sint(&b, arch);
+      put_sint(&b, taxid);
+    }
+
+    put_sint  (&b, hit->window_length);
+    put_double(&b, hit->sortkey);
+    put_float (&b, hit->score);      put_float (&b, hit->pre_score);  put_float (&b, hit->sum_score);
+    put_double(&b, hit->lnP);        put_double(&b, hit->pre_lnP);    put_double(&b, hit->sum_lnP);
+    put_float (&b, hit->nexpected);
+    put_uint  (&b, hit->nregions);   put_uint  (&b, hit->nclustered); put_uint  (&b, hit->noverlaps);
+    put_uint  (&b, hit->nenvelopes); put_uint  (&b, hit->ndom);       put_uint  (&b, hit->flags);
+    put_sint  (&b, hit->nreported);  put_sint  (&b, hit->nincluded);  put_sint  (&b, hit->best_domain);
+    put_sint  (&b, hit->seqidx);     put_sint  (&b, hit->subseq_start);
+
+    for (j = 0; j < hit->ndom; ++j) {
+      dom = &hit->dcl[j];
+      ad  = dom->ad;
+
+      put_sint (&b, dom->ienv);  put_sint(&b, dom->jenv);
+      put_sint (&b, dom->iali);  put_sint(&b, dom->jali);
+      put_sint (&b, dom->iorf);  put_sint(&b, dom->jorf);
+      put_float(&b, dom->envsc); put_float(&b, dom->domcorrection); put_float(&b, dom->dombias);
+      put_float(&b, dom->oasc);  put_float(&b, dom->bitscore);
+      put_double(&b, dom->lnP);
+      put_uint (&b, dom->is_reported);
+      put_uint (&b, dom->is_included);
+
+      put_sint(&b, ad->N);
+      put_sint(&b, ad->hmmfrom); put_sint(&b, ad->hmmto);  put_sint(&b, ad->M);
+      put_sint(&b, ad->sqfrom);  put_sint(&b, ad->sqto);   put_sint(&b, ad->L);
+      put_uint(&b, ad->memsize);
+      ad_strings(ad, str);
+      for (k = 0; k < AD_NSTRINGS; ++k)
+        put_uint(&b, (*str[k] == NULL) ? 0 : *str[k] - ad->mem + 1);
+      put_bytes(&b, ad->mem, ad->memsize);
+    }
+  }
+
+  if (b.status != eslOK) {
+    if (b.buf != NULL) free(b.buf);
+    *ret_buf = NULL;
+    *ret_n   = 0;
+    ESL_EXCEPTION(b.status, "allocation failed serializing search results");
+  }
+
+  *ret_buf = (char *) b.buf;
+  *ret_n   = b.n;
+  return eslOK;
+}
+
+/* Function:  hmmpgmd_DecodeResults()
+ * Synopsis:  Unpack a worker's search results.
+ *
+ * Purpose:   Decode the <n> bytes in <buf>, a worker's results in the
+ *            HMMD_RESULTS_VERSION format, into search statistics
+ *            <*stats>, an array of <stats->nhits> hits <*ret_hit>, and
+ *            a block <*ret_data> of <*ret_datasize> bytes holding the
+ *            hits' domains and alignments; the caller frees both.
+ *
+ *            The hits and their data are laid out as in the original
+ *            (version 0) format, so the master handles results the
+ *            same way whichever format a worker sent: each hit's
+ *            <offset> is the offset of its P7_DOMAIN array in the
+ *            stream of stats, hits and data, and the P7_ALIDISPLAY
+ *            string pointers are offsets from the start of that array.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> if <buf> is truncated or corrupt.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+hmmpgmd_DecodeResults(const char *buf, uint64_t n, HMMD_SEARCH_STATS *stats, P7_HIT **ret_hit, char **ret_data, uint64_t *ret_datasize)
+{
+  WIRE_CUR       c    = { (const unsigned char *) buf, (const unsigned char *) buf + n, eslOK };
+  WIRE_BUF       data = { NULL, 0, 0, eslOK };
+  P7_HIT        *hit  = NULL;
+  P7_HIT        *h;
+  P7_DOMAIN      dom;
+  P7_ALIDISPLAY  ad;
+  unsigned char *p;
+  char         **str[AD_NSTRINGS];
+  uint64_t       start;
+  uint64_t       adpos;
+  uint64_t       off;
+  uint64_t       i;
+  int            j, k;
+  int            status;
+
+  stats->elapsed     = get_double(&c);  stats->user = get_double(&c);  stats->sys = get_double(&c);
+  stats->Z           = get_double(&c);  stats->domZ = get_double(&c);
+  stats->Z_setby     = get_uint(&c);    stats->domZ_setby = get_uint(&c);
+  stats->nmodels     = get_uint(&c);    stats->nseqs       = get_uint(&c);
+  stats->n_past_msv  = get_uint(&c);    stats->n_past_bias = get_uint(&c);
+  stats->n_past_vit  = get_uint(&c);    stats->n_past_fwd  = get_uint(&c);
+  stats->nhits       = get_uint(&c);    stats->nreported   = get_uint(&c);  stats->nincluded = get_uint(&c);
+  if (c.status != eslOK || stats->nhits > (uint64_t) (c.end - c.p)) { status = eslEFORMAT; goto ERROR; }
+
+  ESL_ALLOC(hit, sizeof(P7_HIT) * ESL_MAX(1, stats->nhits));
+  memset(hit, 0, sizeof(P7_HIT) * ESL_MAX(1, stats->nhits));
+
+  for (i = 0; i < stats->nhits; ++i) {
+    h = &hit[i];
+
+    /* the integers stand in for strings, as in the original format */
+    h->name = (char *) (intptr_t) get_sint(&c);
+    if (get_uint(&c)) {
+      h->desc = (char *) (intptr_t) get_sint(&c);
+      h->acc  = (char *) (intptr_t) get_sint(&c);
+    }
+
+    h->window_length = get_sint(&c);
+    h->sortkey       = get_double(&c);
+    h->score         = get_float(&c);   h->pre_score  = get_float(&c);   h->sum_score = get_float(&c);
+    h->lnP           = get_double(&c);  h->pre_lnP    = get_double(&c);  h->sum_lnP   = get_double(&c);
+    h->nexpected     = get_float(&c);
+    h->nregions      = get_uint(&c);    h->nclustered = get_uint(&c);    h->noverlaps = get_uint(&c);
+    h->nenvelopes    = get_uint(&c);    h->ndom       = get_uint(&c);    h->flags     = get_uint(&c);
+    h->nreported     = get_sint(&c);    h->nincluded  = get_sint(&c);    h->best_domain = get_sint(&c);
+    h->seqidx        = get_sint(&c);    h->subseq_start = get_sint(&c);
+    if (c.status != eslOK || h->ndom < 0 || (uint64_t) h->ndom > (uint64_t) (c.end - c.p)) { status = eslEFORMAT; goto ERROR; }
+
+    start     = data.n;
+    h->offset = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * stats->nhits + start;
+    wire_reserve(&data, sizeof(P7_DOMAIN) * h->ndom);
+    if (data.status != eslOK) { status = data.status; goto ERROR; }
+
+    for (j = 0; j < h->ndom; ++j) {
+      memset(&dom, 0, sizeof(P7_DOMAIN));
+      dom.ienv  = get_sint(&c);   dom.jenv = get_sint(&c);
+      dom.iali  = get_sint(&c);   dom.jali = get_sint(&c);
+      dom.iorf  = get_sint(&c);   dom.jorf = get_sint(&c);
+      dom.envsc = get_float(&c);  dom.domcorrection = get_float(&c);  dom.dombias = get_float(&c);
+      dom.oasc  = get_float(&c);  dom.bitscore      = get_float(&c);
+      dom.lnP   = get_double(&c);
+      dom.is_reported = get_uint(&c);
+      dom.is_included = get_uint(&c);
+      memcpy(data.buf + start + sizeof(P7_DOMAIN) * j, &dom, sizeof(P7_DOMAIN));
+
+      memset(&ad, 0, sizeof(P7_ALIDISPLAY));
+      ad.N       = get_sint(&c);
+      ad.hmmfrom = get_sint(&c);  ad.hmmto = get_sint(&c);  ad.M = get_sint(&c);
+      ad.sqfrom  = get_sint(&c);  ad.sqto  = get_sint(&c);  ad.L = get_sint(&c);
+      ad.memsize = get_uint(&c);
+      if (c.status != eslOK || ad.memsize < 0 || (uint64_t) ad.memsize > (uint64_t) (c.end - c.p)) { status = eslEFORMAT; goto ERROR; }
+
+      /* string pointers become offsets from the hit's P7_DOMAIN array */
+      adpos = data.n;
+      ad_strings(&ad, str);
+      for (k = 0; k < AD_NSTRINGS; ++k) {
+        off = get_uint(&c);
+        if (off > (uint64_t) ad.memsize) { status = eslEFORMAT; goto ERROR; }
+        *str[k] = (off == 0) ? NULL : ((char *) NULL) + (adpos - start) + sizeof(P7_ALIDISPLAY) + (off - 1);
+      }
+      if (c.status != eslOK || (uint64_t) (c.end - c.p) < (uint64_t) ad.memsize) { status = eslEFORMAT; goto ERROR; }
+
+      p = wire_reserve(&data, sizeof(P7_ALIDISPLAY) + ad.memsize);
+      if (data.status != eslOK) { status = data.status; goto ERROR; }
+      memcpy(p, &ad, sizeof(P7_ALIDISPLAY));
+      memcpy(p + sizeof(P7_ALIDISPLAY), c.p, ad.memsize);
+      c.p += ad.memsize;
+    }
+  }
+  if (c.status != eslOK || c.p != c.end) { status = eslEFORMAT; goto ERROR; }
+
+  *ret_hit      = hit;
+  *ret_data     = (char *) data.buf;
+  *ret_datasize = data.n;
+  return eslOK;
+
+ ERROR:
+  if (hit      != NULL) free(hit);
+  if (data.buf != NULL) free(data.buf);
+  *ret_hit      = NULL;
+  *ret_data     = NULL;
+  *ret_datasize = 0;
+  return status;
+}
+
+
+/*****************************************************************
+ * Unit tests.
+ *****************************************************************/
+#ifdef p7HMMDUTILS_TESTDRIVE
+
+/* utest_set_alidisplay()
+ * Fill in alignment display <ad> for a domain, with strings of length
+ * <len> (the longest string is the aligned target, <slen> long), and
+ * NULL for the optional lines.
+ */
+static void
+utest_set_alidisplay(P7_ALIDISPLAY *ad, int len, int slen)
+{
+  char *p;
+
+  memset(ad, 0, sizeof(P7_ALIDISPLAY));
+  ad->memsize = 3 * (len + 1) + (slen + 1) + 4 * 8;
+  if ((ad->mem = malloc(ad->memsize)) == NULL) esl_fatal("allocation failed");
+  p = ad->mem;
+
+  ad->model   = p; memset(p, 'M', len);  p[len]  = '\0'; p += len + 1;
+  ad->mline   = p; memset(p, '+', len);  p[len]  = '\0'; p += len + 1;
+  ad->ppline  = p; memset(p, '9', len);  p[len]  = '\0'; p += len + 1;
+  ad->aseq    = p; memset(p, 'a', slen); p[slen] = '\0'; p += slen + 1;
+  ad->hmmname = p; strcpy(p, "query");   p += 8;
+  ad->hmmacc  = p; strcpy(p, "");        p += 8;
+  ad->sqname  = p; strcpy(p, "target");  p += 8;
+  ad->sqdesc  = p; strcpy(p, "desc");    p += 8;
+
+  ad->N       = len;
+  ad->hmmfrom = 1;      ad->hmmto = len;   ad->M = len;
+  ad->sqfrom  = 100;    ad->sqto  = 10;    ad->L = INT64_MAX;
+}
+
+/* utest_check_alidisplay()
+ * Compare a decoded alignment display <ad>, whose string pointers are
+ * offsets from <base>, to the original <ad0>.
+ */
+static void
+utest_check_alidisplay(char *msg, char *base, P7_ALIDISPLAY *ad, P7_ALIDISPLAY *ad0)
+{
+  char **s[AD_NSTRINGS];
+  char **s0[AD_NSTRINGS];
+  int    k;
+
+  if (ad->N       != ad0->N       || ad->hmmfrom != ad0->hmmfrom || ad->hmmto != ad0->hmmto || ad->M != ad0->M) esl_fatal(msg);
+  if (ad->sqfrom  != ad0->sqfrom  || ad->sqto    != ad0->sqto    || ad->L     != ad0->L)                       esl_fatal(msg);
+  if (ad->memsize != ad0->memsize)                                                                            esl_fatal(msg);
+
+  ad_strings(ad,  s);
+  ad_strings(ad0, s0);
+  for (k = 0; k < AD_NSTRINGS; ++k) {
+    if ((*s[k] == NULL) != (*s0[k] == NULL)) esl_fatal(msg);
+    if (*s[k] != NULL && strcmp(base + (*s[k] - (char *) NULL), *s0[k]) != 0) esl_fatal(msg);
+  }
+}
+
+/* utest_roundtrip()
+ * Encode <nhits> hits of up to three domains each and decode them
+ * again. The hits carry negative and extreme values, which the zigzag
+ * encoding has to bring back; every third hit has no description, and
+ * the last domain of each hit has a target line <slen> long. Decoding
+ * the encoding with any byte missing must fail with <eslEFORMAT>.
+ */
+static void
+utest_roundtrip(int nhits, int slen)
+{
+  char              msg[] = "hmmpgmd results round trip test failed";
+  HMMD_SEARCH_STATS stats, stats2;
+  P7_TOPHITS       *th    = p7_tophits_Create();
+  P7_HIT           *hit;
+  P7_HIT           *h;
+  P7_HIT           *hit2  = NULL;
+  P7_DOMAIN        *dom;
+  P7_DOMAIN         dom2;
+  P7_ALIDISPLAY     ad2;
+  char             *buf   = NULL;
+  char             *data  = NULL;
+  char             *base;
+  char             *adp;
+  char              name[32];
+  uint64_t          n;
+  uint64_t          datasize;
+  uint64_t          hdr;
+  int               i, j;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.elapsed    = 1.5;    stats.user = 2.25;   stats.sys = 0.125;
+  stats.Z          = 1e6;    stats.domZ = 42.0;
+  stats.Z_setby    = p7_ZSETBY_OPTION;            stats.domZ_setby = p7_ZSETBY_NTARGETS;
+  stats.nmodels    = 1;      stats.nseqs       = UINT64_MAX;
+  stats.n_past_msv = 1000;   stats.n_past_bias = 900;
+  stats.n_past_vit = 100;    stats.n_past_fwd  = 10;
+  stats.nhits      = nhits;  stats.nreported   = nhits / 2;   stats.nincluded = nhits / 3;
+
+  for (i = 0; i < nhits; ++i) {
+    if (p7_tophits_CreateNextHit(th, &hit) != eslOK) esl_fatal(msg);
+
+    /* negative names and descriptions, and differences of either sign between consecutive hits */
+    sprintf(name, "%d", (i % 2) ? -i : i * 1000);
+    esl_strdup(name, -1, &hit->name);
+    hit->acc  = NULL;
+    hit->desc = NULL;
+    if (i % 3 != 2) esl_strdup((i % 2) ? "-12343829483298 -7" : "12343829483298 1234", -1, &hit->desc);
+
+    hit->window_length = -i;
+    hit->sortkey       = -i * 0.5;
+    hit->score         = i - 10.5f;  hit->pre_score = -1.0f;   hit->sum_score = 3.0f;
+    hit->lnP           = -i * 10.0;  hit->pre_lnP   = -1e300;  hit->sum_lnP   = 0.0;
+    hit->nexpected     = 1.5f;
+    hit->nregions      = 1;          hit->nclustered = 0;      hit->noverlaps = 2;
+    hit->nenvelopes    = 3;          hit->ndom       = i % 4;  hit->flags     = p7_IS_REPORTED | p7_IS_INCLUDED;
+    hit->nreported     = hit->ndom;  hit->nincluded  = -1;     hit->best_domain = (i % 2) ? INT32_MIN : INT32_MAX;
+    hit->seqidx        = (i % 2) ? INT64_MIN : INT64_MAX;
+    hit->subseq_start  = -i;
+
+    if (hit->ndom > 0 && (hit->dcl = calloc(hit->ndom, sizeof(P7_DOMAIN))) == NULL) esl_fatal(msg);
+    for (j = 0; j < hit->ndom; ++j) {
+      dom = &hit->dcl[j];
+      dom->ienv  = -j;   dom->jenv = j;
+      dom->iali  = INT64_MIN;      dom->jali = INT64_MAX;
+      dom->iorf  = -1;   dom->jorf = 0;
+      dom->envsc = -2.5f;  dom->domcorrection = 0.25f;  dom->dombias = -0.0f;
+      dom->oasc  = 7.0f;   dom->bitscore      = -100.0f;
+      dom->lnP   = -i - j;
+      dom->is_reported = TRUE;
+      dom->is_included = (j % 2);
+      if ((dom->ad = malloc(sizeof(P7_ALIDISPLAY))) == NULL) esl_fatal(msg);
+      utest_set_alidisplay(dom->ad, 10 + j, (j == hit->ndom - 1) ? slen : 10 + j);
+    }
+  }
+
+  if (hmmpgmd_EncodeResults(&stats, th, &buf, &n) != eslOK) esl_fatal(msg);
+  if (hmmpgmd_DecodeResults(buf, n, &stats2, &hit2, &data, &datasize) != eslOK) esl_fatal(msg);
+
+  if (stats2.elapsed    != stats.elapsed    || stats2.user        != stats.user        || stats2.sys        != stats.sys)        esl_fatal(msg);
+  if (stats2.Z          != stats.Z          || stats2.domZ        != stats.domZ)                                               esl_fatal(msg);
+  if (stats2.Z_setby    != stats.Z_setby    || stats2.domZ_setby  != stats.domZ_setby)                                         esl_fatal(msg);
+  if (stats2.nmodels    != stats.nmodels    || stats2.nseqs       != stats.nseqs)                                              esl_fatal(msg);
+  if (stats2.n_past_msv != stats.n_past_msv || stats2.n_past_bias != stats.n_past_bias)                                        esl_fatal(msg);
+  if (stats2.n_past_vit != stats.n_past_vit || stats2.n_past_fwd  != stats.n_past_fwd)                                         esl_fatal(msg);
+  if (stats2.nhits      != stats.nhits      || stats2.nreported   != stats.nreported   || stats2.nincluded  != stats.nincluded)  esl_fatal(msg);
+  if (nhits == 0 && datasize != 0)                                                                                             esl_fatal(msg);
+
+  /* the hits' offsets count from the start of the stats, as in the original format */
+  hdr = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * nhits;
+  for (i = 0; i < nhits; ++i) {
+    hit = &th->unsrt[i];
+    h   = &hit2[i];
+
+    if ((intptr_t) h->name != strtol(hit->name, NULL, 10)) esl_fatal(msg);
+    if (hit->desc == NULL) {
+      if (h->desc != NULL || h->acc != NULL)                  esl_fatal(msg);
+    } else if (i % 2) {
+      if ((intptr_t) h->desc != -12343829483298LL || (intptr_t) h->acc != -7)   esl_fatal(msg);
+    } else {
+      if ((intptr_t) h->desc !=  12343829483298LL || (intptr_t) h->acc != 1234) esl_fatal(msg);
+    }
+
+    if (h->window_length != hit->window_length || h->sortkey    != hit->sortkey)                              esl_fatal(msg);
+    if (h->score         != hit->score         || h->pre_score  != hit->pre_score || h->sum_score != hit->sum_score) esl_fatal(msg);
+    if (h->lnP           != hit->lnP           || h->pre_lnP    != hit->pre_lnP   || h->sum_lnP   != hit->sum_lnP)   esl_fatal(msg);
+    if (h->nexpected     != hit->nexpected)                                                                   esl_fatal(msg);
+    if (h->nregions      != hit->nregions      || h->nclustered != hit->nclustered || h->noverlaps != hit->noverlaps) esl_fatal(msg);
+    if (h->nenvelopes    != hit->nenvelopes    || h->ndom       != hit->ndom       || h->flags     != hit->flags)     esl_fatal(msg);
+    if (h->nreported     != hit->nreported     || h->nincluded  != hit->nincluded  || h->best_domain != hit->best_domain) esl_fatal(msg);
+    if (h->seqidx        != hit->seqidx        || h->subseq_start != hit->subseq_start)                       esl_fatal(msg);
+    if (h->offset < hdr  || (uint64_t) h->offset - hdr + sizeof(P7_DOMAIN) * h->ndom > datasize)             esl_fatal(msg);
+
+    /* the hit's domains, then each domain's alignment display and its
+     * strings; the blob is packed, so the structs are copied out of it */
+    base = data + (h->offset - hdr);
+    adp  = base + sizeof(P7_DOMAIN) * h->ndom;
+    for (j = 0; j < h->ndom; ++j) {
+      dom = &hit->dcl[j];
+      memcpy(&dom2, base + sizeof(P7_DOMAIN) * j, sizeof(P7_DOMAIN));
+      if (dom2.ienv  != dom->ienv  || dom2.jenv          != dom->jenv)          esl_fatal(msg);
+      if (dom2.iali  != dom->iali  || dom2.jali          != dom->jali)          esl_fatal(msg);
+      if (dom2.iorf  != dom->iorf  || dom2.jorf          != dom->jorf)          esl_fatal(msg);
+      if (dom2.envsc != dom->envsc || dom2.domcorrection != dom->domcorrection) esl_fatal(msg);
+      if (dom2.oasc  != dom->oasc  || dom2.bitscore      != dom->bitscore)      esl_fatal(msg);
+      if (dom2.lnP   != dom->lnP   || dom2.dombias       != dom->dombias)       esl_fatal(msg);
+      if (dom2.is_reported != dom->is_reported || dom2.is_included != dom->is_included) esl_fatal(msg);
+
+      if (adp + sizeof(P7_ALIDISPLAY) > data + datasize) esl_fatal(msg);
+      memcpy(&ad2, adp, sizeof(P7_ALIDISPLAY));
+      if (adp + sizeof(P7_ALIDISPLAY) + ad2.memsize > data + datasize) esl_fatal(msg);
+      utest_check_alidisplay(msg, base, &ad2, dom->ad);
+      adp += sizeof(P7_ALIDISPLAY) + ad2.memsize;
+    }
+  }
+  free(hit2);
+  free(data);
+
+  /* a short buffer fails cleanly, wherever it was cut */
+  for (n = n - 1; n > 0; n = (n > 64) ? n - n / 7 - 1 : n - 1) {
+    if (hmmpgmd_DecodeResults(buf, n, &stats2, &hit2, &data, &datasize) != eslEFORMAT) esl_fatal(msg);
+    if (hit2 != NULL || data != NULL || datasize != 0)                                esl_fatal(msg);
+  }
+
+  free(buf);
+  p7_tophits_Destroy(th);
+}
+
+#endif /*p7HMMDUTILS_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
 #endif /*HMMER_THREADS*/
+
+
+/*****************************************************************
+ * Test driver.
+ *****************************************************************/
+#ifdef p7HMMDUTILS_TESTDRIVE
+
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_getopts.h"
+
+#include "hmmer.h"
+#include "hmmpgmd.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  { "-L",        eslARG_INT, "100000", NULL, "n>0", NULL,  NULL, NULL, "length of the longest alignment line",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for hmmpgmd utilities";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS *go = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+
+  fprintf(stderr, "## %s\n", argv[0]);
+
+#ifdef HMMER_THREADS
+  utest_roundtrip(0,  10);                              /* empty hit list          */
+  utest_roundtrip(1,  10);
+  utest_roundtrip(50, 10);
+  utest_roundtrip(5,  esl_opt_GetInteger(go, "-L"));    /* long alignment strings  */
+#endif
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7HMMDUTILS_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
@@ -13,6 +13,7 @@
 #include <pthread.h>
 #include <setjmp.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>     /* On FreeBSD, you need netinet/in.h for struct sockaddr_in            */
 #endif                      /* On OpenBSD, netinet/in.h is required for (must precede) arpa/inet.h */
@@ -36,6 +37,7 @@
 #include "hmmpgmd.h"
 #include "cachedb.h"
 #include "p7_hmmcache.h"
+#include "p7_scheduler.h"
 
 #define MAX_WORKERS  64
 #define MAX_BUFFER   4096
@@ -48,15 +50,20 @@ typedef struct {
   int               db_Z;        /* true number of sequences         */
 
   P7_OPROFILE     **om_list;     /* list of profiles to process      */
+  P7_MSVPROFILE    *msv_list;    /* their MSV stage: msv_list[i] for om_list[i] */
   int               om_cnt;      /* number of profiles               */
 
   pthread_mutex_t  *inx_mutex;   /* protect data                     */
   int              *blk_size;    /* sequences per block              */
   int              *limit;       /* point to decrease block size     */
   int              *inx;         /* next index to process            */
+  int              *cancel;      /* TRUE to stop at the next block   */
+  int              *nfinished;   /* number of threads done           */
+  int               wake_fd;     /* the last thread done writes here */
 
+  int               nq;          /* number of queries: 1, or a batch */
   P7_HMM           *hmm;         /* query HMM                        */
-  ESL_SQ           *seq;         /* query sequence                   */
+  ESL_SQ          **seq;         /* seq[q]: query sequences, or NULL */
   ESL_ALPHABET     *abc;         /* digital alphabet                 */
   ESL_GETOPTS      *opts;        /* search specific options          */
 
@@ -64,34 +71,57 @@ typedef struct {
 
   double            elapsed;     /* elapsed search time              */
 
+  const P7_NUMA    *numa;        /* if non-NULL, pin the thread (--numa) */
+  int               node;        /* NUMA node to pin the thread to   */
+
   /* Structure created and populated by the individual threads.
    * The main thread is responsible for freeing up the memory.
    */
-  P7_PIPELINE      *pli;         /* work pipeline                    */
-  P7_TOPHITS       *th;          /* top hit results                  */
+  P7_PIPELINE     **pli;         /* pli[q]: work pipeline for query q  */
+  P7_TOPHITS      **th;          /* th[q]: top hit results for query q */
 } WORKER_INFO;
 
+/* The databases resident in one slot (see HMMD_MAX_DBS). */
+typedef struct {
+  P7_SEQCACHE  *seq_db;          /* cached sequence database         */
+  P7_HMMCACHE  *hmm_db;          /* cached hmm database              */
+
+  P7_SEQCACHE **seq_rep;         /* seq_rep[n]: node n's copy; [0] is <seq_db>      */
+  P7_HMMCACHE **hmm_rep;         /* hmm_rep[n]: node n's copy; [0] is <hmm_db>      */
+} WORKER_DB;
+
 typedef struct {
   int fd;                        /* socket connection to server      */
   int ncpus;                     /* number of cpus to use            */
+  int wake[2];                   /* pipe: search threads are done    */
+
+  WORKER_DB     db[HMMD_MAX_DBS];/* resident databases, by slot      */
 
-  P7_SEQCACHE *seq_db;           /* cached sequence database         */
-  P7_HMMCACHE *hmm_db;           /* cached hmm database              */
+  P7_NUMA      *numa;            /* NUMA topology if --numa; else NULL              */
+  int           nrep;            /* # of database copies: numa->nnodes if --numa_rep, else 1 */
 } WORKER_ENV;
 
+static int  process_VersionCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
 static void process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
+static void process_DropCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
 static void process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query);
 static void process_Shutdown(HMMD_COMMAND *cmd, WORKER_ENV *env);
 
+static void replicate_caches(WORKER_ENV *env, WORKER_DB *db);
+static void close_caches(WORKER_ENV *env, WORKER_DB *db);
+
 static QUEUE_DATA *process_QueryCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
 
 static int  setup_masterside_comm(ESL_GETOPTS *opts);
 
 static void send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli);
+static void send_cancelled(int fd);
 
 #define BLOCK_SIZE 1000
 static void search_thread(void *arg);
 static void scan_thread(void *arg);
+static void thread_done(ESL_THREADS *obj, WORKER_INFO *info);
+static void watch_master(WORKER_ENV *env, pthread_mutex_t *inx_mutex, int *cancel);
 
 static void
 print_timings(int i, double elapsed, P7_PIPELINE *pli)
@@ -144,8 +174,10 @@ worker_process(ESL_GETOPTS *go)
 {
   HMMD_COMMAND *cmd      = NULL;  /* see hmmpgmd.h */
   int           shutdown = 0;
+  int           checked  = FALSE; /* TRUE once the master checked our command version */
   WORKER_ENV    env;
   int           status;
+  int           i;
    
   QUEUE_DATA      *query      = NULL;   
   
@@ -155,17 +187,38 @@ worker_process(ESL_GETOPTS *go)
 
   env.ncpus = ESL_MIN(esl_opt_GetInteger(go, "--cpu"),  esl_threads_GetCPUCount());
 
-  env.hmm_db = NULL;
-  env.seq_db = NULL;
-  env.fd     = setup_masterside_comm(go);
+  env.numa    = NULL;
+  env.nrep    = 1;
+  if (esl_opt_GetBoolean(go, "--numa")) {
+    if ((env.numa = p7_numa_Create()) == NULL) LOG_FATAL_MSG("NUMA topology", errno);
+    if (esl_opt_GetBoolean(go, "--numa_rep")) env.nrep = env.numa->nnodes;
+  }
+  for (i = 0; i < HMMD_MAX_DBS; i++) {
+    env.db[i].hmm_db  = NULL;
+    env.db[i].seq_db  = NULL;
+    if ((env.db[i].seq_rep = calloc(env.nrep, sizeof(P7_SEQCACHE *))) == NULL) LOG_FATAL_MSG("malloc", errno);
+    if ((env.db[i].hmm_rep = calloc(env.nrep, sizeof(P7_HMMCACHE *))) == NULL) LOG_FATAL_MSG("malloc", errno);
+  }
+
+  if (pipe(env.wake) < 0) LOG_FATAL_MSG("pipe", errno);
+
+  env.fd      = setup_masterside_comm(go);
 
   while (!shutdown) 
     {
       if ((status = read_Command(&cmd, &env)) != eslOK) break;
 
+      /* a master older than the version check sends commands we'd misread */
+      if (! checked && cmd->hdr.command != HMMD_CMD_VERSION) {
+	p7_syslog(LOG_ERR,"[%s:%d] - master sent command %d before checking our command version %d: it is older\n", __FILE__, __LINE__, cmd->hdr.command, HMMD_PROTOCOL_VERSION);
+	free(cmd);
+	break;
+      }
 
       switch (cmd->hdr.command) {
+      case HMMD_CMD_VERSION:   if (process_VersionCmd(cmd, &env) != eslOK) shutdown = 1; checked = TRUE; break;
       case HMMD_CMD_INIT:      process_InitCmd  (cmd, &env);                break;
+      case HMMD_CMD_DROP:      process_DropCmd  (cmd, &env);                break;
       case HMMD_CMD_SCAN: 
 	  {	  
  		   query = process_QueryCmd(cmd, &env);
@@ -178,6 +231,7 @@ worker_process(ESL_GETOPTS *go)
 	     process_SearchCmd(cmd, &env, query);
          break;
       case HMMD_CMD_SHUTDOWN:  process_Shutdown (cmd, &env);  shutdown = 1; break;
+      case HMMD_CMD_CANCEL:    /* came in after the range it cancels was done */ break;
       default: p7_syslog(LOG_ERR,"[%s:%d] - unknown command %d (%d)\n", __FILE__, __LINE__, cmd->hdr.command, cmd->hdr.length);
       }
 
@@ -185,8 +239,14 @@ worker_process(ESL_GETOPTS *go)
       cmd = NULL;
     }
 
-  if (env.hmm_db) p7_hmmcache_Close(env.hmm_db);
-  if (env.seq_db) p7_seqcache_Close(env.seq_db);
+  for (i = 0; i < HMMD_MAX_DBS; i++) {
+    close_caches(&env, &env.db[i]);
+    free(env.db[i].seq_rep);
+    free(env.db[i].hmm_rep);
+  }
+  p7_numa_Destroy(env.numa);
+  close(env.wake[0]);
+  close(env.wake[1]);
   if (env.fd != -1) close(env.fd);
   return;
 }
@@ -196,16 +256,22 @@ static void
 process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
 { 
   int              i;
+  int              q;
   int              cnt;
   int              limit;
   int              status;
   int              blk_size;
   WORKER_INFO     *info       = NULL;
+  ESL_SQ         **seqs       = NULL;
+  QUEUE_DATA      *node;
+  WORKER_DB       *db         = &env->db[query->db_slot];
   ESL_ALPHABET    *abc;
   ESL_STOPWATCH   *w;
   ESL_THREADS     *threadObj  = NULL;
   pthread_mutex_t  inx_mutex;
   int              current_index;
+  int              cancel     = FALSE;
+  int              nfinished  = 0;
   time_t           date;
   char             timestamp[32];
 
@@ -233,8 +299,15 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
   if (query->cmd_type == HMMD_CMD_SEARCH) threadObj = esl_threads_Create(&search_thread);
   else                                    threadObj = esl_threads_Create(&scan_thread);
 
+  /* the query sequences, in the order their results are sent back */
+  if (query->query_type == HMMD_SEQUENCE) {
+    ESL_ALLOC(seqs, sizeof(ESL_SQ *) * query->nq);
+    for (q = 0, node = query; q < query->nq; ++q, node = node->next) seqs[q] = node->seq;
+  }
+
   if (query->query_type == HMMD_SEQUENCE) {
     fprintf(stdout, "Search seq %s  [L=%ld]", query->seq->name, (long) query->seq->n);
+    if (query->nq > 1) fprintf(stdout, " and %d more", query->nq - 1);
   } else {
     fprintf(stdout, "Search hmm %s  [M=%d]", query->hmm->name, query->hmm->M);
   }
@@ -250,12 +323,16 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
   /* Create processing pipeline and hit list */
   for (i = 0; i < env->ncpus; ++i) {
     info[i].abc   = query->abc;
+    info[i].nq    = query->nq;
     info[i].hmm   = query->hmm;
-    info[i].seq   = query->seq;
+    info[i].seq   = seqs;
     info[i].opts  = query->opts;
 
     info[i].range_list  = info[0].range_list;
 
+    info[i].numa  = env->numa;
+    info[i].node  = env->numa ? i % env->numa->nnodes : 0;
+
     info[i].th    = NULL;
     info[i].pli   = NULL;
 
@@ -263,19 +340,25 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
     info[i].inx       = &current_index;/* this is confusing trickery - to share a single variable across all threads */
     info[i].blk_size  = &blk_size;     /* ditto */
     info[i].limit     = &limit;	       /* ditto. TODO: come back and clean this up. */
+    info[i].cancel    = &cancel;
+    info[i].nfinished = &nfinished;
+    info[i].wake_fd   = env->wake[1];
 
+    /* with --numa_rep, each thread searches its own node's copy */
     if (query->cmd_type == HMMD_CMD_SEARCH) {
-      HMMER_SEQ **list  = env->seq_db->db[query->dbx].list;
+      HMMER_SEQ **list  = db->seq_rep[info[i].node % env->nrep]->db[query->dbx].list;
       info[i].sq_list   = &list[query->inx];
       info[i].sq_cnt    = query->cnt;
-      info[i].db_Z      = env->seq_db->db[query->dbx].K;
+      info[i].db_Z      = db->seq_db->db[query->dbx].K;
       info[i].om_list   = NULL;
+      info[i].msv_list  = NULL;
       info[i].om_cnt    = 0;
     } else {
       info[i].sq_list   = NULL;
       info[i].sq_cnt    = 0;
       info[i].db_Z      = 0;
-      info[i].om_list   = &env->hmm_db->list[query->inx];
+      info[i].om_list   = &db->hmm_rep[info[i].node % env->nrep]->list[query->inx];
+      info[i].msv_list  = &db->hmm_rep[info[i].node % env->nrep]->msv[query->inx];
       info[i].om_cnt    = query->cnt;
     }
 
@@ -301,29 +384,43 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
   current_index = 0;
 
   esl_threads_WaitForStart(threadObj);
+  watch_master(env, &inx_mutex, &cancel);
   esl_threads_WaitForFinish(threadObj);
 
   esl_stopwatch_Stop(w);
 #if 1
   fprintf (stdout, "   Sequences  Residues                              Elapsed\n");
   for (i = 0; i < env->ncpus; ++i) {
-    print_timings(i, info[i].elapsed, info[i].pli);
+    print_timings(i, info[i].elapsed, info[i].pli[0]);
   }
 #endif
-  /* merge the results of the search results */
+  /* merge the results of the search results, query by query */
   for (i = 1; i < env->ncpus; ++i) {
-    p7_tophits_Merge(info[0].th, info[i].th);
-    p7_pipeline_Merge(info[0].pli, info[i].pli);
-    p7_pipeline_Destroy(info[i].pli);
-    p7_tophits_Destroy(info[i].th);
+    for (q = 0; q < query->nq; ++q) {
+      p7_tophits_Merge(info[0].th[q], info[i].th[q]);
+      p7_pipeline_Merge(info[0].pli[q], info[i].pli[q]);
+      p7_pipeline_Destroy(info[i].pli[q]);
+      p7_tophits_Destroy(info[i].th[q]);
+    }
+    free(info[i].pli);
+    free(info[i].th);
   }
 
-  print_timings(99, w->elapsed, info[0].pli);
-  send_results(env->fd, w, info[0].th, info[0].pli);
+  /* one answer for each query of a batch, in order */
+  print_timings(99, w->elapsed, info[0].pli[0]);
+  for (q = 0; q < query->nq; ++q) {
+    if (cancel) send_cancelled(env->fd);
+    else        send_results(env->fd, w, info[0].th[q], info[0].pli[q]);
+  }
 
   /* free the last of the pipeline data */
-  p7_pipeline_Destroy(info->pli);
-  p7_tophits_Destroy(info->th);
+  for (q = 0; q < query->nq; ++q) {
+    p7_pipeline_Destroy(info->pli[q]);
+    p7_tophits_Destroy(info->th[q]);
+  }
+  free(info->pli);
+  free(info->th);
+  if (seqs != NULL) free(seqs);
 
   esl_threads_Destroy(threadObj);
 
@@ -353,12 +450,17 @@ process_QueryCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
   int                n;
   int                status;
 
+  int                q;
+  uint32_t           len;
+
   char              *p;
   char              *name;
   char              *desc;
   ESL_DSQ           *dsq;
 
   QUEUE_DATA        *query  = NULL;
+  QUEUE_DATA        *last   = NULL;
+  QUEUE_DATA        *node   = NULL;
 
   if ((query = malloc(sizeof(QUEUE_DATA))) == NULL) LOG_FATAL_MSG("malloc", errno);
   memset(query, 0, sizeof(QUEUE_DATA));	 /* avoid uninitialized bytes. remove this, if we ever serialize/deserialize structures properly */
@@ -368,10 +470,13 @@ process_QueryCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
   query->cmd_type   = cmd->hdr.command;
   query->query_type = cmd->srch.query_type;
   query->dbx        = cmd->srch.db_inx;
+  query->db_slot    = cmd->srch.db_slot;
   query->inx        = cmd->srch.inx;
   query->cnt        = cmd->srch.cnt;
   query->sock       = env->fd;
   query->cmd        = NULL;
+  query->nq         = (cmd->srch.query_cnt > 0) ? cmd->srch.query_cnt : 1;
+  query->next       = NULL;
 
   p = cmd->srch.data;
 
@@ -386,11 +491,28 @@ process_QueryCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
 
   /* check if we are processing a sequence or hmm */
   if (cmd->srch.query_type == HMMD_SEQUENCE) {
-    n    = cmd->srch.query_length - 2;
-    name = p + cmd->srch.opts_length;
-    desc = name + strlen(name) + 1;
-    dsq  = (ESL_DSQ *) (desc + strlen(desc) + 1);
-    query->seq = esl_sq_CreateDigitalFrom(query->abc, name, dsq, n, desc, NULL, NULL);
+    /* a batch chains the sequences after the first onto <query> */
+    p  += cmd->srch.opts_length;
+    len = cmd->srch.query_length;
+    last = query;
+    for (q = 0; q < query->nq; ++q) {
+      if (q > 0) {
+        memcpy(&len, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+
+        if ((node = malloc(sizeof(QUEUE_DATA))) == NULL) LOG_FATAL_MSG("malloc", errno);
+        memset(node, 0, sizeof(QUEUE_DATA));
+        last->next = node;
+        last       = node;
+      }
+
+      n    = len - 2;
+      name = p;
+      desc = name + strlen(name) + 1;
+      dsq  = (ESL_DSQ *) (desc + strlen(desc) + 1);
+      last->seq = esl_sq_CreateDigitalFrom(query->abc, name, dsq, n, desc, NULL, NULL);
+      p = (char *) dsq + len;
+    }
   } else {
     P7_HMM  thmm;
     P7_HMM *hmm = p7_hmm_CreateShell();
@@ -455,18 +577,23 @@ process_Shutdown(HMMD_COMMAND *cmd, WORKER_ENV  *env)
   }
 }
 
+/* process_InitCmd()
+ * Load the databases named in <cmd> into its slot, replacing any that
+ * were there; the other slots are left alone, so searches of them go on
+ * while a new version of a database is loaded next to the current one.
+ */
 static void
 process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
 {
-  char *p;
-  int   n;
-  int   status;
+  WORKER_DB *db;
+  char      *p;
+  int        n;
+  int        status;
 
-  if (env->hmm_db != NULL) p7_hmmcache_Close(env->hmm_db);
-  if (env->seq_db != NULL) p7_seqcache_Close(env->seq_db);
+  if (cmd->init.db_slot >= HMMD_MAX_DBS) LOG_FATAL_MSG("database slot", cmd->init.db_slot);
+  db = &env->db[cmd->init.db_slot];
 
-  env->hmm_db = NULL;
-  env->seq_db = NULL;
+  close_caches(env, db);
 
   /* load the sequence database */
   if (cmd->init.db_cnt != 0) {
@@ -486,7 +613,7 @@ process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
       LOG_FATAL_MSG("database integrity error", 0);
     }
 
-    env->seq_db = sdb;
+    db->seq_db = sdb;
   }
 
   /* load the hmm database */
@@ -514,13 +641,17 @@ process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
       LOG_FATAL_MSG("database integrity error", 0);
     }
 
-    env->hmm_db = hcache;
+    db->hmm_db = hcache;
 
     printf("Loaded profile db %s;  models: %d  memory: %" PRId64 "\n",
          p, hcache->n, (uint64_t) p7_hmmcache_Sizeof(hcache));
 
   }
 
+  db->seq_rep[0] = db->seq_db;
+  db->hmm_rep[0] = db->hmm_db;
+  if (env->nrep > 1) replicate_caches(env, db);
+
   /* if stdout is redirected at the commandline, it causes printf's to be buffered,
    * which means status logging isn't printed. This line strongly requests unbuffering,
    * which should be ok, given the low stdout load of hmmpgmd
@@ -538,11 +669,209 @@ process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
   }
 }
 
+/* process_VersionCmd()
+ * Answer the master's check of the version of the commands (see
+ * check_version() in hmmdmstr.c) with our own. Returns <eslOK> if the
+ * versions match; else <eslEINCOMPAT>, and the master turns us away.
+ */
+static int
+process_VersionCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
+{
+  HMMD_COMMAND reply;
+  uint32_t     version = 0;
+  int          n;
+
+  if (cmd->hdr.length >= sizeof(HMMD_VERSION_CMD)) version = cmd->vers.version;
+
+  memset(&reply, 0, sizeof(HMMD_COMMAND));
+  reply.hdr.command  = HMMD_CMD_VERSION;
+  reply.hdr.length   = sizeof(HMMD_VERSION_CMD);
+  reply.hdr.status   = eslOK;
+  reply.vers.version = HMMD_PROTOCOL_VERSION;
+
+  n = MSG_SIZE(&reply);
+  if (writen(env->fd, &reply, n) != n) {
+    LOG_FATAL_MSG("write error", errno);
+  }
+
+  if (version != HMMD_PROTOCOL_VERSION) {
+    p7_syslog(LOG_ERR,"[%s:%d] - master uses command version %d, this worker %d\n", __FILE__, __LINE__, version, HMMD_PROTOCOL_VERSION);
+    return eslEINCOMPAT;
+  }
+  return eslOK;
+}
+
+/* process_DropCmd()
+ * Free the databases in the slot of <cmd>, once the master has no
+ * searches left against them.
+ */
+static void
+process_DropCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
+{
+  int n;
+
+  if (cmd->init.db_slot >= HMMD_MAX_DBS) LOG_FATAL_MSG("database slot", cmd->init.db_slot);
+  close_caches(env, &env->db[cmd->init.db_slot]);
+
+  printf("Dropped databases in slot %d\n", cmd->init.db_slot);
+
+  n = MSG_SIZE(cmd);
+  cmd->hdr.status = eslOK;
+  if (writen(env->fd, cmd, n) != n) {
+    LOG_FATAL_MSG("write error", errno);
+  }
+}
+
+/* replicate_caches()
+ * For --numa_rep: make a copy of the loaded databases on each NUMA
+ * node but the first, which keeps the originals. Each copy is made
+ * by a thread pinned to its node, so that its pages are allocated
+ * (first touched) there.
+ */
+typedef struct {
+  WORKER_ENV *env;
+  WORKER_DB  *db;
+  int         node;
+  int         status;
+} REPLICA_ARG;
+
+static void *
+replicate_thread(void *arg)
+{
+  REPLICA_ARG *ra  = (REPLICA_ARG *) arg;
+  WORKER_DB   *db  = ra->db;
+
+  p7_numa_Bind(ra->env->numa, ra->node);
+  ra->status = eslOK;
+  if (db->seq_db != NULL && ra->status == eslOK) ra->status = p7_seqcache_Replicate(db->seq_db, &db->seq_rep[ra->node]);
+  if (db->hmm_db != NULL && ra->status == eslOK) ra->status = p7_hmmcache_Replicate(db->hmm_db, &db->hmm_rep[ra->node]);
+  return NULL;
+}
+
+static void
+replicate_caches(WORKER_ENV *env, WORKER_DB *db)
+{
+  pthread_t   *tid = NULL;
+  REPLICA_ARG *ra  = NULL;
+  int          n;
+
+  if ((tid = malloc(sizeof(pthread_t)   * env->nrep)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  if ((ra  = malloc(sizeof(REPLICA_ARG) * env->nrep)) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+  for (n = 1; n < env->nrep; n++) {
+    ra[n].env  = env;
+    ra[n].db   = db;
+    ra[n].node = n;
+    if ((errno = pthread_create(&tid[n], NULL, replicate_thread, &ra[n])) != 0) LOG_FATAL_MSG("pthread_create", errno);
+  }
+  for (n = 1; n < env->nrep; n++) {
+    if ((errno = pthread_join(tid[n], NULL)) != 0) LOG_FATAL_MSG("pthread_join", errno);
+    if (ra[n].status != eslOK) LOG_FATAL_MSG("cache replica error", ra[n].status);
+  }
+
+  printf("Replicated cached databases on %d NUMA nodes\n", env->nrep);
+  free(ra);
+  free(tid);
+}
+
+/* close_caches()
+ * Free the databases loaded in slot <db> and their per-node copies.
+ * The copies go first: cloned profiles share the original cache's
+ * alphabet.
+ */
+static void
+close_caches(WORKER_ENV *env, WORKER_DB *db)
+{
+  int n;
+
+  for (n = 1; n < env->nrep; n++) {
+    if (db->seq_rep[n] != NULL) p7_seqcache_Close(db->seq_rep[n]);
+    if (db->hmm_rep[n] != NULL) p7_hmmcache_Close(db->hmm_rep[n]);
+    db->seq_rep[n] = NULL;
+    db->hmm_rep[n] = NULL;
+  }
+  if (db->hmm_db != NULL) p7_hmmcache_Close(db->hmm_db);
+  if (db->seq_db != NULL) p7_seqcache_Close(db->seq_db);
+
+  db->hmm_db     = NULL;
+  db->seq_db     = NULL;
+  db->seq_rep[0] = NULL;
+  db->hmm_rep[0] = NULL;
+}
+
+
+/* watch_master()
+ * While the search threads run, watch for the master cancelling the
+ * search; the threads check <*cancel> before each block they take.
+ * Returns once all the threads are done.
+ */
+static void
+watch_master(WORKER_ENV *env, pthread_mutex_t *inx_mutex, int *cancel)
+{
+  HMMD_COMMAND *cmd     = NULL;
+  int           watch   = TRUE;
+  int           done    = FALSE;
+  char          c;
+  fd_set        rset;
+
+  while (!done) {
+    FD_ZERO(&rset);
+    FD_SET(env->wake[0], &rset);
+    if (watch) FD_SET(env->fd, &rset);
+
+    if (select(ESL_MAX(env->fd, env->wake[0]) + 1, &rset, NULL, NULL, NULL) < 0) {
+      if (errno == EINTR) continue;
+      LOG_FATAL_MSG("select", errno);
+    }
+
+    /* the last thread to finish wakes us up */
+    if (FD_ISSET(env->wake[0], &rset)) {
+      if (read(env->wake[0], &c, 1) != 1) LOG_FATAL_MSG("read", errno);
+      done = TRUE;
+    }
+
+    if (watch && FD_ISSET(env->fd, &rset)) {
+      if (read_Command(&cmd, env) != eslOK) {
+        /* lost the master; nobody wants the results */
+        watch = FALSE;
+        cmd   = NULL;
+      } else if (cmd->hdr.command != HMMD_CMD_CANCEL) {
+        p7_syslog(LOG_ERR,"[%s:%d] - unexpected command %d during search\n", __FILE__, __LINE__, cmd->hdr.command);
+        free(cmd);
+        continue;
+      }
+
+      if (pthread_mutex_lock(inx_mutex) != 0) p7_Fail("mutex lock failed");
+      *cancel = TRUE;
+      if (pthread_mutex_unlock(inx_mutex) != 0) p7_Fail("mutex unlock failed");
+
+      if (cmd != NULL) free(cmd);
+      cmd = NULL;
+    }
+  }
+}
+
+/* thread_done()
+ * Count a search thread as done; the last one wakes up watch_master().
+ */
+static void
+thread_done(ESL_THREADS *obj, WORKER_INFO *info)
+{
+  char c = 0;
+  int  last;
+
+  if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
+  last = (++(*info->nfinished) == esl_threads_GetWorkerCount(obj));
+  if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
+
+  if (last && write(info->wake_fd, &c, 1) != 1) LOG_FATAL_MSG("write", errno);
+}
 
 static void 
 search_thread(void *arg)
 {
   int               i;
+  int               q;
   int               count;
   int               seed;
   int               status;
@@ -552,25 +881,31 @@ search_thread(void *arg)
   ESL_SQ            dbsq;
   ESL_STOPWATCH    *w        = NULL;         /* timing stopwatch               */
   P7_BUILDER       *bld      = NULL;         /* HMM construction configuration */
-  P7_BG            *bg       = NULL;         /* null model                     */
-  P7_PIPELINE      *pli      = NULL;         /* work pipeline                  */
-  P7_TOPHITS       *th       = NULL;         /* top hit results                */
+  P7_BG           **bg       = NULL;         /* bg[q]: null model for query q  */
+  P7_PIPELINE     **pli      = NULL;         /* pli[q]: work pipeline          */
+  P7_TOPHITS      **th       = NULL;         /* th[q]: top hit results         */
   P7_PROFILE       *gm       = NULL;         /* generic model                  */
-  P7_OPROFILE      *om       = NULL;         /* optimized query profile        */
+  P7_OPROFILE     **om       = NULL;         /* om[q]: optimized query profile */
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
   info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  p7_numa_Bind(info->numa, info->node); /* before allocating: profile and DP matrices go node-local */
   w    = esl_stopwatch_Create();
-  bg   = p7_bg_Create(info->abc);
   esl_stopwatch_Start(w);
 
+  ESL_ALLOC(bg,  sizeof(P7_BG *)       * info->nq);
+  ESL_ALLOC(om,  sizeof(P7_OPROFILE *) * info->nq);
+  ESL_ALLOC(pli, sizeof(P7_PIPELINE *) * info->nq);
+  ESL_ALLOC(th,  sizeof(P7_TOPHITS *)  * info->nq);
+  for (q = 0; q < info->nq; ++q) bg[q] = p7_bg_Create(info->abc);
+
   /* set up the dummy description and accession fields */
   dbsq.desc = "";
   dbsq.acc  = "";
 
-  /* process a query sequence or hmm */
+  /* process the query sequences or hmm */
   if (info->seq != NULL) {
     bld = p7_builder_Create(NULL, info->abc);
     if ((seed = esl_opt_GetInteger(info->opts, "--seed")) > 0) {
@@ -585,29 +920,32 @@ search_thread(void *arg)
     bld->EfN = esl_opt_GetInteger(info->opts, "--EfN");
     bld->Eft = esl_opt_GetReal   (info->opts, "--Eft");
 
-    if (esl_opt_IsOn(info->opts, "--mxfile")) status = p7_builder_SetScoreSystem (bld, esl_opt_GetString(info->opts, "--mxfile"), NULL, esl_opt_GetReal(info->opts, "--popen"), esl_opt_GetReal(info->opts, "--pextend"), bg);
-    else                                      status = p7_builder_LoadScoreSystem(bld, esl_opt_GetString(info->opts, "--mx"),           esl_opt_GetReal(info->opts, "--popen"), esl_opt_GetReal(info->opts, "--pextend"), bg); 
+    if (esl_opt_IsOn(info->opts, "--mxfile")) status = p7_builder_SetScoreSystem (bld, esl_opt_GetString(info->opts, "--mxfile"), NULL, esl_opt_GetReal(info->opts, "--popen"), esl_opt_GetReal(info->opts, "--pextend"), bg[0]);
+    else                                      status = p7_builder_LoadScoreSystem(bld, esl_opt_GetString(info->opts, "--mx"),           esl_opt_GetReal(info->opts, "--popen"), esl_opt_GetReal(info->opts, "--pextend"), bg[0]); 
     if (status != eslOK) {
       //client_error(info->sock, status, "hmmgpmd: failed to set single query sequence score system: %s", bld->errbuf);
       fprintf(stderr, "hmmpgmd: failed to set single query sequence score system: %s", bld->errbuf);
       pthread_exit(NULL);
       return;
     }
-    p7_SingleBuilder(bld, info->seq, bg, NULL, NULL, NULL, &om); /* bypass HMM - only need model */
+    for (q = 0; q < info->nq; ++q)
+      p7_SingleBuilder(bld, info->seq[q], bg[q], NULL, NULL, NULL, &om[q]); /* bypass HMM - only need model */
     p7_builder_Destroy(bld);
   } else {
-    gm = p7_profile_Create (info->hmm->M, info->abc);
-    om = p7_oprofile_Create(info->hmm->M, info->abc);
-    p7_ProfileConfig(info->hmm, bg, gm, 100, p7_LOCAL);
-    p7_oprofile_Convert(gm, om);
+    gm    = p7_profile_Create (info->hmm->M, info->abc);
+    om[0] = p7_oprofile_Create(info->hmm->M, info->abc);
+    p7_ProfileConfig(info->hmm, bg[0], gm, 100, p7_LOCAL);
+    p7_oprofile_Convert(gm, om[0]);
   }
 
-  /* Create processing pipeline and hit list */
-  th  = p7_tophits_Create(); 
-  pli = p7_pipeline_Create(info->opts, om->M, 100, FALSE, p7_SEARCH_SEQS);
-  p7_pli_NewModel(pli, om, bg);
+  /* Create processing pipelines and hit lists */
+  for (q = 0; q < info->nq; ++q) {
+    th[q]  = p7_tophits_Create(); 
+    pli[q] = p7_pipeline_Create(info->opts, om[q]->M, 100, FALSE, p7_SEARCH_SEQS);
+    p7_pli_NewModel(pli[q], om[q], bg[q]);
 
-  if (pli->Z_setby == p7_ZSETBY_NTARGETS) pli->Z = info->db_Z;
+    if (pli[q]->Z_setby == p7_ZSETBY_NTARGETS) pli[q]->Z = info->db_Z;
+  }
 
   /* loop until all sequences have been processed */
   count = 1;
@@ -616,8 +954,12 @@ search_thread(void *arg)
     int          blksz;
     HMMER_SEQ  **sq;
 
-    /* grab the next block of sequences */
+    /* grab the next block of sequences, unless the search was cancelled */
     if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
+    if (*info->cancel) {
+      if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
+      break;
+    }
     inx = *info->inx;
     blksz = *info->blk_size;
     if (inx > *info->limit) {
@@ -632,26 +974,29 @@ search_thread(void *arg)
     *info->inx += blksz;
     if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
 
-    sq = info->sq_list + inx;
-
     count = info->sq_cnt - inx;
     if (count > blksz) count = blksz;
 
-    /* Main loop: */
-    for (i = 0; i < count; ++i, ++sq) {
-      if ( !(info->range_list) || hmmpgmd_IsWithinRanges ((*sq)->idx, info->range_list)) {
-        dbsq.name  = (*sq)->name;
-        dbsq.dsq   = (*sq)->dsq;
-        dbsq.n     = (*sq)->n;
-        dbsq.idx   = (*sq)->idx;
-        if((*sq)->desc != NULL) dbsq.desc  = (*sq)->desc;
-
-        p7_bg_SetLength(bg, dbsq.n);
-        p7_oprofile_ReconfigLength(om, dbsq.n);
-
-        p7_Pipeline(pli, om, bg, &dbsq, NULL, th);
-
-        p7_pipeline_Reuse(pli);
+    /* Main loop: a batch runs each of its queries over the block
+     * while the block's sequences are still in cache.
+     */
+    for (q = 0; q < info->nq; ++q) {
+      sq = info->sq_list + inx;
+      for (i = 0; i < count; ++i, ++sq) {
+        if ( !(info->range_list) || hmmpgmd_IsWithinRanges ((*sq)->idx, info->range_list)) {
+          dbsq.name  = (*sq)->name;
+          dbsq.dsq   = (*sq)->dsq;
+          dbsq.n     = (*sq)->n;
+          dbsq.idx   = (*sq)->idx;
+          dbsq.desc  = ((*sq)->desc != NULL) ? (*sq)->desc : "";
+
+          p7_bg_SetLength(bg[q], dbsq.n);
+          p7_oprofile_ReconfigLength(om[q], dbsq.n);
+
+          p7_Pipeline(pli[q], om[q], bg[q], &dbsq, NULL, th[q]);
+
+          p7_pipeline_Reuse(pli[q]);
+        }
       }
     }
   }
@@ -661,8 +1006,12 @@ search_thread(void *arg)
   info->pli = pli;
 
   /* clean up */
-  p7_bg_Destroy(bg);
-  p7_oprofile_Destroy(om);
+  for (q = 0; q < info->nq; ++q) {
+    p7_bg_Destroy(bg[q]);
+    p7_oprofile_Destroy(om[q]);
+  }
+  free(bg);
+  free(om);
 
   if (gm != NULL)  p7_profile_Destroy(gm);
 
@@ -671,53 +1020,75 @@ search_thread(void *arg)
 
   esl_stopwatch_Destroy(w);
 
+  thread_done(obj, info);
   esl_threads_Finished(obj, workeridx);
 
   pthread_exit(NULL);
   return;
+
+ ERROR:
+  LOG_FATAL_MSG("malloc", errno);
 }
 
 static void 
 scan_thread(void *arg)
 {
   int               i;
+  int               q;
   int               count;
+  int               status;
   int               workeridx;
   WORKER_INFO      *info;
   ESL_THREADS      *obj;
 
   ESL_STOPWATCH    *w;
 
-  P7_BG            *bg       = NULL;         /* null model                     */
-  P7_PIPELINE      *pli      = NULL;         /* work pipeline                  */
-  P7_TOPHITS       *th       = NULL;         /* top hit results                */
+  P7_BG           **bg       = NULL;         /* bg[q]: null model for query q  */
+  P7_PIPELINE     **pli      = NULL;         /* pli[q]: work pipeline          */
+  P7_TOPHITS      **th       = NULL;         /* th[q]: top hit results         */
+  P7_OPROFILE      *shadow   = NULL;         /* MSV stage of the current target */
+  ESL_SQ           *seq;
+  int               pass;
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
   info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  p7_numa_Bind(info->numa, info->node);
 
   w = esl_stopwatch_Create();
   esl_stopwatch_Start(w);
 
   /* Convert to an optimized model */
-  bg = p7_bg_Create(info->abc);
-
-  /* Create processing pipeline and hit list */
-  th  = p7_tophits_Create(); 
-  pli = p7_pipeline_Create(info->opts, 100, 100, FALSE, p7_SCAN_MODELS);
-
-  p7_pli_NewSeq(pli, info->seq);
+  shadow = p7_oprofile_CreateShadow(info->abc);
+
+  /* Create processing pipelines and hit lists */
+  ESL_ALLOC(bg,  sizeof(P7_BG *)       * info->nq);
+  ESL_ALLOC(pli, sizeof(P7_PIPELINE *) * info->nq);
+  ESL_ALLOC(th,  sizeof(P7_TOPHITS *)  * info->nq);
+  for (q = 0; q < info->nq; ++q) {
+    bg[q]  = p7_bg_Create(info->abc);
+    th[q]  = p7_tophits_Create(); 
+    pli[q] = p7_pipeline_Create(info->opts, 100, 100, FALSE, p7_SCAN_MODELS);
+
+    p7_pli_NewSeq(pli[q], info->seq[q]);
+    p7_bg_SetLength(bg[q], info->seq[q]->n);
+  }
 
   /* loop until all sequences have been processed */
   count = 1;
   while (count > 0) {
-    int           inx;
-    int          blksz;
-    P7_OPROFILE **om;
+    int            inx;
+    int            blksz;
+    P7_OPROFILE  **om;
+    P7_MSVPROFILE *msv;
 
-    /* grab the next block of sequences */
+    /* grab the next block of sequences, unless the search was cancelled */
     if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
+    if (*info->cancel) {
+      if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
+      break;
+    }
     inx   = *info->inx;
     blksz = *info->blk_size;
     if (inx > *info->limit) {
@@ -733,17 +1104,30 @@ scan_thread(void *arg)
     if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
 
     om    = info->om_list + inx;
+    msv   = info->msv_list + inx;
     count = info->om_cnt - inx;
     if (count > blksz) count = blksz;
 
-    /* Main loop: */
-    for (i = 0; i < count; ++i, ++om) {
-      p7_pli_NewModel(pli, *om, bg);
-      p7_bg_SetLength(bg, info->seq->n);
-      p7_oprofile_ReconfigLength(*om, info->seq->n);
+    /* Main loop: the MSV filter runs on the compact profiles,
+     * and only its survivors go through the full pipeline.
+     * Each model is loaded once for all the queries of a batch.
+     */
+    for (i = 0; i < count; ++i, ++om, ++msv) {
+      p7_oprofile_ShadowMSV(shadow, msv);
+
+      for (q = 0; q < info->nq; ++q) {
+        seq = info->seq[q];
+        p7_oprofile_SetMSVLength(shadow, &(pli[q]->olen));
+        p7_pli_ScanMSV(pli[q], shadow, bg[q], seq, &pass);
+        if (! pass) continue;
+
+        p7_pli_NewModel(pli[q], *om, bg[q]);
+        p7_bg_SetLength(bg[q], seq->n);
+        p7_oprofile_ReconfigLength(*om, seq->n);
 	      
-      p7_Pipeline(pli, *om, bg, info->seq, NULL, th);
-      p7_pipeline_Reuse(pli);
+        p7_Pipeline(pli[q], *om, bg[q], seq, NULL, th[q]);
+        p7_pipeline_Reuse(pli[q]);
+      }
     }
   }
 
@@ -752,17 +1136,23 @@ scan_thread(void *arg)
   info->pli = pli;
 
   /* clean up */
-  p7_bg_Destroy(bg);
+  for (q = 0; q < info->nq; ++q) p7_bg_Destroy(bg[q]);
+  free(bg);
+  p7_oprofile_Destroy(shadow);
 
   esl_stopwatch_Stop(w);
   info->elapsed = w->elapsed;
 
   esl_stopwatch_Destroy(w);
 
+  thread_done(obj, info);
   esl_threads_Finished(obj, workeridx);
 
   pthread_exit(NULL);
   return;
+
+ ERROR:
+  LOG_FATAL_MSG("malloc", errno);
 }
 
 
@@ -771,16 +1161,9 @@ send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli)
 {
   HMMD_SEARCH_STATS   stats;
   HMMD_SEARCH_STATUS  status;
-  P7_HIT             *hit;
-  P7_DOMAIN          *dcl;
-  int                 i, j, n;
-  esl_pos_t           offset;
-  char               *pEnd; /* pointer used by strtol to locate the taxonomy id on the description line. */
-
-
-  memset(&status, 0, sizeof(HMMD_SEARCH_STATUS)); /* silence valgrind errors - zero out entire structure including its padding */
-  status.status     = eslOK;
-  status.msg_size   = sizeof(stats);
+  char               *buf = NULL;
+  uint64_t            size;
+  int                 n;
 
   /* copy the search stats */
   stats.elapsed     = w->elapsed;
@@ -803,120 +1186,44 @@ send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli)
   stats.nreported   = th->nreported;
   stats.nincluded   = th->nincluded;
 
-  n = sizeof(P7_HIT) * stats.nhits;
-
-  status.msg_size += n;
-  offset = status.msg_size;
-  if ((hit = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-
-  /* get the data in the right format before we send it */
-  for (i = 0; i < stats.nhits; ++i) {
-    P7_HIT *h1 = &hit[i];
-    P7_HIT *h2 = &th->unsrt[i];
+  if (hmmpgmd_EncodeResults(&stats, th, &buf, &size) != eslOK) LOG_FATAL_MSG("malloc", errno);
 
-    memcpy(h1, h2, sizeof(P7_HIT));
-
-    /* the name will be an integer value of the sequence index */
-    h1->name = (char *) strtol(h2->name, NULL, 10);
-//    h1->acc  = NULL;
+  memset(&status, 0, sizeof(HMMD_SEARCH_STATUS)); /* silence valgrind errors - zero out entire structure including its padding */
+  status.status     = eslOK;
+  status.version    = HMMD_RESULTS_VERSION;
+  status.msg_size   = size;
 
-    /* We want to override the sequence description as a container
-     * for the domain architecture.
-     * We have already assigned the architecture when generating
-     * the sequence database, and comparing it to the latest version
-     * of Pfam. Copying the example above, convert the string to
-     * a long and cast back to a char. Nasty hack, but at least
-     * then it gets written back out to the socket. rdf
-     */
-    //if(h2->desc != NULL) h1->desc = (char *) strtol(h2->desc, NULL, 10);
-    if (h2->desc != NULL) {
-      h1->desc = (char *) strtol(h2->desc, &pEnd, 10);
-      /* Given the sequence header:
-       * >1 000101001 12343829483298 1234
-       * This will grab the last value (1234) if present and place it in
-       * the acc entry as it is not being used by hmmpgmd. This is the same
-       * way that we hijacked the desc field to pass the architecture
-       * information back. Currently used to pass the taxonomy id to the
-       * hmmer website.
-       */
-       h1->acc  = (char *) strtol(pEnd, &pEnd, 10);
-    }
+  /* send back a successful status message */
+  n = sizeof(status);
+  if (writen(fd, &status, n) != n) LOG_FATAL_MSG("write", errno);
 
+  /* and the stats and hits */
+  if (writen(fd, buf, size) != size) LOG_FATAL_MSG("write", errno);
 
-    h1->offset = offset;
+  free(buf);
+  printf("Bytes: %" PRId64 "  hits: %" PRId64 "  sent on socket %d\n", status.msg_size, stats.nhits, fd);
+  fflush(stdout);
+}
 
-    /* figure out how big the domains are and their offset */
-    dcl = h2->dcl;
-    for (j = 0; j < h1->ndom; ++j) {
-      n = sizeof(P7_DOMAIN) + sizeof(P7_ALIDISPLAY) + dcl->ad->memsize;
-      status.msg_size += n;
-      offset += n;
+/* send_cancelled()
+ * Answer a range the master cancelled; the partial results are dropped.
+ */
+static void
+send_cancelled(int fd)
+{
+  HMMD_SEARCH_STATUS  status;
+  char                msg[] = "Search cancelled";
+  int                 n;
 
-      ++dcl;
-    }
-  }
+  memset(&status, 0, sizeof(HMMD_SEARCH_STATUS));
+  status.status     = HMMD_STATUS_CANCELLED;
+  status.msg_size   = sizeof(msg);
 
-  /* send back a successful status message */
   n = sizeof(status);
   if (writen(fd, &status, n) != n) LOG_FATAL_MSG("write", errno);
+  if (writen(fd, msg, sizeof(msg)) != sizeof(msg)) LOG_FATAL_MSG("write", errno);
 
-  /* send back that search stats */
-  n = sizeof(stats);
-  if (writen(fd, &stats, n) != n) LOG_FATAL_MSG("write", errno);
-
-  /* send all the hit data */
-  n = sizeof(P7_HIT) * stats.nhits;
-  if (writen(fd, hit, n) != n) LOG_FATAL_MSG("write", errno);
-
-  /* loop through the hit list sending the domains */
-  for (i = 0; i < stats.nhits; ++i) {
-    char *base;
-    P7_HIT *h2 = &th->unsrt[i];
-
-    dcl = h2->dcl;
-
-    n = sizeof(P7_DOMAIN) * h2->ndom;
-    if (writen(fd, dcl, n) != n) LOG_FATAL_MSG("write", errno);
-    base = (char *)NULL + n;
-
-    for (j = 0; j < h2->ndom; ++j) {
-      P7_ALIDISPLAY *ad = NULL;
-
-      /* save off the original mem pointer so all the pointers can be adjusted
-       * to the new block of memory.
-       */
-      base += sizeof(P7_ALIDISPLAY);
-
-      /* readjust all the pointers to the new memory block */
-      ad = dcl->ad;
-      if (ad->rfline  != NULL) ad->rfline  = base + (ad->rfline  - ad->mem);
-      if (ad->mmline  != NULL) ad->mmline  = base + (ad->mmline  - ad->mem);
-      if (ad->csline  != NULL) ad->csline  = base + (ad->csline  - ad->mem);
-      if (ad->model   != NULL) ad->model   = base + (ad->model   - ad->mem);
-      if (ad->mline   != NULL) ad->mline   = base + (ad->mline   - ad->mem);
-      if (ad->aseq    != NULL) ad->aseq    = base + (ad->aseq    - ad->mem);
-      if (ad->ntseq   != NULL) ad->ntseq   = base + (ad->ntseq   - ad->mem);
-      if (ad->ppline  != NULL) ad->ppline  = base + (ad->ppline  - ad->mem);
-      if (ad->hmmname != NULL) ad->hmmname = base + (ad->hmmname - ad->mem);
-      if (ad->hmmacc  != NULL) ad->hmmacc  = base + (ad->hmmacc  - ad->mem);
-      if (ad->hmmdesc != NULL) ad->hmmdesc = base + (ad->hmmdesc - ad->mem);
-      if (ad->sqname  != NULL) ad->sqname  = base + (ad->sqname  - ad->mem);
-      if (ad->sqacc   != NULL) ad->sqacc   = base + (ad->sqacc   - ad->mem);
-      if (ad->sqdesc  != NULL) ad->sqdesc  = base + (ad->sqdesc  - ad->mem);
-
-      n = sizeof(P7_ALIDISPLAY);
-      if (writen(fd, dcl->ad, n) != n) LOG_FATAL_MSG("write", errno);
-
-      n = dcl->ad->memsize;
-      if (writen(fd, dcl->ad->mem, n) != n) LOG_FATAL_MSG("write", errno);
-
-      base += ad->memsize;
-      ++dcl;
-    }
-  }
-
-  free(hit);
-  printf("Bytes: %" PRId64 "  hits: %" PRId64 "  sent on socket %d\n", status.msg_size, stats.nhits, fd);
+  printf("Search cancelled on socket %d\n", fd);
   fflush(stdout);
 }
 
@@ -425,6 +425,18 @@ typedef struct p7_hmmfile_s {
   FILE         *ffp;		/* MSV part of the optimized profile */
   FILE         *pfp;		/* rest of the optimized profile     */
 
+  /* If p7_hmmfile_Map() mapped the .h3f and .h3p files, profiles are read from here: */
+  char         *fmap;		/* .h3f contents, or NULL            */
+  char         *pmap;		/* .h3p contents, or NULL            */
+  size_t        fmapsize;	/* size of <fmap> in bytes           */
+  size_t        pmapsize;	/* size of <pmap> in bytes           */
+  off_t         fpos;		/* offset of the next MSV record in <fmap> */
+  char         *shm;		/* if opened from a shared memory cache (p7_hmmfile_OpenShm()): */
+  size_t        shmsize;	/*   the whole mapped cache, which <fmap>,<pmap> point into     */
+
+  /* If p7_hmmfile_ReadAhead() was called, ASCII models are parsed ahead by worker threads: */
+  struct p7_readahead_s *ra;	/* read-ahead state, or NULL         */
+
 #ifdef HMMER_THREADS
   int              syncRead;
   pthread_mutex_t  readMutex;
@@ -1214,6 +1226,9 @@ typedef struct p7_pipeline_s {
   double  F1;		        /* MSV filter threshold                     */
   double  F2;		        /* Viterbi filter threshold                 */
   double  F3;		        /* uncorrected Forward filter threshold     */
+  double  F1_g;		        /* F1, F2 as Gumbel cutoff terms and F3 as  */
+  double  F2_g;		        /*   an exponential one, for rejecting a    */
+  double  F3_e;		        /*   score without its P-value              */
   int     B1;               /* window length for biased-composition modifier - MSV*/
   int     B2;               /* window length for biased-composition modifier - Viterbi*/
   int     B3;               /* window length for biased-composition modifier - Forward*/
@@ -1246,6 +1261,7 @@ typedef struct p7_pipeline_s {
   int           show_alignments;/* TRUE to output alignments (default)      */
 
   P7_HMMFILE   *hfp;		/* COPY of open HMM database (if scan mode) */
+  P7_OLENGTH    olen;		/* scan mode: length params for the query (p7_pli_NewSeq()) */
   char          errbuf[eslERRBUFSIZE];
 } P7_PIPELINE;
 
@@ -1577,6 +1593,11 @@ extern int  p7_hmmfile_Open     (char *filename, char *env, P7_HMMFILE **ret_hfp
 extern int  p7_hmmfile_OpenNoDB (char *filename, char *env, P7_HMMFILE **ret_hfp); /* deprecated */
 extern int  p7_hmmfile_OpenBuffer(char *buffer, int size, P7_HMMFILE **ret_hfp);
 extern void p7_hmmfile_Close(P7_HMMFILE *hfp);
+extern int  p7_hmmfile_Map  (P7_HMMFILE *hfp);
+extern int  p7_hmmfile_ReadAhead(P7_HMMFILE *hfp, int nworkers);
+extern int  p7_hmmfile_ShmCreate(char *filename, char *env, const char *shmname, int force, char *errbuf);
+extern int  p7_hmmfile_OpenShm  (const char *shmname, int writable, P7_HMMFILE **ret_hfp, char *errbuf);
+extern int  p7_hmmfile_ShmRemove(const char *shmname, char *errbuf);
 #ifdef HMMER_THREADS
 extern int  p7_hmmfile_CreateLock(P7_HMMFILE *hfp);
 #endif
@@ -1623,6 +1644,7 @@ extern int p7_pli_DomainIncludable  (P7_PIPELINE *pli, float dom_score, double l
 extern int p7_pli_NewModel          (P7_PIPELINE *pli, const P7_OPROFILE *om, P7_BG *bg);
 extern int p7_pli_NewModelThresholds(P7_PIPELINE *pli, const P7_OPROFILE *om);
 extern int p7_pli_NewSeq            (P7_PIPELINE *pli, const ESL_SQ *sq);
+extern int p7_pli_ScanMSV           (P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, int *ret_pass);
 extern int p7_Pipeline              (P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, const ESL_SQ *ntsq, P7_TOPHITS *th);
 extern int p7_Pipeline_LongTarget   (P7_PIPELINE *pli, P7_OPROFILE *om, P7_SCOREDATA *data,
                                      P7_BG *bg, P7_TOPHITS *hitlist, int64_t seqidx,
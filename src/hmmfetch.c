@@ -55,12 +55,14 @@ static ESL_OPTIONS options[] = {
   { "-o",       eslARG_OUTFILE,FALSE,NULL, NULL, NULL, NULL,"-O,--index",   "output HMM to file <f> instead of stdout",          0 },
   { "-O",       eslARG_NONE,  FALSE, NULL, NULL, NULL, NULL,"-o,-f,--index","output HMM to file named <key>",                    0 },
   { "--index",  eslARG_NONE,  FALSE, NULL, NULL, NULL, NULL, NULL,          "index the <hmmfile>, creating <hmmfile>.ssi",       0 },
+  { "--fileorder",eslARG_NONE,FALSE, NULL, NULL, NULL, "-f","--index",      "with -f and an index: fetch in <hmmfile> order",    0 },
   { 0,0,0,0,0,0,0,0,0,0 },
 };
 
 static void create_ssi_index(ESL_GETOPTS *go, P7_HMMFILE *hfp);
 static void multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, P7_HMMFILE *hfp);
 static void onefetch(ESL_GETOPTS *go, FILE *ofp, char *key, P7_HMMFILE *hfp);
+static int  fileorder_fetch(FILE *ofp, ESL_KEYHASH *keys, P7_HMMFILE *hfp);
 
 int
 main(int argc, char **argv)
@@ -122,6 +124,10 @@ main(int argc, char **argv)
   else if (status == eslEFORMAT)   p7_Fail("File format problem in trying to open HMM file %s.\n%s\n",                hmmfile, errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",                       status, hmmfile, errbuf);  
 
+  /* Without an index, HMMs are fetched by reading the file through, in file order anyway */
+  if (esl_opt_GetBoolean(go, "--fileorder") && hfp->ssi == NULL)
+    fprintf(stderr, "Warning: no SSI index for %s; --fileorder has no effect, HMMs are read in file order\n", hmmfile);
+
  /* Open the output file, if any  */
   if (esl_opt_GetBoolean(go, "-O")) 
     {
@@ -228,6 +234,9 @@ create_ssi_index(ESL_GETOPTS *go, P7_HMMFILE *hfp)
  * Note that with an SSI index, you get the HMMs in the order they
  * appear in the <keyfile>, but without an SSI index, you get HMMs in
  * the order they occur in the HMM file.
+ *
+ * With an SSI index and --fileorder, the keys are stored first, then
+ * fetched all at once by fileorder_fetch(), in HMM file order.
  */
 static void
 multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, P7_HMMFILE *hfp)
@@ -240,6 +249,7 @@ multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, P7_HMMFILE *hfp)
   char           *key;
   int             keylen;
   int             keyidx;
+  int             do_sorted = (hfp->ssi != NULL && esl_opt_GetBoolean(go, "--fileorder"));
   int             status;
   
   if (esl_fileparser_Open(keyfile, NULL, &efp) != eslOK)  p7_Fail("Failed to open key file %s\n", keyfile);
@@ -253,9 +263,11 @@ multifetch(ESL_GETOPTS *go, FILE *ofp, char *keyfile, P7_HMMFILE *hfp)
       status = esl_keyhash_Store(keys, key, -1, &keyidx);
       if (status == eslEDUP) p7_Fail("HMM key %s occurs more than once in file %s\n", key, keyfile);
 	
-      if (hfp->ssi != NULL) { onefetch(go, ofp, key, hfp);  nhmm++; }
+      if (hfp->ssi != NULL && ! do_sorted) { onefetch(go, ofp, key, hfp);  nhmm++; }
     }
 
+  if (do_sorted) nhmm = fileorder_fetch(ofp, keys, hfp);
+
   if (hfp->ssi == NULL) 
     {
       while ((status = p7_hmmfile_Read(hfp, &abc, &hmm)) != eslEOF)
@@ -327,3 +339,122 @@ onefetch(ESL_GETOPTS *go, FILE *ofp, char *key, P7_HMMFILE *hfp)
 
   esl_alphabet_Destroy(abc);
 }
+
+
+/* The location of one key in an SSI-indexed HMM file, for fileorder_fetch(). */
+typedef struct {
+  off_t roff;			/* offset of the HMM record in the HMM file */
+  int   keyidx;			/* index of its key in <keys>               */
+} FETCH_LOC;
+
+static int
+fetchloc_compare(const void *vp1, const void *vp2)
+{
+  const FETCH_LOC *a = (const FETCH_LOC *) vp1;
+  const FETCH_LOC *b = (const FETCH_LOC *) vp2;
+
+  if      (a->roff < b->roff) return -1;
+  else if (a->roff > b->roff) return  1;
+  else                        return  0;
+}
+
+/* fileorder_fetch()
+ * Given a hash of <keys> (HMM names or accessions) and an HMM file <hfp>
+ * with an SSI index, retrieve the corresponding HMMs in the order they
+ * occur in the HMM file; return the number of HMMs written.
+ *
+ * All keys are located before any HMM is read, and the HMMs are then
+ * read in order of increasing file offset, so the HMM file is read
+ * front to back instead of with a seek back and forth for each key.
+ * When there are many keys relative to the size of the index, the
+ * index's primary keys (names) are read in one pass and looked up in
+ * <keys>, which is cheaper than a binary search of the index for each
+ * key; whatever is left (accessions) is looked up in the index one by
+ * one. An HMM named by both its name and its accession is output once.
+ */
+static int
+fileorder_fetch(FILE *ofp, ESL_KEYHASH *keys, P7_HMMFILE *hfp)
+{
+  ESL_ALPHABET *abc    = NULL;
+  P7_HMM       *hmm    = NULL;
+  FETCH_LOC    *loc    = NULL;
+  char         *found  = NULL;	/* found[keyidx] is TRUE once key <keyidx> is located */
+  char         *pkey   = NULL;
+  int           nkeys  = esl_keyhash_GetNumber(keys);
+  int           nloc   = 0;
+  int           nhmm   = 0;
+  int64_t       i;
+  off_t         roff;
+  uint16_t      fh;
+  int           keyidx;
+  int           status;
+
+  ESL_ALLOC(loc,   sizeof(FETCH_LOC) * ESL_MAX(1, nkeys));
+  ESL_ALLOC(found, sizeof(char)      * ESL_MAX(1, nkeys));
+  for (keyidx = 0; keyidx < nkeys; keyidx++) found[keyidx] = FALSE;
+
+  /* A binary search costs ~log2(nprimary) index reads per key; one pass costs nprimary. */
+  if ((int64_t) nkeys * 16 >= hfp->ssi->nprimary)
+    {
+      for (i = 0; i < hfp->ssi->nprimary && nloc < nkeys; i++)
+	{
+	  if (esl_ssi_FindNumber(hfp->ssi, i, &fh, &roff, NULL, NULL, &pkey) != eslOK)
+	    p7_Fail("Failed to parse SSI index for %s\n", hfp->fname);
+
+	  if (esl_keyhash_Lookup(keys, pkey, -1, &keyidx) == eslOK && ! found[keyidx])
+	    {
+	      loc[nloc].roff   = roff;
+	      loc[nloc].keyidx = keyidx;
+	      found[keyidx]    = TRUE;
+	      nloc++;
+	    }
+	  free(pkey);
+	  pkey = NULL;
+	}
+    }
+
+  for (keyidx = 0; keyidx < nkeys; keyidx++)
+    {
+      if (found[keyidx]) continue;
+
+      status = esl_ssi_FindName(hfp->ssi, esl_keyhash_Get(keys, keyidx), &fh, &roff, NULL, NULL);
+      if      (status == eslENOTFOUND) p7_Fail("HMM %s not found in SSI index for file %s\n", esl_keyhash_Get(keys, keyidx), hfp->fname);
+      else if (status == eslEFORMAT)   p7_Fail("Failed to parse SSI index for %s\n", hfp->fname);
+      else if (status != eslOK)        p7_Fail("Failed to look up location of HMM %s in SSI index of file %s\n", esl_keyhash_Get(keys, keyidx), hfp->fname);
+
+      loc[nloc].roff   = roff;
+      loc[nloc].keyidx = keyidx;
+      found[keyidx]    = TRUE;
+      nloc++;
+    }
+
+  qsort(loc, nloc, sizeof(FETCH_LOC), fetchloc_compare);
+
+  for (i = 0; i < nloc; i++)
+    {
+      if (i > 0 && loc[i].roff == loc[i-1].roff) continue; /* name and accession of the same HMM */
+
+      if (p7_hmmfile_Position(hfp, loc[i].roff) != eslOK)
+	p7_Fail("Failed to position HMM file %s to HMM %s\n", hfp->fname, esl_keyhash_Get(keys, loc[i].keyidx));
+
+      status = p7_hmmfile_Read(hfp, &abc, &hmm);
+      if      (status == eslEOF)       p7_Fail("HMM %s not found in file %s\n", esl_keyhash_Get(keys, loc[i].keyidx), hfp->fname);
+      else if (status == eslEOD)       p7_Fail("read failed, HMM file %s may be truncated?", hfp->fname);
+      else if (status == eslEFORMAT)   p7_Fail("bad file format in HMM file %s",             hfp->fname);
+      else if (status == eslEINCOMPAT) p7_Fail("HMM file %s contains different alphabets",   hfp->fname);
+      else if (status != eslOK)        p7_Fail("Unexpected error in reading HMMs from %s",   hfp->fname);
+
+      p7_hmmfile_WriteASCII(ofp, -1, hmm);
+      p7_hmm_Destroy(hmm);
+      nhmm++;
+    }
+
+  if (abc != NULL) esl_alphabet_Destroy(abc);
+  free(found);
+  free(loc);
+  return nhmm;
+
+ ERROR:
+  p7_Fail("allocation failed in fetching %d HMMs", nkeys);
+  return 0;			/* not reached */
+}
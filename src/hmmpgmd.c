@@ -18,6 +18,7 @@
 
 #include "hmmer.h"
 #include "hmmpgmd.h"
+#include "cachedb.h"
 
 #define CONF_FILE "/etc/hmmpgmd.conf"
 
@@ -33,8 +34,12 @@ static ESL_OPTIONS cmdlineOpts[] = {
   { "--pid",        eslARG_OUTFILE, NULL,     NULL, NULL,           NULL,  NULL,  NULL,            "file to write process id to",                                 12 },
   { "--daemon",     eslARG_NONE,    NULL,     NULL, NULL,           NULL,  NULL,  NULL,            "run as a daemon using config file: /etc/hmmpgmd.conf",        12 },
   { "--seqdb",      eslARG_INFILE,  NULL,     NULL, NULL,           NULL,  NULL,  "--worker",      "protein database to cache for searches",                      12 },
+  { "--seqdb_press",eslARG_OUTFILE, NULL,     NULL, NULL,           NULL,"--seqdb","--master,--worker","write --seqdb as a binary cache to <f> and exit",          12 },
   { "--hmmdb",      eslARG_INFILE,  NULL,     NULL, NULL,           NULL,  NULL,  "--worker",      "hmm database to cache for searches",                          12 },
+  { "--rcache_mb",  eslARG_INT,     "256",    NULL, "n>=0",         NULL,  NULL,  "--worker",      "memory for caching search results, in MB (0: don't cache)",    12 },
   { "--cpu",        eslARG_INT,  p7_NCPU,"HMMER_NCPU","n>0",        NULL,  NULL,  "--master",      "number of parallel CPU workers to use for multithreads",      12 },
+  { "--numa",       eslARG_NONE,    NULL,     NULL, NULL,           NULL,  NULL,  "--master",      "pin worker threads to NUMA nodes",                            12 },
+  { "--numa_rep",   eslARG_NONE,    NULL,     NULL, NULL,           NULL,"--numa","--master",      "also keep a copy of the cached databases on each NUMA node",  12 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 
   };
@@ -89,6 +94,29 @@ write_pid(ESL_GETOPTS *go)
   fclose(fp);
 }
 
+/* press_seqdb()
+ * Load the --seqdb database and write it to the --seqdb_press file
+ * as a binary cache, which --seqdb will map instead of parsing.
+ */
+static void
+press_seqdb(ESL_GETOPTS *go)
+{
+  char        *seqfile   = esl_opt_GetString(go, "--seqdb");
+  char        *pressfile = esl_opt_GetString(go, "--seqdb_press");
+  char         errbuf[eslERRBUFSIZE];
+  P7_SEQCACHE *cache     = NULL;
+  FILE        *ofp       = NULL;
+  int          status;
+
+  if ((status = p7_seqcache_Open(seqfile, &cache, errbuf)) != eslOK) p7_Fail("Failed to cache %s (%d): %s", seqfile, status, errbuf);
+  if ((ofp = fopen(pressfile, "wb")) == NULL)                         p7_Fail("Failed to open %s for writing", pressfile);
+  if ((status = p7_seqcache_Write(cache, ofp)) != eslOK)              p7_Fail("Failed to write %s (%d)", pressfile, status);
+  if (fclose(ofp) != 0)                                               p7_Fail("Failed to write %s", pressfile);
+
+  printf("Pressed %s into %s\n", seqfile, pressfile);
+  p7_seqcache_Close(cache);
+}
+
 static int
 process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go)
 {
@@ -166,7 +194,8 @@ main(int argc, char **argv)
   /* check if we need to write out our pid */
   if (esl_opt_IsOn(go, "--pid")) write_pid(go);
 
-  if      (esl_opt_IsUsed(go, "--master"))  master_process(go);
+  if      (esl_opt_IsUsed(go, "--seqdb_press")) press_seqdb(go);
+  else if (esl_opt_IsUsed(go, "--master"))  master_process(go);
   else if (esl_opt_IsUsed(go, "--worker"))  worker_process(go);
   else
     { puts("Options --master or --worker must be specified.");  }
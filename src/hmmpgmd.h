@@ -2,8 +2,26 @@
 #define P7_HMMPGMD_INCLUDED
 
 
+/* Format of the search results that follow a HMMD_SEARCH_STATUS; see
+ * hmmpgmd_EncodeResults(). Version 0 is the original raw struct format.
+ */
+#define HMMD_RESULTS_VERSION 1
+
+/* Status of a batch of results streamed to a client (--stream); more
+ * messages follow, the last one with status eslOK or an error.
+ */
+#define HMMD_STATUS_PARTIAL  1000
+
+/* Status of a search given up before it finished: cancelled by the
+ * client, or past its --timeout.  An error string follows.  Workers
+ * answer a cancelled range with it too.
+ */
+#define HMMD_STATUS_CANCELLED 1001
+
 typedef struct {
   uint32_t   status;            /* error status                             */
+  uint32_t   version;           /* format of the results: 0, or             */
+                                /* HMMD_RESULTS_VERSION                     */
   uint64_t   msg_size;          /* size of the next packet.  if status not  */
                                 /* zero, the length is for the error string */
                                 /* otherwise it is the length of the data   */
@@ -41,25 +59,57 @@ typedef struct {
 #define HMMD_CMD_INIT       10003
 #define HMMD_CMD_SHUTDOWN   10004
 #define HMMD_CMD_RESET      10005
+#define HMMD_CMD_DROP       10006
+#define HMMD_CMD_CANCEL     10007
+#define HMMD_CMD_STATS      10008
+#define HMMD_CMD_VERSION    10009
+
+/* Version of the commands between master and worker. They are sent
+ * as raw structs, so both sides must agree on their layout: the
+ * master asks each worker for its version (HMMD_CMD_VERSION) before
+ * sending it anything else, and turns it away if it differs. Workers
+ * that predate the check don't answer it.
+ *   2: database slots (db_slot, the name of an INIT; HMMD_CMD_DROP)
+ *   3: batches of queries (query_cnt of a search, and the length
+ *      before each query's data after the first)
+ */
+#define HMMD_PROTOCOL_VERSION 3
+#define HMMD_VERSION_WAIT     10  /* seconds the master waits for the answer */
 
 #define MAX_INIT_DESC 32
 
+/* Databases are resident in numbered slots, on the master and on each
+ * worker; a reload goes into a free slot next to the databases it
+ * replaces.
+ */
+#define HMMD_MAX_DBS  16
+#define HMMD_DEFAULT_DB "default"   /* name of the databases given on the command line */
+
+/* Most queries in one request (a batch of sequences) */
+#define HMMD_MAX_BATCH  1000
+
 /* HMMD_CMD_SEARCH or HMMD_CMD_SCAN */
 typedef struct {
   uint32_t    db_inx;               /* database index to search                 */
   uint32_t    db_type;              /* database type to search                  */
+  uint32_t    db_slot;              /* slot of the resident databases to search */
   uint32_t    inx;                  /* index to begin search                    */
   uint32_t    cnt;                  /* number of sequences to search            */
   uint32_t    query_type;           /* sequence / hmm                           */
-  uint32_t    query_length;         /* length of the query data                 */
+  uint32_t    query_length;         /* length of the (first) query's data       */
+  uint32_t    query_cnt;            /* number of queries: 1, or a batch; each   */
+                                    /* query after the first is preceded by the */
+                                    /* length of its data (uint32_t)            */
   uint32_t    opts_length;          /* length of the options string             */
   char        data[1];              /* search data                              */
 } HMMD_SEARCH_CMD;
 
-/* HMMD_CMD_INIT */
+/* HMMD_CMD_INIT or HMMD_CMD_DROP */
 typedef struct {
   char        sid[MAX_INIT_DESC];   /* unique id for sequence database          */
   char        hid[MAX_INIT_DESC];   /* unique id for hmm database               */
+  char        name[MAX_INIT_DESC];  /* name searches select the databases by    */
+  uint32_t    db_slot;              /* slot to load the databases into, or drop */
   uint32_t    seqdb_off;            /* offset to seq database name, 0 if none   */
   uint32_t    hmmdb_off;            /* offset to hmm database name, 0 if none   */
   uint32_t    db_cnt;               /* total number of sequence databases       */
@@ -69,6 +119,11 @@ typedef struct {
   char        data[1];              /* string data                              */
 } HMMD_INIT_CMD;
 
+/* HMMD_CMD_VERSION, and the worker's answer */
+typedef struct {
+  uint32_t    version;              /* HMMD_PROTOCOL_VERSION                    */
+} HMMD_VERSION_CMD;
+
 /* HMMD_CMD_RESET */
 typedef struct {
   char        ip_addr[1];           /* ip address                               */
@@ -87,6 +142,7 @@ typedef struct {
     HMMD_INIT_CMD   init;
     HMMD_SEARCH_CMD srch;
     HMMD_INIT_RESET reset;
+    HMMD_VERSION_CMD vers;
   };
 } HMMD_COMMAND;
 
@@ -108,9 +164,12 @@ typedef struct queue_data_s {
   char           ip_addr[64];
 
   int            dbx;         /* database index to search       */
+  int            db_slot;     /* slot of the resident databases */
   int            inx;         /* sequence index to start search */
   int            cnt;         /* number of sequences to search  */
 
+  int            nq;          /* number of queries: 1, or the size of a batch       */
+  struct queue_data_s *next;  /* next query of a batch; only <seq> or <hmm> is set  */
 } QUEUE_DATA;
 
 
@@ -126,6 +185,9 @@ extern int  hmmpgmd_GetRanges (RANGE_LIST *list, char *rangestr);
 
 extern int  process_searchopts(int fd, char *cmdstr, ESL_GETOPTS **ret_opts);
 
+extern int  hmmpgmd_EncodeResults(const HMMD_SEARCH_STATS *stats, const P7_TOPHITS *th, char **ret_buf, uint64_t *ret_n);
+extern int  hmmpgmd_DecodeResults(const char *buf, uint64_t n, HMMD_SEARCH_STATS *stats, P7_HIT **ret_hit, char **ret_data, uint64_t *ret_datasize);
+
 extern void worker_process(ESL_GETOPTS *go);
 extern void master_process(ESL_GETOPTS *go);
 
@@ -9,13 +9,24 @@
 #include "easel.h"
 #include "esl_alphabet.h"
 #include "esl_getopts.h"
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif
 
 #include "hmmer.h"
+#ifdef HMMER_THREADS
+#include "p7_scheduler.h"
+#endif
 
 static ESL_OPTIONS options[] = {
   /* name           type      default  env  range     toggles      reqs   incomp  help   docgroup*/
   { "-h",        eslARG_NONE,   FALSE, NULL, NULL,      NULL,      NULL,    NULL, "show brief help on version and usage",          0 },
   { "-f",        eslARG_NONE,   FALSE, NULL, NULL,      NULL,      NULL,    NULL, "force: overwrite any previous pressed files",   0 },
+  { "--shm",     eslARG_STRING,  NULL, NULL, NULL,      NULL,      NULL,    NULL, "load pressed <hmmfile> into shared memory cache <s>, don't press it", 0 },
+  { "--shmrm",   eslARG_NONE,   FALSE, NULL, NULL,      NULL,   "--shm",    NULL, "remove shared memory cache <s> instead of loading it",          0 },
+#ifdef HMMER_THREADS
+  { "--cpu",     eslARG_INT,  p7_NCPU,"HMMER_NCPU","n>=0", NULL,   NULL,    NULL, "number of parallel CPU workers for reading and converting models", 0 },
+#endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 static char usage[]  = "[-options] <hmmfile>";
@@ -36,8 +47,29 @@ struct dbfiles {
   ESL_NEWSSI *nssi;
 };
   
+/* hmmpress converts each model to an optimized profile, in worker
+ * threads if it has them. Models are read into a ring of slots and
+ * written in the order they were read: the oldest is written once its
+ * conversion is done, and its slot takes the next model. The output
+ * is the same as a serial press.
+ */
+typedef struct {
+  P7_HMM       *hmm;		/* model read from the HMM file, or NULL if slot empty */
+  P7_BG        *bg;		/* null model to configure it with (shared, read-only) */
+  P7_OPROFILE  *om;		/* its optimized profile, once converted               */
+#ifdef HMMER_THREADS
+  P7_TASKGROUP *grp;		/* its conversion task, while it runs                  */
+#endif
+} PRESS_SLOT;
+
+#define PRESS_DEPTH 4		/* models in the ring, per worker */
+
 static struct dbfiles *open_dbfiles (ESL_GETOPTS *go, char *basename);
 static void            close_dbfiles(struct dbfiles *dbf, int status);
+static void            shm_main     (ESL_GETOPTS *go, char *hmmfile);
+static void            convert_model(void *arg, int workeridx);
+static int             write_model  (struct dbfiles *dbf, uint16_t fh, P7_HMM *hmm, P7_OPROFILE *om, char *errbuf);
+static void            destroy_slots(PRESS_SLOT *slot, int nslots);
 
 int
 main(int argc, char **argv)
@@ -46,16 +78,24 @@ main(int argc, char **argv)
   ESL_ALPHABET   *abc     = NULL;
   char           *hmmfile = esl_opt_GetArg(go, 1);
   P7_HMMFILE     *hfp     = NULL;
-  P7_HMM         *hmm     = NULL;
   P7_BG          *bg      = NULL;
-  P7_PROFILE     *gm      = NULL;
-  P7_OPROFILE    *om      = NULL;
+  PRESS_SLOT     *slot    = NULL;
+  PRESS_SLOT     *ps      = NULL;
+  int             nslots  = 1;
   struct dbfiles *dbf     = NULL;
   uint16_t        fh      = 0;
   int             nmodel  = 0;
-  uint64_t        totM    = 0;
+  int             nread   = 0;
+  int             i;
+  int             rstatus = eslOK;	/* status of reading models; eslEOF when done */
   int             status;
   char            errbuf[eslERRBUFSIZE];
+#ifdef HMMER_THREADS
+  P7_SCHEDULER   *sch     = NULL;
+  int             ncpus   = 0;
+#endif
+
+  if (esl_opt_IsOn(go, "--shm")) shm_main(go, hmmfile); /* doesn't return */
 
   if (strcmp(hmmfile, "-") == 0) p7_Fail("Can't use - for <hmmfile> argument: can't index standard input\n");
 
@@ -66,50 +106,79 @@ main(int argc, char **argv)
 
   if (hfp->do_stdin || hfp->do_gzip) p7_Fail("HMM file %s must be a normal file, not gzipped or a stdin pipe", hmmfile);
 
+#ifdef HMMER_THREADS
+  ncpus = ESL_MIN(esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
+  if (ncpus > 0)
+    {
+      p7_hmmfile_ReadAhead(hfp, ncpus); /* for files it can't do, models are read serially */
+      if ((sch = p7_scheduler_Create(ncpus, NULL)) == NULL) p7_Fail("Failed to start worker threads");
+      nslots = ncpus * PRESS_DEPTH;
+    }
+#endif
+
   dbf = open_dbfiles(go, hmmfile);  // After this, we have to close_dbfiles() before exiting with any error. Don't leave partial/corrupt files.
 
   if (( status = esl_newssi_AddFile(dbf->nssi, hfp->fname, 0, &fh)) != eslOK) /* 0 = format code (HMMs don't have any yet) */
      ESL_XFAIL(status, errbuf, "Failed to add HMM file %s to new SSI index\n", hfp->fname);
 
+  ESL_ALLOC(slot, sizeof(PRESS_SLOT) * nslots);
+  for (i = 0; i < nslots; i++)
+    {
+      slot[i].hmm = NULL;
+      slot[i].bg  = NULL;
+      slot[i].om  = NULL;
+#ifdef HMMER_THREADS
+      slot[i].grp = NULL;
+      if (sch && (slot[i].grp = p7_taskgroup_Create()) == NULL) ESL_XFAIL(eslEMEM, errbuf, "Failed to create task group");
+#endif
+    }
+
   printf("Working...    "); 
   fflush(stdout);
 
-  while ((status = p7_hmmfile_Read(hfp, &abc, &hmm)) == eslOK)
+  /* Read models into the free slots of the ring, starting their
+   * conversions; then write the oldest model; until none remain.
+   */
+  while (TRUE)
     {
-      if (hmm->name == NULL) ESL_XFAIL(eslEINVAL, errbuf, "Every HMM must have a name to be indexed. Failed to find name of HMM #%d\n", nmodel+1); 
-
-      if (nmodel == 0) { 	/* first time initialization, now that alphabet known */
-	bg = p7_bg_Create(abc);
-	p7_bg_SetLength(bg, 400);
-      }
-
+      while (rstatus == eslOK && nread - nmodel < nslots)
+	{
+	  ps = &(slot[nread % nslots]);
+	  if ((rstatus = p7_hmmfile_Read(hfp, &abc, &(ps->hmm))) != eslOK) break;
+	  nread++;
+
+	  if (ps->hmm->name == NULL) ESL_XFAIL(eslEINVAL, errbuf, "Every HMM must have a name to be indexed. Failed to find name of HMM #%d\n", nread); 
+
+	  if (bg == NULL) { 	/* first time initialization, now that alphabet known */
+	    bg = p7_bg_Create(abc);
+	    p7_bg_SetLength(bg, 400);
+	  }
+	  ps->bg = bg;
+
+#ifdef HMMER_THREADS
+	  if (sch) {
+	    if ((status = p7_scheduler_Submit(sch, ps->grp, convert_model, ps)) != eslOK) ESL_XFAIL(status, errbuf, "Failed to queue a profile conversion");
+	  } else
+#endif
+	    convert_model(ps, 0);
+	}
+      if (nmodel == nread) break;
+
+      ps = &(slot[nmodel % nslots]);
+#ifdef HMMER_THREADS
+      if (sch && (status = p7_taskgroup_Wait(ps->grp)) != eslOK) ESL_XFAIL(status, errbuf, "Failed to wait for a profile conversion");
+#endif
+      if ((status = write_model(dbf, fh, ps->hmm, ps->om, errbuf)) != eslOK) goto ERROR;
       nmodel++;
-      totM += hmm->M;
-
-      gm = p7_profile_Create(hmm->M, abc);
-      p7_ProfileConfig(hmm, bg, gm, 400, p7_LOCAL);
-      om = p7_oprofile_Create(gm->M, abc);
-      p7_oprofile_Convert(gm, om);
-      
-      if ((om->offs[p7_MOFFSET] = ftello(dbf->mfp)) == -1) ESL_XFAIL(eslESYS, errbuf, "Failed to ftello() current disk position of HMM db file");
-      if ((om->offs[p7_FOFFSET] = ftello(dbf->ffp)) == -1) ESL_XFAIL(eslESYS, errbuf, "Failed to ftello() current disk position of MSV db file");   
-      if ((om->offs[p7_POFFSET] = ftello(dbf->pfp)) == -1) ESL_XFAIL(eslESYS, errbuf, "Failed to ftello() current disk position of profile db file"); 
-
-      if ((status = esl_newssi_AddKey(dbf->nssi, hmm->name, fh, om->offs[p7_MOFFSET], 0, 0)) != eslOK) ESL_XFAIL(status, errbuf, "Failed to add key %s to SSI index", hmm->name); 
-      if (hmm->acc) {
-	if ((status = esl_newssi_AddAlias(dbf->nssi, hmm->acc, hmm->name))                   != eslOK) ESL_XFAIL(status, errbuf, "Failed to add secondary key %s to SSI index", hmm->acc); 
-      }
-
-      p7_hmmfile_WriteBinary(dbf->mfp, -1, hmm);
-      p7_oprofile_Write(dbf->ffp, dbf->pfp, om);
-
-      p7_profile_Destroy(gm);
-      p7_oprofile_Destroy(om);
-      p7_hmm_Destroy(hmm);
+
+      p7_oprofile_Destroy(ps->om);
+      p7_hmm_Destroy(ps->hmm);
+      ps->om  = NULL;
+      ps->hmm = NULL;
     }
-  if      (status == eslEFORMAT)   ESL_XFAIL(status, errbuf, "bad file format in HMM file %s",             hmmfile); 
-  else if (status == eslEINCOMPAT) ESL_XFAIL(status, errbuf, "HMM file %s contains different alphabets",   hmmfile); 
-  else if (status != eslEOF)       ESL_XFAIL(status, errbuf, "Unexpected error in reading HMMs from %s",   hmmfile); 
+  if      (rstatus == eslEFORMAT)   ESL_XFAIL(rstatus, errbuf, "bad file format in HMM file %s",             hmmfile); 
+  else if (rstatus == eslEINCOMPAT) ESL_XFAIL(rstatus, errbuf, "HMM file %s contains different alphabets",   hmmfile); 
+  else if (rstatus != eslEOF)       ESL_XFAIL(rstatus, errbuf, "Unexpected error in reading HMMs from %s",   hmmfile); 
 
   status = esl_newssi_Write(dbf->nssi);
   if      (status == eslEDUP)     ESL_XFAIL(status, errbuf, "SSI index construction failed:\n  %s", dbf->nssi->errbuf);        
@@ -127,6 +196,10 @@ main(int argc, char **argv)
   printf("Profiles (MSV part) pressed into:  %s\n", dbf->ffile);
   printf("Profiles (remainder) pressed into: %s\n", dbf->pfile);
 
+#ifdef HMMER_THREADS
+  p7_scheduler_Destroy(sch);   /* finishes any conversions still running */
+#endif
+  destroy_slots(slot, nslots);
   close_dbfiles(dbf, eslOK);
   p7_bg_Destroy(bg);
   p7_hmmfile_Close(hfp);
@@ -136,6 +209,10 @@ main(int argc, char **argv)
 
  ERROR:
   fprintf(stderr, "%s\n", errbuf);
+#ifdef HMMER_THREADS
+  p7_scheduler_Destroy(sch);   /* finishes any conversions still running */
+#endif
+  destroy_slots(slot, nslots);
   close_dbfiles(dbf, status);
   p7_bg_Destroy(bg);
   p7_hmmfile_Close(hfp);
@@ -222,3 +299,108 @@ close_dbfiles(struct dbfiles *dbf, int status)
 
 }
 
+
+/* convert_model()
+ * Task: configure the model in slot <arg> and convert it to an
+ * optimized profile. <workeridx> is unused.
+ */
+static void
+convert_model(void *arg, int workeridx)
+{
+  PRESS_SLOT *ps = (PRESS_SLOT *) arg;
+  P7_PROFILE *gm = p7_profile_Create(ps->hmm->M, ps->hmm->abc);
+
+  p7_ProfileConfig(ps->hmm, ps->bg, gm, 400, p7_LOCAL);
+  ps->om = p7_oprofile_Create(gm->M, ps->hmm->abc);
+  p7_oprofile_Convert(gm, ps->om);
+  p7_profile_Destroy(gm);
+}
+
+/* write_model()
+ * Append a model and its optimized profile to the pressed database,
+ * and index it.
+ */
+static int
+write_model(struct dbfiles *dbf, uint16_t fh, P7_HMM *hmm, P7_OPROFILE *om, char *errbuf)
+{
+  int status;
+
+  if ((om->offs[p7_MOFFSET] = ftello(dbf->mfp)) == -1) ESL_FAIL(eslESYS, errbuf, "Failed to ftello() current disk position of HMM db file");
+  if ((om->offs[p7_FOFFSET] = ftello(dbf->ffp)) == -1) ESL_FAIL(eslESYS, errbuf, "Failed to ftello() current disk position of MSV db file");   
+  if ((om->offs[p7_POFFSET] = ftello(dbf->pfp)) == -1) ESL_FAIL(eslESYS, errbuf, "Failed to ftello() current disk position of profile db file"); 
+
+  if ((status = esl_newssi_AddKey(dbf->nssi, hmm->name, fh, om->offs[p7_MOFFSET], 0, 0)) != eslOK) ESL_FAIL(status, errbuf, "Failed to add key %s to SSI index", hmm->name); 
+  if (hmm->acc) {
+    if ((status = esl_newssi_AddAlias(dbf->nssi, hmm->acc, hmm->name))                   != eslOK) ESL_FAIL(status, errbuf, "Failed to add secondary key %s to SSI index", hmm->acc); 
+  }
+
+  p7_hmmfile_WriteBinary(dbf->mfp, -1, hmm);
+  p7_oprofile_Write(dbf->ffp, dbf->pfp, om);
+  return eslOK;
+}
+
+/* destroy_slots()
+ * Free the conversion ring, and any models left in it. Any
+ * conversions must have finished.
+ */
+static void
+destroy_slots(PRESS_SLOT *slot, int nslots)
+{
+  int i;
+
+  if (slot == NULL) return;
+  for (i = 0; i < nslots; i++)
+    {
+      if (slot[i].om)  p7_oprofile_Destroy(slot[i].om);
+      if (slot[i].hmm) p7_hmm_Destroy(slot[i].hmm);
+#ifdef HMMER_THREADS
+      p7_taskgroup_Destroy(slot[i].grp);
+#endif
+    }
+  free(slot);
+}
+
+
+/* shm_main()
+ * hmmpress --shm <name>: load the already pressed <hmmfile> into
+ * shared memory cache <name>, where hmmscan and nhmmscan --shmcache
+ * find it; or with --shmrm, remove that cache. -f replaces an
+ * existing cache.
+ */
+static void
+shm_main(ESL_GETOPTS *go, char *hmmfile)
+{
+  char       *shmname = esl_opt_GetString(go, "--shm");
+  P7_HMMFILE *hfp     = NULL;
+  char       *dbtail  = NULL;
+  char       *shmtail = NULL;
+  char        errbuf[eslERRBUFSIZE];
+  int         status;
+
+  if (esl_opt_GetBoolean(go, "--shmrm"))
+    {
+      /* If the cache is complete, make sure it's the one for <hmmfile> */
+      if (p7_hmmfile_OpenShm(shmname, FALSE, &hfp, errbuf) == eslOK)
+	{
+	  if (esl_FileTail(hmmfile, FALSE, &dbtail) != eslOK || esl_FileTail(hfp->fname, FALSE, &shmtail) != eslOK) p7_Fail("esl_FileTail() failed");
+	  if (strcmp(dbtail, shmtail) != 0) p7_Fail("Shared memory cache %s holds %s, not %s; not removed\n", shmname, hfp->fname, hmmfile);
+	  free(dbtail);
+	  free(shmtail);
+	  p7_hmmfile_Close(hfp);
+	}
+      if (p7_hmmfile_ShmRemove(shmname, errbuf) != eslOK) p7_Fail("%s\n", errbuf);
+      printf("Removed shared memory cache %s.\n", shmname);
+    }
+  else
+    {
+      status = p7_hmmfile_ShmCreate(hmmfile, p7_HMMDBENV, shmname, esl_opt_GetBoolean(go, "-f"), errbuf);
+      if      (status == eslENOTFOUND) p7_Fail("File existence/permissions problem in trying to open HMM file %s.\n%s\n", hmmfile, errbuf);
+      else if (status == eslEFORMAT)   p7_Fail("Failed to load %s: %s\nRun hmmpress on it first (again, if it was pressed by an older version)\n", hmmfile, errbuf);
+      else if (status == eslEWRITE)    p7_Fail("%s\n%s", errbuf, esl_opt_GetBoolean(go, "-f") ? "" : "Use -f to replace an existing cache\n");
+      else if (status != eslOK)        p7_Fail("Failed to load %s into shared memory: %s\n", hmmfile, errbuf);
+      printf("Loaded pressed profiles of %s into shared memory cache %s.\n", hmmfile, shmname);
+    }
+
+  esl_getopts_Destroy(go);
+  exit(0);
+}
@@ -51,6 +51,29 @@ if ($? != 0)                                     { die "hmmpress -f failed to pr
 if ($output !~ /Pressed and indexed (\d+) HMMs/) { die "unexpected hmmpress -f output"; }
 if ($1 != $nmodels)                              { die "unexpected number of models after hmmpress -f"; }
 
+# A threaded hmmpress must write the same files with and without
+# worker threads.
+$output = `$hmmpress -h 2>&1`;
+if ($output =~ /--cpu/)
+{
+    @suffixes = ("h3m", "h3f", "h3p", "h3i");
+
+    $output = `$hmmpress -f --cpu 0 $tmppfx.hmm 2>&1`;
+    if ($? != 0) { die "hmmpress --cpu 0 failed to press $minifam"; }
+    foreach $sfx (@suffixes) {
+	system("cp $tmppfx.hmm.$sfx $tmppfx.serial.$sfx 2>&1");
+	if ($? != 0) { die "failed to copy $tmppfx.hmm.$sfx"; }
+    }
+
+    $output = `$hmmpress -f --cpu 4 $tmppfx.hmm 2>&1`;
+    if ($? != 0) { die "hmmpress --cpu 4 failed to press $minifam"; }
+    foreach $sfx (@suffixes) {
+	system("cmp -s $tmppfx.hmm.$sfx $tmppfx.serial.$sfx");
+	if ($? != 0) { die "$sfx file differs between hmmpress --cpu 0 and --cpu 4"; }
+    }
+    unlink <$tmppfx.serial.*>;
+}
+
 print "ok\n";
 unlink <$tmppfx.hmm*>;
 exit 0;
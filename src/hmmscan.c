@@ -26,19 +26,18 @@
 #ifdef HMMER_THREADS
 #include <unistd.h>
 #include "esl_threads.h"
-#include "esl_workqueue.h"
 #endif
 
 #include "hmmer.h"
+#include "p7_checkpoint.h"
+#include "p7_scheduler.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif
-  ESL_SQ           *qsq;
+  ESL_SQ          **qsq;         /* block of query sequences [0..nq-1]      */
+  int               nq;          /* number of queries in the block          */
   P7_BG            *bg;	         /* null model                              */
-  P7_PIPELINE      *pli;         /* work pipeline                           */
-  P7_TOPHITS       *th;          /* top hit results                         */
+  P7_PIPELINE     **pli;         /* work pipelines, one per query           */
+  P7_TOPHITS      **th;          /* top hit results, one per query          */
 } WORKER_INFO;
 
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
@@ -49,7 +48,7 @@ typedef struct {
 
 #if defined (HMMER_THREADS) && defined (HMMER_MPI)
 #define CPUOPTS     "--mpi"
-#define MPIOPTS     "--cpu"
+#define MPIOPTS     "--cpu,--checkpoint,--qblock,--shmcache"
 #else
 #define CPUOPTS     NULL
 #define MPIOPTS     NULL
@@ -93,6 +92,12 @@ static ESL_OPTIONS options[] = {
   { "--domZ",       eslARG_REAL,   FALSE, NULL, "x>0",   NULL,  NULL,  NULL,            "set # of significant seqs, for domain E-value calculation",    12 },
   { "--seed",       eslARG_INT,    "42",  NULL, "n>=0",  NULL,  NULL,  NULL,            "set RNG seed to <n> (if 0: one-time arbitrary seed)",          12 },
   { "--qformat",    eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,            "assert input <seqfile> is in format <s>: no autodetection",    12 },
+  { "--qblock",     eslARG_INT,      "1", NULL, "n>0",   NULL,  NULL,  NULL,            "search <n> query sequences per pass through the database",     12 },
+  { "--nommap",     eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "read the pressed database with stdio, not a memory mapping",   12 },
+  { "--shmcache",   eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,"--nommap",        "read profiles from shared memory cache <s> (hmmpress --shm)",  12 },
+  { "--checkpoint", eslARG_STRING,  NULL, NULL, NULL,    NULL,  "-o",  NULL,            "save search state in directory <s>, so it can be resumed",     12 },
+  { "--ckinterval", eslARG_INT,    "600", NULL, "n>0",   NULL,"--checkpoint",NULL,      "save search state at most every <n> seconds",                  12 },
+  { "--resume",     eslARG_NONE,   FALSE, NULL, NULL,    NULL,"--checkpoint",NULL,      "resume an interrupted search from its --checkpoint state",     12 },
 #ifdef HMMER_THREADS
   { "--cpu",        eslARG_INT, p7_NCPU,"HMMER_NCPU","n>=0",NULL,  NULL,  CPUOPTS,      "number of parallel CPU workers to use for multithreads",       12 },
 #endif
@@ -122,13 +127,39 @@ static char usage[]  = "[-options] <hmmdb> <seqfile>";
 static char banner[] = "search sequence(s) against a profile database";
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
+static int  open_hmmdb   (ESL_GETOPTS *go, struct cfg_s *cfg, P7_HMMFILE **ret_hfp, char *errbuf);
 static int  serial_loop  (WORKER_INFO *info, P7_HMMFILE *hfp);
+static void scan_model   (WORKER_INFO *info, P7_OPROFILE *om);
 
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_HMMFILE *hfp);
-static void pipeline_thread(void *arg);
+/* OM_POOL: a fixed set of reusable profile blocks, which bounds how
+ * far the reader runs ahead of the workers (as a P7_BLOCKPOOL does
+ * for target sequence blocks).
+ */
+typedef struct {
+  P7_OM_BLOCK   **block;	/* free blocks [0..nfree-1]                       */
+  int             nfree;	/* # of blocks in the pool now                    */
+  int             nblocks;	/* # of blocks owned by the pool                  */
+  pthread_mutex_t mutex;
+  pthread_cond_t  avail;	/* signalled when a block is returned             */
+} OM_POOL;
+
+/* BLOCK_TASK: one block of target profiles to compare to the query block */
+typedef struct {
+  WORKER_INFO      *info;        /* per-worker pipelines and hit lists [0..ncpus-1] */
+  P7_OM_BLOCK      *block;
+  OM_POOL          *pool;        /* where <block> goes back to when done    */
+} BLOCK_TASK;
+
+static OM_POOL     *om_pool_Create (int nblocks);
+static P7_OM_BLOCK *om_pool_Get    (OM_POOL *pool);
+static void         om_pool_Put    (OM_POOL *pool, P7_OM_BLOCK *block);
+static void         om_pool_Destroy(OM_POOL *pool);
+
+static int  thread_loop(P7_SCHEDULER *sched, OM_POOL *pool, WORKER_INFO *info, P7_HMMFILE *hfp);
+static void scan_block (void *arg, int workeridx);
 #endif
 
 #ifdef HMMER_MPI
@@ -244,6 +275,10 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *hmmfile, char *seqfile)
     else if (                                  fprintf(ofp, "# random number seed set to:       %d\n",        esl_opt_GetInteger(go, "--seed"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   }
   if (esl_opt_IsUsed(go, "--qformat")   && fprintf(ofp, "# input seqfile format asserted:   %s\n",            esl_opt_GetString(go, "--qformat"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--qblock")    && fprintf(ofp, "# queries per database pass:       %d\n",            esl_opt_GetInteger(go, "--qblock"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--nommap")    && fprintf(ofp, "# memory map the database:         no\n")                                                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--shmcache")  && fprintf(ofp, "# profiles read from shared cache: %s\n",            esl_opt_GetString(go, "--shmcache"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--checkpoint")&& fprintf(ofp, "# search state saved to:           %s\n",            esl_opt_GetString(go, "--checkpoint")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")       && fprintf(ofp, "# number of worker threads:        %d\n",            esl_opt_GetInteger(go, "--cpu"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
 #endif
@@ -327,22 +362,24 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ESL_ALPHABET    *abc      = NULL;              /* sequence alphabet                               */
   P7_OPROFILE     *om       = NULL;		 /* target profile                                  */
   ESL_STOPWATCH   *w        = NULL;              /* timing                                          */
-  ESL_SQ          *qsq      = NULL;		 /* query sequence                                  */
+  ESL_SQ         **qsq      = NULL;		 /* block of query sequences                        */
+  P7_CHECKPOINT   *ck       = NULL;              /* saved search state (--checkpoint)               */
+  int              qblock   = esl_opt_GetInteger(go, "--qblock"); /* max queries per database pass  */
+  int              nq       = 0;		 /* # of queries in the current block               */
   int              nquery   = 0;
   int              textw;
   int              status   = eslOK;
   int              hstatus  = eslOK;
   int              sstatus  = eslOK;
-  int              i;
+  int              i, q;
 
   int              ncpus    = 0;
 
   int              infocnt  = 0;
   WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  P7_OM_BLOCK     *block    = NULL;
-  ESL_THREADS     *threadObj= NULL;
-  ESL_WORK_QUEUE  *queue    = NULL;
+  P7_SCHEDULER    *sched    = NULL;
+  OM_POOL         *pool     = NULL;
 #endif
   char             errbuf[eslERRBUFSIZE];
 
@@ -358,9 +395,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   }
 
   /* Open the target profile database to get the sequence alphabet */
-  status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, errbuf);
+  status = open_hmmdb(go, cfg, &hfp, errbuf);
   if      (status == eslENOTFOUND) p7_Fail("File existence/permissions problem in trying to open HMM file %s.\n%s\n", cfg->hmmfile, errbuf);
   else if (status == eslEFORMAT)   p7_Fail("File format problem, trying to open HMM file %s.\n%s\n",                  cfg->hmmfile, errbuf);
+  else if (status == eslEINCOMPAT) p7_Fail("%s\n",                                                                    errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",               status, cfg->hmmfile, errbuf);  
   if (! hfp->is_pressed)           p7_Fail("Failed to open binary auxfiles for %s: use hmmpress first\n",             hfp->fname);
 
@@ -378,23 +416,55 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   else if (status == eslEFORMAT)   p7_Fail("Sequence file %s is empty or misformatted\n",        cfg->seqfile);
   else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
   else if (status != eslOK)        p7_Fail("Unexpected error %d opening sequence file %s\n", status, cfg->seqfile);
-  qsq = esl_sq_CreateDigital(abc);
+  ESL_ALLOC(qsq, sizeof(ESL_SQ *) * qblock);
+  for (q = 0; q < qblock; q++) qsq[q] = esl_sq_CreateDigital(abc);
+
+  /* --resume reads the query sequences again, skipping the finished
+   * ones: stdin and gzip'ed files can't be read that way.
+   */
+  if (esl_opt_GetBoolean(go, "--resume") && ! esl_sqfile_IsRewindable(sqfp))
+    p7_Fail("Can't resume a search of stdin or of a .gz file: --resume needs input files that can be read again\n");
+
+  /* Saved search state. Each query sequence is a short scan, so only
+   * finished queries are saved, not partial ones. With --resume, the
+   * outputs opened below are cut back to where they were when it was
+   * saved, and the finished queries are skipped.
+   */
+  if (esl_opt_IsOn(go, "--checkpoint"))
+    {
+      ck = p7_checkpoint_Create(esl_opt_GetString(go, "--checkpoint"), "hmmscan", cfg->seqfile, cfg->hmmfile, esl_opt_GetInteger(go, "--ckinterval"));
+      if (ck == NULL) p7_Fail("Failed to create search checkpoint in directory %s\n", esl_opt_GetString(go, "--checkpoint"));
+      if (esl_opt_GetBoolean(go, "--resume"))
+	{
+	  status = p7_checkpoint_Load(ck, errbuf);
+	  if (status != eslOK && status != eslENOTFOUND) p7_Fail("Can't resume search:\n%s\n", errbuf); /* ENOTFOUND: nothing saved; start over */
+	}
+    }
 
   /* Open the results output files */
-  if (esl_opt_IsOn(go, "-o"))          { if ((ofp      = fopen(esl_opt_GetString(go, "-o"),          "w")) == NULL)  esl_fatal("Failed to open output file %s for writing\n",                 esl_opt_GetString(go, "-o")); }
-  if (esl_opt_IsOn(go, "--tblout"))    { if ((tblfp    = fopen(esl_opt_GetString(go, "--tblout"),    "w")) == NULL)  esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
-  if (esl_opt_IsOn(go, "--domtblout")) { if ((domtblfp = fopen(esl_opt_GetString(go, "--domtblout"), "w")) == NULL)  esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
-  if (esl_opt_IsOn(go, "--pfamtblout")){ if ((pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
+  if (esl_opt_IsOn(go, "-o"))          { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "-o"),          &ofp)       != eslOK)  esl_fatal("Failed to open output file %s for writing\n",                 esl_opt_GetString(go, "-o")); }
+  if (esl_opt_IsOn(go, "--tblout"))    { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--tblout"),    &tblfp)     != eslOK)  esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
+  if (esl_opt_IsOn(go, "--domtblout")) { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--domtblout"), &domtblfp)  != eslOK)  esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
+  if (esl_opt_IsOn(go, "--pfamtblout")){ if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--pfamtblout"),&pfamtblfp) != eslOK)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
+
+  if (ck)
+    for (; nquery < ck->nquery; nquery++)
+      {
+	if (esl_sqio_Read(sqfp, qsq[0]) != eslOK) p7_Fail("Sequence file %s has fewer queries than the checkpoint's search", cfg->seqfile);
+	esl_sq_Reuse(qsq[0]);
+      }
 
-  output_header(ofp, go, cfg->hmmfile, cfg->seqfile);
+  if (nquery == 0) output_header(ofp, go, cfg->hmmfile, cfg->seqfile); /* else it's there from before --resume */
 
 #ifdef HMMER_THREADS
   /* initialize thread data */
   ncpus = ESL_MIN( esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
   if (ncpus > 0)
     {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
+      sched = p7_scheduler_Create(ncpus, NULL);
+      if (sched == NULL) p7_Fail("Failed to start worker threads");
+      pool  = om_pool_Create(ncpus * 2);
+      if (pool  == NULL) p7_Fail("Failed to allocate profile blocks");
     }
 #endif
 
@@ -404,31 +474,27 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   for (i = 0; i < infocnt; ++i)
     {
       info[i].bg    = p7_bg_Create(abc);
-#ifdef HMMER_THREADS
-      info[i].queue = queue;
-#endif
-    }
-
-#ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
-    {
-      block = p7_oprofile_CreateBlock(BLOCK_SIZE);
-      if (block == NULL)    esl_fatal("Failed to allocate sequence block");
-
-      status = esl_workqueue_Init(queue, block);
-      if (status != eslOK)  esl_fatal("Failed to add block to work queue");
+      info[i].qsq   = qsq;
+      info[i].nq    = 0;
+      ESL_ALLOC(info[i].pli, sizeof(P7_PIPELINE *) * qblock);
+      ESL_ALLOC(info[i].th,  sizeof(P7_TOPHITS *)  * qblock);
     }
-#endif
 
-  /* Outside loop: over each query sequence in <seqfile>. */
-  while ((sstatus = esl_sqio_Read(sqfp, qsq)) == eslOK)
+  /* Outside loop: over each block of query sequences in <seqfile>.
+   * Each pass through the database searches every query in the block
+   * against a model before moving on to the next model, so a model is
+   * read (or mapped) and set up once per block, not once per query.
+   */
+  while (sstatus == eslOK)
     {
-      nquery++;
+      for (nq = 0; nq < qblock; nq++)
+	if ((sstatus = esl_sqio_Read(sqfp, qsq[nq])) != eslOK) break;
+      if (nq == 0) break;
       esl_stopwatch_Start(w);	                          
 
       /* Open the target profile database */
-      status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, NULL);
-      if (status != eslOK)        p7_Fail("Unexpected error %d in opening hmm file %s.\n",           status, cfg->hmmfile);  
+      status = open_hmmdb(go, cfg, &hfp, errbuf);
+      if (status != eslOK)        p7_Fail("Unexpected error %d in opening hmm file %s.\n%s\n",       status, cfg->hmmfile, errbuf);  
   
 #ifdef HMMER_THREADS
       /* if we are threaded, create a lock to prevent multiple readers */
@@ -439,27 +505,22 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	}
 #endif
 
-      if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->acc[0]  != 0 && fprintf(ofp, "Accession:   %s\n", qsq->acc)     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->desc[0] != 0 && fprintf(ofp, "Description: %s\n", qsq->desc)    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-
       for (i = 0; i < infocnt; ++i)
 	{
-	  /* Create processing pipeline and hit list */
-	  info[i].th  = p7_tophits_Create(); 
-	  info[i].pli = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
-	  info[i].pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
-
-	  p7_pli_NewSeq(info[i].pli, qsq);
-	  info[i].qsq = qsq;
+	  /* Create processing pipelines and hit lists, one per query */
+	  for (q = 0; q < nq; q++)
+	    {
+	      info[i].th[q]  = p7_tophits_Create(); 
+	      info[i].pli[q] = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
+	      info[i].pli[q]->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
 
-#ifdef HMMER_THREADS
-	  if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
-#endif
+	      p7_pli_NewSeq(info[i].pli[q], qsq[q]);
+	    }
+	  info[i].nq = nq;
 	}
 
 #ifdef HMMER_THREADS
-      if (ncpus > 0)  hstatus = thread_loop(threadObj, queue, hfp);
+      if (ncpus > 0)  hstatus = thread_loop(sched, pool, info, hfp);
       else	      hstatus = serial_loop(info, hfp);
 #else
       hstatus = serial_loop(info, hfp);
@@ -474,34 +535,46 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       /* merge the results of the search results */
       for (i = 1; i < infocnt; ++i)
+	for (q = 0; q < nq; q++)
+	  {
+	    p7_tophits_Merge(info[0].th[q], info[i].th[q]);
+	    p7_pipeline_Merge(info[0].pli[q], info[i].pli[q]);
+
+	    p7_pipeline_Destroy(info[i].pli[q]);
+	    p7_tophits_Destroy(info[i].th[q]);
+	  }
+      esl_stopwatch_Stop(w);
+
+      /* Print results, in the order of the queries in <seqfile> */
+      for (q = 0; q < nq; q++)
 	{
-	  p7_tophits_Merge(info[0].th, info[i].th);
-	  p7_pipeline_Merge(info[0].pli, info[i].pli);
+	  nquery++;
 
-	  p7_pipeline_Destroy(info[i].pli);
-	  p7_tophits_Destroy(info[i].th);
-	}
+	  if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq[q]->name, (long) qsq[q]->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  if (qsq[q]->acc[0]  != 0 && fprintf(ofp, "Accession:   %s\n", qsq[q]->acc)     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  if (qsq[q]->desc[0] != 0 && fprintf(ofp, "Description: %s\n", qsq[q]->desc)    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 
-      /* Print results */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
+	  p7_tophits_SortBySortkey(info->th[q]);
+	  p7_tophits_Threshold(info->th[q], info->pli[q]);
 
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  p7_tophits_Targets(ofp, info->th[q], info->pli[q], textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  p7_tophits_Domains(ofp, info->th[q], info->pli[q], textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
+	  if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq[q]->name, qsq[q]->acc, info->th[q], info->pli[q], (nquery == 1));
+	  if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq[q]->name, qsq[q]->acc, info->th[q], info->pli[q], (nquery == 1));
+	  if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq[q]->name, qsq[q]->acc, info->th[q], info->pli[q]);
 
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
-      if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      fflush(ofp);
+	  p7_pli_Statistics(ofp, info->pli[q], w); /* time is for the whole block */
+	  if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  fflush(ofp);
+	  if (ck && p7_checkpoint_QueryDone(ck, nquery) != eslOK) esl_fatal("Failed to save search checkpoint");
+
+	  p7_pipeline_Destroy(info->pli[q]);
+	  p7_tophits_Destroy(info->th[q]);
+	  esl_sq_Reuse(qsq[q]);
+	}
 
       p7_hmmfile_Close(hfp);
-      p7_pipeline_Destroy(info->pli);
-      p7_tophits_Destroy(info->th);
-      esl_sq_Reuse(qsq);
     }
   if      (sstatus == eslEFORMAT) esl_fatal("Parse failed (sequence file %s):\n%s\n",
 					    sqfp->filename, esl_sqfile_GetErrorBuf(sqfp));
@@ -515,28 +588,31 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (pfamtblfp)p7_tophits_TabularTail(pfamtblfp,"hmmscan", p7_SEARCH_SEQS, cfg->seqfile, cfg->hmmfile, go);
   if (ofp)      { if (fprintf(ofp, "[ok]\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
 
+  /* The search is complete: a --resume has nothing left to do */
+  if (ck) p7_checkpoint_Finish(ck);
+
   /* Cleanup - prepare for successful exit
    */
   for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
-
-#ifdef HMMER_THREADS
-  if (ncpus > 0)
     {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	p7_oprofile_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
+      p7_bg_Destroy(info[i].bg);
+      free(info[i].pli);
+      free(info[i].th);
     }
+
+#ifdef HMMER_THREADS
+  p7_scheduler_Destroy(sched);
+  om_pool_Destroy(pool);
 #endif
 
   free(info);
 
-  esl_sq_Destroy(qsq);
+  for (q = 0; q < qblock; q++) esl_sq_Destroy(qsq[q]);
+  free(qsq);
   esl_stopwatch_Destroy(w);
   esl_alphabet_Destroy(abc);
   esl_sqfile_Close(sqfp);
+  p7_checkpoint_Destroy(ck);
 
   if (ofp != stdout) fclose(ofp);
   if (tblfp)         fclose(tblfp);
@@ -548,6 +624,48 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return status;
 }
 
+/* open_hmmdb()
+ * Open the target profile database <cfg->hmmfile> for a pass of the
+ * search. With --shmcache, profiles come from the named shared memory
+ * cache, which must have been loaded from a database of the same
+ * name. Otherwise they come from the pressed files, read in place
+ * from a shared mapping of them unless --nommap.
+ */
+static int
+open_hmmdb(ESL_GETOPTS *go, struct cfg_s *cfg, P7_HMMFILE **ret_hfp, char *errbuf)
+{
+  P7_HMMFILE *hfp     = NULL;
+  char       *dbtail  = NULL;
+  char       *shmtail = NULL;
+  int         status;
+
+  if (esl_opt_IsOn(go, "--shmcache"))
+    {
+      if ((status = p7_hmmfile_OpenShm(esl_opt_GetString(go, "--shmcache"), FALSE, &hfp, errbuf)) != eslOK) goto ERROR;
+      if ((status = esl_FileTail(cfg->hmmfile, FALSE, &dbtail))  != eslOK) goto ERROR;
+      if ((status = esl_FileTail(hfp->fname,   FALSE, &shmtail)) != eslOK) goto ERROR;
+      if (strcmp(dbtail, shmtail) != 0)
+	ESL_XFAIL(eslEINCOMPAT, errbuf, "shared memory cache %s holds %s, not %s", esl_opt_GetString(go, "--shmcache"), hfp->fname, cfg->hmmfile);
+      free(dbtail);
+      free(shmtail);
+    }
+  else
+    {
+      if ((status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, errbuf)) != eslOK) goto ERROR;
+      if (! esl_opt_GetBoolean(go, "--nommap")) p7_hmmfile_Map(hfp);
+    }
+
+  *ret_hfp = hfp;
+  return eslOK;
+
+ ERROR:
+  if (dbtail)  free(dbtail);
+  if (shmtail) free(shmtail);
+  if (hfp)     p7_hmmfile_Close(hfp);
+  *ret_hfp = NULL;
+  return status;
+}
+
 #ifdef HMMER_MPI
 
 /* Define common tags used by the MPI master/slave processes */
@@ -1078,7 +1196,7 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 
 	      p7_pli_NewModel(pli, om, bg);
 	      p7_bg_SetLength(bg, qsq->n);
-	      p7_oprofile_ReconfigLength(om, qsq->n);
+	      p7_oprofile_SetMSVLength(om, &(pli->olen));
 	      
 	      p7_Pipeline(pli, om, bg, qsq, NULL, th);
 	      
@@ -1152,6 +1270,30 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 }
 #endif /*HMMER_MPI*/
 
+/* scan_model()
+ * Compare one target model <om> to each query in the worker's block.
+ * The first query whose MSV score passes reads the rest of <om>;
+ * later queries in the block find it already read.
+ */
+static void
+scan_model(WORKER_INFO *info, P7_OPROFILE *om)
+{
+  int q;
+  int status;
+
+  for (q = 0; q < info->nq; q++)
+    {
+      p7_pli_NewModel(info->pli[q], om, info->bg);
+      p7_bg_SetLength(info->bg, info->qsq[q]->n);
+      p7_oprofile_SetMSVLength(om, &(info->pli[q]->olen)); /* rest is set by the pipeline, if it reads it */
+
+      status = p7_Pipeline(info->pli[q], om, info->bg, info->qsq[q], NULL, info->th[q]);
+      if (status == eslEINVAL) p7_Fail(info->pli[q]->errbuf);
+
+      p7_pipeline_Reuse(info->pli[q]);
+    }
+}
+
 static int
 serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
 {
@@ -1162,15 +1304,8 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
   /* Main loop: */
   while ((status = p7_oprofile_ReadMSV(hfp, &abc, &om)) == eslOK)
     {
-      p7_pli_NewModel(info->pli, om, info->bg);
-      p7_bg_SetLength(info->bg, info->qsq->n);
-      p7_oprofile_ReconfigLength(om, info->qsq->n);
-
-      status = p7_Pipeline(info->pli, om, info->bg, info->qsq, NULL, info->th);
-      if (status == eslEINVAL) p7_Fail(info->pli->errbuf);
-
+      scan_model(info, om);
       p7_oprofile_Destroy(om);
-      p7_pipeline_Reuse(info->pli);
     }
 
   esl_alphabet_Destroy(abc);
@@ -1179,108 +1314,148 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
 }
 
 #ifdef HMMER_THREADS
+/* thread_loop()
+ * Read the target profiles in blocks taken from <pool>, and submit a
+ * task for each block that compares it to the current query block,
+ * using the pipelines and hit lists of the worker that runs it,
+ * <info[workeridx]>. Returns once all the tasks are done.
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_HMMFILE *hfp)
+thread_loop(P7_SCHEDULER *sched, OM_POOL *pool, WORKER_INFO *info, P7_HMMFILE *hfp)
 {
-  int  status   = eslOK;
-  int  sstatus  = eslOK;
-  int  eofCount = 0;
+  int            sstatus = eslOK;
+  int            i;
   P7_OM_BLOCK   *block;
+  BLOCK_TASK    *task;
+  P7_TASKGROUP  *grp;
   ESL_ALPHABET  *abc = NULL;
-  void          *newBlock;
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+  grp = p7_taskgroup_Create();
+  if (grp == NULL) p7_Fail("Failed to create task group");
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
-      
   /* Main loop: */
   while (sstatus == eslOK)
     {
-      block = (P7_OM_BLOCK *) newBlock;
+      block   = om_pool_Get(pool);
       sstatus = p7_oprofile_ReadBlockMSV(hfp, &abc, block);
-      if (sstatus == eslEOF)
+      if (sstatus != eslOK)
 	{
-	  if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-	  ++eofCount;
-	}
-	  
-      if (sstatus == eslOK)
-	{
-	  status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-	  if (status != eslOK) esl_fatal("Work queue reader failed");
+	  for (i = 0; i < block->count; ++i) { p7_oprofile_Destroy(block->list[i]); block->list[i] = NULL; }
+	  block->count = 0;
+	  om_pool_Put(pool, block);
+	  break;
 	}
+
+      if ((task = malloc(sizeof(BLOCK_TASK))) == NULL) p7_Fail("malloc failed");
+      task->info  = info;
+      task->block = block;
+      task->pool  = pool;
+      if (p7_scheduler_Submit(sched, grp, scan_block, task) != eslOK) p7_Fail("Failed to submit scan task");
     }
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
+  /* the tasks use <hfp> and the pipelines; wait for them either way */
+  if (p7_taskgroup_Wait(grp) != eslOK) p7_Fail("Failed waiting for scan tasks");
+  p7_taskgroup_Destroy(grp);
 
-  if (sstatus == eslEOF)
-    {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
-    }
-  
   esl_alphabet_Destroy(abc);
   return sstatus;
 }
 
-static void 
-pipeline_thread(void *arg)
+/* scan_block()
+ * Task: compare one block of target profiles to the query block,
+ * using the pipelines and hit lists of worker <workeridx>.
+ */
+static void
+scan_block(void *arg, int workeridx)
 {
-  int i;
-  int status;
-  int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-  P7_OM_BLOCK   *block;
-  void          *newBlock;
-  
-  impl_Init();
+  BLOCK_TASK  *task  = (BLOCK_TASK *) arg;
+  P7_OM_BLOCK *block = task->block;
+  int          i;
 
-  obj = (ESL_THREADS *) arg;
-  esl_threads_Started(obj, &workeridx);
+  for (i = 0; i < block->count; ++i)
+    {
+      scan_model(&(task->info[workeridx]), block->list[i]);
+      p7_oprofile_Destroy(block->list[i]);
+      block->list[i] = NULL;
+    }
+  block->count = 0;
 
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  om_pool_Put(task->pool, block);
+  free(task);
+}
 
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
-  if (status != eslOK) esl_fatal("Work queue worker failed");
+/* om_pool_Create()
+ * Create a pool of <nblocks> empty profile blocks of BLOCK_SIZE
+ * profiles each. Returns NULL on allocation or pthreads init failure.
+ */
+static OM_POOL *
+om_pool_Create(int nblocks)
+{
+  OM_POOL *pool = NULL;
+  int      status;
 
-  /* loop until all blocks have been processed */
-  block = (P7_OM_BLOCK *) newBlock;
-  while (block->count > 0)
-  {
-      /* Main loop: */
-    for (i = 0; i < block->count; ++i)
-    {
-      P7_OPROFILE *om = block->list[i];
+  ESL_ALLOC(pool, sizeof(OM_POOL));
+  pool->block   = NULL;
+  pool->nfree   = 0;
+  pool->nblocks = nblocks;
+  if (pthread_mutex_init(&pool->mutex, NULL) != 0) { free(pool); return NULL; }
+  if (pthread_cond_init (&pool->avail, NULL) != 0) { pthread_mutex_destroy(&pool->mutex); free(pool); return NULL; }
 
-      p7_pli_NewModel(info->pli, om, info->bg);
-      p7_bg_SetLength(info->bg, info->qsq->n);
-      p7_oprofile_ReconfigLength(om, info->qsq->n);
+  ESL_ALLOC(pool->block, sizeof(P7_OM_BLOCK *) * nblocks);
+  for (pool->nfree = 0; pool->nfree < nblocks; pool->nfree++)
+    if ((pool->block[pool->nfree] = p7_oprofile_CreateBlock(BLOCK_SIZE)) == NULL) goto ERROR;
+  return pool;
 
-      status = p7_Pipeline(info->pli, om, info->bg, info->qsq, NULL, info->th);
-      if (status == eslEINVAL) p7_Fail(info->pli->errbuf);
+ ERROR:
+  om_pool_Destroy(pool);
+  return NULL;
+}
 
-      p7_oprofile_Destroy(om);
-      p7_pipeline_Reuse(info->pli);
+/* om_pool_Get()
+ * Take an empty block from <pool>, waiting until one is returned if
+ * none is free.
+ */
+static P7_OM_BLOCK *
+om_pool_Get(OM_POOL *pool)
+{
+  P7_OM_BLOCK *block;
+
+  if (pthread_mutex_lock(&pool->mutex) != 0) p7_Fail("pthread_mutex_lock failed");
+  while (pool->nfree == 0)
+    if (pthread_cond_wait(&pool->avail, &pool->mutex) != 0) p7_Fail("pthread_cond_wait failed");
+  block = pool->block[--pool->nfree];
+  if (pthread_mutex_unlock(&pool->mutex) != 0) p7_Fail("pthread_mutex_unlock failed");
+  return block;
+}
 
-      block->list[i] = NULL;
-    }
+/* om_pool_Put()
+ * Return an emptied <block>, taken with om_pool_Get(), to <pool>.
+ */
+static void
+om_pool_Put(OM_POOL *pool, P7_OM_BLOCK *block)
+{
+  if (pthread_mutex_lock(&pool->mutex) != 0) p7_Fail("pthread_mutex_lock failed");
+  pool->block[pool->nfree++] = block;
+  pthread_cond_signal(&pool->avail);
+  if (pthread_mutex_unlock(&pool->mutex) != 0) p7_Fail("pthread_mutex_unlock failed");
+}
 
-    status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
-    if (status != eslOK) esl_fatal("Work queue worker failed");
+/* om_pool_Destroy()
+ * Free <pool> and its blocks, all of which must have been returned.
+ */
+static void
+om_pool_Destroy(OM_POOL *pool)
+{
+  int i;
 
-    block = (P7_OM_BLOCK *) newBlock;
+  if (! pool) return;
+  if (pool->block) {
+    for (i = 0; i < pool->nfree; i++) p7_oprofile_DestroyBlock(pool->block[i]);
+    free(pool->block);
   }
-
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
-  if (status != eslOK) esl_fatal("Work queue worker failed");
-
-  esl_threads_Finished(obj, workeridx);
-  return;
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->avail);
+  free(pool);
 }
 #endif   /* HMMER_THREADS */
 
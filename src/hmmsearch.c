@@ -28,21 +28,57 @@
 #ifdef HMMER_THREADS
 #include <unistd.h>
 #include "esl_threads.h"
-#include "esl_workqueue.h"
 #endif 
 
 #include "hmmer.h"
+#include "p7_checkpoint.h"
+#include "p7_scheduler.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif 
   P7_BG            *bg;	         /* null model                              */
   P7_PIPELINE      *pli;         /* work pipeline                           */
   P7_TOPHITS       *th;          /* top hit results                         */
   P7_OPROFILE      *om;          /* optimized query profile                 */
 } WORKER_INFO;
 
+/* QUERY_INFO: one query and the per-worker pipelines its targets are
+ * searched with. With threads, the next query's targets are submitted
+ * before this one's results are collected, so more than one query
+ * can be in flight; each owns its own worker state.
+ */
+typedef struct query_info_s {
+  ESL_GETOPTS      *go;          /* pipeline options                        */
+  P7_HMM           *hmm;         /* query HMM                               */
+  P7_PROFILE       *gm;          /* configured query profile                */
+  P7_OPROFILE      *om;          /* optimized query profile                 */
+  int               qidx;        /* query number, 1..nquery                 */
+  int               infocnt;     /* number of workers                       */
+  WORKER_INFO      *info;        /* per-worker state [0..infocnt-1]         */
+  int               lazy;        /* TRUE: each worker sets up its own state */
+  ESL_STOPWATCH    *w;           /* started at setup, stopped at last block */
+#ifdef HMMER_THREADS
+  P7_TASKGROUP     *grp;         /* this query's block search tasks         */
+  int               nblocks;     /* number of blocks submitted              */
+  pthread_mutex_t   wmutex;      /* guards <w> against workers              */
+  struct query_info_s *next;     /* next query in the output queue          */
+#endif
+} QUERY_INFO;
+
+/* PREP_TASK: read the next query HMM and set it up for searching.
+ * With threads, this runs on a worker while the current query's
+ * targets are read and searched.
+ */
+typedef struct {
+  ESL_GETOPTS      *go;
+  P7_HMMFILE       *hfp;         /* open query HMM file                     */
+  ESL_ALPHABET    **byp_abc;     /* query alphabet; set by the first read   */
+  int               qidx;        /* number of the query to read             */
+  int               infocnt;     /* number of workers                       */
+  int               lazy;        /* TRUE: workers set up their own state    */
+  int               hstatus;     /* RETURN: status of reading the HMM       */
+  QUERY_INFO       *qi;          /* RETURN: the query; NULL unless eslOK    */
+} PREP_TASK;
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
@@ -51,7 +87,7 @@ typedef struct {
 
 #if defined (HMMER_THREADS) && defined (HMMER_MPI)
 #define CPUOPTS     "--mpi"
-#define MPIOPTS     "--cpu"
+#define MPIOPTS     "--cpu,--checkpoint"
 #else
 #define CPUOPTS     NULL
 #define MPIOPTS     NULL
@@ -97,9 +133,13 @@ static ESL_OPTIONS options[] = {
   { "--domZ",       eslARG_REAL,   FALSE, NULL, "x>0",   NULL,  NULL,  NULL,            "set # of significant seqs, for domain E-value calculation",   12 },
   { "--seed",       eslARG_INT,    "42",  NULL, "n>=0",  NULL,  NULL,  NULL,            "set RNG seed to <n> (if 0: one-time arbitrary seed)",         12 },
   { "--tformat",    eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,            "assert target <seqfile> is in format <s>: no autodetection",  12 },
+  { "--checkpoint", eslARG_STRING,  NULL, NULL, NULL,    NULL,  "-o",  NULL,            "save search state in directory <s>, so it can be resumed",    12 },
+  { "--ckinterval", eslARG_INT,    "600", NULL, "n>0",   NULL,"--checkpoint",NULL,      "save search state at most every <n> seconds",                 12 },
+  { "--resume",     eslARG_NONE,   FALSE, NULL, NULL,    NULL,"--checkpoint",NULL,      "resume an interrupted search from its --checkpoint state",    12 },
 
 #ifdef HMMER_THREADS 
   { "--cpu",        eslARG_INT, p7_NCPU,"HMMER_NCPU","n>=0",NULL,  NULL,  CPUOPTS,      "number of parallel CPU workers to use for multithreads",      12 },
+  { "--numa",       eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  CPUOPTS,         "pin workers to NUMA nodes; keep their search data node-local", 12 },
 #endif
 #ifdef HMMER_MPI
   { "--stall",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,"--mpi", NULL,            "arrest after start: for debugging MPI under gdb",             12 },  
@@ -139,13 +179,55 @@ struct cfg_s {
 };
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
-static int  serial_loop  (WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs);
+static int  serial_loop  (WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs, P7_CHECKPOINT *ck, int qidx, int64_t ntargets);
+static int  skip_targets (ESL_SQFILE *dbfp, int64_t ntargets);
+
+static QUERY_INFO *query_Create (ESL_GETOPTS *go, P7_HMM *hmm, const ESL_ALPHABET *abc, int qidx, int infocnt, int lazy);
+static void        query_SetupWorker(QUERY_INFO *qi, int workeridx);
+static int         query_Output (ESL_GETOPTS *go, QUERY_INFO *qi, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw);
+static void        query_Checkpoint(QUERY_INFO *qi, P7_CHECKPOINT *ck, int64_t ntargets, off_t roff);
+static void        query_Destroy(QUERY_INFO *qi);
+static void        prepare_query(void *arg, int workeridx);
 
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs);
-static void pipeline_thread(void *arg);
+/* BLOCK_TASK: one block of targets to search with one query */
+typedef struct {
+  QUERY_INFO       *qi;
+  ESL_SQ_BLOCK     *block;
+  P7_BLOCKPOOL     *pool;        /* where <block> goes back to when done    */
+} BLOCK_TASK;
+
+/* OUTPUT_INFO: the output thread, which collects, prints and frees
+ * searched queries in order, while the workers go on to the next.
+ */
+#define MAX_OUTPUT_QUEUE 4	/* max # of queries waiting for output  */
+typedef struct {
+  ESL_GETOPTS      *go;
+  FILE             *ofp;
+  FILE             *afp;
+  FILE             *tblfp;
+  FILE             *domtblfp;
+  FILE             *pfamtblfp;
+  int               textw;
+  P7_CHECKPOINT    *ck;          /* if non-NULL, told as each query is done */
+
+  QUERY_INFO       *head;        /* oldest query waiting for output         */
+  QUERY_INFO       *tail;        /* newest query waiting for output         */
+  int               nqueued;     /* # of queries waiting                    */
+  int               done;        /* TRUE when no more queries will come     */
+  pthread_t         thread;
+  pthread_mutex_t   mutex;
+  pthread_cond_t    cond;        /* signalled when the queue changes        */
+} OUTPUT_INFO;
+
+static int   thread_loop (P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, QUERY_INFO *qi, ESL_SQFILE *dbfp, int n_targetseqs, P7_CHECKPOINT *ck, int64_t ntargets);
+static void  search_block(void *arg, int workeridx);
+static void  output_Start (OUTPUT_INFO *out);
+static void  output_Submit(OUTPUT_INFO *out, QUERY_INFO *qi);
+static void  output_Finish(OUTPUT_INFO *out);
+static void *output_thread(void *arg);
 #endif 
 
 #ifdef HMMER_MPI
@@ -260,8 +342,10 @@ output_header(FILE *ofp, const ESL_GETOPTS *go, char *hmmfile, char *seqfile)
     else if (                               fprintf(ofp, "# random number seed set to:       %d\n",             esl_opt_GetInteger(go, "--seed"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   }
   if (esl_opt_IsUsed(go, "--tformat")    && fprintf(ofp, "# targ <seqfile> format asserted:  %s\n",             esl_opt_GetString(go, "--tformat"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--checkpoint") && fprintf(ofp, "# search state saved to:           %s\n",             esl_opt_GetString(go, "--checkpoint")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")        && fprintf(ofp, "# number of worker threads:        %d\n",             esl_opt_GetInteger(go, "--cpu"))       < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
+  if (esl_opt_IsUsed(go, "--numa")       && fprintf(ofp, "# NUMA worker placement:           on\n")                                                    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #endif
 #ifdef HMMER_MPI
   if (esl_opt_IsUsed(go, "--mpi")        && fprintf(ofp, "# MPI:                             on\n")                                                    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -356,30 +440,31 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   FILE            *pfamtblfp= NULL;              /* output stream for pfam tabular output (--pfamtblout)    */
   P7_HMMFILE      *hfp      = NULL;              /* open input HMM file                             */
   ESL_SQFILE      *dbfp     = NULL;              /* open input sequence file                        */
-  P7_HMM          *hmm      = NULL;              /* one HMM query                                   */
   ESL_ALPHABET    *abc      = NULL;              /* digital alphabet                                */
   int              dbfmt    = eslSQFILE_UNKNOWN; /* format code for sequence database file          */
-  ESL_STOPWATCH   *w;
+  QUERY_INFO      *qi       = NULL;              /* query being searched                            */
+  PREP_TASK        prep;                         /* reads and sets up the next query                */
+  P7_CHECKPOINT   *ck       = NULL;              /* saved search state (--checkpoint)               */
+  P7_HMM          *hmm      = NULL;              /* a query skipped on --resume                     */
+  int64_t          ntargets = 0;                 /* # of targets of a resumed query already searched */
+  off_t            roff     = -1;                /* where the rest of them start on disk            */
+  int              n_targetseq;
   int              textw    = 0;
   int              nquery   = 0;
   int              status   = eslOK;
-  int              hstatus  = eslOK;
   int              sstatus  = eslOK;
-  int              i;
 
   int              ncpus    = 0;
-
   int              infocnt  = 0;
-  WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  ESL_SQ_BLOCK    *block    = NULL;
-  ESL_THREADS     *threadObj= NULL;
-  ESL_WORK_QUEUE  *queue    = NULL;
+  P7_SCHEDULER    *sched    = NULL;
+  P7_BLOCKPOOL    *pool     = NULL;
+  P7_TASKGROUP    *prepgrp  = NULL;
+  P7_NUMA         *numa     = NULL;
+  OUTPUT_INFO      out;
 #endif
   char             errbuf[eslERRBUFSIZE];
 
-  w = esl_stopwatch_Create();
-
   if (esl_opt_GetBoolean(go, "--notextw")) textw = 0;
   else                                     textw = esl_opt_GetInteger(go, "--textw");
 
@@ -411,62 +496,112 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   else if (status == eslEFORMAT)   p7_Fail("File format problem in trying to open HMM file %s.\n%s\n",                cfg->hmmfile, errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",               status, cfg->hmmfile, errbuf);  
 
+  /* --resume reads the inputs again, skipping what was already done,
+   * and seeks in the target database: stdin and gzip'ed files can't
+   * be read that way.
+   */
+  if (esl_opt_GetBoolean(go, "--resume") && (hfp->do_stdin || hfp->do_gzip || ! esl_sqfile_IsRewindable(dbfp)))
+    p7_Fail("Can't resume a search of stdin or of a .gz file: --resume needs input files that can be read again\n");
+
+  /* Saved search state. With --resume, the outputs opened below are
+   * cut back to where they were when it was saved.
+   */
+  if (esl_opt_IsOn(go, "--checkpoint"))
+    {
+      ck = p7_checkpoint_Create(esl_opt_GetString(go, "--checkpoint"), "hmmsearch", cfg->hmmfile, cfg->dbfile, esl_opt_GetInteger(go, "--ckinterval"));
+      if (ck == NULL) p7_Fail("Failed to create search checkpoint in directory %s\n", esl_opt_GetString(go, "--checkpoint"));
+      if (esl_opt_GetBoolean(go, "--resume"))
+	{
+	  status = p7_checkpoint_Load(ck, errbuf);
+	  if (status != eslOK && status != eslENOTFOUND) p7_Fail("Can't resume search:\n%s\n", errbuf); /* ENOTFOUND: nothing saved; start over */
+	}
+    }
+
   /* Open the results output files */
-  if (esl_opt_IsOn(go, "-o"))          { if ((ofp      = fopen(esl_opt_GetString(go, "-o"), "w")) == NULL) p7_Fail("Failed to open output file %s for writing\n",    esl_opt_GetString(go, "-o")); }
-  if (esl_opt_IsOn(go, "-A"))          { if ((afp      = fopen(esl_opt_GetString(go, "-A"), "w")) == NULL) p7_Fail("Failed to open alignment file %s for writing\n", esl_opt_GetString(go, "-A")); }
-  if (esl_opt_IsOn(go, "--tblout"))    { if ((tblfp    = fopen(esl_opt_GetString(go, "--tblout"),    "w")) == NULL)  esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
-  if (esl_opt_IsOn(go, "--domtblout")) { if ((domtblfp = fopen(esl_opt_GetString(go, "--domtblout"), "w")) == NULL)  esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
-  if (esl_opt_IsOn(go, "--pfamtblout")){ if ((pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
+  if (esl_opt_IsOn(go, "-o"))          { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "-o"),          &ofp)       != eslOK) p7_Fail("Failed to open output file %s for writing\n",    esl_opt_GetString(go, "-o")); }
+  if (esl_opt_IsOn(go, "-A"))          { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "-A"),          &afp)       != eslOK) p7_Fail("Failed to open alignment file %s for writing\n", esl_opt_GetString(go, "-A")); }
+  if (esl_opt_IsOn(go, "--tblout"))    { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--tblout"),    &tblfp)     != eslOK) esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
+  if (esl_opt_IsOn(go, "--domtblout")) { if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--domtblout"), &domtblfp)  != eslOK) esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
+  if (esl_opt_IsOn(go, "--pfamtblout")){ if (p7_checkpoint_OpenOutput(ck, esl_opt_GetString(go, "--pfamtblout"),&pfamtblfp) != eslOK) esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
 
 #ifdef HMMER_THREADS
   /* initialize thread data */
   ncpus = ESL_MIN( esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
   if (ncpus > 0)
     {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
+      if (esl_opt_GetBoolean(go, "--numa") && (numa = p7_numa_Create()) == NULL) esl_fatal("Failed to get NUMA topology");
+      sched = p7_scheduler_Create(ncpus, numa);
+      if (sched == NULL) esl_fatal("Failed to start worker threads");
+
+      /* Queries are parsed ahead by one more thread. For a file it
+       * can't do (stdin, gzip, binary), they're read serially. */
+      p7_hmmfile_ReadAhead(hfp, 1);
     }
 #endif
 
   infocnt = (ncpus == 0) ? 1 : ncpus;
-  ESL_ALLOC(info, sizeof(*info) * infocnt);
 
   /* <abc> is not known 'til first HMM is read. */
-  hstatus = p7_hmmfile_Read(hfp, &abc, &hmm);
-  if (hstatus == eslOK)
-    {
-      /* One-time initializations after alphabet <abc> becomes known */
-      output_header(ofp, go, cfg->hmmfile, cfg->dbfile);
-      esl_sqfile_SetDigital(dbfp, abc); //ReadBlock requires knowledge of the alphabet to decide how best to read blocks
-
-      for (i = 0; i < infocnt; ++i)
-	{
-	  info[i].bg    = p7_bg_Create(abc);
+  prep.go      = go;
+  prep.hfp     = hfp;
+  prep.byp_abc = &abc;
+  prep.qidx    = 1;
+  prep.infocnt = infocnt;
 #ifdef HMMER_THREADS
-	  info[i].queue = queue;
+  prep.lazy    = (numa != NULL);
+#else
+  prep.lazy    = FALSE;
 #endif
+
+  /* --resume: skip the queries whose output is already complete */
+  if (ck)
+    {
+      for (nquery = 0; nquery < ck->nquery; nquery++)
+	{
+	  if (p7_hmmfile_Read(hfp, &abc, &hmm) != eslOK) p7_Fail("HMM file %s has fewer queries than the checkpoint's search", cfg->hmmfile);
+	  p7_hmm_Destroy(hmm);
 	}
+      prep.qidx = nquery + 1;
+    }
+
+  prepare_query(&prep, 0);
+  if (prep.hstatus == eslOK)
+    {
+      /* One-time initializations after alphabet <abc> becomes known */
+      if (nquery == 0) output_header(ofp, go, cfg->hmmfile, cfg->dbfile); /* else it's there from before --resume */
+      esl_sqfile_SetDigital(dbfp, abc); //ReadBlock requires knowledge of the alphabet to decide how best to read blocks
 
 #ifdef HMMER_THREADS
-      for (i = 0; i < ncpus * 2; ++i)
+      if (ncpus > 0)
 	{
-	  block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-	  if (block == NULL) 	      esl_fatal("Failed to allocate sequence block");
-
- 	  status = esl_workqueue_Init(queue, block);
-	  if (status != eslOK)	      esl_fatal("Failed to add block to work queue");
+	  pool = p7_blockpool_Create(ncpus * 2, BLOCK_SIZE, abc);
+	  if (pool == NULL) esl_fatal("Failed to allocate sequence blocks");
+	  prepgrp = p7_taskgroup_Create();
+	  if (prepgrp == NULL) esl_fatal("Failed to create task group");
+
+	  out.go        = go;
+	  out.ofp       = ofp;
+	  out.afp       = afp;
+	  out.tblfp     = tblfp;
+	  out.domtblfp  = domtblfp;
+	  out.pfamtblfp = pfamtblfp;
+	  out.textw     = textw;
+	  out.ck        = ck;
+	  output_Start(&out);
 	}
 #endif
     }
 
-  /* Outer loop: over each query HMM in <hmmfile>. */
-  while (hstatus == eslOK) 
+  /* Outer loop: over each query HMM in <hmmfile>. 
+   * With threads, three things overlap: the workers search this
+   * query's target blocks, queued behind the previous query's; one
+   * worker reads and sets up the next query; and the output thread
+   * prints the previous query's results once its blocks are done.
+   */
+  while (prep.hstatus == eslOK) 
     {
-      P7_PROFILE      *gm      = NULL;
-      P7_OPROFILE     *om      = NULL;       /* optimized query profile                  */
-
+      qi = prep.qi;
       nquery++;
-      esl_stopwatch_Start(w);
 
       /* seqfile may need to be rewound (multiquery mode) */
       if (nquery > 1)
@@ -484,35 +619,35 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
           p7_Fail("Failure setting restrictdb_stkey to %d\n", cfg->firstseq_key);
       }
 
-      if (fprintf(ofp, "Query:       %s  [M=%d]\n", hmm->name, hmm->M)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (hmm->acc)  { if (fprintf(ofp, "Accession:   %s\n", hmm->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
-      if (hmm->desc) { if (fprintf(ofp, "Description: %s\n", hmm->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
-
-      /* Convert to an optimized model */
-      gm = p7_profile_Create (hmm->M, abc);
-      om = p7_oprofile_Create(hmm->M, abc);
-      p7_ProfileConfig(hmm, info->bg, gm, 100, p7_LOCAL); /* 100 is a dummy length for now; and MSVFilter requires local mode */
-      p7_oprofile_Convert(gm, om);                  /* <om> is now p7_LOCAL, multihit */
-
-      for (i = 0; i < infocnt; ++i)
-      {
-        /* Create processing pipeline and hit list */
-        info[i].th  = p7_tophits_Create();
-        info[i].om  = p7_oprofile_Clone(om);
-        info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
-        status = p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
-        if (status == eslEINVAL) p7_Fail(info->pli->errbuf);
+      /* --resume in the middle of this query: pick up its results so
+       * far, and go on from the first target not yet searched.
+       */
+      ntargets    = 0;
+      n_targetseq = cfg->n_targetseq;
+      if (ck && ck->has_partial)
+	{
+	  if (qi->info[0].pli == NULL) query_SetupWorker(qi, 0);
+	  if (p7_checkpoint_Restore(ck, nquery, qi->info[0].th, qi->info[0].pli, &ntargets, &roff) == eslOK)
+	    {
+	      if (roff >= 0) sstatus = esl_sqfile_Position(dbfp, roff);
+	      else           sstatus = skip_targets(dbfp, ntargets);
+	      if (sstatus != eslOK) p7_Fail("Failed to position sequence file %s to resume search\n", cfg->dbfile);
+	      if (n_targetseq != -1) n_targetseq -= ntargets;
+	    }
+	}
 
-#ifdef HMMER_THREADS
-        if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
-#endif
-      }
+      esl_stopwatch_Start(qi->w);
+      prep.qidx = nquery + 1;
 
 #ifdef HMMER_THREADS
-      if (ncpus > 0)  sstatus = thread_loop(threadObj, queue, dbfp, cfg->n_targetseq);
-      else            sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      if (ncpus > 0) 
+	{
+	  if (p7_scheduler_Submit(sched, prepgrp, prepare_query, &prep) != eslOK) esl_fatal("Failed to submit query setup");
+	  sstatus = thread_loop(sched, pool, qi, dbfp, n_targetseq, ck, ntargets);
+	}
+      else sstatus = serial_loop(qi->info, dbfp, n_targetseq, ck, nquery, ntargets);
 #else
-      sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      sstatus = serial_loop(qi->info, dbfp, n_targetseq, ck, nquery, ntargets);
 #endif
       switch(sstatus)
       {
@@ -527,68 +662,36 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
         esl_fatal("Unexpected error %d reading sequence file %s", sstatus, dbfp->filename);
       }
 
-      /* merge the results of the search results */
-      for (i = 1; i < infocnt; ++i)
-      {
-        p7_tophits_Merge(info[0].th, info[i].th);
-        p7_pipeline_Merge(info[0].pli, info[i].pli);
-
-        p7_pipeline_Destroy(info[i].pli);
-        p7_tophits_Destroy(info[i].th);
-        p7_oprofile_Destroy(info[i].om);
-      }
-
-      /* Print the results.  */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    hmm->name, hmm->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, hmm->name, hmm->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, hmm->name, hmm->acc, info->th, info->pli);
-  
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
-      if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-
-      /* Output the results in an MSA (-A option) */
-      if (afp) {
-	ESL_MSA *msa = NULL;
-
-	if (p7_tophits_Alignment(info->th, abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK)
-	  {
-	    esl_msa_SetName     (msa, hmm->name, -1);
-	    esl_msa_SetAccession(msa, hmm->acc,  -1);
-	    esl_msa_SetDesc     (msa, hmm->desc, -1);
-	    esl_msa_FormatAuthor(msa, "hmmsearch (HMMER %s)", HMMER_VERSION);
-
-	    if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
-	    else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
-	  
-	    if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  } 
-	else { if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
-	  
-	esl_msa_Destroy(msa);
-      }
-
-      p7_pipeline_Destroy(info->pli);
-      p7_tophits_Destroy(info->th);
-      p7_oprofile_Destroy(info->om);
-      p7_oprofile_Destroy(om);
-      p7_profile_Destroy(gm);
-      p7_hmm_Destroy(hmm);
-
-      hstatus = p7_hmmfile_Read(hfp, &abc, &hmm);
+#ifdef HMMER_THREADS
+      if (ncpus > 0)
+	{
+	  if (qi->nblocks == 0) esl_stopwatch_Stop(qi->w);
+	  output_Submit(&out, qi); /* output thread waits for its blocks, prints and frees it */
+	  if (p7_taskgroup_Wait(prepgrp) != eslOK) esl_fatal("Failed waiting for query setup");
+	}
+      else
+#endif
+	{
+	  esl_stopwatch_Stop(qi->w);
+	  if (query_Output(go, qi, ofp, afp, tblfp, domtblfp, pfamtblfp, textw) != eslOK) goto ERROR;
+	  if (ck && p7_checkpoint_QueryDone(ck, nquery) != eslOK) esl_fatal("Failed to save search checkpoint");
+	  query_Destroy(qi);
+	  prepare_query(&prep, 0);
+	}
+      qi = NULL;
     } /* end outer loop over query HMMs */
 
-  switch(hstatus) {
+#ifdef HMMER_THREADS
+  if (ncpus > 0 && pool != NULL) output_Finish(&out);
+#endif
+
+  switch(prep.hstatus) {
   case eslEOD:       p7_Fail("read failed, HMM file %s may be truncated?", cfg->hmmfile);      break;
   case eslEFORMAT:   p7_Fail("bad file format in HMM file %s",             cfg->hmmfile);      break;
   case eslEINCOMPAT: p7_Fail("HMM file %s contains different alphabets",   cfg->hmmfile);      break;
+  case eslEMEM:      p7_Fail("allocation failed setting up a query from HMM file %s", cfg->hmmfile); break;
   case eslEOF:       /* do nothing. EOF is what we want. */                                    break;
-  default:           p7_Fail("Unexpected error (%d) in reading HMMs from %s", hstatus, cfg->hmmfile);
+  default:           p7_Fail("Unexpected error (%d) in reading HMMs from %s", prep.hstatus, cfg->hmmfile);
   }
 
 
@@ -599,27 +702,22 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (pfamtblfp) p7_tophits_TabularTail(pfamtblfp,"hmmsearch", p7_SEARCH_SEQS, cfg->hmmfile, cfg->dbfile, go);
   if (ofp)      { if (fprintf(ofp, "[ok]\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
 
+  /* The search is complete: a --resume has nothing left to do */
+  if (ck) p7_checkpoint_Finish(ck);
+
   /* Cleanup - prepare for exit
    */
-  for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
-
 #ifdef HMMER_THREADS
-  if (ncpus > 0)
-    {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
-    }
+  p7_scheduler_Destroy(sched);
+  p7_blockpool_Destroy(pool);
+  p7_taskgroup_Destroy(prepgrp);
+  p7_numa_Destroy(numa);
 #endif
 
-  free(info);
   p7_hmmfile_Close(hfp);
   esl_sqfile_Close(dbfp);
   esl_alphabet_Destroy(abc);
-  esl_stopwatch_Destroy(w);
+  p7_checkpoint_Destroy(ck);
 
   if (ofp != stdout) fclose(ofp);
   if (afp)           fclose(afp);
@@ -633,6 +731,245 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return eslFAIL;
 }
 
+/* query_Create()
+ * Configure query <hmm> (number <qidx>) for searching, and create the
+ * pipelines, hit lists and profile clones for <infocnt> workers. The
+ * new QUERY_INFO takes ownership of <hmm>. Its stopwatch is started by
+ * the caller when the search starts. If <lazy> is TRUE (--numa), the
+ * per-worker state is left for each worker to create on first use;
+ * see query_SetupWorker(). Returns NULL on allocation failure, and
+ * <hmm> is then still the caller's; other errors are fatal.
+ */
+static QUERY_INFO *
+query_Create(ESL_GETOPTS *go, P7_HMM *hmm, const ESL_ALPHABET *abc, int qidx, int infocnt, int lazy)
+{
+  QUERY_INFO *qi = NULL;
+  P7_BG      *bg = NULL;
+  int         i;
+  int         status;
+
+  ESL_ALLOC(qi, sizeof(QUERY_INFO));
+  qi->go      = go;
+  qi->hmm     = hmm;
+  qi->qidx    = qidx;
+  qi->infocnt = infocnt;
+  qi->lazy    = lazy;
+  qi->info    = NULL;
+  qi->w       = esl_stopwatch_Create();
+
+  ESL_ALLOC(qi->info, sizeof(WORKER_INFO) * infocnt);
+  for (i = 0; i < infocnt; ++i)
+    {
+      qi->info[i].bg  = NULL;
+      qi->info[i].th  = NULL;
+      qi->info[i].om  = NULL;
+      qi->info[i].pli = NULL;
+    }
+
+  /* Convert to an optimized model */
+  bg     = p7_bg_Create(abc);
+  qi->gm = p7_profile_Create (hmm->M, abc);
+  qi->om = p7_oprofile_Create(hmm->M, abc);
+  p7_ProfileConfig(hmm, bg, qi->gm, 100, p7_LOCAL); /* 100 is a dummy length for now; and MSVFilter requires local mode */
+  p7_oprofile_Convert(qi->gm, qi->om);              /* <om> is now p7_LOCAL, multihit */
+  p7_bg_Destroy(bg);
+
+  if (! lazy)
+    for (i = 0; i < infocnt; ++i)
+      query_SetupWorker(qi, i);
+
+#ifdef HMMER_THREADS
+  qi->nblocks = 0;
+  qi->next    = NULL;
+  if ((qi->grp = p7_taskgroup_Create()) == NULL) esl_fatal("Failed to create task group");
+  if (pthread_mutex_init(&qi->wmutex, NULL) != 0) esl_fatal("Failed to create mutex");
+#endif
+  return qi;
+
+ ERROR:
+  if (qi)
+    {
+      if (qi->info) free(qi->info);
+      esl_stopwatch_Destroy(qi->w);
+      free(qi);
+    }
+  return NULL;
+}
+
+
+/* query_SetupWorker()
+ * Create worker <workeridx>'s null model, profile clone, pipeline
+ * and hit list for query <qi>. Each query has its own null models:
+ * p7_pli_NewModel() sets their bias filter from the query, and the
+ * previous query's blocks may still be in flight. In --numa mode the
+ * worker calls this itself, on its first block of the query, and
+ * takes a full copy of the profile rather than a clone sharing the
+ * query's score vectors, so that they and its DP matrices are
+ * allocated on its own node.
+ */
+static void
+query_SetupWorker(QUERY_INFO *qi, int workeridx)
+{
+  WORKER_INFO *info = &(qi->info[workeridx]);
+
+  /* Create processing pipeline and hit list */
+  info->bg  = p7_bg_Create(qi->om->abc);
+  info->th  = p7_tophits_Create();
+  info->om  = qi->lazy ? p7_oprofile_Copy(qi->om) : p7_oprofile_Clone(qi->om);
+  if (info->om == NULL) p7_Fail("Failed to copy the query profile");
+  info->pli = p7_pipeline_Create(qi->go, qi->om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+  if (p7_pli_NewModel(info->pli, info->om, info->bg) == eslEINVAL) p7_Fail(info->pli->errbuf);
+}
+
+
+/* query_Output()
+ * Wait for all of query <qi>'s targets to be searched, merge the
+ * workers' results, and output them. 
+ */
+static int
+query_Output(ESL_GETOPTS *go, QUERY_INFO *qi, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw)
+{
+  P7_HMM      *hmm  = qi->hmm;
+  WORKER_INFO *info = qi->info;
+  int          i;
+
+#ifdef HMMER_THREADS
+  if (p7_taskgroup_Wait(qi->grp) != eslOK) esl_fatal("Failed waiting for search tasks");
+#endif
+
+  /* merge the results of the search results. With --numa, a worker
+   * that got none of this query's blocks never set itself up.
+   */
+  if (info[0].pli == NULL) query_SetupWorker(qi, 0);
+  for (i = 1; i < qi->infocnt; ++i)
+    if (info[i].pli != NULL)
+      {
+	p7_tophits_Merge(info[0].th, info[i].th);
+	p7_pipeline_Merge(info[0].pli, info[i].pli);
+      }
+
+  if (fprintf(ofp, "Query:       %s  [M=%d]\n", hmm->name, hmm->M)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (hmm->acc)  { if (fprintf(ofp, "Accession:   %s\n", hmm->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+  if (hmm->desc) { if (fprintf(ofp, "Description: %s\n", hmm->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+
+  /* Print the results.  */
+  p7_tophits_SortBySortkey(info->th);
+  p7_tophits_Threshold(info->th, info->pli);
+  p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+
+  if (tblfp)     p7_tophits_TabularTargets(tblfp,    hmm->name, hmm->acc, info->th, info->pli, (qi->qidx == 1));
+  if (domtblfp)  p7_tophits_TabularDomains(domtblfp, hmm->name, hmm->acc, info->th, info->pli, (qi->qidx == 1));
+  if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, hmm->name, hmm->acc, info->th, info->pli);
+
+  p7_pli_Statistics(ofp, info->pli, qi->w);
+  if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+
+  /* Output the results in an MSA (-A option) */
+  if (afp) {
+    ESL_MSA *msa = NULL;
+
+    if (p7_tophits_Alignment(info->th, qi->om->abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK)
+      {
+	esl_msa_SetName     (msa, hmm->name, -1);
+	esl_msa_SetAccession(msa, hmm->acc,  -1);
+	esl_msa_SetDesc     (msa, hmm->desc, -1);
+	esl_msa_FormatAuthor(msa, "hmmsearch (HMMER %s)", HMMER_VERSION);
+
+	if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
+	else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
+	  
+	if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      } 
+    else { if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+	  
+    esl_msa_Destroy(msa);
+  }
+  return eslOK;
+}
+
+
+/* query_Checkpoint()
+ * Save the partial results of query <qi>, whose first <ntargets>
+ * targets are searched; the next one starts at disk offset <roff>.
+ * None of its search tasks may be running. Errors are fatal.
+ */
+static void
+query_Checkpoint(QUERY_INFO *qi, P7_CHECKPOINT *ck, int64_t ntargets, off_t roff)
+{
+  P7_TOPHITS  **th  = NULL;
+  P7_PIPELINE **pli = NULL;
+  int           i;
+  int           status;
+
+  ESL_ALLOC(th,  sizeof(P7_TOPHITS *)  * qi->infocnt);
+  ESL_ALLOC(pli, sizeof(P7_PIPELINE *) * qi->infocnt);
+  for (i = 0; i < qi->infocnt; ++i)
+    {
+      th[i]  = qi->info[i].th;
+      pli[i] = qi->info[i].pli;
+    }
+  if (p7_checkpoint_SavePartial(ck, qi->qidx, ntargets, roff, th, pli, qi->infocnt) != eslOK) esl_fatal("Failed to save search checkpoint");
+  free(th);
+  free(pli);
+  return;
+
+ ERROR:
+  esl_fatal("Failed to save search checkpoint");
+}
+
+
+/* query_Destroy()
+ * Free a query and all its worker state. Its search tasks must have
+ * finished; see query_Output().
+ */
+static void
+query_Destroy(QUERY_INFO *qi)
+{
+  int i;
+
+  if (! qi) return;
+  for (i = 0; i < qi->infocnt; ++i)
+    {
+      p7_pipeline_Destroy(qi->info[i].pli);
+      p7_tophits_Destroy(qi->info[i].th);
+      p7_oprofile_Destroy(qi->info[i].om);
+      p7_bg_Destroy(qi->info[i].bg);
+    }
+#ifdef HMMER_THREADS
+  p7_taskgroup_Destroy(qi->grp);
+  pthread_mutex_destroy(&qi->wmutex);
+#endif
+  free(qi->info);
+  p7_oprofile_Destroy(qi->om);
+  p7_profile_Destroy(qi->gm);
+  p7_hmm_Destroy(qi->hmm);
+  esl_stopwatch_Destroy(qi->w);
+  free(qi);
+}
+
+
+/* prepare_query()
+ * Task: read query number <prep->qidx> from the HMM file and set it up
+ * for searching. <workeridx> is unused; the task uses no worker state.
+ */
+static void
+prepare_query(void *arg, int workeridx)
+{
+  PREP_TASK *prep = (PREP_TASK *) arg;
+  P7_HMM    *hmm  = NULL;
+
+  prep->qi      = NULL;
+  prep->hstatus = p7_hmmfile_Read(prep->hfp, prep->byp_abc, &hmm);
+  if (prep->hstatus == eslOK)
+    prep->qi = query_Create(prep->go, hmm, *(prep->byp_abc), prep->qidx, prep->infocnt, prep->lazy);
+  if (prep->hstatus == eslOK && prep->qi == NULL)
+    {
+      p7_hmm_Destroy(hmm);
+      prep->hstatus = eslEMEM;
+    }
+}
+
 #ifdef HMMER_MPI
 
 /* Define common tags used by the MPI master/slave processes */
@@ -1285,8 +1622,14 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 }
 #endif /*HMMER_MPI*/
 
+/* serial_loop()
+ * Search the targets in <dbfp> with query number <qidx>, of which
+ * <ntargets> were already searched before a --resume. With
+ * --checkpoint (<ck> non-NULL), save the partial results when it's
+ * time to.
+ */
 static int
-serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
+serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs, P7_CHECKPOINT *ck, int qidx, int64_t ntargets)
 {
   int      sstatus;
   ESL_SQ   *dbsq     = NULL;   /* one target sequence (digital)  */
@@ -1297,6 +1640,10 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
   /* Main loop: */
   while ( (n_targetseqs==-1 || seq_cnt<n_targetseqs) &&  (sstatus = esl_sqio_Read(dbfp, dbsq)) == eslOK)
   {
+      if (ck && p7_checkpoint_IsDue(ck, qidx) &&
+	  p7_checkpoint_SavePartial(ck, qidx, ntargets + seq_cnt, dbsq->roff, &(info->th), &(info->pli), 1) != eslOK)
+	esl_fatal("Failed to save search checkpoint");
+
       p7_pli_NewSeq(info->pli, dbsq);
       p7_bg_SetLength(info->bg, dbsq->n);
       p7_oprofile_ReconfigLength(info->om, dbsq->n);
@@ -1316,114 +1663,200 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
   return sstatus;
 }
 
+/* skip_targets()
+ * Read past the first <ntargets> targets in <dbfp>, on --resume when
+ * their disk offset isn't known.
+ */
+static int
+skip_targets(ESL_SQFILE *dbfp, int64_t ntargets)
+{
+  ESL_SQ  *sq = esl_sq_CreateDigital(dbfp->abc);
+  int64_t  n;
+  int      status = eslOK;
+
+  for (n = 0; n < ntargets && (status = esl_sqio_ReadInfo(dbfp, sq)) == eslOK; n++)
+    esl_sq_Reuse(sq);
+  esl_sq_Destroy(sq);
+  return status;
+}
+
 #ifdef HMMER_THREADS
+/* thread_loop()
+ * Read the targets for query <qi> in blocks taken from <pool>, and
+ * submit a search task for each block to the scheduler. Returns as
+ * soon as the last block is submitted, without waiting for the
+ * searches; see query_Output(). <ntargets> targets were already
+ * searched before a --resume. With --checkpoint, when it's time to
+ * save, wait for the blocks submitted so far and save their results.
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs)
+thread_loop(P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, QUERY_INFO *qi, ESL_SQFILE *dbfp, int n_targetseqs, P7_CHECKPOINT *ck, int64_t ntargets)
 {
-  int  status  = eslOK;
-  int  sstatus = eslOK;
-  int  eofCount = 0;
-  ESL_SQ_BLOCK *block;
-  void         *newBlock;
+  int             sstatus = eslOK;
+  ESL_SQ_BLOCK   *block;
+  BLOCK_TASK     *task;
+  P7_BLOCKREADER *br;
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+  br = p7_blockreader_Create(dbfp, qi->om->M, n_targetseqs);
+  if (br == NULL) p7_Fail("Failed to create target block reader");
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
-      
   /* Main loop: */
-  while (sstatus == eslOK )
+  while (sstatus == eslOK)
     {
-      block = (ESL_SQ_BLOCK *) newBlock;
-
-      if (n_targetseqs == 0)
-      {
-        block->count = 0;
-        sstatus = eslEOF;
-      } else {
-        sstatus = esl_sqio_ReadBlock(dbfp, block, -1, n_targetseqs, FALSE);
-        n_targetseqs -= block->count;
-      }
+      block = p7_blockpool_Get(pool);
+      if (block == NULL) p7_Fail("Failed to get a sequence block");
 
-      if (sstatus == eslEOF)
-      {
-        if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-        ++eofCount;
-      }
-
-      if (sstatus == eslOK)
-      {
-        status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-        if (status != eslOK) esl_fatal("Work queue reader failed");
-      }
-    }
-
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
+      sstatus = p7_blockreader_Read(br, block);
+      if (sstatus != eslOK)
+	{
+	  p7_blockpool_Put(pool, block);
+	  break;
+	}
 
-  if (sstatus == eslEOF)
-    {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      if (ck && p7_checkpoint_IsDue(ck, qi->qidx))
+	{
+	  if (p7_taskgroup_Wait(qi->grp) != eslOK) p7_Fail("Failed waiting for search tasks");
+	  query_Checkpoint(qi, ck, ntargets, block->list[0].roff);
+	}
+      ntargets += block->count;
+
+      if ((task = malloc(sizeof(BLOCK_TASK))) == NULL) p7_Fail("malloc failed");
+      task->qi    = qi;
+      task->block = block;
+      task->pool  = pool;
+      if (p7_scheduler_Submit(sched, qi->grp, search_block, task) != eslOK) p7_Fail("Failed to submit search task");
+      qi->nblocks++;
     }
 
+  p7_blockreader_Destroy(br);
   return sstatus;
 }
 
+/* search_block()
+ * Task: search one block of targets with one query, using the
+ * pipeline and hit list of worker <workeridx>.
+ */
 static void 
-pipeline_thread(void *arg)
+search_block(void *arg, int workeridx)
 {
-  int i;
-  int status;
-  int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-
-  ESL_SQ_BLOCK  *block = NULL;
-  void          *newBlock;
-  
-  impl_Init();
+  BLOCK_TASK   *task  = (BLOCK_TASK *) arg;
+  QUERY_INFO   *qi    = task->qi;
+  WORKER_INFO  *info  = &(qi->info[workeridx]);
+  ESL_SQ_BLOCK *block = task->block;
+  int           i;
 
-  obj = (ESL_THREADS *) arg;
-  esl_threads_Started(obj, &workeridx);
+  if (info->pli == NULL) query_SetupWorker(qi, workeridx); /* --numa: first block of this query */
 
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
-
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
-  if (status != eslOK) esl_fatal("Work queue worker failed");
-
-  /* loop until all blocks have been processed */
-  block = (ESL_SQ_BLOCK *) newBlock;
-  while (block->count > 0)
+  for (i = 0; i < block->count; ++i)
     {
-      /* Main loop: */
-      for (i = 0; i < block->count; ++i)
-	{
-	  ESL_SQ *dbsq = block->list + i;
+      ESL_SQ *dbsq = block->list + i;
 
-	  p7_pli_NewSeq(info->pli, dbsq);
-	  p7_bg_SetLength(info->bg, dbsq->n);
-	  p7_oprofile_ReconfigLength(info->om, dbsq->n);
+      p7_pli_NewSeq(info->pli, dbsq);
+      p7_bg_SetLength(info->bg, dbsq->n);
+      p7_oprofile_ReconfigLength(info->om, dbsq->n);
 	  
-	  p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
+      p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
 	  
-	  esl_sq_Reuse(dbsq);
-	  p7_pipeline_Reuse(info->pli);
-	}
+      esl_sq_Reuse(dbsq);
+      p7_pipeline_Reuse(info->pli);
+    }
 
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
-      if (status != eslOK) esl_fatal("Work queue worker failed");
+  /* the query's elapsed time runs until its last block is done */
+  pthread_mutex_lock(&qi->wmutex);
+  esl_stopwatch_Stop(qi->w);
+  pthread_mutex_unlock(&qi->wmutex);
 
-      block = (ESL_SQ_BLOCK *) newBlock;
-    }
+  if (p7_blockpool_Put(task->pool, block) != eslOK) p7_Fail("Failed to return sequence block");
+  free(task);
+}
+/* output_Start()
+ * Start the output thread, with output streams and options already
+ * set in <out>.
+ */
+static void
+output_Start(OUTPUT_INFO *out)
+{
+  out->head    = NULL;
+  out->tail    = NULL;
+  out->nqueued = 0;
+  out->done    = FALSE;
+  if (pthread_mutex_init(&out->mutex, NULL) != 0)                  esl_fatal("Failed to create mutex");
+  if (pthread_cond_init (&out->cond,  NULL) != 0)                  esl_fatal("Failed to create condition variable");
+  if (pthread_create(&out->thread, NULL, output_thread, out) != 0) esl_fatal("Failed to start output thread");
+}
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
-  if (status != eslOK) esl_fatal("Work queue worker failed");
+/* output_Submit()
+ * Queue query <qi> for output, once all its blocks have been
+ * submitted. The output thread takes ownership of it. If the output
+ * thread has fallen behind, wait for it, so unprinted results don't
+ * pile up in memory.
+ */
+static void
+output_Submit(OUTPUT_INFO *out, QUERY_INFO *qi)
+{
+  pthread_mutex_lock(&out->mutex);
+  while (out->nqueued >= MAX_OUTPUT_QUEUE)
+    pthread_cond_wait(&out->cond, &out->mutex);
+
+  qi->next = NULL;
+  if (out->tail) out->tail->next = qi;
+  else           out->head       = qi;
+  out->tail = qi;
+  out->nqueued++;
+
+  pthread_cond_broadcast(&out->cond);
+  pthread_mutex_unlock(&out->mutex);
+}
 
-  esl_threads_Finished(obj, workeridx);
-  return;
+/* output_Finish()
+ * Tell the output thread no more queries are coming; wait for it to
+ * print the ones it has, and stop it.
+ */
+static void
+output_Finish(OUTPUT_INFO *out)
+{
+  pthread_mutex_lock(&out->mutex);
+  out->done = TRUE;
+  pthread_cond_broadcast(&out->cond);
+  pthread_mutex_unlock(&out->mutex);
+
+  pthread_join(out->thread, NULL);
+  pthread_cond_destroy(&out->cond);
+  pthread_mutex_destroy(&out->mutex);
+}
+
+/* output_thread()
+ * Take queries off the output queue in order; wait for each one's
+ * searches to finish, then print and free it.
+ */
+static void *
+output_thread(void *arg)
+{
+  OUTPUT_INFO *out = (OUTPUT_INFO *) arg;
+  QUERY_INFO  *qi;
+
+  while (1)
+    {
+      pthread_mutex_lock(&out->mutex);
+      while (out->head == NULL && ! out->done)
+	pthread_cond_wait(&out->cond, &out->mutex);
+      if ((qi = out->head) == NULL) { pthread_mutex_unlock(&out->mutex); break; } /* done, and nothing left */
+      out->head = qi->next;
+      if (out->head == NULL) out->tail = NULL;
+      pthread_mutex_unlock(&out->mutex);
+
+      if (query_Output(out->go, qi, out->ofp, out->afp, out->tblfp, out->domtblfp, out->pfamtblfp, out->textw) != eslOK)
+	esl_fatal("Failed to write results");
+      if (out->ck && p7_checkpoint_QueryDone(out->ck, qi->qidx) != eslOK)
+	esl_fatal("Failed to save search checkpoint");
+      query_Destroy(qi);
+
+      pthread_mutex_lock(&out->mutex);
+      out->nqueued--;
+      pthread_cond_broadcast(&out->cond);
+      pthread_mutex_unlock(&out->mutex);
+    }
+  return NULL;
 }
 #endif   /* HMMER_THREADS */
  
@@ -15,6 +15,9 @@
 #include "easel.h"
 #include "esl_getopts.h"
 #include "esl_exponential.h"
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif
 
 #include "hmmer.h"
 
@@ -29,6 +32,9 @@ static ESL_OPTIONS options[] = {
   { "--baseZ1",     eslARG_INT,     "0", NULL, NULL,   NULL,  NULL,       "--baseZ,-Z",      "database size (M bases) (DNA only, if search on single strand)",     0 },
   { "-E",           eslARG_REAL,  "0.01", NULL, NULL,   NULL,  "--eval2score", NULL,         "E-value threshold, for --eval2score",                                0 },
   { "-S",           eslARG_REAL,  "0.01", NULL, NULL,   NULL,  "--score2eval", NULL,         "Score input for --score2eval",                                       0 },
+#ifdef HMMER_THREADS
+  { "--cpu",        eslARG_INT, p7_NCPU,"HMMER_NCPU","n>=0",NULL,  NULL,        NULL,            "number of parallel CPU workers for reading models",                  0 },
+#endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -86,6 +92,9 @@ main(int argc, char **argv)
   float            s_val;
 
   float nseq;
+#ifdef HMMER_THREADS
+  int   ncpus = 0;
+#endif
 
   /* Process the command line options.
    */
@@ -154,6 +163,12 @@ main(int argc, char **argv)
   else if (status == eslEFORMAT)   p7_Fail("File format problem in trying to open HMM file %s.\n%s\n",                hmmfile, errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",               status, hmmfile, errbuf);  
 
+#ifdef HMMER_THREADS
+  /* Parse models ahead in worker threads; if that's not possible for this file, they're read serially */
+  ncpus = ESL_MIN(esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
+  if (ncpus > 0) p7_hmmfile_ReadAhead(hfp, ncpus);
+#endif
+
   /* Main body: read HMMs one at a time, print one line of stats
    */
   printf("#\n");
@@ -139,8 +139,45 @@ typedef struct p7_oprofile_s {
   int    clone;                 /* this optimized profile structure is just a copy   */
                                 /* of another profile structre.  all pointers of     */
                                 /* this structure should not be freed.               */
+  int    mapped;                /* vectors and annotation point into a mapped .h3f/  */
+                                /* .h3p file; only the row pointers are ours.        */
 } P7_OPROFILE;
 
+/* P7_OLENGTH: the parts of the special state parameters that depend
+ * on target length <L> but not on the profile. Computed once for a
+ * length (p7_oprofile_ComputeLength()), they are then set in any
+ * number of profiles (p7_oprofile_SetLength()) at the cost of a few
+ * stores, instead of p7_oprofile_ReconfigLength()'s logf()'s.
+ */
+typedef struct {
+  int   L;			/* target length; -1 if unset                    */
+  float ltjb;			/* log NCJ move prob for MSVFilter, 3/(L+3)      */
+  float pmove[2];		/* NCJ move prob; [0] unihit, [1] multihit (nj)  */
+  float ploop[2];		/* NCJ loop prob, 1-pmove                        */
+  float lpmove[2];		/* log pmove, for ViterbiFilter                  */
+} P7_OLENGTH;
+
+/* P7_MSVPROFILE: only what the SSV and MSV filters read from a
+ * profile. Its score vectors are in one block (the SSV rows, then the
+ * MSV rows) that the caller provides, so a database of these can be
+ * laid out back to back in memory and streamed through the first
+ * filter stage. It is searched through an empty P7_OPROFILE
+ * (p7_oprofile_CreateShadow(), p7_oprofile_ShadowMSV()); only the
+ * targets that pass need their full profile.
+ */
+typedef struct {
+  int       M;			/* model length                                  */
+  int       Q;			/* # of vectors per MSV row, om->allocQ16        */
+  uint8_t   tbm_b;		/* constant B->Mk cost                           */
+  uint8_t   tec_b;		/* constant E->C cost                            */
+  uint8_t   base_b;		/* offset of uchar scores                        */
+  uint8_t   bias_b;		/* bias added to emission scores                 */
+  float     scale_b;		/* score units                                   */
+  float     evparam[p7_NEVPARAM]; /* MSV Gumbel params are used              */
+  __m128i  *sbv;		/* SSV scores, Kp rows of Q+p7O_EXTRA_SB vectors */
+  __m128i  *rbv;		/* MSV scores, Kp rows of Q vectors, after <sbv> */
+} P7_MSVPROFILE;
+
 typedef struct {
   int            count;       /* number of <P7_OPROFILE> objects in the block */
   int            listSize;    /* maximum number elements in the list          */
@@ -270,6 +307,7 @@ extern int          p7_omx_DumpFBRow(P7_OMX *ox, int logify, int rowi, int width
 
 /* p7_oprofile.c */
 extern P7_OPROFILE *p7_oprofile_Create(int M, const ESL_ALPHABET *abc);
+extern P7_OPROFILE *p7_oprofile_CreateMapped(int M, const ESL_ALPHABET *abc);
 extern int          p7_oprofile_IsLocal(const P7_OPROFILE *om);
 extern void         p7_oprofile_Destroy(P7_OPROFILE *om);
 extern size_t       p7_oprofile_Sizeof(P7_OPROFILE *om);
@@ -284,9 +322,18 @@ extern int          p7_oprofile_Convert(const P7_PROFILE *gm, P7_OPROFILE *om);
 extern int          p7_oprofile_ReconfigLength    (P7_OPROFILE *om, int L);
 extern int          p7_oprofile_ReconfigMSVLength (P7_OPROFILE *om, int L);
 extern int          p7_oprofile_ReconfigRestLength(P7_OPROFILE *om, int L);
+extern int          p7_oprofile_ComputeLength     (P7_OLENGTH *olen, int L);
+extern int          p7_oprofile_SetLength         (P7_OPROFILE *om, const P7_OLENGTH *olen);
+extern int          p7_oprofile_SetMSVLength      (P7_OPROFILE *om, const P7_OLENGTH *olen);
+extern int          p7_oprofile_SetRestLength     (P7_OPROFILE *om, const P7_OLENGTH *olen);
 extern int          p7_oprofile_ReconfigMultihit  (P7_OPROFILE *om, int L);
 extern int          p7_oprofile_ReconfigUnihit    (P7_OPROFILE *om, int L);
 
+extern size_t       p7_oprofile_MSVSizeof  (const P7_OPROFILE *om);
+extern int          p7_oprofile_MoveMSV    (P7_OPROFILE *om, void *mem, P7_MSVPROFILE *msv);
+extern P7_OPROFILE *p7_oprofile_CreateShadow(const ESL_ALPHABET *abc);
+extern int          p7_oprofile_ShadowMSV  (P7_OPROFILE *om, const P7_MSVPROFILE *msv);
+
 extern int          p7_oprofile_Dump(FILE *fp, const P7_OPROFILE *om);
 extern int          p7_oprofile_Sample(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, const P7_BG *bg, int M, int L,
                P7_HMM **opt_hmm, P7_PROFILE **opt_gm, P7_OPROFILE **ret_om);
@@ -10,6 +10,12 @@
  * <hmmfile>.h3p, which nominally stand for "H3 filter" and "H3
  * profile".
  * 
+ * Each record, and each array of score vectors in it, starts on a
+ * 64-byte boundary in the file (the writer pads with zeros). If the
+ * files are memory mapped (<p7_hmmfile_Map()>), the readers point the
+ * profile's vectors and annotation straight into the mapping instead
+ * of copying them.
+ * 
  * Contents:
  *    1. Writing optimized profiles to two files.
  *    2. Reading optimized profiles in two stages.
@@ -30,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 #ifdef HMMER_THREADS
 #include <pthread.h>
@@ -43,6 +50,9 @@
 #include "hmmer.h"
 #include "impl_sse.h"
 
+static uint32_t  v3g_fmagic = 0xb3e7e6f3; /* 3/g binary MSV file, SSE:     "3gfs" = 0x 33 67 66 73  + 0x80808080 */
+static uint32_t  v3g_pmagic = 0xb3e7f0f3; /* 3/g binary profile file, SSE: "3gps" = 0x 33 67 70 73  + 0x80808080 */
+
 static uint32_t  v3f_fmagic = 0xb3e6e6f3; /* 3/f binary MSV file, SSE:     "3ffs" = 0x 33 66 66 73  + 0x80808080 */
 static uint32_t  v3f_pmagic = 0xb3e6f0f3; /* 3/f binary profile file, SSE: "3fps" = 0x 33 66 70 73  + 0x80808080 */
 
@@ -61,6 +71,14 @@ static uint32_t  v3b_pmagic = 0xb3e2f0f3; /* 3/b binary profile file, SSE: "3bps
 static uint32_t  v3a_fmagic = 0xe8b3e6f3; /* 3/a binary MSV file, SSE:     "h3fs" = 0x 68 33 66 73  + 0x80808080 */
 static uint32_t  v3a_pmagic = 0xe8b3f0f3; /* 3/a binary profile file, SSE: "h3ps" = 0x 68 33 70 73  + 0x80808080 */
 
+#define p7O_MAPALIGN       64	/* records, vector arrays in .h3f/.h3p start on this boundary */
+#define p7O_MAPALIGNUP(n)  ((((n) + p7O_MAPALIGN - 1) / p7O_MAPALIGN) * p7O_MAPALIGN)
+
+static int write_pad(FILE *fp);
+static int read_pad (FILE *fp);
+static int map_msv  (P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_om);
+static int map_rest (P7_HMMFILE *hfp, P7_OPROFILE *om);
+
 
 /*****************************************************************
  *# 1. Writing optimized profiles to two files.
@@ -80,6 +98,10 @@ static uint32_t  v3a_pmagic = 0xe8b3f0f3; /* 3/a binary profile file, SSE: "h3ps
  *
  * Returns:   <eslOK> on success.
  *
+ *            Records and their score vector arrays are padded to
+ *            start on 64-byte boundaries, so <ffp> and <pfp> must be
+ *            positionable (<ftello()> works on them).
+ *
  * Throws:    <eslEWRITE> on any write failure, such as filling
  *            the disk.
  */
@@ -94,7 +116,7 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
   int x;
 
   /* <ffp> is the part of the oprofile that MSVFilter() needs */
-  if (fwrite((char *) &(v3f_fmagic),    sizeof(uint32_t), 1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
+  if (fwrite((char *) &(v3g_fmagic),    sizeof(uint32_t), 1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->M),         sizeof(int),      1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->abc->type), sizeof(int),      1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &n,               sizeof(int),      1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
@@ -107,19 +129,22 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
   if (fwrite((char *) &(om->base_b),    sizeof(uint8_t),  1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");  
   if (fwrite((char *) &(om->bias_b),    sizeof(uint8_t),  1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");  
 
+  if (write_pad(ffp) != eslOK) return eslEWRITE;
   for (x = 0; x < om->abc->Kp; x++)
     if (fwrite( (char *) om->sbv[x],    sizeof(__m128i),  Q16x,        ffp) != Q16x)        ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   
+  if (write_pad(ffp) != eslOK) return eslEWRITE;
   for (x = 0; x < om->abc->Kp; x++)
     if (fwrite( (char *) om->rbv[x],    sizeof(__m128i),  Q16,         ffp) != Q16)         ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   
   if (fwrite((char *) om->evparam,      sizeof(float),    p7_NEVPARAM, ffp) != p7_NEVPARAM) ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) om->offs,         sizeof(off_t),    p7_NOFFSETS, ffp) != p7_NOFFSETS) ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) om->compo,        sizeof(float),    p7_MAXABET,  ffp) != p7_MAXABET)  ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
-  if (fwrite((char *) &(v3f_fmagic),    sizeof(uint32_t), 1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed"); /* sentinel */
+  if (fwrite((char *) &(v3g_fmagic),    sizeof(uint32_t), 1,           ffp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed"); /* sentinel */
+  if (write_pad(ffp) != eslOK) return eslEWRITE;
 
   /* <pfp> gets the rest of the oprofile */
-  if (fwrite((char *) &(v3f_pmagic),    sizeof(uint32_t), 1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
+  if (fwrite((char *) &(v3g_pmagic),    sizeof(uint32_t), 1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->M),         sizeof(int),      1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->abc->type), sizeof(int),      1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &n,               sizeof(int),      1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
@@ -149,7 +174,9 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
   if (fwrite((char *) om->consensus,    sizeof(char),     om->M+2,     pfp) != om->M+2)     ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
 
   /* ViterbiFilter part */
+  if (write_pad(pfp) != eslOK) return eslEWRITE;
   if (fwrite((char *) om->twv,             sizeof(__m128i),  8*Q8,        pfp) != 8*Q8)        ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
+  if (write_pad(pfp) != eslOK) return eslEWRITE;
   for (x = 0; x < om->abc->Kp; x++)
     if (fwrite( (char *) om->rwv[x],       sizeof(__m128i),  Q8,          pfp) != Q8)          ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   for (x = 0; x < p7O_NXSTATES; x++)
@@ -160,7 +187,9 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
   if (fwrite((char *) &(om->ncj_roundoff), sizeof(float),    1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
 
   /* Forward/Backward part */
+  if (write_pad(pfp) != eslOK) return eslEWRITE;
   if (fwrite((char *) om->tfv,          sizeof(__m128),   8*Q4,        pfp) != 8*Q4)        ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
+  if (write_pad(pfp) != eslOK) return eslEWRITE;
   for (x = 0; x < om->abc->Kp; x++)
     if (fwrite( (char *) om->rfv[x],    sizeof(__m128),   Q4,          pfp) != Q4)          ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   for (x = 0; x < p7O_NXSTATES; x++)
@@ -170,7 +199,8 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
   if (fwrite((char *) &(om->nj),        sizeof(float),    1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->mode),      sizeof(int),      1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
   if (fwrite((char *) &(om->L)   ,      sizeof(int),      1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
-  if (fwrite((char *) &(v3f_pmagic),    sizeof(uint32_t), 1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed"); /* sentinel */
+  if (fwrite((char *) &(v3g_pmagic),    sizeof(uint32_t), 1,           pfp) != 1)           ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed"); /* sentinel */
+  if (write_pad(pfp) != eslOK) return eslEWRITE;
   return eslOK;
 }
 /*---------------- end, writing oprofile ------------------------*/
@@ -202,6 +232,11 @@ p7_oprofile_Write(FILE *ffp, FILE *pfp, P7_OPROFILE *om)
  *            The <.h3f> file was opened automatically, if it existed,
  *            when the HMM file was opened with <p7_hmmfile_OpenE()>.
  *            
+ *            If the file was mapped with <p7_hmmfile_Map()>, <om>'s
+ *            score vectors point into the mapping (<om->mapped> is
+ *            TRUE); <om> must be treated as read-only, and destroyed
+ *            before <hfp> is closed.
+ *
  *            When no more HMMs remain in the file, return <eslEOF>.
  *
  * Args:      hfp     - open HMM file, with associated .h3p file
@@ -239,6 +274,8 @@ p7_oprofile_ReadMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_o
   int           alphatype;
   int           status;
 
+  if (hfp->fmap != NULL) return map_msv(hfp, byp_abc, ret_om);
+
   hfp->errbuf[0] = '\0';
   if (hfp->ffp == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no MSV profile file; hmmpress probably wasn't run");
   if (feof(hfp->ffp))   { status = eslEOF; goto ERROR; }	/* normal EOF: no more profiles */
@@ -252,7 +289,8 @@ p7_oprofile_ReadMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_o
   if (magic == v3c_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/c); please hmmpress your HMM file again");
   if (magic == v3d_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/d); please hmmpress your HMM file again");
   if (magic == v3e_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/e); please hmmpress your HMM file again");
-  if (magic != v3f_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database?");
+  if (magic == v3f_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/f); please hmmpress your HMM file again");
+  if (magic != v3g_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database?");
 
   if (! fread( (char *) &M,         sizeof(int),      1, hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
   if (! fread( (char *) &alphatype, sizeof(int),      1, hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");  
@@ -284,8 +322,10 @@ p7_oprofile_ReadMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_o
   if (! fread((char *) &(om->scale_b),   sizeof(float),   1,           hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read scale");
   if (! fread((char *) &(om->base_b),    sizeof(uint8_t), 1,           hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read base");
   if (! fread((char *) &(om->bias_b),    sizeof(uint8_t), 1,           hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read bias");
+  if (read_pad(hfp->ffp) != eslOK)                                                ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   for (x = 0; x < abc->Kp; x++)
     if (! fread((char *) om->sbv[x],     sizeof(__m128i), Q16x,        hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ssv scores at %d [residue %c]", x, abc->sym[x]); 
+  if (read_pad(hfp->ffp) != eslOK)                                                ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   for (x = 0; x < abc->Kp; x++)
     if (! fread((char *) om->rbv[x],     sizeof(__m128i), Q16,         hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read msv scores at %d [residue %c]", x, abc->sym[x]); 
   if (! fread((char *) om->evparam,      sizeof(float),   p7_NEVPARAM, hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read stat params");
@@ -294,7 +334,8 @@ p7_oprofile_ReadMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_o
 
   /* record ends with magic sentinel, for detecting binary file corruption */
   if (! fread( (char *) &magic,     sizeof(uint32_t), 1, hfp->ffp))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3f file corrupted?");
-  if (magic != v3f_fmagic)                                           ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3f file corrupted?");
+  if (magic != v3g_fmagic)                                           ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3f file corrupted?");
+  if (read_pad(hfp->ffp) != eslOK)                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
 
   /* keep track of the ending offset of the MSV model */
   om->eoff = ftello(hfp->ffp) - 1;;
@@ -360,6 +401,8 @@ p7_oprofile_ReadInfoMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **r
   int           alphatype;
   int           status;
 
+  if (hfp->fmap != NULL) return map_msv(hfp, byp_abc, ret_om); /* mapped: reading the scores costs nothing */
+
   hfp->errbuf[0] = '\0';
   if (hfp->ffp == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no MSV profile file; hmmpress probably wasn't run");
   if (feof(hfp->ffp))   { status = eslEOF; goto ERROR; }	/* normal EOF: no more profiles */
@@ -373,7 +416,8 @@ p7_oprofile_ReadInfoMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **r
   if (magic == v3c_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/c); please hmmpress your HMM file again");
   if (magic == v3d_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/d); please hmmpress your HMM file again");
   if (magic == v3e_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/e); please hmmpress your HMM file again");
-  if (magic != v3f_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database?");
+  if (magic == v3f_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/f); please hmmpress your HMM file again");
+  if (magic != v3g_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database?");
 
   if (! fread( (char *) &M,         sizeof(int),      1, hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
   if (! fread( (char *) &alphatype, sizeof(int),      1, hfp->ffp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");  
@@ -400,12 +444,15 @@ p7_oprofile_ReadInfoMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **r
   roff += (sizeof(int) * 5);                      /* magic, model size, alphabet type, max length, name length */
   roff += (sizeof(char) * (n + 1));               /* name string and terminator '\0'                           */
   roff += (sizeof(float) + sizeof(uint8_t) * 5);  /* transition  costs, bias, scale and base                   */
+  roff  = p7O_MAPALIGNUP(roff);                   /* padding                                                   */
   roff += (sizeof(__m128i) * abc->Kp * Q16x);     /* ssv scores                                                */
+  roff  = p7O_MAPALIGNUP(roff);                   /* padding                                                   */
   roff += (sizeof(__m128i) * abc->Kp * Q16);      /* msv scores                                                */
   roff += (sizeof(float) * p7_NEVPARAM);          /* stat params                                               */
   roff += (sizeof(off_t) * p7_NOFFSETS);          /* hmmscan offsets                                           */
   roff += (sizeof(float) * p7_MAXABET);           /* model composition                                         */
   roff += sizeof(uint32_t);			  /* sentinel magic                                            */
+  roff  = p7O_MAPALIGNUP(roff);                   /* padding to the next record                                */
 
   /* keep track of the ending offset of the MSV model */
   p7_oprofile_Position(hfp, roff);
@@ -470,6 +517,10 @@ p7_oprofile_ReadBlockMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OM_BLOCK *h
  *            successful <p7_oprofile_ReadMSV()> call on the same
  *            open <hfp>.
  *
+ *            If <hfp> is mapped (<p7_hmmfile_Map()>), the rest of
+ *            <om> is pointed into the mapping, without copying and
+ *            without taking <hfp>'s read lock.
+ *
  * Args:      hfp - open HMM file, from which we've previously
  *                  called <p7_oprofile_ReadMSV()>.
  *            om  - optimized profile that was successfully
@@ -497,6 +548,8 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   int           alphatype;
   int           status;
 
+  if (hfp->pmap != NULL && om->mapped) return map_rest(hfp, om); /* no lock needed */
+
 #ifdef HMMER_THREADS
   /* lock the mutex to prevent other threads from reading from the optimized
    * profile at the same time.
@@ -519,7 +572,8 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   if (magic == v3c_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/c); please hmmpress your HMM file again");
   if (magic == v3d_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/d); please hmmpress your HMM file again");
   if (magic == v3e_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/e); please hmmpress your HMM file again");
-  if (magic != v3f_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database file?");
+  if (magic == v3f_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/f); please hmmpress your HMM file again");
+  if (magic != v3g_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database file?");
 
   if (! fread( (char *) &M,              sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
   if (! fread( (char *) &alphatype,      sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");  
@@ -550,7 +604,9 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   Q4  = p7O_NQF(om->M);
   Q8  = p7O_NQW(om->M);
 
+  if (read_pad(hfp->pfp) != eslOK)                                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   if (! fread((char *) om->twv,             sizeof(__m128i),  8*Q8,        hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tu>, vitfilter transitions");
+  if (read_pad(hfp->pfp) != eslOK)                                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   for (x = 0; x < om->abc->Kp; x++)
     if (! fread( (char *) om->rwv[x],       sizeof(__m128i),  Q8,          hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <ru>[%d], vitfilter emissions for sym %c", x, om->abc->sym[x]);
   for (x = 0; x < p7O_NXSTATES; x++)
@@ -560,7 +616,9 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   if (! fread((char *) &(om->ddbound_w),    sizeof(int16_t),  1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
   if (! fread((char *) &(om->ncj_roundoff), sizeof(float),    1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
 
+  if (read_pad(hfp->pfp) != eslOK)                                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   if (! fread((char *) om->tfv,          sizeof(__m128),   8*Q4,        hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tf> transitions");
+  if (read_pad(hfp->pfp) != eslOK)                                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read padding");
   for (x = 0; x < om->abc->Kp; x++)
     if (! fread( (char *) om->rfv[x],    sizeof(__m128),   Q4,          hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <rf>[%d] emissions for sym %c", x, om->abc->sym[x]);
   for (x = 0; x < p7O_NXSTATES; x++)
@@ -573,7 +631,7 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
 
   /* record ends with magic sentinel, for detecting binary file corruption */
   if (! fread( (char *) &magic,     sizeof(uint32_t), 1, hfp->pfp))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3p file corrupted?");
-  if (magic != v3f_pmagic)                                           ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3p file corrupted?");
+  if (magic != v3g_pmagic)                                           ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3p file corrupted?");
 
 #ifdef HMMER_THREADS
   if (hfp->syncRead)
@@ -597,6 +655,209 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   if (name != NULL) free(name);
   return status;
 }
+/* map_get()
+ * Copy <n> bytes at offset <*pos> of mapped file <map> of <mapsize>
+ * bytes to <dest>, and advance <*pos>. Return <eslEOF> if they run
+ * off the end of the mapping.
+ */
+static int
+map_get(const char *map, size_t mapsize, off_t *pos, void *dest, size_t n)
+{
+  if (*pos < 0 || (size_t) *pos + n > mapsize) return eslEOF;
+  memcpy(dest, map + *pos, n);
+  *pos += n;
+  return eslOK;
+}
+
+/* map_vec()
+ * Skip the padding at <*pos> to the next 64-byte boundary, and return
+ * a pointer to the <n> bytes of vector data there in <map>; advance
+ * <*pos> past them. Return <NULL> if they run off the end of the
+ * mapping. The mapping itself is page aligned, so the pointer is
+ * aligned as the file offset is.
+ */
+static void *
+map_vec(char *map, size_t mapsize, off_t *pos, size_t n)
+{
+  void *v;
+
+  *pos = p7O_MAPALIGNUP(*pos);
+  if ((size_t) *pos + n > mapsize) return NULL;
+  v     = map + *pos;
+  *pos += n;
+  return v;
+}
+
+/* map_msv()
+ * p7_oprofile_ReadMSV() from a mapped <.h3f> file: the next record
+ * is at <hfp->fpos>. The score vectors of the new <om> point into the
+ * mapping.
+ */
+static int
+map_msv(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OPROFILE **ret_om)
+{
+  P7_OPROFILE  *om      = NULL;
+  ESL_ALPHABET *abc     = NULL;
+  char         *map     = hfp->fmap;
+  size_t        mapsize = hfp->fmapsize;
+  off_t         pos     = hfp->fpos;
+  __m128i      *v;
+  uint32_t      magic;
+  int           M, Q16, Q16x;
+  int           x,n;
+  int           alphatype;
+  int           status;
+
+  hfp->errbuf[0] = '\0';
+  if (map_get(map, mapsize, &pos, &magic, sizeof(uint32_t)) != eslOK) { status = eslEOF; goto ERROR; } /* normal EOF: no more profiles */
+  if (magic == v3a_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/a); please hmmpress your HMM file again");
+  if (magic == v3b_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/b); please hmmpress your HMM file again");
+  if (magic == v3c_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/c); please hmmpress your HMM file again");
+  if (magic == v3d_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/d); please hmmpress your HMM file again");
+  if (magic == v3e_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/e); please hmmpress your HMM file again");
+  if (magic == v3f_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/f); please hmmpress your HMM file again");
+  if (magic != v3g_fmagic)  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database?");
+
+  if (map_get(map, mapsize, &pos, &M,         sizeof(int)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
+  if (map_get(map, mapsize, &pos, &alphatype, sizeof(int)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");
+  Q16  = p7O_NQB(M);
+  Q16x = p7O_NQB(M) + p7O_EXTRA_SB;
+
+  /* Set or verify alphabet. */
+  if (byp_abc == NULL || *byp_abc == NULL)	{	/* alphabet unknown: whether wanted or unwanted, make a new one */
+    if ((abc = esl_alphabet_Create(alphatype)) == NULL)  ESL_XFAIL(eslEMEM, hfp->errbuf, "allocation failed: alphabet");
+  } else {			/* alphabet already known: verify it against what we see in the HMM */
+    abc = *byp_abc;
+    if (abc->type != alphatype) 
+      ESL_XFAIL(eslEINCOMPAT, hfp->errbuf, "Alphabet type mismatch: was %s, but current profile says %s", 
+		esl_abc_DecodeType(abc->type), esl_abc_DecodeType(alphatype));
+  }
+  if ((om = p7_oprofile_CreateMapped(M, abc)) == NULL)  ESL_XFAIL(eslEMEM, hfp->errbuf, "allocation failed: oprofile");
+  om->M    = M;
+  om->roff = hfp->fpos;
+
+  if (map_get(map, mapsize, &pos, &n,               sizeof(int))     != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name length");
+  if (n < 0)                                                                   ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad name length");
+  ESL_ALLOC(om->name, sizeof(char) * (n+1));
+  if (map_get(map, mapsize, &pos, om->name,         sizeof(char) * (n+1)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name");
+  if (map_get(map, mapsize, &pos, &(om->max_length),sizeof(int))     != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read max_length");
+  if (map_get(map, mapsize, &pos, &(om->tbm_b),     sizeof(uint8_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read tbm");
+  if (map_get(map, mapsize, &pos, &(om->tec_b),     sizeof(uint8_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read tec");
+  if (map_get(map, mapsize, &pos, &(om->tjb_b),     sizeof(uint8_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read tjb");
+  if (map_get(map, mapsize, &pos, &(om->scale_b),   sizeof(float))   != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read scale");
+  if (map_get(map, mapsize, &pos, &(om->base_b),    sizeof(uint8_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read base");
+  if (map_get(map, mapsize, &pos, &(om->bias_b),    sizeof(uint8_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read bias");
+
+  if ((v = map_vec(map, mapsize, &pos, sizeof(__m128i) * Q16x * abc->Kp)) == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ssv scores");
+  for (x = 0; x < abc->Kp; x++) om->sbv[x] = v + x * Q16x;
+  if ((v = map_vec(map, mapsize, &pos, sizeof(__m128i) * Q16  * abc->Kp)) == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read msv scores");
+  for (x = 0; x < abc->Kp; x++) om->rbv[x] = v + x * Q16;
+
+  if (map_get(map, mapsize, &pos, om->evparam, sizeof(float) * p7_NEVPARAM) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read stat params");
+  if (map_get(map, mapsize, &pos, om->offs,    sizeof(off_t) * p7_NOFFSETS) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read hmmpfam offsets");
+  if (map_get(map, mapsize, &pos, om->compo,   sizeof(float) * p7_MAXABET)  != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model composition");
+
+  /* record ends with magic sentinel, for detecting binary file corruption */
+  if (map_get(map, mapsize, &pos, &magic, sizeof(uint32_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3f file corrupted?");
+  if (magic != v3g_fmagic)                                            ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3f file corrupted?");
+
+  /* skip the padding to the next record */
+  pos       = p7O_MAPALIGNUP(pos);
+  om->eoff  = pos - 1;
+  hfp->fpos = pos;
+
+  if (byp_abc != NULL) *byp_abc = abc;  /* pass alphabet (whether new or not) back to caller, if caller wanted it */
+  *ret_om = om;
+  return eslOK;
+
+ ERROR:
+  if (abc != NULL && (byp_abc == NULL || *byp_abc == NULL)) esl_alphabet_Destroy(abc); /* destroy alphabet if we created it here */
+  if (om != NULL) p7_oprofile_Destroy(om);
+  *ret_om = NULL;
+  return status;
+}
+
+/* map_rest()
+ * p7_oprofile_ReadRest() from a mapped <.h3p> file, into an <om> that
+ * map_msv() created. Nothing is read through <hfp->pfp>, and
+ * the mapping is never written, so no lock is needed.
+ */
+static int
+map_rest(P7_HMMFILE *hfp, P7_OPROFILE *om)
+{
+  char         *map     = hfp->pmap;
+  size_t        mapsize = hfp->pmapsize;
+  off_t         pos     = om->offs[p7_POFFSET];
+  __m128i      *v;
+  __m128       *vf;
+  uint32_t      magic;
+  int           M, Q4, Q8;
+  int           x,n;
+  int           alphatype;
+  int           status;
+
+  hfp->errbuf[0] = '\0';
+  if (map_get(map, mapsize, &pos, &magic, sizeof(uint32_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read magic");
+  if (magic == v3f_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/f); please hmmpress your HMM file again");
+  if (magic != v3g_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database file?");
+
+  if (map_get(map, mapsize, &pos, &M,         sizeof(int)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
+  if (map_get(map, mapsize, &pos, &alphatype, sizeof(int)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");
+  if (map_get(map, mapsize, &pos, &n,         sizeof(int)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name length");
+  if (M         != om->M)                                            ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f model length mismatch");
+  if (alphatype != om->abc->type)                                    ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f alphabet type mismatch");
+  if (n < 0 || (size_t) pos + n + 1 > mapsize)                       ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name");
+  if (memcmp(map + pos, om->name, n+1) != 0)                         ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f name mismatch");
+  pos += n+1;
+
+  if (map_get(map, mapsize, &pos, &n, sizeof(int)) != eslOK)         ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession length");
+  if (n > 0) {
+    ESL_ALLOC(om->acc, sizeof(char) * (n+1));
+    if (map_get(map, mapsize, &pos, om->acc, sizeof(char) * (n+1)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession");
+  }
+  if (map_get(map, mapsize, &pos, &n, sizeof(int)) != eslOK)         ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description length");
+  if (n > 0) {
+    ESL_ALLOC(om->desc, sizeof(char) * (n+1));
+    if (map_get(map, mapsize, &pos, om->desc, sizeof(char) * (n+1)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description");
+  }
+
+  /* rf, mm, cs, consensus annotation: M+2 chars each, used in place */
+  if ((size_t) pos + 4 * (M+2) > mapsize)                            ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read annotation");
+  om->rf        = map + pos;  pos += M+2;
+  om->mm        = map + pos;  pos += M+2;
+  om->cs        = map + pos;  pos += M+2;
+  om->consensus = map + pos;  pos += M+2;
+
+  Q4  = p7O_NQF(om->M);
+  Q8  = p7O_NQW(om->M);
+
+  if ((om->twv = map_vec(map, mapsize, &pos, sizeof(__m128i) * 8 * Q8))       == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tu>, vitfilter transitions");
+  if ((v       = map_vec(map, mapsize, &pos, sizeof(__m128i) * Q8 * om->abc->Kp)) == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <ru>, vitfilter emissions");
+  for (x = 0; x < om->abc->Kp; x++) om->rwv[x] = v + x * Q8;
+  if (map_get(map, mapsize, &pos, om->xw,               sizeof(int16_t) * p7O_NXSTATES * p7O_NXTRANS) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xu>, vitfilter special transitions");
+  if (map_get(map, mapsize, &pos, &(om->scale_w),       sizeof(float))   != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read scale_w");
+  if (map_get(map, mapsize, &pos, &(om->base_w),        sizeof(int16_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read base_w");
+  if (map_get(map, mapsize, &pos, &(om->ddbound_w),     sizeof(int16_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
+  if (map_get(map, mapsize, &pos, &(om->ncj_roundoff),  sizeof(float))   != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ncj_roundoff");
+
+  if ((om->tfv = map_vec(map, mapsize, &pos, sizeof(__m128) * 8 * Q4))        == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tf> transitions");
+  if ((vf      = map_vec(map, mapsize, &pos, sizeof(__m128) * Q4 * om->abc->Kp))  == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <rf> emissions");
+  for (x = 0; x < om->abc->Kp; x++) om->rfv[x] = vf + x * Q4;
+  if (map_get(map, mapsize, &pos, om->xf,      sizeof(float) * p7O_NXSTATES * p7O_NXTRANS) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xf> special transitions");
+
+  if (map_get(map, mapsize, &pos, om->cutoff,  sizeof(float) * p7_NCUTOFFS) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read Pfam score cutoffs");
+  if (map_get(map, mapsize, &pos, &(om->nj),   sizeof(float))               != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read nj");
+  if (map_get(map, mapsize, &pos, &(om->mode), sizeof(int))                 != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mode");
+  if (map_get(map, mapsize, &pos, &(om->L),    sizeof(int))                 != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read L");
+
+  /* record ends with magic sentinel, for detecting binary file corruption */
+  if (map_get(map, mapsize, &pos, &magic, sizeof(uint32_t)) != eslOK) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3p file corrupted?");
+  if (magic != v3g_pmagic)                                            ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3p file corrupted?");
+  return eslOK;
+
+ ERROR:
+  return status;
+}
 /*----------- end, reading optimized profiles -------------------*/
 
 
@@ -694,11 +955,45 @@ p7_oprofile_Position(P7_HMMFILE *hfp, off_t offset)
   if (hfp->do_gzip)      ESL_EXCEPTION(eslEINVAL, "can't Position() in a gzipped file");
   if (offset < 0)        ESL_EXCEPTION(eslEINVAL, "bad offset");
 
+  if (hfp->fmap != NULL) { hfp->fpos = offset; return eslOK; }
   if (fseeko(hfp->ffp, offset, SEEK_SET) != 0) ESL_EXCEPTION(eslESYS, "fseeko() failed");
 
   return eslOK;
 }
 
+/* write_pad()
+ * Write zeros to <fp> up to the next 64-byte boundary.
+ */
+static int
+write_pad(FILE *fp)
+{
+  static char zeros[p7O_MAPALIGN];  /* static: initialized to 0 */
+  off_t       pos;
+  size_t      n;
+
+  if ((pos = ftello(fp)) == -1) ESL_EXCEPTION_SYS(eslEWRITE, "ftello() failed on oprofile file");
+  n = p7O_MAPALIGNUP(pos) - pos;
+  if (n > 0 && fwrite(zeros, sizeof(char), n, fp) != n) ESL_EXCEPTION_SYS(eslEWRITE, "oprofile write failed");
+  return eslOK;
+}
+
+/* read_pad()
+ * Skip the padding in <fp> up to the next 64-byte boundary.
+ * Reads (rather than seeks) so the stream buffer isn't flushed.
+ */
+static int
+read_pad(FILE *fp)
+{
+  char    buf[p7O_MAPALIGN];
+  off_t   pos;
+  size_t  n;
+
+  if ((pos = ftello(fp)) == -1) return eslEFORMAT;
+  n = p7O_MAPALIGNUP(pos) - pos;
+  if (n > 0 && fread(buf, sizeof(char), n, fp) != n) return eslEFORMAT;
+  return eslOK;
+}
+
 /*-------------------- end, utility routines ---------------------*/
 
 
@@ -846,6 +1141,21 @@ utest_ReadWrite(P7_HMM *hmm, P7_OPROFILE *om)
        
   p7_oprofile_Destroy(om2);
   p7_hmmfile_Close(hfp);
+
+  /* 4. again, reading in place from a memory mapping, where we have one */
+  if ( p7_hmmfile_OpenE(tmpfile, NULL, &hfp, NULL)  != eslOK) esl_fatal(msg);
+  if ( p7_hmmfile_Map(hfp) == eslOK)
+    {
+      if ( p7_oprofile_ReadMSV(hfp, &abc, &om2)         != eslOK) esl_fatal(msg);
+      if ( ! om2->mapped)                                          esl_fatal(msg);
+      if ( ((uintptr_t) om2->sbv[0]) % 64 != 0)                    esl_fatal(msg);
+      if ( p7_oprofile_ReadRest(hfp, om2)               != eslOK) esl_fatal(msg);
+      if ( ((uintptr_t) om2->rfv[0]) % 64 != 0)                    esl_fatal(msg);
+      if ( p7_oprofile_Compare(om, om2, tolerance, errbuf) != eslOK) esl_fatal("%s\n%s", msg, errbuf);
+      p7_oprofile_Destroy(om2);
+      if ( p7_oprofile_ReadMSV(hfp, &abc, &om2)         != eslEOF) esl_fatal(msg);
+    }
+  p7_hmmfile_Close(hfp);
   esl_alphabet_Destroy(abc);
   remove(ssifile);
   remove(ffile);
@@ -649,6 +649,52 @@ utest_msv_filter(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M, int L,
   p7_profile_Destroy(gm);
   p7_oprofile_Destroy(om);
 }
+
+/* utest_msv_compact()
+ * A compact MSV profile (p7_oprofile_MoveMSV()), searched through a
+ * shadow, and the profile it was moved out of must both give exactly
+ * the scores of the original. The moved rows belong to the caller's
+ * block now, so the profile's size must drop by exactly their
+ * allocations (+15 alignment slack on each of rbv_mem, sbv_mem).
+ */
+static void
+utest_msv_compact(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M, int L, int N)
+{
+  char          msg[]  = "msv filter compact profile unit test failed";
+  P7_OPROFILE  *om     = NULL;
+  P7_OPROFILE  *om2    = NULL;
+  P7_OPROFILE  *shadow = NULL;
+  P7_MSVPROFILE msv;
+  char         *mem    = NULL;
+  ESL_DSQ      *dsq    = malloc(sizeof(ESL_DSQ) * (L+2));
+  P7_OMX       *ox     = p7_omx_Create(M, 0, 0);
+  float         sc1, sc2, sc3;
+
+  p7_oprofile_Sample(r, abc, bg, M, L, NULL, NULL, &om);
+  if ((om2    = p7_oprofile_Copy(om))              == NULL)  esl_fatal(msg);
+  if ((shadow = p7_oprofile_CreateShadow(abc))     == NULL)  esl_fatal(msg);
+  if ((mem    = malloc(p7_oprofile_MSVSizeof(om) + 15)) == NULL)  esl_fatal(msg);
+  if (p7_oprofile_MoveMSV(om2, (void *) (((unsigned long int) mem + 15) & (~0xf)), &msv) != eslOK) esl_fatal(msg);
+  if (p7_oprofile_Sizeof(om) - p7_oprofile_Sizeof(om2) != p7_oprofile_MSVSizeof(om) + 30) esl_fatal("%s: moved rows still counted in profile size", msg);
+  if (p7_oprofile_ShadowMSV(shadow, &msv)      != eslOK) esl_fatal(msg);
+  if (p7_oprofile_ReconfigMSVLength(shadow, L) != eslOK) esl_fatal(msg);
+
+  while (N--)
+    {
+      esl_rsq_xfIID(r, bg->f, abc->K, L, dsq);
+      p7_MSVFilter(dsq, L, om,     ox, &sc1);
+      p7_MSVFilter(dsq, L, om2,    ox, &sc2);
+      p7_MSVFilter(dsq, L, shadow, ox, &sc3);
+      if (sc1 != sc2 || sc1 != sc3) esl_fatal("%s: scores differ (%.2f, %.2f, %.2f)", msg, sc1, sc2, sc3);
+    }
+
+  free(dsq);
+  p7_omx_Destroy(ox);
+  p7_oprofile_Destroy(shadow);
+  p7_oprofile_Destroy(om2);
+  p7_oprofile_Destroy(om);
+  free(mem);
+}
 #endif /*p7MSVFILTER_TESTDRIVE*/
 /*-------------------- end, unit tests --------------------------*/
 
@@ -704,6 +750,7 @@ main(int argc, char **argv)
   utest_msv_filter(r, abc, bg, M, L, N);   /* normal sized models */
   utest_msv_filter(r, abc, bg, 1, L, 10);  /* size 1 models       */
   utest_msv_filter(r, abc, bg, M, 1, 10);  /* size 1 sequences    */
+  utest_msv_compact(r, abc, bg, M, L, 10);
 
   esl_alphabet_Destroy(abc);
   p7_bg_Destroy(bg);
@@ -715,6 +762,7 @@ main(int argc, char **argv)
   utest_msv_filter(r, abc, bg, M, L, N);   
   utest_msv_filter(r, abc, bg, 1, L, 10);  
   utest_msv_filter(r, abc, bg, M, 1, 10);  
+  utest_msv_compact(r, abc, bg, M, L, 10);
 
   esl_alphabet_Destroy(abc);
   p7_bg_Destroy(bg);
@@ -71,6 +71,7 @@ p7_oprofile_Create(int allocM, const ESL_ALPHABET *abc)
   om->rfv     = NULL;
   om->tfv     = NULL;
   om->clone   = 0;
+  om->mapped  = 0;
 
   /* level 1 */
   ESL_ALLOC(om->rbv_mem, sizeof(__m128i) * nqb  * abc->Kp          +15); /* +15 is for manual 16-byte alignment */
@@ -154,6 +155,96 @@ p7_oprofile_Create(int allocM, const ESL_ALPHABET *abc)
   return NULL;
 }
 
+/* Function:  p7_oprofile_CreateMapped()
+ * Synopsis:  Allocate an optimized profile that will point into a mapped file.
+ *
+ * Purpose:   Allocate the shell of an optimized profile of <M> nodes
+ *            for digital alphabet <abc>: the structure itself and the
+ *            per-residue row pointer arrays, but no vector memory and
+ *            no annotation strings. The caller (the readers of a
+ *            mapped pressed database, <p7_hmmfile_Map()>) sets the
+ *            vector and annotation pointers to data it doesn't own.
+ *            <p7_oprofile_Destroy()> only frees what was allocated
+ *            here, and the name, accession and description.
+ *
+ * Throws:    <NULL> on allocation error.
+ */
+P7_OPROFILE *
+p7_oprofile_CreateMapped(int M, const ESL_ALPHABET *abc)
+{
+  int          status;
+  P7_OPROFILE *om  = NULL;
+  int          x;
+
+  ESL_ALLOC(om, sizeof(P7_OPROFILE));
+  om->rbv_mem = NULL;
+  om->sbv_mem = NULL;
+  om->rwv_mem = NULL;
+  om->twv_mem = NULL;
+  om->rfv_mem = NULL;
+  om->tfv_mem = NULL;
+  om->rbv     = NULL;
+  om->sbv     = NULL;
+  om->rwv     = NULL;
+  om->twv     = NULL;
+  om->rfv     = NULL;
+  om->tfv     = NULL;
+  om->clone   = 0;
+  om->mapped  = 1;
+
+  ESL_ALLOC(om->rbv, sizeof(__m128i *) * abc->Kp); 
+  ESL_ALLOC(om->sbv, sizeof(__m128i *) * abc->Kp); 
+  ESL_ALLOC(om->rwv, sizeof(__m128i *) * abc->Kp); 
+  ESL_ALLOC(om->rfv, sizeof(__m128  *) * abc->Kp); 
+  for (x = 0; x < abc->Kp; x++) {
+    om->rbv[x] = NULL;
+    om->sbv[x] = NULL;
+    om->rwv[x] = NULL;
+    om->rfv[x] = NULL;
+  }
+  om->allocQ16  = p7O_NQB(M);
+  om->allocQ8   = p7O_NQW(M);
+  om->allocQ4   = p7O_NQF(M);
+
+  om->tbm_b     = 0;
+  om->tec_b     = 0;
+  om->tjb_b     = 0;
+  om->scale_b   = 0.0f;
+  om->base_b    = 0;
+  om->bias_b    = 0;
+
+  om->scale_w      = 0.0f;
+  om->base_w       = 0;
+  om->ddbound_w    = 0;
+  om->ncj_roundoff = 0.0f;	
+
+  for (x = 0; x < p7_NOFFSETS; x++) om->offs[x]    = -1;
+  for (x = 0; x < p7_NEVPARAM; x++) om->evparam[x] = p7_EVPARAM_UNSET;
+  for (x = 0; x < p7_NCUTOFFS; x++) om->cutoff[x]  = p7_CUTOFF_UNSET;
+  for (x = 0; x < p7_MAXABET;  x++) om->compo[x]   = p7_COMPO_UNSET;
+
+  om->name      = NULL;
+  om->acc       = NULL;
+  om->desc      = NULL;
+  om->rf        = NULL;
+  om->mm        = NULL;
+  om->cs        = NULL;
+  om->consensus = NULL;
+
+  om->abc        = abc;
+  om->L          = 0;
+  om->M          = 0;
+  om->max_length = -1;
+  om->allocM     = M;
+  om->mode       = p7_NO_MODE;
+  om->nj         = 0.0f;
+  return om;
+
+ ERROR:
+  p7_oprofile_Destroy(om);
+  return NULL;
+}
+
 /* Function:  p7_oprofile_IsLocal()
  * Synopsis:  Returns TRUE if profile is in local alignment mode.
  * Incept:    SRE, Sat Aug 16 08:46:00 2008 [Janelia]
@@ -191,10 +282,13 @@ p7_oprofile_Destroy(P7_OPROFILE *om)
       if (om->name      != NULL) free(om->name);
       if (om->acc       != NULL) free(om->acc);
       if (om->desc      != NULL) free(om->desc);
-      if (om->rf        != NULL) free(om->rf);
-      if (om->mm        != NULL) free(om->mm);
-      if (om->cs        != NULL) free(om->cs);
-      if (om->consensus != NULL) free(om->consensus);
+      if (! om->mapped) 
+	{
+	  if (om->rf        != NULL) free(om->rf);
+	  if (om->mm        != NULL) free(om->mm);
+	  if (om->cs        != NULL) free(om->cs);
+	  if (om->consensus != NULL) free(om->consensus);
+	}
     }
 
   free(om);
@@ -223,8 +317,13 @@ p7_oprofile_Sizeof(P7_OPROFILE *om)
    * maintainability and clarity.
    */
   n  += sizeof(P7_OPROFILE);
-  n  += sizeof(__m128i) * nqb  * om->abc->Kp +15; /* om->rbv_mem   */
-  n  += sizeof(__m128i) * nqs  * om->abc->Kp +15; /* om->sbv_mem   */
+  if (om->mapped) 		/* vectors, annotation aren't ours; see _CreateMapped() */
+    return n + 4 * sizeof(__m128i *) * om->abc->Kp;
+
+  if (om->rbv_mem)                                /* not if moved to a P7_MSVPROFILE */
+    n += sizeof(__m128i) * nqb  * om->abc->Kp +15; /* om->rbv_mem   */
+  if (om->sbv_mem)
+    n += sizeof(__m128i) * nqs  * om->abc->Kp +15; /* om->sbv_mem   */
   n  += sizeof(__m128i) * nqw  * om->abc->Kp +15; /* om->rwv_mem   */
   n  += sizeof(__m128i) * nqw  * p7O_NTRANS  +15; /* om->twv_mem   */
   n  += sizeof(__m128)  * nqf  * om->abc->Kp +15; /* om->rfv_mem   */
@@ -285,6 +384,7 @@ p7_oprofile_Copy(P7_OPROFILE *om1)
   om2->twv     = NULL;
   om2->rfv     = NULL;
   om2->tfv     = NULL;
+  om2->mapped  = 0;
 
   /* level 1 */
   ESL_ALLOC(om2->rbv_mem, sizeof(__m128i) * nqb  * abc->Kp    +15);	/* +15 is for manual 16-byte alignment */
@@ -366,10 +466,10 @@ p7_oprofile_Copy(P7_OPROFILE *om1)
   ESL_ALLOC(om2->cs,          size);
   ESL_ALLOC(om2->consensus,   size);
 
-  memcpy(om2->rf,        om1->rf,        size);
-  memcpy(om2->mm,        om1->mm,        size);
-  memcpy(om2->cs,        om1->cs,        size);
-  memcpy(om2->consensus, om1->consensus, size);
+  if (om1->rf        != NULL) memcpy(om2->rf,        om1->rf,        size); else memset(om2->rf,        '\0', size);
+  if (om1->mm        != NULL) memcpy(om2->mm,        om1->mm,        size); else memset(om2->mm,        '\0', size);
+  if (om1->cs        != NULL) memcpy(om2->cs,        om1->cs,        size); else memset(om2->cs,        '\0', size);
+  if (om1->consensus != NULL) memcpy(om2->consensus, om1->consensus, size); else memset(om2->consensus, '\0', size);
 
   om2->abc       = om1->abc;
   om2->L         = om1->L;
@@ -417,6 +517,128 @@ p7_oprofile_Clone(const P7_OPROFILE *om1)
   return NULL;
 }
 
+/* Function:  p7_oprofile_MSVSizeof()
+ * Synopsis:  Size of the score vectors of <om>'s compact MSV profile.
+ *
+ * Purpose:   Returns the number of bytes of vector memory that
+ *            <p7_oprofile_MoveMSV()> needs for <om>: its SSV and MSV
+ *            score rows. This is a multiple of 16, so the blocks of
+ *            many profiles can be laid out back to back.
+ */
+size_t
+p7_oprofile_MSVSizeof(const P7_OPROFILE *om)
+{
+  int nqb = om->allocQ16;
+  int nqs = nqb + p7O_EXTRA_SB;
+
+  return sizeof(__m128i) * (nqs + nqb) * om->abc->Kp;
+}
+
+/* Function:  p7_oprofile_MoveMSV()
+ * Synopsis:  Move <om>'s MSV filter scores into a compact MSV profile.
+ *
+ * Purpose:   Copy the SSV and MSV score vectors of <om> into <mem>, a
+ *            16-byte aligned block of at least
+ *            <p7_oprofile_MSVSizeof(om)> bytes that the caller owns,
+ *            and set <msv> to describe them. <om> then uses the
+ *            copies too, and its own vector memory for them is
+ *            freed; <mem> must outlive <om>.
+ *
+ *            This is how a cached database (<p7_hmmcache_Open()>)
+ *            keeps the first filter stage of all its profiles in one
+ *            contiguous block without holding the scores twice.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <om> doesn't own its vectors (it is a
+ *            clone, or mapped).
+ */
+int
+p7_oprofile_MoveMSV(P7_OPROFILE *om, void *mem, P7_MSVPROFILE *msv)
+{
+  int nqb = om->allocQ16;
+  int nqs = nqb + p7O_EXTRA_SB;
+  int x;
+
+  if (om->clone || om->mapped) ESL_EXCEPTION(eslEINVAL, "profile doesn't own its score vectors");
+
+  msv->M       = om->M;
+  msv->Q       = nqb;
+  msv->tbm_b   = om->tbm_b;
+  msv->tec_b   = om->tec_b;
+  msv->base_b  = om->base_b;
+  msv->bias_b  = om->bias_b;
+  msv->scale_b = om->scale_b;
+  for (x = 0; x < p7_NEVPARAM; x++) msv->evparam[x] = om->evparam[x];
+
+  msv->sbv = (__m128i *) mem;
+  msv->rbv = msv->sbv + nqs * om->abc->Kp;
+  memcpy(msv->sbv, om->sbv[0], sizeof(__m128i) * nqs * om->abc->Kp);
+  memcpy(msv->rbv, om->rbv[0], sizeof(__m128i) * nqb * om->abc->Kp);
+
+  for (x = 0; x < om->abc->Kp; x++) {
+    om->sbv[x] = msv->sbv + x * nqs;
+    om->rbv[x] = msv->rbv + x * nqb;
+  }
+  if (om->sbv_mem) free(om->sbv_mem);
+  if (om->rbv_mem) free(om->rbv_mem);
+  om->sbv_mem = NULL;
+  om->rbv_mem = NULL;
+  return eslOK;
+}
+
+/* Function:  p7_oprofile_CreateShadow()
+ * Synopsis:  Allocate an empty profile for searching compact MSV profiles.
+ *
+ * Purpose:   Allocate a profile shell for alphabet <abc> with no score
+ *            vectors of its own. <p7_oprofile_ShadowMSV()> points it
+ *            at a <P7_MSVPROFILE>, after which it can be given to the
+ *            SSV and MSV filters, and nothing else. One shell serves
+ *            any number of compact profiles, one at a time.
+ *
+ * Throws:    <NULL> on allocation error.
+ */
+P7_OPROFILE *
+p7_oprofile_CreateShadow(const ESL_ALPHABET *abc)
+{
+  return p7_oprofile_CreateMapped(0, abc); /* row pointers only; we never own what they point at */
+}
+
+/* Function:  p7_oprofile_ShadowMSV()
+ * Synopsis:  Point a profile shell at a compact MSV profile.
+ *
+ * Purpose:   Set shell <om> (from <p7_oprofile_CreateShadow()>) to use
+ *            the scores of compact MSV profile <msv>. The caller then
+ *            sets the length-dependent part with
+ *            <p7_oprofile_SetMSVLength()> or
+ *            <p7_oprofile_ReconfigMSVLength()>. <msv> itself is not
+ *            changed, so threads can share it.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_ShadowMSV(P7_OPROFILE *om, const P7_MSVPROFILE *msv)
+{
+  int nqs = msv->Q + p7O_EXTRA_SB;
+  int x;
+
+  om->M        = msv->M;
+  om->allocM   = msv->M;
+  om->allocQ16 = msv->Q;
+  om->tbm_b    = msv->tbm_b;
+  om->tec_b    = msv->tec_b;
+  om->base_b   = msv->base_b;
+  om->bias_b   = msv->bias_b;
+  om->scale_b  = msv->scale_b;
+  for (x = 0; x < p7_NEVPARAM; x++) om->evparam[x] = msv->evparam[x];
+
+  for (x = 0; x < om->abc->Kp; x++) {
+    om->sbv[x] = msv->sbv + x * nqs;
+    om->rbv[x] = msv->rbv + x * msv->Q;
+  }
+  return eslOK;
+}
+
 
 /* Function:  p7_oprofile_UpdateFwdEmissionScores()
  * Synopsis:  Update the Forward/Backward part of the optimized profile
@@ -1136,6 +1358,82 @@ p7_oprofile_ReconfigRestLength(P7_OPROFILE *om, int L)
 }
 
 
+/* Function:  p7_oprofile_ComputeLength()
+ * Synopsis:  Precompute length parameters for many profiles.
+ *
+ * Purpose:   Compute the parts of the special state parameters that
+ *            depend on target length <L> but not on the profile, in
+ *            <olen>. Setting them in a profile with
+ *            <p7_oprofile_SetLength()> is then the same as
+ *            <p7_oprofile_ReconfigLength(om, L)>, without its
+ *            <logf()> calls. This pays when many profiles are set
+ *            for one length, as hmmscan does for each query.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_ComputeLength(P7_OLENGTH *olen, int L)
+{
+  int nj;
+
+  olen->L    = L;
+  olen->ltjb = logf(3.0f / (float) (L+3));
+  for (nj = 0; nj <= 1; nj++)
+    {
+      olen->pmove[nj]  = (2.0f + (float) nj) / ((float) L + 2.0f + (float) nj);
+      olen->ploop[nj]  = 1.0f - olen->pmove[nj];
+      olen->lpmove[nj] = logf(olen->pmove[nj]);
+    }
+  return eslOK;
+}
+
+/* Function:  p7_oprofile_SetLength()
+ * Synopsis:  Set the target sequence length of a model, from precomputed parameters.
+ *
+ * Purpose:   Same as <p7_oprofile_ReconfigLength(om, olen->L)>, using
+ *            the parameters in <olen> from <p7_oprofile_ComputeLength()>.
+ *            <p7_oprofile_SetMSVLength()> and <p7_oprofile_SetRestLength()>
+ *            are the two parts of it, as for <ReconfigLength()>.
+ *
+ *            A profile in a mode other than multihit or unihit
+ *            (<om->nj> not 1 or 0) is reconfigured the slow way.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_SetLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  int status;
+  if ((status = p7_oprofile_SetMSVLength (om, olen)) != eslOK) return status;
+  if ((status = p7_oprofile_SetRestLength(om, olen)) != eslOK) return status;
+  return eslOK;
+}
+
+int
+p7_oprofile_SetMSVLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  om->tjb_b = unbiased_byteify(om, olen->ltjb);
+  return eslOK;
+}
+
+int
+p7_oprofile_SetRestLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  int nj;
+
+  if      (om->nj == 1.0f) nj = 1;
+  else if (om->nj == 0.0f) nj = 0;
+  else return p7_oprofile_ReconfigRestLength(om, olen->L);
+
+  om->xf[p7O_N][p7O_LOOP] =  om->xf[p7O_C][p7O_LOOP] = om->xf[p7O_J][p7O_LOOP] = olen->ploop[nj];
+  om->xf[p7O_N][p7O_MOVE] =  om->xf[p7O_C][p7O_MOVE] = om->xf[p7O_J][p7O_MOVE] = olen->pmove[nj];
+  om->xw[p7O_N][p7O_MOVE] =  om->xw[p7O_C][p7O_MOVE] = om->xw[p7O_J][p7O_MOVE] = wordify(om, olen->lpmove[nj]);
+
+  om->L = olen->L;
+  return eslOK;
+}
+
+
 /* Function:  p7_oprofile_ReconfigMultihit()
  * Synopsis:  Quickly reconfig model into multihit mode for target length <L>.
  * Incept:    SRE, Thu Aug 21 10:04:07 2008 [Janelia]
@@ -2076,8 +2374,60 @@ main(int argc, char **argv)
  * 6. Unit tests
  *****************************************************************/
 #ifdef p7OPROFILE_TESTDRIVE
+#include "esl_random.h"
 
+/* utest_setlength()
+ * 
+ * Setting a profile's length from precomputed parameters
+ * (p7_oprofile_ComputeLength(), p7_oprofile_SetLength()) must give
+ * the same profile as p7_oprofile_ReconfigLength(), for unihit and
+ * multihit profiles and for the fallback taken when om->nj is
+ * neither 0 nor 1.
+ */
+static void
+utest_setlength(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M)
+{
+  char         *msg   = "p7_oprofile setlength unit test failed";
+  P7_OPROFILE  *om    = NULL;
+  P7_OPROFILE  *om1   = NULL;
+  P7_OPROFILE  *om2   = NULL;
+  P7_OLENGTH    olen;
+  int           Lv[]  = { 0, 1, 2, 100, 400, 1000, 100000 };
+  int           nL    = sizeof(Lv) / sizeof(int);
+  char          errbuf[eslERRBUFSIZE];
+  int           mode, i;
 
+  if (p7_oprofile_Sample(r, abc, bg, M, 400, NULL, NULL, &om) != eslOK) esl_fatal(msg);
+
+  for (mode = 0; mode < 3; mode++)
+    {
+      if      (mode == 0) p7_oprofile_ReconfigUnihit  (om, 400);
+      else if (mode == 1) p7_oprofile_ReconfigMultihit(om, 400);
+      else                om->nj = 0.5f; /* neither uni- nor multihit: SetRestLength() falls back */
+
+      for (i = 0; i < nL; i++)
+	{
+	  if ((om1 = p7_oprofile_Clone(om)) == NULL) esl_fatal(msg);
+	  if ((om2 = p7_oprofile_Clone(om)) == NULL) esl_fatal(msg);
+
+	  if (p7_oprofile_ComputeLength(&olen, Lv[i])         != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetLength(om1, &olen)                != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_ReconfigLength(om2, Lv[i])           != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_Compare(om1, om2, 0.0001f, errbuf)   != eslOK) esl_fatal("%s\nL=%d nj=%.1f: %s", msg, Lv[i], om->nj, errbuf);
+
+	  /* and the two part version, as hmmscan uses it */
+	  if (p7_oprofile_ReconfigLength(om1, 42)              != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetMSVLength (om1, &olen)            != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetRestLength(om1, &olen)            != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_Compare(om1, om2, 0.0001f, errbuf)   != eslOK) esl_fatal("%s\nL=%d nj=%.1f: %s", msg, Lv[i], om->nj, errbuf);
+
+	  p7_oprofile_Destroy(om1);
+	  p7_oprofile_Destroy(om2);
+	}
+    }
+
+  p7_oprofile_Destroy(om);
+}
 #endif /*p7OPROFILE_TESTDRIVE*/
 /*------------------- end, unit tests ---------------------------*/
 
@@ -2088,8 +2438,51 @@ main(int argc, char **argv)
  * 7. Test driver
  *****************************************************************/
 #ifdef p7OPROFILE_TESTDRIVE
+/* 
+   gcc -g -Wall -msse2 -std=gnu99 -I.. -L.. -I../../easel -L../../easel -o p7_oprofile_utest -Dp7OPROFILE_TESTDRIVE p7_oprofile.c -lhmmer -leasel -lm
+   ./p7_oprofile_utest
+ */
+#include "p7_config.h"
 
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+
+#include "hmmer.h"
+#include "impl_sse.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,     "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-M",        eslARG_INT,    "145", NULL, NULL,  NULL,  NULL, NULL, "size of random models to sample",                0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for the SSE P7_OPROFILE implementation";
 
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go   = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *r    = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc  = NULL;
+  P7_BG          *bg   = NULL;
+  int             M    = esl_opt_GetInteger(go, "-M");
+
+  if ((abc = esl_alphabet_Create(eslAMINO)) == NULL)  esl_fatal("failed to create alphabet");
+  if ((bg = p7_bg_Create(abc))              == NULL)  esl_fatal("failed to create null model");
+
+  utest_setlength(r, abc, bg, M);
+  utest_setlength(r, abc, bg, 1);
+
+  esl_alphabet_Destroy(abc);
+  p7_bg_Destroy(bg);
+  esl_getopts_Destroy(go);
+  esl_randomness_Destroy(r);
+  return eslOK;
+}
 #endif /*p7OPROFILE_TESTDRIVE*/
 /*------------------- end, test driver --------------------------*/
 
@@ -212,7 +212,8 @@ p7_oprofile_Sizeof(P7_OPROFILE *om)
   int    nqf = om->allocQ4;  /* # of float vectors needed for query */
 
   n += sizeof(P7_OPROFILE);
-  n += sizeof(vector unsigned char) * nqb  * om->abc->Kp +15; /* om->rbv_mem */
+  if (om->rbv_mem)		/* not if moved to a P7_MSVPROFILE */
+    n += sizeof(vector unsigned char) * nqb  * om->abc->Kp +15; /* om->rbv_mem */
   n += sizeof(vector signed short)  * nqw  * om->abc->Kp +15; /* om->rwv_mem */
   n += sizeof(vector signed short)  * nqw  * p7O_NTRANS  +15; /* om->twv_mem */
   n += sizeof(vector float)         * nqf  * om->abc->Kp +15; /* om->rfv_mem */
@@ -395,6 +396,154 @@ p7_oprofile_Clone(const P7_OPROFILE *om1)
   return NULL;
 }
 
+/* Function:  p7_oprofile_MSVSizeof()
+ * Synopsis:  Size of the score vectors of <om>'s compact MSV profile.
+ *
+ * Purpose:   Returns the number of bytes of vector memory that
+ *            <p7_oprofile_MoveMSV()> needs for <om>: its MSV score
+ *            rows. This is a multiple of 16, so the blocks of many
+ *            profiles can be laid out back to back.
+ */
+size_t
+p7_oprofile_MSVSizeof(const P7_OPROFILE *om)
+{
+  return sizeof(vector unsigned char) * om->allocQ16 * om->abc->Kp;
+}
+
+/* Function:  p7_oprofile_MoveMSV()
+ * Synopsis:  Move <om>'s MSV filter scores into a compact MSV profile.
+ *
+ * Purpose:   Copy the MSV score vectors of <om> into <mem>, a 16-byte
+ *            aligned block of at least <p7_oprofile_MSVSizeof(om)>
+ *            bytes that the caller owns, and set <msv> to describe
+ *            them. <om> then uses the copies too, and its own vector
+ *            memory for them is freed; <mem> must outlive <om>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <om> is a clone, which doesn't own its
+ *            vectors.
+ */
+int
+p7_oprofile_MoveMSV(P7_OPROFILE *om, void *mem, P7_MSVPROFILE *msv)
+{
+  int nqb = om->allocQ16;
+  int x;
+
+  if (om->clone) ESL_EXCEPTION(eslEINVAL, "profile doesn't own its score vectors");
+
+  msv->M       = om->M;
+  msv->Q       = nqb;
+  msv->tbm_b   = om->tbm_b;
+  msv->tec_b   = om->tec_b;
+  msv->base_b  = om->base_b;
+  msv->bias_b  = om->bias_b;
+  msv->scale_b = om->scale_b;
+  for (x = 0; x < p7_NEVPARAM; x++) msv->evparam[x] = om->evparam[x];
+
+  msv->rbv = (vector unsigned char *) mem;
+  memcpy(msv->rbv, om->rbv[0], sizeof(vector unsigned char) * nqb * om->abc->Kp);
+
+  for (x = 0; x < om->abc->Kp; x++)
+    om->rbv[x] = msv->rbv + x * nqb;
+  if (om->rbv_mem) free(om->rbv_mem);
+  om->rbv_mem = NULL;
+  return eslOK;
+}
+
+/* Function:  p7_oprofile_CreateShadow()
+ * Synopsis:  Allocate an empty profile for searching compact MSV profiles.
+ *
+ * Purpose:   Allocate a profile shell for alphabet <abc> with no score
+ *            vectors of its own. <p7_oprofile_ShadowMSV()> points it
+ *            at a <P7_MSVPROFILE>, after which it can be given to the
+ *            MSV filter, and nothing else.
+ *
+ * Throws:    <NULL> on allocation error.
+ */
+P7_OPROFILE *
+p7_oprofile_CreateShadow(const ESL_ALPHABET *abc)
+{
+  P7_OPROFILE *om = NULL;
+  int          x;
+  int          status;
+
+  ESL_ALLOC(om, sizeof(P7_OPROFILE));
+  om->rbv_mem   = NULL;
+  om->rwv_mem   = NULL;
+  om->twv_mem   = NULL;
+  om->rfv_mem   = NULL;
+  om->tfv_mem   = NULL;
+  om->rwv       = NULL;
+  om->twv       = NULL;
+  om->rfv       = NULL;
+  om->tfv       = NULL;
+  om->clone     = 0;
+  om->name      = NULL;
+  om->acc       = NULL;
+  om->desc      = NULL;
+  om->rf        = NULL;
+  om->mm        = NULL;
+  om->cs        = NULL;
+  om->consensus = NULL;
+
+  ESL_ALLOC(om->rbv, sizeof(vector unsigned char *) * abc->Kp);
+  for (x = 0; x < abc->Kp; x++) om->rbv[x] = NULL;
+
+  for (x = 0; x < p7_NOFFSETS; x++) om->offs[x]    = -1;
+  for (x = 0; x < p7_NEVPARAM; x++) om->evparam[x] = p7_EVPARAM_UNSET;
+  for (x = 0; x < p7_NCUTOFFS; x++) om->cutoff[x]  = p7_CUTOFF_UNSET;
+  for (x = 0; x < p7_MAXABET;  x++) om->compo[x]   = p7_COMPO_UNSET;
+
+  om->abc        = abc;
+  om->L          = 0;
+  om->M          = 0;
+  om->max_length = -1;
+  om->allocM     = 0;
+  om->allocQ16   = 0;
+  om->allocQ8    = 0;
+  om->allocQ4    = 0;
+  om->mode       = p7_NO_MODE;
+  om->nj         = 0.0f;
+  return om;
+
+ ERROR:
+  p7_oprofile_Destroy(om);
+  return NULL;
+}
+
+/* Function:  p7_oprofile_ShadowMSV()
+ * Synopsis:  Point a profile shell at a compact MSV profile.
+ *
+ * Purpose:   Set shell <om> (from <p7_oprofile_CreateShadow()>) to use
+ *            the scores of compact MSV profile <msv>. The caller then
+ *            sets the length-dependent part with
+ *            <p7_oprofile_SetMSVLength()> or
+ *            <p7_oprofile_ReconfigMSVLength()>. <msv> itself is not
+ *            changed, so threads can share it.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_ShadowMSV(P7_OPROFILE *om, const P7_MSVPROFILE *msv)
+{
+  int x;
+
+  om->M        = msv->M;
+  om->allocM   = msv->M;
+  om->allocQ16 = msv->Q;
+  om->tbm_b    = msv->tbm_b;
+  om->tec_b    = msv->tec_b;
+  om->base_b   = msv->base_b;
+  om->bias_b   = msv->bias_b;
+  om->scale_b  = msv->scale_b;
+  for (x = 0; x < p7_NEVPARAM; x++) om->evparam[x] = msv->evparam[x];
+
+  for (x = 0; x < om->abc->Kp; x++)
+    om->rbv[x] = msv->rbv + x * msv->Q;
+  return eslOK;
+}
+
 
 /* Function:  p7_oprofile_UpdateFwdEmissionScores()
  * Synopsis:  Update the Forward/Backward part of the optimized profile
@@ -1057,6 +1206,82 @@ p7_oprofile_ReconfigRestLength(P7_OPROFILE *om, int L)
 }
 
 
+/* Function:  p7_oprofile_ComputeLength()
+ * Synopsis:  Precompute length parameters for many profiles.
+ *
+ * Purpose:   Compute the parts of the special state parameters that
+ *            depend on target length <L> but not on the profile, in
+ *            <olen>. Setting them in a profile with
+ *            <p7_oprofile_SetLength()> is then the same as
+ *            <p7_oprofile_ReconfigLength(om, L)>, without its
+ *            <logf()> calls. This pays when many profiles are set
+ *            for one length, as hmmscan does for each query.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_ComputeLength(P7_OLENGTH *olen, int L)
+{
+  int nj;
+
+  olen->L    = L;
+  olen->ltjb = logf(3.0f / (float) (L+3));
+  for (nj = 0; nj <= 1; nj++)
+    {
+      olen->pmove[nj]  = (2.0f + (float) nj) / ((float) L + 2.0f + (float) nj);
+      olen->ploop[nj]  = 1.0f - olen->pmove[nj];
+      olen->lpmove[nj] = logf(olen->pmove[nj]);
+    }
+  return eslOK;
+}
+
+/* Function:  p7_oprofile_SetLength()
+ * Synopsis:  Set the target sequence length of a model, from precomputed parameters.
+ *
+ * Purpose:   Same as <p7_oprofile_ReconfigLength(om, olen->L)>, using
+ *            the parameters in <olen> from <p7_oprofile_ComputeLength()>.
+ *            <p7_oprofile_SetMSVLength()> and <p7_oprofile_SetRestLength()>
+ *            are the two parts of it, as for <ReconfigLength()>.
+ *
+ *            A profile in a mode other than multihit or unihit
+ *            (<om->nj> not 1 or 0) is reconfigured the slow way.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_oprofile_SetLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  int status;
+  if ((status = p7_oprofile_SetMSVLength (om, olen)) != eslOK) return status;
+  if ((status = p7_oprofile_SetRestLength(om, olen)) != eslOK) return status;
+  return eslOK;
+}
+
+int
+p7_oprofile_SetMSVLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  om->tjb_b = unbiased_byteify(om, olen->ltjb);
+  return eslOK;
+}
+
+int
+p7_oprofile_SetRestLength(P7_OPROFILE *om, const P7_OLENGTH *olen)
+{
+  int nj;
+
+  if      (om->nj == 1.0f) nj = 1;
+  else if (om->nj == 0.0f) nj = 0;
+  else return p7_oprofile_ReconfigRestLength(om, olen->L);
+
+  om->xf[p7O_N][p7O_LOOP] =  om->xf[p7O_C][p7O_LOOP] = om->xf[p7O_J][p7O_LOOP] = olen->ploop[nj];
+  om->xf[p7O_N][p7O_MOVE] =  om->xf[p7O_C][p7O_MOVE] = om->xf[p7O_J][p7O_MOVE] = olen->pmove[nj];
+  om->xw[p7O_N][p7O_MOVE] =  om->xw[p7O_C][p7O_MOVE] = om->xw[p7O_J][p7O_MOVE] = wordify(om, olen->lpmove[nj]);
+
+  om->L = olen->L;
+  return eslOK;
+}
+
+
 /* Function:  p7_oprofile_ReconfigMultihit()
  * Synopsis:  Quickly reconfig model into multihit mode for target length <L>.
  * Incept:    SRE, Thu Aug 21 10:04:07 2008 [Janelia]
@@ -2005,8 +2230,60 @@ main(int argc, char **argv)
  * 6. Unit tests
  *****************************************************************/
 #ifdef p7OPROFILE_TESTDRIVE
+#include "esl_random.h"
+
+/* utest_setlength()
+ * 
+ * Setting a profile's length from precomputed parameters
+ * (p7_oprofile_ComputeLength(), p7_oprofile_SetLength()) must give
+ * the same profile as p7_oprofile_ReconfigLength(), for unihit and
+ * multihit profiles and for the fallback taken when om->nj is
+ * neither 0 nor 1.
+ */
+static void
+utest_setlength(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M)
+{
+  char         *msg   = "p7_oprofile setlength unit test failed";
+  P7_OPROFILE  *om    = NULL;
+  P7_OPROFILE  *om1   = NULL;
+  P7_OPROFILE  *om2   = NULL;
+  P7_OLENGTH    olen;
+  int           Lv[]  = { 0, 1, 2, 100, 400, 1000, 100000 };
+  int           nL    = sizeof(Lv) / sizeof(int);
+  char          errbuf[eslERRBUFSIZE];
+  int           mode, i;
 
+  if (p7_oprofile_Sample(r, abc, bg, M, 400, NULL, NULL, &om) != eslOK) esl_fatal(msg);
+
+  for (mode = 0; mode < 3; mode++)
+    {
+      if      (mode == 0) p7_oprofile_ReconfigUnihit  (om, 400);
+      else if (mode == 1) p7_oprofile_ReconfigMultihit(om, 400);
+      else                om->nj = 0.5f; /* neither uni- nor multihit: SetRestLength() falls back */
+
+      for (i = 0; i < nL; i++)
+	{
+	  if ((om1 = p7_oprofile_Clone(om)) == NULL) esl_fatal(msg);
+	  if ((om2 = p7_oprofile_Clone(om)) == NULL) esl_fatal(msg);
+
+	  if (p7_oprofile_ComputeLength(&olen, Lv[i])         != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetLength(om1, &olen)                != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_ReconfigLength(om2, Lv[i])           != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_Compare(om1, om2, 0.0001f, errbuf)   != eslOK) esl_fatal("%s\nL=%d nj=%.1f: %s", msg, Lv[i], om->nj, errbuf);
+
+	  /* and the two part version, as hmmscan uses it */
+	  if (p7_oprofile_ReconfigLength(om1, 42)              != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetMSVLength (om1, &olen)            != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_SetRestLength(om1, &olen)            != eslOK) esl_fatal(msg);
+	  if (p7_oprofile_Compare(om1, om2, 0.0001f, errbuf)   != eslOK) esl_fatal("%s\nL=%d nj=%.1f: %s", msg, Lv[i], om->nj, errbuf);
+
+	  p7_oprofile_Destroy(om1);
+	  p7_oprofile_Destroy(om2);
+	}
+    }
 
+  p7_oprofile_Destroy(om);
+}
 #endif /*p7OPROFILE_TESTDRIVE*/
 /*------------------- end, unit tests ---------------------------*/
 
@@ -2017,8 +2294,51 @@ main(int argc, char **argv)
  * 7. Test driver
  *****************************************************************/
 #ifdef p7OPROFILE_TESTDRIVE
+/* 
+   gcc -g -Wall -maltivec -std=gnu99 -I.. -L.. -I../../easel -L../../easel -o p7_oprofile_utest -Dp7OPROFILE_TESTDRIVE p7_oprofile.c -lhmmer -leasel -lm
+   ./p7_oprofile_utest
+ */
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
 
+#include "hmmer.h"
+#include "impl_vmx.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,     "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-M",        eslARG_INT,    "145", NULL, NULL,  NULL,  NULL, NULL, "size of random models to sample",                0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for the VMX P7_OPROFILE implementation";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go   = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *r    = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc  = NULL;
+  P7_BG          *bg   = NULL;
+  int             M    = esl_opt_GetInteger(go, "-M");
+
+  if ((abc = esl_alphabet_Create(eslAMINO)) == NULL)  esl_fatal("failed to create alphabet");
+  if ((bg = p7_bg_Create(abc))              == NULL)  esl_fatal("failed to create null model");
 
+  utest_setlength(r, abc, bg, M);
+  utest_setlength(r, abc, bg, 1);
+
+  esl_alphabet_Destroy(abc);
+  p7_bg_Destroy(bg);
+  esl_getopts_Destroy(go);
+  esl_randomness_Destroy(r);
+  return eslOK;
+}
 #endif /*p7OPROFILE_TESTDRIVE*/
 /*------------------- end, test driver --------------------------*/
 
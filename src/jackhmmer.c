@@ -26,15 +26,12 @@
 #ifdef HMMER_THREADS
 #include <unistd.h>
 #include "esl_threads.h"
-#include "esl_workqueue.h"
 #endif 
 
 #include "hmmer.h"
+#include "p7_scheduler.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif
   P7_BG            *bg;
   P7_PIPELINE      *pli;
   P7_TOPHITS       *th;
@@ -172,8 +169,15 @@ static int  serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp);
-static void pipeline_thread(void *arg);
+/* BLOCK_TASK: one block of targets to search with the current model */
+typedef struct {
+  WORKER_INFO      *info;        /* per-worker pipelines and hit lists [0..ncpus-1] */
+  ESL_SQ_BLOCK     *block;
+  P7_BLOCKPOOL     *pool;        /* where <block> goes back to when done    */
+} BLOCK_TASK;
+
+static int  thread_loop (P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, WORKER_INFO *info, ESL_SQFILE *dbfp, int M);
+static void search_block(void *arg, int workeridx);
 #endif 
 
 #ifdef HMMER_MPI
@@ -457,9 +461,8 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   int              infocnt  = 0;
   WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  ESL_SQ_BLOCK    *block    = NULL;
-  ESL_THREADS     *threadObj= NULL;
-  ESL_WORK_QUEUE  *queue    = NULL;
+  P7_SCHEDULER    *sched    = NULL;
+  P7_BLOCKPOOL    *pool     = NULL;
 #endif
 
   /* Initializations */
@@ -528,8 +531,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ncpus = ESL_MIN(esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
   if (ncpus > 0)
     {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
+      sched = p7_scheduler_Create(ncpus, NULL);
+      if (sched == NULL) p7_Fail("Failed to start worker threads");
+      pool  = p7_blockpool_Create(ncpus * 2, BLOCK_SIZE, abc);
+      if (pool  == NULL) p7_Fail("Failed to allocate sequence blocks");
     }
 #endif
 
@@ -545,28 +550,8 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       info[i].th    = NULL;
       info[i].om    = NULL;
       info[i].bg    = p7_bg_Clone(bg);
-#ifdef HMMER_THREADS
-      info[i].queue = queue;
-#endif
     }
 
-#ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
-    {
-      block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-      if (block == NULL) 
-	{
-	  p7_Fail("Failed to allocate sequence block");
-	}
-
-      status = esl_workqueue_Init(queue, block);
-      if (status != eslOK) 
-	{
-	  p7_Fail("Failed to add block to work queue");
-	}
-    }
-#endif
-
   /* Outer loop over sequence queries, if more than one */
   while ((qstatus = esl_sqio_Read(qfp, qsq)) == eslOK)
     {
@@ -634,14 +619,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	      info[i].om  = p7_oprofile_Clone(om);
 	      info[i].pli = p7_pipeline_Create(go, om->M, 400, FALSE, p7_SEARCH_SEQS); /* 400 is a dummy length for now */
 	      p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
-
-#ifdef HMMER_THREADS
-	      if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
-#endif
 	    }
 
 #ifdef HMMER_THREADS
-	  if (ncpus > 0) sstatus = thread_loop(threadObj, queue, dbfp);
+	  if (ncpus > 0) sstatus = thread_loop(sched, pool, info, dbfp, om->M);
 	  else           sstatus = serial_loop(info, dbfp);
 #else
 	  sstatus = serial_loop(info, dbfp);
@@ -759,14 +740,8 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
     p7_bg_Destroy(info[i].bg);
 
 #ifdef HMMER_THREADS
-  if (ncpus > 0)
-    {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
-    }
+  p7_scheduler_Destroy(sched);
+  p7_blockpool_Destroy(pool);
 #endif
 
   free(info);
@@ -1624,105 +1599,83 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp)
 }
 
 #ifdef HMMER_THREADS
+/* thread_loop()
+ * Read the targets in blocks taken from <pool>, and submit a task
+ * for each block that searches it with the current model, using the
+ * pipeline and hit list of the worker that runs it,
+ * <info[workeridx]>. Returns once all the tasks are done, since the
+ * next round's model is built from this one's hits.
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp)
+thread_loop(P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, WORKER_INFO *info, ESL_SQFILE *dbfp, int M)
 {
-  int  status  = eslOK;
-  int  sstatus = eslOK;
-  int  eofCount = 0;
-  ESL_SQ_BLOCK *block;
-  void         *newBlock;
+  int             sstatus = eslOK;
+  ESL_SQ_BLOCK   *block;
+  BLOCK_TASK     *task;
+  P7_TASKGROUP   *grp;
+  P7_BLOCKREADER *br;
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+  br = p7_blockreader_Create(dbfp, M, -1);
+  if (br == NULL) p7_Fail("Failed to create target block reader");
+  grp = p7_taskgroup_Create();
+  if (grp == NULL) p7_Fail("Failed to create task group");
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
-      
   /* Main loop: */
   while (sstatus == eslOK)
     {
-      block = (ESL_SQ_BLOCK *) newBlock;
-      sstatus = esl_sqio_ReadBlock(dbfp, block, -1, -1, FALSE);
-      if (sstatus == eslEOF)
-	{
-	  if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-	  ++eofCount;
-	}
+      block = p7_blockpool_Get(pool);
+      if (block == NULL) p7_Fail("Failed to get a sequence block");
 
-      if (sstatus == eslOK)
+      sstatus = p7_blockreader_Read(br, block);
+      if (sstatus != eslOK)
 	{
-	  status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-	  if (status != eslOK) p7_Fail("Work queue reader failed");
+	  p7_blockpool_Put(pool, block);
+	  break;
 	}
-    }
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
-
-  if (sstatus == eslEOF)
-    {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      if ((task = malloc(sizeof(BLOCK_TASK))) == NULL) p7_Fail("malloc failed");
+      task->info  = info;
+      task->block = block;
+      task->pool  = pool;
+      if (p7_scheduler_Submit(sched, grp, search_block, task) != eslOK) p7_Fail("Failed to submit search task");
     }
 
+  /* the tasks use the pipelines and hit lists; wait for them either way */
+  if (p7_taskgroup_Wait(grp) != eslOK) p7_Fail("Failed waiting for search tasks");
+  p7_taskgroup_Destroy(grp);
+
+  p7_blockreader_Destroy(br);
   return sstatus;
 }
 
+/* search_block()
+ * Task: search one block of targets with the current model, using
+ * the pipeline and hit list of worker <workeridx>.
+ */
 static void 
-pipeline_thread(void *arg)
+search_block(void *arg, int workeridx)
 {
-  int i;
-  int status;
-  int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-
-  ESL_SQ_BLOCK  *block = NULL;
-  void          *newBlock;
-
-  impl_Init();
-
-
-  obj = (ESL_THREADS *) arg;
-  esl_threads_Started(obj, &workeridx);
-
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
-
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
-  if (status != eslOK) p7_Fail("Work queue worker failed");
+  BLOCK_TASK   *task  = (BLOCK_TASK *) arg;
+  WORKER_INFO  *info  = &(task->info[workeridx]);
+  ESL_SQ_BLOCK *block = task->block;
+  int           i;
 
-  /* loop until all blocks have been processed */
-  block = (ESL_SQ_BLOCK *) newBlock;
-  while (block->count > 0)
+  for (i = 0; i < block->count; ++i)
     {
-      /* Main loop: */
-      for (i = 0; i < block->count; ++i)
-	{
-	  ESL_SQ *dbsq = block->list + i;
-
-	  p7_pli_NewSeq(info->pli, dbsq);
-	  p7_bg_SetLength(info->bg, dbsq->n);
-	  p7_oprofile_ReconfigLength(info->om, dbsq->n);
-
-	  p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
+      ESL_SQ *dbsq = block->list + i;
 
-	  esl_sq_Reuse(dbsq);
-	  p7_pipeline_Reuse(info->pli);
-	}
+      p7_pli_NewSeq(info->pli, dbsq);
+      p7_bg_SetLength(info->bg, dbsq->n);
+      p7_oprofile_ReconfigLength(info->om, dbsq->n);
 
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
-      if (status != eslOK) p7_Fail("Work queue worker failed");
+      p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
 
-      block = (ESL_SQ_BLOCK *) newBlock;
+      esl_sq_Reuse(dbsq);
+      p7_pipeline_Reuse(info->pli);
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
-  if (status != eslOK) p7_Fail("Work queue worker failed");
-
-  esl_threads_Finished(obj, workeridx);
-  return;
+  if (p7_blockpool_Put(task->pool, block) != eslOK) p7_Fail("Failed to return sequence block");
+  free(task);
 }
 #endif   /* HMMER_THREADS */
 
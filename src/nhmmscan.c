@@ -77,6 +77,7 @@ static ESL_OPTIONS options[] = {
 
   /* Other options */
   { "--qformat",    eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,             "assert input <seqfile> is in format <s>",                      12 },
+  { "--shmcache",   eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,             "read profiles from shared memory cache <s> (hmmpress --shm)",  12 },
   { "--nonull2",    eslARG_NONE,    NULL, NULL, NULL,    NULL,  NULL,  NULL,             "turn off biased composition score corrections",                12 },
   { "-Z",           eslARG_REAL,   FALSE, NULL, "x>0",   NULL,  NULL,  NULL,             "set # of comparisons done, for E-value calculation",           12 },
   { "--seed",       eslARG_INT,    "42",  NULL, "n>=0",  NULL,  NULL,  NULL,             "set RNG seed to <n> (if 0: one-time arbitrary seed)",          12 },
@@ -131,6 +132,7 @@ static char usage[]  = "[-options] <hmmdb> <seqfile>";
 static char banner[] = "search DNA sequence(s) against a DNA profile database";
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
+static int  open_hmmdb   (ESL_GETOPTS *go, struct cfg_s *cfg, P7_HMMFILE **ret_hfp, char *errbuf);
 static int  serial_loop  (WORKER_INFO *info, P7_HMMFILE *hfp);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1
@@ -254,6 +256,7 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *hmmfile, char *seqfile)
     else if (                                  fprintf(ofp, "# random number seed set to:       %d\n",        esl_opt_GetInteger(go, "--seed"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   }
   if (esl_opt_IsUsed(go, "--qformat")   && fprintf(ofp, "# input seqfile format asserted:   %s\n",            esl_opt_GetString(go, "--qformat"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--shmcache")  && fprintf(ofp, "# profiles read from shared cache: %s\n",            esl_opt_GetString(go, "--shmcache"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--w_beta")     && fprintf(ofp, "# window length beta value:        %g\n",             esl_opt_GetReal(go, "--w_beta"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--w_length")   && fprintf(ofp, "# window length :                  %d\n",             esl_opt_GetInteger(go, "--w_length")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
@@ -350,9 +353,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   }
 
   /* Open the target profile database to get the sequence alphabet */
-  status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, errbuf);
+  status = open_hmmdb(go, cfg, &hfp, errbuf);
   if      (status == eslENOTFOUND) p7_Fail("File existence/permissions problem in trying to open HMM file %s.\n%s\n", cfg->hmmfile, errbuf);
   else if (status == eslEFORMAT)   p7_Fail("File format problem, trying to open HMM file %s.\n%s\n",                  cfg->hmmfile, errbuf);
+  else if (status == eslEINCOMPAT) p7_Fail("%s\n",                                                                    errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",               status, cfg->hmmfile, errbuf);  
   if (! hfp->is_pressed)           p7_Fail("Failed to open binary auxfiles for %s: use hmmpress first\n",             hfp->fname);
 
@@ -441,8 +445,8 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       esl_stopwatch_Start(w);	                          
 
       /* Open the target profile database */
-      status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, NULL);
-      if (status != eslOK)        p7_Fail("Unexpected error %d in opening hmm file %s.\n",           status, cfg->hmmfile);  
+      status = open_hmmdb(go, cfg, &hfp, errbuf);
+      if (status != eslOK)        p7_Fail("Unexpected error %d in opening hmm file %s.\n%s\n",       status, cfg->hmmfile, errbuf);  
   
 #ifdef HMMER_THREADS
       /* if we are threaded, create a lock to prevent multiple readers */
@@ -610,6 +614,44 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 }
 
 
+/* open_hmmdb()
+ * Open the target profile database <cfg->hmmfile> for a pass of the
+ * search: from the shared memory cache named by --shmcache, which
+ * must have been loaded from a database of the same name, or else
+ * from the pressed files. With --bgfile, profile scores are rewritten
+ * as they're read, so the cache is mapped copy-on-write.
+ */
+static int
+open_hmmdb(ESL_GETOPTS *go, struct cfg_s *cfg, P7_HMMFILE **ret_hfp, char *errbuf)
+{
+  P7_HMMFILE *hfp     = NULL;
+  char       *dbtail  = NULL;
+  char       *shmtail = NULL;
+  int         status;
+
+  if (esl_opt_IsOn(go, "--shmcache"))
+    {
+      if ((status = p7_hmmfile_OpenShm(esl_opt_GetString(go, "--shmcache"), esl_opt_IsOn(go, "--bgfile"), &hfp, errbuf)) != eslOK) goto ERROR;
+      if ((status = esl_FileTail(cfg->hmmfile, FALSE, &dbtail))  != eslOK) goto ERROR;
+      if ((status = esl_FileTail(hfp->fname,   FALSE, &shmtail)) != eslOK) goto ERROR;
+      if (strcmp(dbtail, shmtail) != 0)
+	ESL_XFAIL(eslEINCOMPAT, errbuf, "shared memory cache %s holds %s, not %s", esl_opt_GetString(go, "--shmcache"), hfp->fname, cfg->hmmfile);
+      free(dbtail);
+      free(shmtail);
+    }
+  else if ((status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, errbuf)) != eslOK) goto ERROR;
+
+  *ret_hfp = hfp;
+  return eslOK;
+
+ ERROR:
+  if (dbtail)  free(dbtail);
+  if (shmtail) free(shmtail);
+  if (hfp)     p7_hmmfile_Close(hfp);
+  *ret_hfp = NULL;
+  return status;
+}
+
 static int
 serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
 {
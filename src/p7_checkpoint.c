@@ -0,0 +1,1007 @@
+/* Restart state for long searches: hmmsearch and hmmscan --checkpoint.
+ *
+ * A checkpoint is a small binary file, <dir>/<progname>.ckpt, written
+ * to <ckfile>.tmp and renamed into place, so a run killed in the
+ * middle of a save still has the previous one. It is only meant to be
+ * read back by the same build on the same machine: numbers are in
+ * native byte order.
+ *
+ * Contents:
+ *   1. P7_CHECKPOINT: saving and restoring the state of a search.
+ *   2. Reading and writing hit lists.
+ *   3. Unit tests.
+ *   4. Test driver.
+ */
+#include "p7_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#endif
+
+#include "easel.h"
+
+#include "hmmer.h"
+#include "p7_checkpoint.h"
+
+#define CK_MAGIC 0x70376b31	/* "p7k1": change it when the format changes */
+
+/* The P7_PIPELINE accounting fields that a checkpoint saves.
+ * The first four are merged by mode, as in p7_pipeline_Merge().
+ */
+static const size_t count_offset[p7_CHECKPOINT_NCOUNTS] = {
+  offsetof(P7_PIPELINE, nmodels),      offsetof(P7_PIPELINE, nseqs),         offsetof(P7_PIPELINE, nres),         offsetof(P7_PIPELINE, nnodes),
+  offsetof(P7_PIPELINE, n_past_msv),   offsetof(P7_PIPELINE, n_past_bias),   offsetof(P7_PIPELINE, n_past_vit),   offsetof(P7_PIPELINE, n_past_fwd),
+  offsetof(P7_PIPELINE, n_output),
+  offsetof(P7_PIPELINE, pos_past_msv), offsetof(P7_PIPELINE, pos_past_bias), offsetof(P7_PIPELINE, pos_past_vit), offsetof(P7_PIPELINE, pos_past_fwd),
+  offsetof(P7_PIPELINE, pos_output)
+};
+#define PLI_COUNT(pli, k)  (*(uint64_t *) ((char *) (pli) + count_offset[(k)]))
+
+static int ck_save     (P7_CHECKPOINT *ck, int64_t ntargets, off_t roff, const uint64_t *count, P7_TOPHITS **th, int n);
+static int ck_write    (FILE *fp, const void *p, size_t n);
+static int ck_read     (FILE *fp, void *p, size_t n);
+static int ck_write_str(FILE *fp, const char *s);
+static int ck_read_str (FILE *fp, char **ret_s);
+static int tophits_Write(FILE *fp, P7_TOPHITS **th, int n);
+static int tophits_Read (FILE *fp, P7_TOPHITS *th);
+
+
+/*****************************************************************
+ * 1. P7_CHECKPOINT: saving and restoring the state of a search.
+ *****************************************************************/
+
+/* Function:  p7_checkpoint_Create()
+ * Synopsis:  Create the checkpoint state of a new search.
+ *
+ * Purpose:   Create checkpoint state for program <progname>, searching
+ *            <qfile> against <tfile>, to be saved in directory <dir>
+ *            no more often than every <interval> seconds. <dir> is
+ *            created if it does not exist. Nothing is saved until
+ *            the first query finishes or the interval has passed.
+ *
+ *            To resume an interrupted search, follow with
+ *            <p7_checkpoint_Load()>.
+ *
+ * Returns:   ptr to the new <P7_CHECKPOINT>.
+ *
+ * Throws:    <NULL> on allocation failure, or if <dir> can't be
+ *            created.
+ */
+P7_CHECKPOINT *
+p7_checkpoint_Create(const char *dir, const char *progname, const char *qfile, const char *tfile, int interval)
+{
+  P7_CHECKPOINT *ck = NULL;
+  int            i;
+  int            status;
+
+  ESL_ALLOC(ck, sizeof(P7_CHECKPOINT));
+  ck->ckfile      = NULL;
+  ck->tmpfile     = NULL;
+  ck->qfile       = NULL;
+  ck->tfile       = NULL;
+  ck->interval    = interval;
+  ck->last        = time(NULL);
+  ck->is_resumed  = FALSE;
+  ck->nout        = 0;
+  ck->nsaved      = 0;
+  ck->nquery      = 0;
+  ck->has_partial = FALSE;
+  ck->ntargets    = 0;
+  ck->roff        = -1;
+  ck->th          = NULL;
+  for (i = 0; i < p7_CHECKPOINT_MAXOUT;  i++) { ck->out[i] = NULL; ck->outpath[i] = NULL; ck->outoff[i] = 0; }
+  for (i = 0; i < p7_CHECKPOINT_NCOUNTS; i++)   ck->count[i] = 0;
+#ifdef HMMER_THREADS
+  if (pthread_mutex_init(&ck->mutex, NULL) != 0) ESL_XEXCEPTION(eslESYS, "pthread_mutex_init() failed");
+#endif
+
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) ESL_XEXCEPTION_SYS(eslESYS, "failed to create checkpoint directory %s", dir);
+  if ((status = esl_sprintf(&ck->ckfile,  "%s/%s.ckpt", dir, progname)) != eslOK) goto ERROR;
+  if ((status = esl_sprintf(&ck->tmpfile, "%s.tmp",     ck->ckfile))    != eslOK) goto ERROR;
+  if ((status = esl_strdup(qfile, -1, &ck->qfile))                      != eslOK) goto ERROR;
+  if ((status = esl_strdup(tfile, -1, &ck->tfile))                      != eslOK) goto ERROR;
+  return ck;
+
+ ERROR:
+  p7_checkpoint_Destroy(ck);
+  return NULL;
+}
+
+
+/* Function:  p7_checkpoint_Load()
+ * Synopsis:  Load the saved state of an interrupted search.
+ *
+ * Purpose:   Read the state saved in <ck>'s checkpoint file, to resume
+ *            from it. The next <p7_checkpoint_OpenOutput()> calls then
+ *            reopen the outputs and cut them back to the size they
+ *            had at the checkpoint, and <p7_checkpoint_Restore()>
+ *            hands back the partial results of the query that was
+ *            in progress, if any.
+ *
+ *            Caller may provide an <errbuf> of at least
+ *            <eslERRBUFSIZE> bytes for an error message.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if there is no checkpoint file: nothing
+ *            was saved, and the search starts from the beginning.
+ *
+ *            <eslEFORMAT> if the file is corrupt or not a checkpoint;
+ *            <eslEINCOMPAT> if it is for a search of different files.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_checkpoint_Load(P7_CHECKPOINT *ck, char *errbuf)
+{
+  FILE    *fp    = NULL;
+  char    *qfile = NULL;
+  char    *tfile = NULL;
+  uint32_t magic;
+  int32_t  nquery;
+  int32_t  nout;
+  int32_t  partial;
+  int64_t  val;
+  int      i;
+  int      status;
+
+  if (errbuf) errbuf[0] = '\0';
+  if ((fp = fopen(ck->ckfile, "rb")) == NULL) ESL_XFAIL(eslENOTFOUND, errbuf, "no checkpoint %s", ck->ckfile);
+
+  if (ck_read(fp, &magic, sizeof(uint32_t)) != eslOK || magic != CK_MAGIC) ESL_XFAIL(eslEFORMAT, errbuf, "%s is not a HMMER checkpoint file", ck->ckfile);
+  if (ck_read_str(fp, &qfile) != eslOK || ck_read_str(fp, &tfile) != eslOK || ! qfile || ! tfile) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+  if (strcmp(qfile, ck->qfile) != 0 || strcmp(tfile, ck->tfile) != 0)
+    ESL_XFAIL(eslEINCOMPAT, errbuf, "checkpoint %s is for a search of %s against %s", ck->ckfile, qfile, tfile);
+
+  if (ck_read(fp, &nquery, sizeof(int32_t)) != eslOK || nquery < 0)                           ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+  if (ck_read(fp, &nout,   sizeof(int32_t)) != eslOK || nout < 0 || nout > p7_CHECKPOINT_MAXOUT) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+  for (i = 0; i < nout; i++)
+    {
+      if (ck_read_str(fp, &ck->outpath[i])          != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+      if (ck_read(fp, &val, sizeof(int64_t))        != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+      ck->outoff[i] = (off_t) val;
+    }
+  ck->nquery = nquery;
+  ck->nsaved = nout;
+
+  if (ck_read(fp, &partial, sizeof(int32_t)) != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+  if (partial)
+    {
+      if (ck_read(fp, &ck->ntargets, sizeof(int64_t))                      != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+      if (ck_read(fp, &val,          sizeof(int64_t))                      != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+      if (ck_read(fp, ck->count,     sizeof(uint64_t) * p7_CHECKPOINT_NCOUNTS) != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+      ck->roff = (off_t) val;
+
+      if ((ck->th = p7_tophits_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+      if ((status = tophits_Read(fp, ck->th)) != eslOK)
+	{
+	  if (status == eslEFORMAT) ESL_XFAIL(eslEFORMAT, errbuf, "checkpoint %s is corrupt", ck->ckfile);
+	  goto ERROR;
+	}
+      ck->has_partial = TRUE;
+    }
+
+  ck->is_resumed = TRUE;
+  free(qfile);
+  free(tfile);
+  fclose(fp);
+  return eslOK;
+
+ ERROR:
+  for (i = 0; i < p7_CHECKPOINT_MAXOUT; i++)
+    if (ck->outpath[i]) { free(ck->outpath[i]); ck->outpath[i] = NULL; }
+  if (ck->th) { p7_tophits_Destroy(ck->th); ck->th = NULL; }
+  ck->nquery = ck->nsaved = 0;
+  if (qfile) free(qfile);
+  if (tfile) free(tfile);
+  if (fp)    fclose(fp);
+  return status;
+}
+
+
+/* Function:  p7_checkpoint_OpenOutput()
+ * Synopsis:  Open an output file whose size the checkpoint tracks.
+ *
+ * Purpose:   Open output file <path> for writing, and return it in
+ *            <*ret_fp>. The checkpoint records its size at the end of
+ *            each query. When resuming, the file is instead reopened
+ *            and cut back to the size it had at the checkpoint, so
+ *            output from queries that didn't finish is discarded and
+ *            written again. Outputs must be opened in the same order
+ *            as in the interrupted run.
+ *
+ *            If <ck> is <NULL>, just open <path> for writing.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if <path> can't be opened.
+ *
+ *            <eslEINCOMPAT> when resuming, if <path> wasn't an output
+ *            of the interrupted run, or is shorter than it was then.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslEINVAL> if too many
+ *            outputs are opened; <eslESYS> if the file can't be cut
+ *            back.
+ */
+int
+p7_checkpoint_OpenOutput(P7_CHECKPOINT *ck, const char *path, FILE **ret_fp)
+{
+  FILE *fp = NULL;
+  off_t off;
+  int   status;
+
+  if (ck && ck->nout >= p7_CHECKPOINT_MAXOUT) ESL_XEXCEPTION(eslEINVAL, "too many checkpointed output files");
+
+  if (ck == NULL || ! ck->is_resumed)
+    {
+      if ((fp = fopen(path, "w")) == NULL) { status = eslENOTFOUND; goto ERROR; }
+      if (ck && (status = esl_strdup(path, -1, &ck->outpath[ck->nout])) != eslOK) goto ERROR;
+    }
+  else
+    {
+      if (ck->nout >= ck->nsaved || strcmp(path, ck->outpath[ck->nout]) != 0) { status = eslEINCOMPAT; goto ERROR; }
+      if ((fp = fopen(path, "r+")) == NULL)                                     { status = eslENOTFOUND; goto ERROR; }
+
+      off = ck->outoff[ck->nout];
+      if (fseeko(fp, 0, SEEK_END) != 0 || ftello(fp) < off) { status = eslEINCOMPAT; goto ERROR; }
+      if (ftruncate(fileno(fp), off) != 0)  ESL_XEXCEPTION_SYS(eslESYS, "failed to truncate %s", path);
+      if (fseeko(fp, off, SEEK_SET)  != 0)  ESL_XEXCEPTION_SYS(eslESYS, "failed to seek in %s",  path);
+    }
+
+  if (ck) ck->out[ck->nout++] = fp;
+  *ret_fp = fp;
+  return eslOK;
+
+ ERROR:
+  if (fp) fclose(fp);
+  *ret_fp = NULL;
+  return status;
+}
+
+
+/* Function:  p7_checkpoint_IsDue()
+ * Synopsis:  Is it time to save a partial query?
+ *
+ * Purpose:   Return <TRUE> if the caller, searching query number
+ *            <qidx> (1..nquery), should save its partial results now
+ *            with <p7_checkpoint_SavePartial()>: the save interval
+ *            has passed, and the output of every earlier query is
+ *            complete. Otherwise return <FALSE>.
+ *
+ *            A partial save needs the search of <qidx> stopped at a
+ *            point where every target before some position is done,
+ *            which costs the caller a pause; this call is cheap, so
+ *            callers can ask often.
+ */
+int
+p7_checkpoint_IsDue(P7_CHECKPOINT *ck, int qidx)
+{
+  int due;
+
+#ifdef HMMER_THREADS
+  pthread_mutex_lock(&ck->mutex);
+#endif
+  due = (ck->nquery == qidx - 1 && difftime(time(NULL), ck->last) >= ck->interval);
+#ifdef HMMER_THREADS
+  pthread_mutex_unlock(&ck->mutex);
+#endif
+  return due;
+}
+
+
+/* Function:  p7_checkpoint_QueryDone()
+ * Synopsis:  Record that a query's output is complete.
+ *
+ * Purpose:   Record that all output of query <qidx> has been written:
+ *            flush the outputs and note their sizes. Queries must
+ *            finish in order. The state is saved if the save interval
+ *            has passed.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEWRITE> if an output or the checkpoint can't be
+ *            written.
+ */
+int
+p7_checkpoint_QueryDone(P7_CHECKPOINT *ck, int qidx)
+{
+  int i;
+  int status = eslOK;
+
+#ifdef HMMER_THREADS
+  pthread_mutex_lock(&ck->mutex);
+#endif
+  for (i = 0; i < ck->nout; i++)
+    {
+      if (fflush(ck->out[i]) != 0) ESL_XEXCEPTION_SYS(eslEWRITE, "failed to flush %s", ck->outpath[i]);
+      ck->outoff[i] = ftello(ck->out[i]);
+    }
+  ck->nquery = qidx;
+
+  if (difftime(time(NULL), ck->last) >= ck->interval)
+    status = ck_save(ck, 0, -1, NULL, NULL, 0);
+
+ ERROR:
+#ifdef HMMER_THREADS
+  pthread_mutex_unlock(&ck->mutex);
+#endif
+  return status;
+}
+
+
+/* Function:  p7_checkpoint_SavePartial()
+ * Synopsis:  Save how far the search of a query has got.
+ *
+ * Purpose:   Save the state of a search of query <qidx> in which the
+ *            first <ntargets> targets are done and nothing after
+ *            them has been searched yet. <roff> is the disk offset
+ *            of the next target, or -1 if it is unknown. The results
+ *            so far are in the <n> hit lists <th[]> and pipelines
+ *            <pli[]>, one per worker; <NULL> entries are skipped.
+ *            They are not changed.
+ *
+ *            Does nothing if the output of query <qidx>-1 isn't
+ *            complete yet.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEWRITE> if the checkpoint can't be written.
+ */
+int
+p7_checkpoint_SavePartial(P7_CHECKPOINT *ck, int qidx, int64_t ntargets, off_t roff, P7_TOPHITS **th, P7_PIPELINE **pli, int n)
+{
+  uint64_t count[p7_CHECKPOINT_NCOUNTS];
+  int      i, k;
+  int      status = eslOK;
+
+  for (k = 0; k < p7_CHECKPOINT_NCOUNTS; k++)
+    {
+      count[k] = 0;
+      for (i = 0; i < n; i++)
+	if (pli[i]) count[k] += PLI_COUNT(pli[i], k);
+    }
+
+#ifdef HMMER_THREADS
+  pthread_mutex_lock(&ck->mutex);
+#endif
+  if (ck->nquery == qidx - 1)
+    status = ck_save(ck, ntargets, roff, count, th, n);
+#ifdef HMMER_THREADS
+  pthread_mutex_unlock(&ck->mutex);
+#endif
+  return status;
+}
+
+
+/* Function:  p7_checkpoint_Restore()
+ * Synopsis:  Get back the partial results of a resumed query.
+ *
+ * Purpose:   If the loaded state has partial results for query <qidx>,
+ *            merge its saved hits into <th>, add its pipeline counts
+ *            to <pli>, and return the number of targets already
+ *            searched in <*ret_ntargets> and the disk offset of the
+ *            next one (or -1) in <*ret_roff>. The search continues
+ *            from there. Partial results are only handed back once.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEOF> if there are no partial results for <qidx>;
+ *            <*ret_ntargets> is 0 and <*ret_roff> is -1.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_checkpoint_Restore(P7_CHECKPOINT *ck, int qidx, P7_TOPHITS *th, P7_PIPELINE *pli, int64_t *ret_ntargets, off_t *ret_roff)
+{
+  int k;
+  int status;
+
+  *ret_ntargets = 0;
+  *ret_roff     = -1;
+#ifdef HMMER_THREADS
+  pthread_mutex_lock(&ck->mutex);
+#endif
+  if (! ck->has_partial || ck->nquery != qidx - 1) { status = eslEOF; goto ERROR; }
+
+  if ((status = p7_tophits_Merge(th, ck->th)) != eslOK) goto ERROR;
+  p7_tophits_Destroy(ck->th);
+  ck->th = NULL;
+
+  if (pli->mode == p7_SEARCH_SEQS) { pli->nseqs   += ck->count[1]; pli->nres   += ck->count[2]; }
+  else                             { pli->nmodels += ck->count[0]; pli->nnodes += ck->count[3]; }
+  for (k = 4; k < p7_CHECKPOINT_NCOUNTS; k++)
+    PLI_COUNT(pli, k) += ck->count[k];
+  if (pli->Z_setby == p7_ZSETBY_NTARGETS)
+    pli->Z = (pli->mode == p7_SCAN_MODELS) ? pli->nmodels : pli->nseqs;
+
+  *ret_ntargets   = ck->ntargets;
+  *ret_roff       = ck->roff;
+  ck->has_partial = FALSE;
+  status          = eslOK;
+
+ ERROR:
+#ifdef HMMER_THREADS
+  pthread_mutex_unlock(&ck->mutex);
+#endif
+  return status;
+}
+
+
+/* Function:  p7_checkpoint_Finish()
+ * Synopsis:  Remove the checkpoint of a finished search.
+ *
+ * Purpose:   The search is complete: remove its checkpoint file, so a
+ *            later --resume doesn't cut back its finished output.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_checkpoint_Finish(P7_CHECKPOINT *ck)
+{
+  remove(ck->ckfile);
+  remove(ck->tmpfile);
+  return eslOK;
+}
+
+
+/* Function:  p7_checkpoint_Destroy()
+ * Synopsis:  Free a <P7_CHECKPOINT>.
+ *
+ * Purpose:   Free <ck>. The output files are not closed; they belong
+ *            to the caller.
+ */
+void
+p7_checkpoint_Destroy(P7_CHECKPOINT *ck)
+{
+  int i;
+
+  if (! ck) return;
+  for (i = 0; i < p7_CHECKPOINT_MAXOUT; i++)
+    if (ck->outpath[i]) free(ck->outpath[i]);
+  if (ck->ckfile)  free(ck->ckfile);
+  if (ck->tmpfile) free(ck->tmpfile);
+  if (ck->qfile)   free(ck->qfile);
+  if (ck->tfile)   free(ck->tfile);
+  p7_tophits_Destroy(ck->th);
+#ifdef HMMER_THREADS
+  pthread_mutex_destroy(&ck->mutex);
+#endif
+  free(ck);
+}
+
+
+/* ck_save()
+ * Write the state to the temporary file, and rename it over the
+ * checkpoint. If <th> is non-NULL, the state includes a partial query
+ * (see p7_checkpoint_SavePartial()). The outputs are synced first, so
+ * the saved sizes never point past what is on disk. Caller holds the
+ * mutex.
+ */
+static int
+ck_save(P7_CHECKPOINT *ck, int64_t ntargets, off_t roff, const uint64_t *count, P7_TOPHITS **th, int n)
+{
+  FILE    *fp      = NULL;
+  uint32_t magic   = CK_MAGIC;
+  int32_t  nquery  = ck->nquery;
+  int32_t  nout    = ck->nout;
+  int32_t  partial = (th != NULL);
+  int64_t  val;
+  int      i;
+  int      status;
+
+  for (i = 0; i < ck->nout; i++)
+    if (fflush(ck->out[i]) != 0 || fsync(fileno(ck->out[i])) != 0) ESL_XEXCEPTION_SYS(eslEWRITE, "failed to sync %s", ck->outpath[i]);
+
+  if ((fp = fopen(ck->tmpfile, "wb")) == NULL) ESL_XEXCEPTION_SYS(eslEWRITE, "failed to open checkpoint file %s", ck->tmpfile);
+  if ((status = ck_write    (fp, &magic, sizeof(uint32_t))) != eslOK) goto ERROR;
+  if ((status = ck_write_str(fp, ck->qfile))                != eslOK) goto ERROR;
+  if ((status = ck_write_str(fp, ck->tfile))                != eslOK) goto ERROR;
+  if ((status = ck_write    (fp, &nquery, sizeof(int32_t))) != eslOK) goto ERROR;
+  if ((status = ck_write    (fp, &nout,   sizeof(int32_t))) != eslOK) goto ERROR;
+  for (i = 0; i < ck->nout; i++)
+    {
+      val = ck->outoff[i];
+      if ((status = ck_write_str(fp, ck->outpath[i]))     != eslOK) goto ERROR;
+      if ((status = ck_write    (fp, &val, sizeof(int64_t))) != eslOK) goto ERROR;
+    }
+
+  if ((status = ck_write(fp, &partial, sizeof(int32_t))) != eslOK) goto ERROR;
+  if (partial)
+    {
+      val = roff;
+      if ((status = ck_write(fp, &ntargets, sizeof(int64_t)))                      != eslOK) goto ERROR;
+      if ((status = ck_write(fp, &val,      sizeof(int64_t)))                      != eslOK) goto ERROR;
+      if ((status = ck_write(fp, count,     sizeof(uint64_t) * p7_CHECKPOINT_NCOUNTS)) != eslOK) goto ERROR;
+      if ((status = tophits_Write(fp, th, n))                                      != eslOK) goto ERROR;
+    }
+
+  if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) ESL_XEXCEPTION_SYS(eslEWRITE, "failed to sync checkpoint file %s", ck->tmpfile);
+  fclose(fp);
+  fp = NULL;
+  if (rename(ck->tmpfile, ck->ckfile) != 0) ESL_XEXCEPTION_SYS(eslEWRITE, "failed to rename checkpoint file to %s", ck->ckfile);
+
+  ck->last = time(NULL);
+  return eslOK;
+
+ ERROR:
+  if (fp) fclose(fp);
+  return status;
+}
+
+static int
+ck_write(FILE *fp, const void *p, size_t n)
+{
+  if (fwrite(p, n, 1, fp) != 1) ESL_EXCEPTION_SYS(eslEWRITE, "checkpoint write failed");
+  return eslOK;
+}
+
+static int
+ck_read(FILE *fp, void *p, size_t n)
+{
+  return (fread(p, n, 1, fp) == 1) ? eslOK : eslEFORMAT;
+}
+
+/* strings are written as an int32_t length, then the chars without
+ * the trailing NUL; NULL is written as length -1.
+ */
+static int
+ck_write_str(FILE *fp, const char *s)
+{
+  int32_t n = (s ? strlen(s) : -1);
+  int     status;
+
+  if ((status = ck_write(fp, &n, sizeof(int32_t))) != eslOK) return status;
+  if (n > 0 && (status = ck_write(fp, s, n))     != eslOK) return status;
+  return eslOK;
+}
+
+static int
+ck_read_str(FILE *fp, char **ret_s)
+{
+  char   *s = NULL;
+  int32_t n;
+  int     status;
+
+  if ((status = ck_read(fp, &n, sizeof(int32_t))) != eslOK) goto ERROR;
+  if (n >= 0)
+    {
+      ESL_ALLOC(s, sizeof(char) * (n+1));
+      if (n > 0 && (status = ck_read(fp, s, n)) != eslOK) goto ERROR;
+      s[n] = '\0';
+    }
+  *ret_s = s;
+  return eslOK;
+
+ ERROR:
+  if (s) free(s);
+  *ret_s = NULL;
+  return status;
+}
+/*------------------ end, P7_CHECKPOINT -------------------------*/
+
+
+
+/*****************************************************************
+ * 2. Reading and writing hit lists.
+ *****************************************************************/
+
+/* Write or read one field of a struct; on failure, go to ERROR with
+ * <status> set. The fields are listed one by one, rather than
+ * written as whole structs, because the structs hold pointers.
+ */
+#define CK_WFIELD(fp, x)  do { if ((status = ck_write((fp), &(x), sizeof(x))) != eslOK) goto ERROR; } while (0)
+#define CK_RFIELD(fp, x)  do { if ((status = ck_read ((fp), &(x), sizeof(x))) != eslOK) goto ERROR; } while (0)
+#define CK_WSTR(fp, s)    do { if ((status = ck_write_str((fp), (s)))        != eslOK) goto ERROR; } while (0)
+#define CK_RSTR(fp, s)    do { if ((status = ck_read_str ((fp), &(s)))       != eslOK) goto ERROR; } while (0)
+
+/* tophits_Write()
+ * Write the hits of the <n> lists <th[0..n-1]> (skipping NULLs) as
+ * one list. Domain alignment displays are written whole; the
+ * per-position scores that only nhmmer keeps are not.
+ */
+static int
+tophits_Write(FILE *fp, P7_TOPHITS **th, int n)
+{
+  uint64_t       nhits = 0;
+  P7_HIT        *hit;
+  P7_DOMAIN     *dom;
+  P7_ALIDISPLAY *ad;
+  int32_t        has_ad;
+  uint64_t       h;
+  int            i, d;
+  int            status;
+
+  for (i = 0; i < n; i++)
+    if (th[i]) nhits += th[i]->N;
+  CK_WFIELD(fp, nhits);
+
+  for (i = 0; i < n; i++)
+    for (h = 0; th[i] && h < th[i]->N; h++)
+      {
+	hit = th[i]->unsrt + h;
+	CK_WSTR  (fp, hit->name);
+	CK_WSTR  (fp, hit->acc);
+	CK_WSTR  (fp, hit->desc);
+	CK_WFIELD(fp, hit->window_length);
+	CK_WFIELD(fp, hit->sortkey);
+	CK_WFIELD(fp, hit->score);
+	CK_WFIELD(fp, hit->pre_score);
+	CK_WFIELD(fp, hit->sum_score);
+	CK_WFIELD(fp, hit->lnP);
+	CK_WFIELD(fp, hit->pre_lnP);
+	CK_WFIELD(fp, hit->sum_lnP);
+	CK_WFIELD(fp, hit->nexpected);
+	CK_WFIELD(fp, hit->nregions);
+	CK_WFIELD(fp, hit->nclustered);
+	CK_WFIELD(fp, hit->noverlaps);
+	CK_WFIELD(fp, hit->nenvelopes);
+	CK_WFIELD(fp, hit->flags);
+	CK_WFIELD(fp, hit->nreported);
+	CK_WFIELD(fp, hit->nincluded);
+	CK_WFIELD(fp, hit->best_domain);
+	CK_WFIELD(fp, hit->seqidx);
+	CK_WFIELD(fp, hit->subseq_start);
+	CK_WFIELD(fp, hit->ndom);
+
+	for (d = 0; d < hit->ndom; d++)
+	  {
+	    dom = hit->dcl + d;
+	    CK_WFIELD(fp, dom->ienv);
+	    CK_WFIELD(fp, dom->jenv);
+	    CK_WFIELD(fp, dom->iali);
+	    CK_WFIELD(fp, dom->jali);
+	    CK_WFIELD(fp, dom->iorf);
+	    CK_WFIELD(fp, dom->jorf);
+	    CK_WFIELD(fp, dom->envsc);
+	    CK_WFIELD(fp, dom->domcorrection);
+	    CK_WFIELD(fp, dom->dombias);
+	    CK_WFIELD(fp, dom->oasc);
+	    CK_WFIELD(fp, dom->bitscore);
+	    CK_WFIELD(fp, dom->lnP);
+	    CK_WFIELD(fp, dom->is_reported);
+	    CK_WFIELD(fp, dom->is_included);
+
+	    ad     = dom->ad;
+	    has_ad = (ad != NULL);
+	    CK_WFIELD(fp, has_ad);
+	    if (! has_ad) continue;
+	    CK_WSTR  (fp, ad->rfline);
+	    CK_WSTR  (fp, ad->mmline);
+	    CK_WSTR  (fp, ad->csline);
+	    CK_WSTR  (fp, ad->model);
+	    CK_WSTR  (fp, ad->mline);
+	    CK_WSTR  (fp, ad->aseq);
+	    CK_WSTR  (fp, ad->ntseq);
+	    CK_WSTR  (fp, ad->ppline);
+	    CK_WFIELD(fp, ad->N);
+	    CK_WSTR  (fp, ad->hmmname);
+	    CK_WSTR  (fp, ad->hmmacc);
+	    CK_WSTR  (fp, ad->hmmdesc);
+	    CK_WFIELD(fp, ad->hmmfrom);
+	    CK_WFIELD(fp, ad->hmmto);
+	    CK_WFIELD(fp, ad->M);
+	    CK_WSTR  (fp, ad->sqname);
+	    CK_WSTR  (fp, ad->sqacc);
+	    CK_WSTR  (fp, ad->sqdesc);
+	    CK_WFIELD(fp, ad->sqfrom);
+	    CK_WFIELD(fp, ad->sqto);
+	    CK_WFIELD(fp, ad->L);
+	  }
+      }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* tophits_Read()
+ * Read hits written by tophits_Write(), and add them to <th>. Alignment
+ * displays come back in deserialized form. Returns <eslEFORMAT> if
+ * the file ends early; throws <eslEMEM>.
+ */
+static int
+tophits_Read(FILE *fp, P7_TOPHITS *th)
+{
+  uint64_t       nhits;
+  P7_HIT        *hit;
+  P7_DOMAIN     *dom;
+  P7_ALIDISPLAY *ad;
+  int32_t        has_ad;
+  int            ndom;
+  uint64_t       h;
+  int            d;
+  int            status;
+
+  CK_RFIELD(fp, nhits);
+  for (h = 0; h < nhits; h++)
+    {
+      if ((status = p7_tophits_CreateNextHit(th, &hit)) != eslOK) goto ERROR;
+      CK_RSTR  (fp, hit->name);
+      CK_RSTR  (fp, hit->acc);
+      CK_RSTR  (fp, hit->desc);
+      CK_RFIELD(fp, hit->window_length);
+      CK_RFIELD(fp, hit->sortkey);
+      CK_RFIELD(fp, hit->score);
+      CK_RFIELD(fp, hit->pre_score);
+      CK_RFIELD(fp, hit->sum_score);
+      CK_RFIELD(fp, hit->lnP);
+      CK_RFIELD(fp, hit->pre_lnP);
+      CK_RFIELD(fp, hit->sum_lnP);
+      CK_RFIELD(fp, hit->nexpected);
+      CK_RFIELD(fp, hit->nregions);
+      CK_RFIELD(fp, hit->nclustered);
+      CK_RFIELD(fp, hit->noverlaps);
+      CK_RFIELD(fp, hit->nenvelopes);
+      CK_RFIELD(fp, hit->flags);
+      CK_RFIELD(fp, hit->nreported);
+      CK_RFIELD(fp, hit->nincluded);
+      CK_RFIELD(fp, hit->best_domain);
+      CK_RFIELD(fp, hit->seqidx);
+      CK_RFIELD(fp, hit->subseq_start);
+      CK_RFIELD(fp, ndom);
+      if (ndom < 0) { status = eslEFORMAT; goto ERROR; }
+
+      /* <hit> owns <dcl> as soon as it exists, so on error the hit list frees it */
+      if (ndom > 0)
+	{
+	  ESL_ALLOC(hit->dcl, sizeof(P7_DOMAIN) * ndom);
+	  for (d = 0; d < ndom; d++) { hit->dcl[d].ad = NULL; hit->dcl[d].scores_per_pos = NULL; }
+	}
+      hit->ndom = ndom;
+
+      for (d = 0; d < ndom; d++)
+	{
+	  dom = hit->dcl + d;
+	  CK_RFIELD(fp, dom->ienv);
+	  CK_RFIELD(fp, dom->jenv);
+	  CK_RFIELD(fp, dom->iali);
+	  CK_RFIELD(fp, dom->jali);
+	  CK_RFIELD(fp, dom->iorf);
+	  CK_RFIELD(fp, dom->jorf);
+	  CK_RFIELD(fp, dom->envsc);
+	  CK_RFIELD(fp, dom->domcorrection);
+	  CK_RFIELD(fp, dom->dombias);
+	  CK_RFIELD(fp, dom->oasc);
+	  CK_RFIELD(fp, dom->bitscore);
+	  CK_RFIELD(fp, dom->lnP);
+	  CK_RFIELD(fp, dom->is_reported);
+	  CK_RFIELD(fp, dom->is_included);
+
+	  CK_RFIELD(fp, has_ad);
+	  if (! has_ad) continue;
+	  ESL_ALLOC(ad, sizeof(P7_ALIDISPLAY));
+	  memset(ad, 0, sizeof(P7_ALIDISPLAY));	/* all strings NULL; mem NULL, so deserialized */
+	  dom->ad = ad;
+	  CK_RSTR  (fp, ad->rfline);
+	  CK_RSTR  (fp, ad->mmline);
+	  CK_RSTR  (fp, ad->csline);
+	  CK_RSTR  (fp, ad->model);
+	  CK_RSTR  (fp, ad->mline);
+	  CK_RSTR  (fp, ad->aseq);
+	  CK_RSTR  (fp, ad->ntseq);
+	  CK_RSTR  (fp, ad->ppline);
+	  CK_RFIELD(fp, ad->N);
+	  CK_RSTR  (fp, ad->hmmname);
+	  CK_RSTR  (fp, ad->hmmacc);
+	  CK_RSTR  (fp, ad->hmmdesc);
+	  CK_RFIELD(fp, ad->hmmfrom);
+	  CK_RFIELD(fp, ad->hmmto);
+	  CK_RFIELD(fp, ad->M);
+	  CK_RSTR  (fp, ad->sqname);
+	  CK_RSTR  (fp, ad->sqacc);
+	  CK_RSTR  (fp, ad->sqdesc);
+	  CK_RFIELD(fp, ad->sqfrom);
+	  CK_RFIELD(fp, ad->sqto);
+	  CK_RFIELD(fp, ad->L);
+	}
+    }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+/*------------------ end, hit list i/o --------------------------*/
+
+
+
+/*****************************************************************
+ * 3. Unit tests.
+ *****************************************************************/
+#ifdef p7CHECKPOINT_TESTDRIVE
+
+#include "esl_random.h"
+
+/* utest_sample_hits()
+ * Sample a list of <nhits> hits with up to 3 domains each, with
+ * random alignment displays.
+ */
+static P7_TOPHITS *
+utest_sample_hits(ESL_RANDOMNESS *rng, int nhits)
+{
+  char        msg[] = "p7_checkpoint hit sampling failed";
+  P7_TOPHITS *th    = p7_tophits_Create();
+  P7_HIT     *hit;
+  int         h, d;
+
+  for (h = 0; h < nhits; h++)
+    {
+      if (p7_tophits_CreateNextHit(th, &hit) != eslOK) esl_fatal(msg);
+      if (esl_sprintf(&hit->name, "seq%d", h) != eslOK) esl_fatal(msg);
+      if (h % 2 && esl_sprintf(&hit->desc, "description of seq%d", h) != eslOK) esl_fatal(msg);
+      hit->score   = esl_random(rng) * 100.;
+      hit->lnP     = -hit->score;
+      hit->sortkey = hit->score;
+      hit->seqidx  = h;
+      hit->ndom    = 1 + esl_rnd_Roll(rng, 3);
+      if ((hit->dcl = malloc(sizeof(P7_DOMAIN) * hit->ndom)) == NULL) esl_fatal(msg);
+      for (d = 0; d < hit->ndom; d++)
+	{
+	  memset(&hit->dcl[d], 0, sizeof(P7_DOMAIN));
+	  hit->dcl[d].iali     = 1 + esl_rnd_Roll(rng, 100);
+	  hit->dcl[d].jali     = hit->dcl[d].iali + esl_rnd_Roll(rng, 100);
+	  hit->dcl[d].bitscore = esl_random(rng) * 50.;
+	  hit->dcl[d].lnP      = -hit->dcl[d].bitscore;
+	  if (p7_alidisplay_Sample(rng, 1 + esl_rnd_Roll(rng, 60), &hit->dcl[d].ad) != eslOK) esl_fatal(msg);
+	}
+    }
+  return th;
+}
+
+/* utest_roundtrip()
+ * Save a partial query with hits split over two "workers", load it
+ * back, restore it, and check that everything comes back: the
+ * position, the pipeline counts, the hits, and the output files
+ * cut back to their size at the last finished query.
+ */
+static void
+utest_roundtrip(ESL_RANDOMNESS *rng, char *dir)
+{
+  char           msg[]  = "p7_checkpoint roundtrip unit test failed";
+  char           errbuf[eslERRBUFSIZE];
+  char          *outfile = NULL;
+  P7_CHECKPOINT *ck      = NULL;
+  P7_TOPHITS    *th[2];
+  P7_PIPELINE   *pli[2];
+  P7_TOPHITS    *all     = p7_tophits_Create();
+  P7_TOPHITS    *rth     = p7_tophits_Create();
+  P7_PIPELINE   *rpli    = p7_pipeline_Create(NULL, 100, 100, FALSE, p7_SEARCH_SEQS);
+  FILE          *ofp     = NULL;
+  int64_t        ntargets;
+  off_t          roff;
+  uint64_t       h;
+  int            d, i;
+
+  if (esl_sprintf(&outfile, "%s/out", dir) != eslOK) esl_fatal(msg);
+
+  /* A search: query 1 finishes, then query 2 saves partial results */
+  if ((ck = p7_checkpoint_Create(dir, "utest", "queries", "targets", 0)) == NULL) esl_fatal(msg);
+  if (p7_checkpoint_OpenOutput(ck, outfile, &ofp)                        != eslOK) esl_fatal(msg);
+  fprintf(ofp, "query 1 output\n");
+  if (p7_checkpoint_QueryDone(ck, 1)                                     != eslOK) esl_fatal(msg);
+  fprintf(ofp, "output of query 2 that never finished\n");
+  if (p7_checkpoint_IsDue(ck, 3)) esl_fatal(msg);   /* query 2 isn't done: no partial save of 3 */
+  if (! p7_checkpoint_IsDue(ck, 2)) esl_fatal(msg);
+
+  for (i = 0; i < 2; i++)
+    {
+      th[i]  = utest_sample_hits(rng, 5 + i * 7);
+      pli[i] = p7_pipeline_Create(NULL, 100, 100, FALSE, p7_SEARCH_SEQS);
+      pli[i]->nseqs      = 100 + i;
+      pli[i]->nres       = 10000 + i;
+      pli[i]->n_past_msv = 10 + i;
+      pli[i]->n_past_fwd = 1;
+    }
+  if (p7_checkpoint_SavePartial(ck, 2, 201, 12345, th, pli, 2) != eslOK) esl_fatal(msg);
+  fclose(ofp);
+  p7_checkpoint_Destroy(ck);
+
+  /* Resume it */
+  if ((ck = p7_checkpoint_Create(dir, "utest", "queries", "targets", 0)) == NULL) esl_fatal(msg);
+  if (p7_checkpoint_Load(ck, errbuf)                     != eslOK) esl_fatal("%s: %s", msg, errbuf);
+  if (ck->nquery != 1 || ! ck->has_partial)                        esl_fatal(msg);
+  if (p7_checkpoint_OpenOutput(ck, outfile, &ofp)        != eslOK) esl_fatal(msg);
+  if (ftello(ofp) != strlen("query 1 output\n"))                   esl_fatal(msg);
+  if (p7_checkpoint_Restore(ck, 3, rth, rpli, &ntargets, &roff) != eslEOF) esl_fatal(msg);
+  if (p7_checkpoint_Restore(ck, 2, rth, rpli, &ntargets, &roff) != eslOK)  esl_fatal(msg);
+  if (ntargets != 201 || roff != 12345)                            esl_fatal(msg);
+  if (rpli->nseqs != 201 || rpli->nres != 20001 || rpli->n_past_msv != 21 || rpli->n_past_fwd != 2) esl_fatal(msg);
+  if (rpli->nmodels != 0)                                          esl_fatal(msg);
+
+  /* The hits come back intact; compare against a merge of the originals */
+  p7_tophits_Merge(all, th[0]);
+  p7_tophits_Merge(all, th[1]);
+  p7_tophits_SortBySortkey(rth);
+  if (rth->N != all->N) esl_fatal(msg);
+  for (h = 0; h < all->N; h++)
+    {
+      if (strcmp(rth->hit[h]->name, all->hit[h]->name) != 0) esl_fatal(msg);
+      if (esl_strcmp(rth->hit[h]->desc, all->hit[h]->desc) != 0) esl_fatal(msg);
+      if (rth->hit[h]->score != all->hit[h]->score || rth->hit[h]->ndom != all->hit[h]->ndom) esl_fatal(msg);
+      for (d = 0; d < all->hit[h]->ndom; d++)
+	{
+	  if (rth->hit[h]->dcl[d].iali != all->hit[h]->dcl[d].iali) esl_fatal(msg);
+	  if (p7_alidisplay_Compare(rth->hit[h]->dcl[d].ad, all->hit[h]->dcl[d].ad) != eslOK) esl_fatal(msg);
+	}
+    }
+
+  /* A finished search leaves no checkpoint behind */
+  fclose(ofp);
+  p7_checkpoint_Finish(ck);
+  p7_checkpoint_Destroy(ck);
+  if ((ck = p7_checkpoint_Create(dir, "utest", "queries", "targets", 0)) == NULL) esl_fatal(msg);
+  if (p7_checkpoint_Load(ck, errbuf) != eslENOTFOUND) esl_fatal(msg);
+
+  /* A checkpoint of other files is refused */
+  p7_checkpoint_QueryDone(ck, 1);
+  p7_checkpoint_Destroy(ck);
+  if ((ck = p7_checkpoint_Create(dir, "utest", "queries", "other", 0)) == NULL) esl_fatal(msg);
+  if (p7_checkpoint_Load(ck, errbuf) != eslEINCOMPAT) esl_fatal(msg);
+  p7_checkpoint_Finish(ck);
+  p7_checkpoint_Destroy(ck);
+
+  remove(outfile);
+  free(outfile);
+  for (i = 0; i < 2; i++) { p7_tophits_Destroy(th[i]); p7_pipeline_Destroy(pli[i]); }
+  p7_tophits_Destroy(all);
+  p7_tophits_Destroy(rth);
+  p7_pipeline_Destroy(rpli);
+}
+#endif /*p7CHECKPOINT_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
+
+
+/*****************************************************************
+ * 4. Test driver.
+ *****************************************************************/
+#ifdef p7CHECKPOINT_TESTDRIVE
+
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+
+#include "hmmer.h"
+#include "p7_checkpoint.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  { "-s",        eslARG_INT,     "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                    0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for search checkpoints";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go  = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  char            dir[32];
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  snprintf(dir, sizeof(dir), "p7ckpt-utest.%ld", (long) getpid());
+  utest_roundtrip(rng, dir);
+  rmdir(dir);
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7CHECKPOINT_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
@@ -0,0 +1,65 @@
+/* Restart state for long searches (--checkpoint, --resume).
+ */
+#ifndef P7_CHECKPOINT_INCLUDED
+#define P7_CHECKPOINT_INCLUDED
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#endif
+
+#include "hmmer.h"
+
+#define p7_CHECKPOINT_MAXOUT  8	/* max # of output files a checkpoint tracks */
+#define p7_CHECKPOINT_NCOUNTS 14	/* # of P7_PIPELINE accounting fields saved  */
+
+/* P7_CHECKPOINT: where a search is, so it can be resumed after it is
+ * killed. A search is a series of queries. The state is the number of
+ * queries whose output is complete, the sizes the output files had at
+ * that point, and optionally how far the next query got: how many
+ * targets it searched, where the next target is on disk, and the hits
+ * and pipeline counts so far.
+ */
+typedef struct {
+  char       *ckfile;		/* <dir>/<progname>.ckpt                            */
+  char       *tmpfile;		/* <ckfile>.tmp: saved here, then renamed to <ckfile> */
+  char       *qfile;		/* query file name; must match on resume            */
+  char       *tfile;		/* target file name; must match on resume           */
+  int         interval;		/* minimum seconds between saves                    */
+  time_t      last;		/* time of the last save (or of Create)             */
+  int         is_resumed;	/* TRUE if state was loaded from <ckfile>           */
+
+  FILE       *out[p7_CHECKPOINT_MAXOUT];    /* open output files, in OpenOutput() order */
+  char       *outpath[p7_CHECKPOINT_MAXOUT];/* their paths; must match on resume        */
+  off_t       outoff[p7_CHECKPOINT_MAXOUT]; /* their sizes after query <nquery>        */
+  int         nout;		/* # of output files opened                         */
+  int         nsaved;		/* # of output files in the loaded state            */
+
+  int         nquery;		/* # of queries whose output is complete            */
+
+  /* How far query <nquery>+1 got, if <has_partial>:                            */
+  int         has_partial;
+  int64_t     ntargets;		/* # of targets searched                            */
+  off_t       roff;		/* disk offset of the next target; -1 if unknown    */
+  P7_TOPHITS *th;		/* hits on the targets searched                     */
+  uint64_t    count[p7_CHECKPOINT_NCOUNTS]; /* pipeline accounting, summed over workers */
+
+#ifdef HMMER_THREADS
+  pthread_mutex_t mutex;	/* saves come from the output thread and the reader */
+#endif
+} P7_CHECKPOINT;
+
+extern P7_CHECKPOINT *p7_checkpoint_Create     (const char *dir, const char *progname, const char *qfile, const char *tfile, int interval);
+extern int            p7_checkpoint_Load       (P7_CHECKPOINT *ck, char *errbuf);
+extern int            p7_checkpoint_OpenOutput (P7_CHECKPOINT *ck, const char *path, FILE **ret_fp);
+extern int            p7_checkpoint_IsDue      (P7_CHECKPOINT *ck, int qidx);
+extern int            p7_checkpoint_QueryDone  (P7_CHECKPOINT *ck, int qidx);
+extern int            p7_checkpoint_SavePartial(P7_CHECKPOINT *ck, int qidx, int64_t ntargets, off_t roff, P7_TOPHITS **th, P7_PIPELINE **pli, int n);
+extern int            p7_checkpoint_Restore    (P7_CHECKPOINT *ck, int qidx, P7_TOPHITS *th, P7_PIPELINE *pli, int64_t *ret_ntargets, off_t *ret_roff);
+extern int            p7_checkpoint_Finish     (P7_CHECKPOINT *ck);
+extern void           p7_checkpoint_Destroy    (P7_CHECKPOINT *ck);
+
+#endif /*P7_CHECKPOINT_INCLUDED*/
@@ -15,6 +15,8 @@
 #include "hmmer.h"
 #include "p7_hmmcache.h"
 
+static int cache_msv(P7_HMMCACHE *cache);
+
 /*****************************************************************
  * 1. P7_HMMCACHE: a daemon's cached profile database
  *****************************************************************/ 
@@ -25,6 +27,15 @@
  * Purpose:   Open <hmmfile> and read all of its contents, creating
  *            a cached profile database in memory. Return a ptr to the 
  *            cached profile database in <*ret_cache>. 
+ *
+ *            The MSV filter scores of all the profiles are kept in one
+ *            contiguous block, in database order, with a compact MSV
+ *            profile for each in <cache->msv>: the first filter stage
+ *            of a search streams through that block alone, and
+ *            touches a full profile in <cache->list> only for a
+ *            target that passes it (<p7_pli_ScanMSV()>). The full
+ *            profiles use the same MSV scores, so they aren't held
+ *            twice.
  *            
  *            Caller may optionally provide an <errbuf> ptr to
  *            at least <eslERRBUFSIZE> bytes, to capture an 
@@ -61,6 +72,9 @@ p7_hmmcache_Open(char *hmmfile, P7_HMMCACHE **ret_cache, char *errbuf)
   cache->list      = NULL;
   cache->lalloc    = 4096;	/* allocation chunk size for <list> of ptrs  */
   cache->n         = 0;
+  cache->msv       = NULL;
+  cache->msv_mem   = NULL;
+  cache->msv_size  = 0;
 
   if ( ( status = esl_strdup(hmmfile, -1, &cache->name) != eslOK)) goto ERROR; 
   ESL_ALLOC(cache->list, sizeof(P7_OPROFILE *) * cache->lalloc);
@@ -80,6 +94,7 @@ p7_hmmcache_Open(char *hmmfile, P7_HMMCACHE **ret_cache, char *errbuf)
       om = NULL;
     }
   if (status != eslEOF)  { strncpy(errbuf, hfp->errbuf, eslERRBUFSIZE); goto ERROR; }
+  if ((status = cache_msv(cache)) != eslOK) goto ERROR;
 
   //printf("\nfinal:: %d  memory %" PRId64 "\n", inx, total_mem);
   p7_hmmfile_Close(hfp);
@@ -96,6 +111,11 @@ p7_hmmcache_Open(char *hmmfile, P7_HMMCACHE **ret_cache, char *errbuf)
 
 /* Function:  p7_hmmcache_Sizeof()
  * Synopsis:  Returns total size of a profile cache, in bytes.
+ *
+ * Purpose:   The MSV score rows of the cached profiles were moved
+ *            into <cache->msv_mem> (<p7_oprofile_MoveMSV()>); they
+ *            are counted there, once, and not again in the
+ *            <p7_oprofile_Sizeof()> of each profile.
  */
 size_t
 p7_hmmcache_Sizeof(P7_HMMCACHE *cache)
@@ -106,6 +126,8 @@ p7_hmmcache_Sizeof(P7_HMMCACHE *cache)
   n += sizeof(char) * (strlen(cache->name) + 1);
   n += esl_alphabet_Sizeof(cache->abc);
   n += sizeof(P7_OPROFILE *) * cache->lalloc;     /* cache->list */
+  n += sizeof(P7_MSVPROFILE) * cache->n;          /* cache->msv  */
+  n += cache->msv_size + 15;                      /* cache->msv_mem */
 
   for (i = 0; i < cache->n; i++)
     n += p7_oprofile_Sizeof(cache->list[i]);
@@ -145,6 +167,59 @@ p7_hmmcache_SetNumericNames(P7_HMMCACHE *cache)
 }
 
 
+/* Function:  p7_hmmcache_Replicate()
+ * Synopsis:  Make a private copy of a profile cache.
+ *
+ * Purpose:   Copy every profile of <src> into a new cache, returned
+ *            in <*ret_cache>, in the same order and with the same
+ *            names. Used by hmmpgmd --numa to keep one copy of the
+ *            profiles on each NUMA node: the caller runs this in a
+ *            thread pinned to the node, so that all of the copy,
+ *            score vectors and block of MSV scores included, is
+ *            first touched, and placed, there. The replica shares
+ *            nothing with <src>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_hmmcache_Replicate(const P7_HMMCACHE *src, P7_HMMCACHE **ret_cache)
+{
+  P7_HMMCACHE *cache = NULL;
+  int          status;
+
+  ESL_ALLOC(cache, sizeof(P7_HMMCACHE));
+  cache->name      = NULL;
+  cache->abc       = NULL;
+  cache->list      = NULL;
+  cache->lalloc    = src->n;
+  cache->n         = 0;
+  cache->msv       = NULL;
+  cache->msv_mem   = NULL;
+  cache->msv_size  = 0;
+
+  if ( (status = esl_strdup(src->name, -1, &cache->name)) != eslOK) goto ERROR;
+  if ( (cache->abc = esl_alphabet_Create(src->abc->type)) == NULL) { status = eslEMEM; goto ERROR; }
+  ESL_ALLOC(cache->list, sizeof(P7_OPROFILE *) * ESL_MAX(1, cache->lalloc));
+
+  for (cache->n = 0; cache->n < src->n; cache->n++)
+    {
+      if ( (cache->list[cache->n] = p7_oprofile_Copy(src->list[cache->n])) == NULL) { status = eslEMEM; goto ERROR; }
+      cache->list[cache->n]->abc = cache->abc;
+    }
+  if ((status = cache_msv(cache)) != eslOK) goto ERROR;
+
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (cache) p7_hmmcache_Close(cache);
+  *ret_cache = NULL;
+  return status;
+}
+
+
 /* Function:  p7_hmmcache_Close()
  * Synopsis:  Free a profile cache.
  */
@@ -162,9 +237,42 @@ p7_hmmcache_Close(P7_HMMCACHE *cache)
 	p7_oprofile_Destroy(cache->list[i]);
       free(cache->list);
     }
+  if (cache->msv)     free(cache->msv);
+  if (cache->msv_mem) free(cache->msv_mem);
   free(cache);
 }
 
+/* cache_msv()
+ * Lay out the MSV stage of the <cache->n> profiles in <cache->list>
+ * in one block, moving the scores out of the profiles
+ * (p7_oprofile_MoveMSV()).
+ */
+static int
+cache_msv(P7_HMMCACHE *cache)
+{
+  char *mem;
+  int   i;
+  int   status;
+
+  cache->msv_size = 0;
+  for (i = 0; i < cache->n; i++)
+    cache->msv_size += p7_oprofile_MSVSizeof(cache->list[i]);
+
+  ESL_ALLOC(cache->msv,     sizeof(P7_MSVPROFILE) * ESL_MAX(1, cache->n));
+  ESL_ALLOC(cache->msv_mem, cache->msv_size + 15); /* +15 for manual 16-byte alignment */
+  mem = (char *) (((unsigned long int) cache->msv_mem + 15) & (~0xf));
+
+  for (i = 0; i < cache->n; i++)
+    {
+      if ((status = p7_oprofile_MoveMSV(cache->list[i], mem, &(cache->msv[i]))) != eslOK) return status;
+      mem += p7_oprofile_MSVSizeof(cache->list[i]);
+    }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
 /*****************************************************************
  * 2. Benchmark driver
  *****************************************************************/
@@ -13,11 +13,16 @@ typedef struct {
   P7_OPROFILE       **list;        /* list of profiles [0 .. n-1]           */
   uint32_t            lalloc;	   /* allocated length of <list>            */
   uint32_t            n;           /* number of entries in <list>           */
+
+  P7_MSVPROFILE      *msv;         /* msv[i]: MSV stage of list[i]          */
+  char               *msv_mem;     /* their score vectors, back to back     */
+  size_t              msv_size;    /* size of the vectors, in bytes         */
 } P7_HMMCACHE;
 
 extern int    p7_hmmcache_Open (char *hmmfile, P7_HMMCACHE **ret_cache, char *errbuf);
 extern size_t p7_hmmcache_Sizeof         (P7_HMMCACHE *cache);
 extern int    p7_hmmcache_SetNumericNames(P7_HMMCACHE *cache);
+extern int    p7_hmmcache_Replicate      (const P7_HMMCACHE *src, P7_HMMCACHE **ret_cache);
 extern void   p7_hmmcache_Close          (P7_HMMCACHE *cache);
 
 #endif /*P7_HMMCACHE_INCLUDED*/
@@ -20,6 +20,19 @@
 #ifdef HMMER_THREADS
 #include <pthread.h>
 #endif
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SHM_OPEN
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#endif
 
 #include "easel.h"
 #include "esl_alphabet.h"
@@ -27,6 +40,9 @@
 #include "esl_vectorops.h"   /* gives us esl_vec_FCopy()   */
 
 #include "hmmer.h"
+#ifdef HMMER_THREADS
+#include "p7_scheduler.h"
+#endif
 
 /* Magic numbers identifying binary formats.
  * Do not change the old magics! Necessary for backwards compatibility.
@@ -51,6 +67,8 @@ static uint32_t  v3d_magic = 0xe8ededb9; /* 3/d binary: "hmm9" + 0x80808080 */
 static uint32_t  v3e_magic = 0xe8ededb0; /* 3/e binary: "hmm0" + 0x80808080 */
 static uint32_t  v3f_magic = 0xe8ededba; /* 3/f binary: "hmma" + 0x80808080 */
 
+#define p7_HMMFILE_BUFSIZE 65536 /* stdio buffer for model files; big enough for a typical binary model */
+
 
 static int read_asc30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm);
 static int read_bin30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm);
@@ -59,6 +77,14 @@ static int read_asc20hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_h
 static int   write_bin_string(FILE *fp, char *s);
 static int   read_bin_string (FILE *fp, char **ret_s);
 static float h2ascii2prob(char *s, float null);
+static double fast_atof  (const char *s);
+
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+static void readahead_next   (struct p7_readahead_s *ra, int i);
+static void readahead_parse  (void *arg, int workeridx);
+static int  readahead_read   (P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm);
+static void readahead_destroy(struct p7_readahead_s *ra);
+#endif
 
 
 /*****************************************************************
@@ -230,6 +256,14 @@ p7_hmmfile_OpenBuffer(char *buffer, int size, P7_HMMFILE **ret_hfp)
   hfp->efp          = NULL;
   hfp->ffp          = NULL;
   hfp->pfp          = NULL;
+  hfp->fmap         = NULL;
+  hfp->pmap         = NULL;
+  hfp->fmapsize     = 0;
+  hfp->pmapsize     = 0;
+  hfp->fpos         = 0;
+  hfp->shm          = NULL;
+  hfp->shmsize      = 0;
+  hfp->ra           = NULL;
   hfp->ssi          = NULL;
   hfp->errbuf[0]    = '\0';
 
@@ -300,6 +334,14 @@ open_engine(char *filename, char *env, P7_HMMFILE **ret_hfp, int do_ascii_only,
   hfp->efp          = NULL;
   hfp->ffp          = NULL;
   hfp->pfp          = NULL;
+  hfp->fmap         = NULL;
+  hfp->pmap         = NULL;
+  hfp->fmapsize     = 0;
+  hfp->pmapsize     = 0;
+  hfp->fpos         = 0;
+  hfp->shm          = NULL;
+  hfp->shmsize      = 0;
+  hfp->ra           = NULL;
   hfp->ssi          = NULL;
   hfp->errbuf[0]    = '\0';
 
@@ -389,6 +431,19 @@ open_engine(char *filename, char *env, P7_HMMFILE **ret_hfp, int do_ascii_only,
     else     ESL_XFAIL(eslENOTFOUND, errbuf, "HMM file %s not found (nor an .h3m binary of it)",                    filename);
   }
 
+  /* 4b. Models are mostly read front to back, a record at a time: use a
+   *     bigger stdio buffer than the default, so a binary model's
+   *     arrays come in a few large reads, and ask the kernel to read
+   *     ahead. This must come before the first read of <hfp->f>.
+   */
+  if (! hfp->do_stdin && ! hfp->do_gzip)
+  {
+    setvbuf(hfp->f, NULL, _IOFBF, p7_HMMFILE_BUFSIZE);
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(fileno(hfp->f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+
 
   /* 5. If we found and opened a binary model file .h3m, open the rest of 
    *     the press'd model files. (this can't be true if do_ascii_only is set)
@@ -488,15 +543,581 @@ p7_hmmfile_Close(P7_HMMFILE *hfp)
   if (!hfp->do_gzip && !hfp->do_stdin && hfp->f != NULL) fclose(hfp->f);
   if (hfp->ffp   != NULL) fclose(hfp->ffp);
   if (hfp->pfp   != NULL) fclose(hfp->pfp);
+#ifdef HAVE_MMAP
+  if      (hfp->shm   != NULL) munmap(hfp->shm, hfp->shmsize);
+  else {
+    if    (hfp->fmap  != NULL) munmap(hfp->fmap, hfp->fmapsize);
+    if    (hfp->pmap  != NULL) munmap(hfp->pmap, hfp->pmapsize);
+  }
+#endif
   if (hfp->fname != NULL) free(hfp->fname);
   if (hfp->efp   != NULL) esl_fileparser_Destroy(hfp->efp);
   if (hfp->ssi   != NULL) esl_ssi_Close(hfp->ssi);
 #ifdef HMMER_THREADS
   if (hfp->syncRead)      pthread_mutex_destroy (&hfp->readMutex);
+#endif
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+  readahead_destroy(hfp->ra);
 #endif
   free(hfp);
 }
 
+/* Function:  p7_hmmfile_Map()
+ * Synopsis:  Memory map the optimized profiles of a pressed HMM database.
+ *
+ * Purpose:   Map the <.h3f> and <.h3p> files of an open pressed HMM
+ *            database <hfp> read-only into memory. Afterwards,
+ *            <p7_oprofile_ReadMSV()> and <p7_oprofile_ReadRest()> do
+ *            not copy score vectors or annotation; the profiles they
+ *            return point into the mapping, and no lock is taken to
+ *            read them. Because the mapping is shared, concurrent
+ *            processes searching the same database share one copy of
+ *            it in the page cache.
+ *
+ *            Profiles read from a mapped <hfp> are read-only, and must
+ *            be destroyed before <hfp> is closed. Callers that modify
+ *            profile scores (nhmmscan) must not map.
+ *
+ *            Reading resumes at the current position of the <.h3f>
+ *            file.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEINVAL> if <hfp> isn't a pressed database, or it is
+ *            gzipped or stdin.  <eslENORESULT> if memory mapping
+ *            isn't available on this system, or the mapping fails.
+ *            In either case <hfp> is unchanged, and can still be read
+ *            normally.
+ */
+int
+p7_hmmfile_Map(P7_HMMFILE *hfp)
+{
+#ifdef HAVE_MMAP
+  struct stat fst;
+  struct stat pst;
+  char       *fmap = MAP_FAILED;
+  char       *pmap = MAP_FAILED;
+  off_t       fpos;
+
+  if (! hfp->is_pressed || hfp->ffp == NULL || hfp->pfp == NULL) return eslEINVAL;
+  if (hfp->do_gzip || hfp->do_stdin)                             return eslEINVAL;
+  if (hfp->fmap != NULL)                                         return eslOK;
+
+  if ((fpos = ftello(hfp->ffp))        == -1) return eslENORESULT;
+  if (fstat(fileno(hfp->ffp), &fst)    != 0)  return eslENORESULT;
+  if (fstat(fileno(hfp->pfp), &pst)    != 0)  return eslENORESULT;
+  if (fst.st_size == 0 || pst.st_size == 0)   return eslENORESULT;
+
+  fmap = mmap(NULL, fst.st_size, PROT_READ, MAP_SHARED, fileno(hfp->ffp), 0);
+  pmap = mmap(NULL, pst.st_size, PROT_READ, MAP_SHARED, fileno(hfp->pfp), 0);
+  if (fmap == MAP_FAILED || pmap == MAP_FAILED) goto ERROR;
+
+  hfp->fmap     = fmap;
+  hfp->pmap     = pmap;
+  hfp->fmapsize = fst.st_size;
+  hfp->pmapsize = pst.st_size;
+  hfp->fpos     = fpos;
+  return eslOK;
+
+ ERROR:
+  if (fmap != MAP_FAILED) munmap(fmap, fst.st_size);
+  if (pmap != MAP_FAILED) munmap(pmap, pst.st_size);
+  return eslENORESULT;
+#else
+  return eslENORESULT;
+#endif
+}
+
+/* Read-ahead of ASCII save files, for p7_hmmfile_ReadAhead(). The
+ * file is mapped, and the reading thread cuts it into records at its
+ * // lines. Each record is parsed by a worker thread, using its own
+ * P7_HMMFILE opened on the record's text. Records are kept in a ring
+ * of slots; as each is returned in file order, its slot is refilled
+ * with the next record in the file.
+ */
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+#define p7_READAHEAD_DEPTH 4	/* records in flight, per worker */
+
+typedef struct {
+  struct p7_readahead_s *ra;	/* the read-ahead this slot belongs to          */
+  P7_TASKGROUP *grp;		/* the slot's parse task, while it runs         */
+
+  char         *text;		/* start of the record in the mapped file       */
+  size_t        len;		/* length of the record; 0 if past end of file  */
+  off_t         offset;		/* disk offset of the record                    */
+  int           linenumber;	/* line number of its first line                */
+
+  int           status;		/* result of the parse: eslOK or an error code  */
+  P7_HMM       *hmm;		/* the parsed model, if <status> is eslOK       */
+  ESL_ALPHABET *abc;		/*   and the alphabet created for it            */
+  int           errline;	/* line of a format error                       */
+  char          errbuf[eslERRBUFSIZE];
+} P7_RASLOT;
+
+struct p7_readahead_s {
+  char         *map;		/* the mapped save file                         */
+  size_t        mapsize;
+  size_t        pos;		/* offset of the next record not yet in the ring */
+  int           linenumber;	/* line number at <pos>                         */
+  int           format;		/* format of the file; each record must match   */
+  char          tag[16];	/* its format tag, "HMMER3/f" or such           */
+
+  P7_SCHEDULER *sch;		/* the parsing workers                          */
+  P7_RASLOT    *slot;		/* ring of records [0..nslots-1]                */
+  int           nslots;
+  int           head;		/* slot of the next record to return            */
+};
+#endif /*HMMER_THREADS && HAVE_MMAP*/
+
+/* Function:  p7_hmmfile_ReadAhead()
+ * Synopsis:  Parse the models of an ASCII HMM file in parallel.
+ *
+ * Purpose:   Map the rest of the ASCII HMMER3 save file <hfp> into
+ *            memory, and start <nworkers> threads that parse the
+ *            models ahead of the caller. <p7_hmmfile_Read()> still
+ *            returns the models one at a time in file order, with the
+ *            same results and errors it would have given, including
+ *            <hmm->offset> and the line number of a format error in
+ *            <hfp->efp->linenumber>. It no longer reads <hfp->f>.
+ *
+ *            Up to <p7_READAHEAD_DEPTH> models per worker are held in
+ *            memory waiting to be read. Repositioning the file with
+ *            <p7_hmmfile_Position()> or <p7_hmmfile_PositionByKey()>
+ *            stops the read-ahead.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEINVAL> if <hfp> isn't an ASCII HMMER3 file, or it is
+ *            gzipped or stdin, or <nworkers> is < 1. <eslENORESULT>
+ *            if threads or memory mapping aren't available on this
+ *            system, or the mapping fails. In either case <hfp> is
+ *            unchanged, and is read serially as before.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if the worker
+ *            threads can't be started. <hfp> is unchanged.
+ */
+int
+p7_hmmfile_ReadAhead(P7_HMMFILE *hfp, int nworkers)
+{
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+  struct p7_readahead_s *ra = NULL;
+  struct stat            st;
+  off_t                  pos;
+  int                    i;
+  int                    status;
+
+  if (hfp->parser != read_asc30hmm || hfp->f == NULL) return eslEINVAL;
+  if (hfp->do_gzip || hfp->do_stdin || nworkers < 1)  return eslEINVAL;
+  if (hfp->ra != NULL)                                return eslOK;
+
+  /* A newly opened file has had its first line read by open_engine(),
+   * to check its magic; the first record gets parsed from the start.
+   */
+  if      (hfp->newly_opened)                    pos = 0;
+  else if ((pos = ftello(hfp->f))          == -1) return eslENORESULT;
+  if (fstat(fileno(hfp->f), &st)           != 0)  return eslENORESULT;
+  if (! S_ISREG(st.st_mode) || st.st_size == 0)   return eslENORESULT;
+
+  ESL_ALLOC(ra, sizeof(struct p7_readahead_s));
+  ra->map        = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(hfp->f), 0);
+  ra->mapsize    = st.st_size;
+  ra->pos        = pos;
+  ra->linenumber = (hfp->newly_opened ? 1 : hfp->efp->linenumber + 1);
+  ra->format     = hfp->format;
+  ra->sch        = NULL;
+  ra->slot       = NULL;
+  ra->nslots     = nworkers * p7_READAHEAD_DEPTH;
+  ra->head       = 0;
+  snprintf(ra->tag, sizeof(ra->tag), "HMMER3/%c", 'a' + (hfp->format - p7_HMMFILE_3a));
+  if (ra->map == MAP_FAILED) { ra->map = NULL; status = eslENORESULT; goto ERROR; }
+
+  ESL_ALLOC(ra->slot, sizeof(P7_RASLOT) * ra->nslots);
+  for (i = 0; i < ra->nslots; i++)
+    {
+      ra->slot[i].ra  = ra;
+      ra->slot[i].grp = NULL;
+      ra->slot[i].len = 0;
+      ra->slot[i].hmm = NULL;
+      ra->slot[i].abc = NULL;
+    }
+  for (i = 0; i < ra->nslots; i++)
+    if ((ra->slot[i].grp = p7_taskgroup_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+  if ((ra->sch = p7_scheduler_Create(nworkers, NULL)) == NULL) { status = eslESYS; goto ERROR; }
+
+  for (i = 0; i < ra->nslots; i++)
+    readahead_next(ra, i);
+
+  hfp->ra = ra;
+  return eslOK;
+
+ ERROR:
+  readahead_destroy(ra);
+  return status;
+#else
+  return eslENORESULT;
+#endif
+}
+
+/* A shared memory profile cache is a header, then the <.h3f> and
+ * <.h3p> files of a pressed database, each starting on a page
+ * boundary so the 64-byte alignment of their score vectors is kept.
+ * The magic number is written last, so a cache that is still being
+ * loaded can't be opened.
+ */
+#if defined(HAVE_MMAP) && defined(HAVE_SHM_OPEN)
+static uint32_t  v3g_shmmagic = 0xb3e7f3e8; /* "3gsh" + 0x80808080 */
+
+#define p7_SHMNAMELEN 1024
+#define SHM_ALIGNUP(n, a)  ((((n) + (a) - 1) / (a)) * (a))
+
+typedef struct {
+  uint32_t magic;		/* v3g_shmmagic, once the cache is complete    */
+  uint32_t pad;
+  uint64_t totsize;		/* size of the cache, in bytes                 */
+  uint64_t foff;		/* offset of the <.h3f> file image             */
+  uint64_t fsize;		/* size of the <.h3f> file image               */
+  uint64_t poff;		/* offset of the <.h3p> file image             */
+  uint64_t psize;		/* size of the <.h3p> file image               */
+  char     dbname[p7_SHMNAMELEN]; /* name of the database that was loaded */
+} P7_SHMHEADER;
+
+/* shm_openname()
+ * Open shared memory cache <shmname> with open(2) flags <oflag>.
+ * A name with a '/' after its first character is taken to be a file
+ * path, for caches on a hugetlbfs mount; other names are POSIX
+ * shared memory objects, with a leading '/' added if needed.
+ */
+static int
+shm_openname(const char *shmname, int oflag, mode_t mode)
+{
+  char *name = NULL;
+  int   fd;
+
+  if (*shmname == '\0')                 { errno = EINVAL; return -1; }
+  if (strchr(shmname+1, '/') != NULL)   return open(shmname, oflag, mode);
+  if (*shmname == '/')                  return shm_open(shmname, oflag, mode);
+  if (esl_sprintf(&name, "/%s", shmname) != eslOK) { errno = ENOMEM; return -1; }
+  fd = shm_open(name, oflag, mode);
+  free(name);
+  return fd;
+}
+
+/* shm_unlinkname()
+ * Remove shared memory cache <shmname>; see shm_openname().
+ */
+static int
+shm_unlinkname(const char *shmname)
+{
+  char *name = NULL;
+  int   rc;
+
+  if (*shmname == '\0')                 { errno = EINVAL; return -1; }
+  if (strchr(shmname+1, '/') != NULL)   return unlink(shmname);
+  if (*shmname == '/')                  return shm_unlink(shmname);
+  if (esl_sprintf(&name, "/%s", shmname) != eslOK) { errno = ENOMEM; return -1; }
+  rc = shm_unlink(name);
+  free(name);
+  return rc;
+}
+
+/* shm_renamename()
+ * Rename shared memory cache <from> to <to>, atomically replacing any
+ * cache <to>; see shm_openname(). File paths are renamed with
+ * rename(2). POSIX objects have no rename call, but on Linux they are
+ * files in /dev/shm; elsewhere this fails with <errno> ENOTSUP.
+ */
+static int
+shm_renamename(const char *from, const char *to)
+{
+  char *fpath = NULL;
+  char *tpath = NULL;
+  int   rc    = -1;
+
+  if (strchr(from+1, '/') != NULL) return rename(from, to);
+  if (esl_sprintf(&fpath, "/dev/shm/%s", from + (*from == '/')) != eslOK ||
+      esl_sprintf(&tpath, "/dev/shm/%s", to   + (*to   == '/')) != eslOK) { errno = ENOMEM; goto DONE; }
+  if ((rc = rename(fpath, tpath)) != 0 && errno == ENOENT) errno = ENOTSUP;
+ DONE:
+  free(fpath);
+  free(tpath);
+  return rc;
+}
+
+/* shm_write()
+ * Create shared memory cache <name>, which must not exist yet, and
+ * copy the mapped pressed files of <hfp>, database <filename>, into
+ * it. The magic number goes in last. On failure, no cache <name> is
+ * left behind.
+ */
+static int
+shm_write(P7_HMMFILE *hfp, const char *filename, const char *name, char *errbuf)
+{
+  P7_SHMHEADER *hdr     = NULL;
+  char         *shm     = MAP_FAILED;
+  int           fd      = -1;
+  size_t        align;
+  size_t        totsize = 0;
+  struct stat   st;
+  int           status;
+
+  if ((fd = shm_openname(name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+    if (errno == EEXIST) ESL_XFAIL(eslEWRITE, errbuf, "shared memory cache %s already exists", name);
+    else                 ESL_XFAIL(eslEWRITE, errbuf, "failed to create shared memory cache %s: %s", name, strerror(errno));
+  }
+  if (fstat(fd, &st) != 0) ESL_XFAIL(eslEWRITE, errbuf, "failed to stat shared memory cache %s", name);
+
+  /* On hugetlbfs, st_blksize is the huge page size, and the size of the cache must be a multiple of it */
+  align   = ESL_MAX((size_t) sysconf(_SC_PAGESIZE), (size_t) st.st_blksize);
+  totsize = SHM_ALIGNUP(sizeof(P7_SHMHEADER), align) + SHM_ALIGNUP(hfp->fmapsize, align) + SHM_ALIGNUP(hfp->pmapsize, align);
+
+  if (ftruncate(fd, totsize) != 0) ESL_XFAIL(eslEWRITE, errbuf, "failed to size shared memory cache %s to %" PRIu64 " bytes", name, (uint64_t) totsize);
+  if ((shm = mmap(NULL, totsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) ESL_XFAIL(eslEWRITE, errbuf, "failed to map shared memory cache %s", name);
+
+  hdr          = (P7_SHMHEADER *) shm;
+  hdr->magic   = 0;
+  hdr->pad     = 0;
+  hdr->totsize = totsize;
+  hdr->foff    = SHM_ALIGNUP(sizeof(P7_SHMHEADER), align);
+  hdr->fsize   = hfp->fmapsize;
+  hdr->poff    = hdr->foff + SHM_ALIGNUP(hfp->fmapsize, align);
+  hdr->psize   = hfp->pmapsize;
+  strncpy(hdr->dbname, filename, p7_SHMNAMELEN-1);
+  hdr->dbname[p7_SHMNAMELEN-1] = '\0';
+
+  memcpy(shm + hdr->foff, hfp->fmap, hfp->fmapsize);
+  memcpy(shm + hdr->poff, hfp->pmap, hfp->pmapsize);
+  hdr->magic   = v3g_shmmagic;
+
+  munmap(shm, totsize);
+  close(fd);
+  return eslOK;
+
+ ERROR:
+  if (shm != MAP_FAILED) munmap(shm, totsize);
+  if (fd  != -1)       { close(fd); shm_unlinkname(name); }
+  return status;
+}
+#endif /*HAVE_MMAP && HAVE_SHM_OPEN*/
+
+/* Function:  p7_hmmfile_ShmCreate()
+ * Synopsis:  Load a pressed HMM database into a shared memory cache.
+ *
+ * Purpose:   Copy the optimized profiles of pressed HMM database
+ *            <filename> (looked for in <env> too, as in
+ *            <p7_hmmfile_OpenE()>) into a new shared memory cache
+ *            named <shmname>. The cache outlives this process, until
+ *            it's removed with <p7_hmmfile_ShmRemove()> or the system
+ *            is rebooted. Search programs then open it with
+ *            <p7_hmmfile_OpenShm()>, without reading any files.
+ *
+ *            <shmname> is a POSIX shared memory object name, such
+ *            as "pfam". A name with a '/' after its first character
+ *            is a file path instead; a path on a hugetlbfs mount
+ *            puts the cache in huge pages.
+ *
+ *            If <force> is TRUE, an existing cache <shmname> is
+ *            replaced. The new cache is built under a temporary name
+ *            and renamed over the old one once it's complete, so if
+ *            loading fails, the old cache is left in place. Processes
+ *            that have the old one open keep their copy until they
+ *            close it. (POSIX shared memory objects can only be
+ *            renamed on Linux, through </dev/shm>. Elsewhere, the old
+ *            cache is removed only after the new one has been built
+ *            once, and the new one is then copied in again under
+ *            <shmname>.)
+ *
+ *            Caller may provide an <errbuf> of at least
+ *            <eslERRBUFSIZE> bytes for an informative error message.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if <filename> can't be opened.
+ *            <eslEFORMAT> if it isn't pressed, or was pressed in an
+ *            older format that can't be mapped.
+ *            <eslEWRITE> if the cache can't be created, or
+ *            <shmname> exists and <force> is FALSE.
+ *            <eslEUNIMPLEMENTED> if this system has no shared memory.
+ *            On any of these, <errbuf> says why, and no cache is left
+ *            behind.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_hmmfile_ShmCreate(char *filename, char *env, const char *shmname, int force, char *errbuf)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SHM_OPEN)
+  P7_HMMFILE   *hfp     = NULL;
+  P7_OPROFILE  *om      = NULL;
+  ESL_ALPHABET *abc     = NULL;
+  char         *tmpname = NULL;
+  int           rerrno;
+  int           status;
+
+  if (errbuf) errbuf[0] = '\0';
+  if ((status = p7_hmmfile_OpenE(filename, env, &hfp, errbuf)) != eslOK) goto ERROR; /* eslENOTFOUND | eslEFORMAT */
+  if (! hfp->is_pressed)            ESL_XFAIL(eslEFORMAT, errbuf, "%s isn't pressed; run hmmpress first", filename);
+  if (p7_hmmfile_Map(hfp) != eslOK) ESL_XFAIL(eslEFORMAT, errbuf, "failed to map the pressed files of %s", filename);
+
+  /* The first profile tells us if the pressed files are in the mappable format */
+  if ((status = p7_oprofile_ReadMSV(hfp, &abc, &om)) != eslOK && status != eslEOF) ESL_XFAIL(eslEFORMAT, errbuf, "%s: %s", filename, hfp->errbuf);
+  p7_oprofile_Destroy(om);
+  om = NULL;
+
+  if (! force)
+    status = shm_write(hfp, filename, shmname, errbuf);
+  else
+    { /* build the new cache beside the old one, then swap it in */
+      if (esl_sprintf(&tmpname, "%s.tmp%ld", shmname, (long) getpid()) != eslOK) { status = eslEMEM; goto ERROR; }
+      if ((status = shm_write(hfp, filename, tmpname, errbuf)) != eslOK) goto ERROR;
+      if (shm_renamename(tmpname, shmname) != 0)
+	{
+	  rerrno = errno;
+	  shm_unlinkname(tmpname);
+	  if (rerrno != ENOTSUP) ESL_XFAIL(eslEWRITE, errbuf, "failed to replace shared memory cache %s: %s", shmname, strerror(rerrno));
+	  shm_unlinkname(shmname); /* can't rename POSIX objects here: the new cache is sound, copy it in again */
+	  status = shm_write(hfp, filename, shmname, errbuf);
+	}
+    }
+  if (status != eslOK) goto ERROR;
+
+  free(tmpname);
+  p7_hmmfile_Close(hfp);
+  if (abc) esl_alphabet_Destroy(abc);
+  return eslOK;
+
+ ERROR:
+  if (tmpname)           free(tmpname);
+  if (om)                p7_oprofile_Destroy(om);
+  if (hfp)               p7_hmmfile_Close(hfp);
+  if (abc)               esl_alphabet_Destroy(abc);
+  return status;
+#else
+  ESL_FAIL(eslEUNIMPLEMENTED, errbuf, "shared memory caches aren't supported on this system");
+#endif
+}
+
+/* Function:  p7_hmmfile_OpenShm()
+ * Synopsis:  Open a shared memory profile cache for reading.
+ *
+ * Purpose:   Open the shared memory cache <shmname> that
+ *            <p7_hmmfile_ShmCreate()> loaded, and return it in
+ *            <*ret_hfp> as an open pressed HMM database, mapped as
+ *            by <p7_hmmfile_Map()>: <p7_oprofile_ReadMSV()> and
+ *            <p7_oprofile_ReadRest()> point profiles into the cache
+ *            without copying them. <hfp->fname> is the name of the
+ *            database that was loaded.
+ *
+ *            If <writable> is FALSE, the cache is mapped read-only
+ *            and shared, and profiles must not be modified. If
+ *            <writable> is TRUE, it is mapped copy-on-write, for
+ *            callers that rewrite profile scores (nhmmscan
+ *            --bgfile); pages they write become private copies.
+ *
+ *            Only profiles can be read: <hfp> has no <.h3m> file or
+ *            SSI index.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslENOTFOUND> if there's no cache <shmname>.
+ *            <eslEFORMAT> if <shmname> isn't a complete profile cache.
+ *            <eslEUNIMPLEMENTED> if this system has no shared memory.
+ *            On these, <*ret_hfp> is <NULL> and <errbuf> says why.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_hmmfile_OpenShm(const char *shmname, int writable, P7_HMMFILE **ret_hfp, char *errbuf)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SHM_OPEN)
+  P7_HMMFILE   *hfp = NULL;
+  P7_SHMHEADER *hdr = NULL;
+  char         *shm = MAP_FAILED;
+  int           fd  = -1;
+  struct stat   st;
+  int           status;
+
+  if (errbuf) errbuf[0] = '\0';
+  if ((fd = shm_openname(shmname, O_RDONLY, 0)) == -1)  ESL_XFAIL(eslENOTFOUND, errbuf, "no shared memory cache %s", shmname);
+  if (fstat(fd, &st) != 0)                              ESL_XFAIL(eslENOTFOUND, errbuf, "failed to stat shared memory cache %s", shmname);
+  if ((size_t) st.st_size < sizeof(P7_SHMHEADER))       ESL_XFAIL(eslEFORMAT,   errbuf, "%s isn't a shared memory profile cache", shmname);
+
+  if (writable) shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  else          shm = mmap(NULL, st.st_size, PROT_READ,              MAP_SHARED,  fd, 0);
+  if (shm == MAP_FAILED) ESL_XFAIL(eslENOTFOUND, errbuf, "failed to map shared memory cache %s", shmname);
+  close(fd);
+  fd = -1;
+
+  hdr = (P7_SHMHEADER *) shm;
+  if (hdr->magic != v3g_shmmagic)                        ESL_XFAIL(eslEFORMAT, errbuf, "%s isn't a complete shared memory profile cache", shmname);
+  if (hdr->totsize != (uint64_t) st.st_size ||
+      hdr->foff + hdr->fsize > hdr->totsize ||
+      hdr->poff + hdr->psize > hdr->totsize)             ESL_XFAIL(eslEFORMAT, errbuf, "shared memory cache %s is corrupted", shmname);
+
+  ESL_ALLOC(hfp, sizeof(P7_HMMFILE));
+  hfp->f            = NULL;
+  hfp->fname        = NULL;
+  hfp->do_gzip      = FALSE;
+  hfp->do_stdin     = FALSE;
+  hfp->newly_opened = FALSE;
+  hfp->is_pressed   = TRUE;
+#ifdef HMMER_THREADS
+  hfp->syncRead     = FALSE;
+#endif
+  hfp->format       = p7_HMMFILE_3f;
+  hfp->parser       = NULL;
+  hfp->efp          = NULL;
+  hfp->ffp          = NULL;
+  hfp->pfp          = NULL;
+  hfp->fmap         = shm + hdr->foff;
+  hfp->pmap         = shm + hdr->poff;
+  hfp->fmapsize     = hdr->fsize;
+  hfp->pmapsize     = hdr->psize;
+  hfp->fpos         = 0;
+  hfp->shm          = shm;
+  hfp->shmsize      = st.st_size;
+  hfp->ra           = NULL;
+  hfp->ssi          = NULL;
+  hfp->errbuf[0]    = '\0';
+  if ((status = esl_strdup(hdr->dbname, -1, &(hfp->fname))) != eslOK) goto ERROR;
+
+  *ret_hfp = hfp;
+  return eslOK;
+
+ ERROR:
+  if (hfp)               p7_hmmfile_Close(hfp); /* unmaps <shm> too, once it's attached */
+  else if (shm != MAP_FAILED) munmap(shm, st.st_size);
+  if (fd != -1)          close(fd);
+  *ret_hfp = NULL;
+  return status;
+#else
+  *ret_hfp = NULL;
+  ESL_FAIL(eslEUNIMPLEMENTED, errbuf, "shared memory caches aren't supported on this system");
+#endif
+}
+
+/* Function:  p7_hmmfile_ShmRemove()
+ * Synopsis:  Remove a shared memory profile cache.
+ *
+ * Purpose:   Remove the shared memory cache <shmname>. Processes
+ *            that have it open keep using it; its memory is freed
+ *            when the last of them closes it.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslENOTFOUND> if there's no cache <shmname>, or it
+ *            can't be removed; <errbuf> says why.
+ *            <eslEUNIMPLEMENTED> if this system has no shared memory.
+ */
+int
+p7_hmmfile_ShmRemove(const char *shmname, char *errbuf)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SHM_OPEN)
+  if (shm_unlinkname(shmname) != 0) ESL_FAIL(eslENOTFOUND, errbuf, "failed to remove shared memory cache %s: %s", shmname, strerror(errno));
+  return eslOK;
+#else
+  ESL_FAIL(eslEUNIMPLEMENTED, errbuf, "shared memory caches aren't supported on this system");
+#endif
+}
+
 #ifdef HMMER_THREADS
 /* Function:  p7_hmmfile_CreateLock()
  *
@@ -1179,6 +1800,9 @@ int
 p7_hmmfile_Read(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc,  P7_HMM **opt_hmm)
 {
   /* A call to SSI to remember file position may eventually go here.  */
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+  if (hfp->ra) return readahead_read(hfp, ret_abc, opt_hmm);
+#endif
   return (*hfp->parser)(hfp, ret_abc, opt_hmm);
 }
 
@@ -1216,6 +1840,10 @@ p7_hmmfile_PositionByKey(P7_HMMFILE *hfp, const char *key)
   if (hfp->ssi == NULL) ESL_EXCEPTION(eslEINVAL, "Need an open SSI index to call p7_hmmfile_PositionByKey()");
   if ((status = esl_ssi_FindName(hfp->ssi, key, &fh, &offset, NULL, NULL)) != eslOK) return status;
   if (fseeko(hfp->f, offset, SEEK_SET) != 0)    ESL_EXCEPTION(eslESYS, "fseek failed");
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+  readahead_destroy(hfp->ra);  /* reading continues serially, from <hfp->f> */
+  hfp->ra = NULL;
+#endif
 
   hfp->newly_opened = FALSE;  /* because we're poised on the magic number, and must read it */
   return eslOK;
@@ -1239,6 +1867,10 @@ int
 p7_hmmfile_Position(P7_HMMFILE *hfp, const off_t offset)
 {
   if (fseeko(hfp->f, offset, SEEK_SET) != 0)    ESL_EXCEPTION(eslESYS, "fseek failed");
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+  readahead_destroy(hfp->ra);
+  hfp->ra = NULL;
+#endif
 
   hfp->newly_opened = FALSE;  /* because we're poised on the magic number, and must read it */
   return eslOK;
@@ -1530,7 +2162,7 @@ read_asc30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
   if (strcmp(tok1, "COMPO") == 0) {
     for (x = 0; x < abc->K; x++)  {
       if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))     != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few fields on COMPO line");
-      hmm->compo[x] = (*tok1 == '*' ? 0.0 : expf(-1.0 * atof(tok1)));
+      hmm->compo[x] = (*tok1 == '*' ? 0.0 : expf(-1.0 * fast_atof(tok1)));
     }
     hmm->flags |= p7H_COMPO;
     if ((status = esl_fileparser_NextLine(hfp->efp))                          != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Premature end of data after COMPO line");  
@@ -1539,15 +2171,15 @@ read_asc30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
 
   /* First two lines are node 0: insert emissions, then transitions from node 0 (begin) */
 
-  hmm->ins[0][0] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+  hmm->ins[0][0] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
   for (x = 1; x < abc->K; x++) {
     if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))       != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few fields on insert line, node 0: expected %d, got %d\n", abc->K, x);
-    hmm->ins[0][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+    hmm->ins[0][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
   }
   if ((status = esl_fileparser_NextLine(hfp->efp))                            != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Premature end of data in main model: no node 0 transition line");
   for (x = 0; x < p7H_NTRANSITIONS; x++) {
     if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))       != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few fields on begin (0) transition line");
-    hmm->t[0][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+    hmm->t[0][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
   }
 
   /* The main model section. */
@@ -1560,7 +2192,7 @@ read_asc30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
       
       for (x = 0; x < abc->K; x++) {
 	if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))   != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few probability fields on match line, node %d: expected %d, got %d\n", k, abc->K, x);
-	hmm->mat[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+	hmm->mat[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
       }
       
       if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))     != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Missing MAP field on match line for node %d: should at least be -", k);
@@ -1586,12 +2218,12 @@ read_asc30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
       if ((status = esl_fileparser_NextLine(hfp->efp))                        != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Premature end of data in main model: no insert emission line, node %d", k);
       for (x = 0; x < abc->K; x++) {
 	if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))   != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few probability fields on insert line, node %d: expected %d, got %d\n", k, abc->K, x);
-	hmm->ins[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+	hmm->ins[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
       }
       if ((status = esl_fileparser_NextLine(hfp->efp))                        != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Premature end of data in main model: no transition line, node %d", k);
       for (x = 0; x < p7H_NTRANSITIONS; x++) {
 	if ((status = esl_fileparser_GetTokenOnLine(hfp->efp, &tok1, NULL))   != eslOK)  ESL_XFAIL(status,     hfp->errbuf, "Too few probability fields on transition line, node %d: expected %d, got %d\n", k, abc->K, x);
-	hmm->t[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *atof(tok1)));
+	hmm->t[k][x] = (*tok1 == '*' ? 0.0 : expf(-1.0 *fast_atof(tok1)));
       }
     }
 
@@ -1688,13 +2320,12 @@ read_bin30hmm(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
    */
   if ((status = p7_hmm_CreateBody(hmm, hmm->M, abc)) != eslOK)  ESL_XFAIL(eslEMEM, hfp->errbuf, "allocation failed, HMM body");
   
-  /* Core model probabilities. */
-  for (k = 1; k <= hmm->M; k++)
-    if (! fread((char *) hmm->mat[k], sizeof(float), hmm->abc->K,      hfp->f))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mat[%d]", k);
-  for (k = 0; k <= hmm->M; k++)
-    if (! fread((char *) hmm->ins[k], sizeof(float), hmm->abc->K,      hfp->f))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ins[%d]", k);
-  for (k = 0; k <= hmm->M; k++)
-    if (! fread((char *) hmm->t[k],   sizeof(float), p7H_NTRANSITIONS, hfp->f))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read t[%d]", k);
+  /* Core model probabilities. The rows of each are contiguous (p7_hmm_CreateBody()),
+   * and stored in the same order, so each is one read.
+   */
+  if (fread((char *) hmm->mat[1], sizeof(float), hmm->abc->K      * hmm->M,     hfp->f) != (size_t) hmm->abc->K      * hmm->M)      ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mat");
+  if (fread((char *) hmm->ins[0], sizeof(float), hmm->abc->K      * (hmm->M+1), hfp->f) != (size_t) hmm->abc->K      * (hmm->M+1))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ins");
+  if (fread((char *) hmm->t[0],   sizeof(float), p7H_NTRANSITIONS * (hmm->M+1), hfp->f) != (size_t) p7H_NTRANSITIONS * (hmm->M+1))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read t");
   
   /* Annotations. */
   if (read_bin_string(hfp->f, &(hmm->name)) != eslOK)                                                ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name");
@@ -2242,6 +2873,196 @@ h2ascii2prob(char *s, float null)
 {
   return ((*s == '*') ? 0. : null * exp( atoi(s) * 0.00069314718));
 }
+
+/* fast_atof()
+ * Convert a decimal field of an ASCII save file to a double. Fields
+ * are short fixed-point numbers like "2.68618": the value is built
+ * as an integer mantissa divided by an exact power of ten, which is
+ * a single correctly rounded operation, so the result is the same
+ * as atof()'s. Anything else (exponents, long mantissas, "inf") is
+ * left to atof().
+ */
+static double
+fast_atof(const char *s)
+{
+  static const double pow10[16] = { 1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+				     1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+  const char *p   = s;
+  uint64_t    m   = 0;
+  int         nd  = 0;		/* digits in the mantissa     */
+  int         nf  = 0;		/* ... of which are fraction  */
+  int         neg = FALSE;
+
+  if      (*p == '-') { neg = TRUE; p++; }
+  else if (*p == '+') p++;
+  for (; *p >= '0' && *p <= '9'; p++, nd++)
+    m = m * 10 + (*p - '0');
+  if (*p == '.')
+    for (p++; *p >= '0' && *p <= '9'; p++, nd++, nf++)
+      m = m * 10 + (*p - '0');
+  if (*p != '\0' || nd == 0 || nd > 15) return atof(s);
+  return (neg ? -((double) m / pow10[nf]) : (double) m / pow10[nf]);
+}
+
+#if defined(HMMER_THREADS) && defined(HAVE_MMAP)
+/* readahead_next()
+ * Fill slot <i> with the next record of the mapped file: the text
+ * from <ra->pos> through the next line whose first token is //, the
+ * same test read_asc30hmm() uses for the end of a model. Then queue
+ * its parse. If only blank lines and comments remain, the slot is
+ * left empty (len 0), and reading it returns eslEOF.
+ */
+static void
+readahead_next(struct p7_readahead_s *ra, int i)
+{
+  P7_RASLOT *r      = &(ra->slot[i]);
+  char      *end    = ra->map + ra->mapsize;
+  char      *line   = ra->map + ra->pos;
+  char      *eol;
+  char      *c;
+  int        nlines = 0;
+  int        ndata  = 0;	/* # of lines with tokens on them */
+  int        status;
+
+  r->text       = line;
+  r->offset     = ra->pos;
+  r->linenumber = ra->linenumber;
+  r->len        = 0;
+  r->status     = eslOK;
+  r->hmm        = NULL;
+  r->abc        = NULL;
+  r->errline    = 0;
+  r->errbuf[0]  = '\0';
+
+  for (; line < end; line = eol)
+    {
+      if ((eol = memchr(line, '\n', end - line)) == NULL) eol = end; else eol++;
+      nlines++;
+
+      for (c = line; c < eol && (*c == ' ' || *c == '\t'); c++) ;
+      if (c == eol || *c == '\n' || *c == '\r' || *c == '#') continue;  /* blank or comment line */
+      ndata++;
+
+      if (eol - c >= 2 && c[0] == '/' && c[1] == '/' &&
+	  (c + 2 == eol || c[2] == ' ' || c[2] == '\t' || c[2] == '\n' || c[2] == '\r'))
+	{ line = eol; break; }
+    }
+
+  /* a last record with no // is passed along, so the parser reports it */
+  if (ndata > 0) r->len = line - r->text;
+  ra->pos        = line - ra->map;
+  ra->linenumber += nlines;
+
+  if (r->len > 0 && (status = p7_scheduler_Submit(ra->sch, r->grp, readahead_parse, r)) != eslOK)
+    {
+      r->status = status;
+      strcpy(r->errbuf, "failed to queue a parsing task");
+    }
+}
+
+/* readahead_parse()
+ * Task: parse the record in slot <arg>. <workeridx> is unused.
+ */
+static void
+readahead_parse(void *arg, int workeridx)
+{
+  P7_RASLOT  *r   = (P7_RASLOT *) arg;
+  P7_HMMFILE *rfp = NULL;
+
+  if ((r->status = p7_hmmfile_OpenBuffer(r->text, (int) r->len, &rfp)) != eslOK || rfp->format != r->ra->format)
+    {
+      if (r->status != eslEMEM) r->status = eslEFORMAT;
+      r->errline = (rfp ? rfp->efp->linenumber + r->linenumber - 1 : r->linenumber);
+      snprintf(r->errbuf, eslERRBUFSIZE, "Didn't find %s tag: bad format or not a HMMER save file?", r->ra->tag);
+      p7_hmmfile_Close(rfp);
+      return;
+    }
+  rfp->efp->linenumber += r->linenumber - 1;   /* count lines from the start of the file, not the record */
+
+  if ((r->status = p7_hmmfile_Read(rfp, &(r->abc), &(r->hmm))) == eslOK)
+    r->hmm->offset = r->offset;
+  else
+    {
+      r->errline = rfp->efp->linenumber;
+      strcpy(r->errbuf, rfp->errbuf);
+    }
+  p7_hmmfile_Close(rfp);
+}
+
+/* readahead_read()
+ * The read-ahead version of p7_hmmfile_Read(): return the model in
+ * the head slot, once its parse is done, and refill the slot.
+ */
+static int
+readahead_read(P7_HMMFILE *hfp, ESL_ALPHABET **ret_abc, P7_HMM **opt_hmm)
+{
+  struct p7_readahead_s *ra  = hfp->ra;
+  P7_RASLOT             *r   = &(ra->slot[ra->head]);
+  P7_HMM                *hmm = NULL;
+  int                    status;
+
+  hfp->errbuf[0] = '\0';
+  if ((status = p7_taskgroup_Wait(r->grp)) != eslOK) goto ERROR;
+  if (r->len == 0) { status = eslEOF; goto ERROR; }
+
+  hmm    = r->hmm;
+  r->hmm = NULL;
+  if ((status = r->status) != eslOK)
+    {
+      strcpy(hfp->errbuf, r->errbuf);
+      hfp->efp->linenumber = r->errline;
+    }
+  else if (*ret_abc == NULL)
+    {
+      *ret_abc = r->abc;	/* the caller takes the alphabet made for this model */
+      r->abc   = NULL;
+    }
+  else if ((*ret_abc)->type != r->abc->type)
+    {
+      status = eslEINCOMPAT;
+      snprintf(hfp->errbuf, eslERRBUFSIZE, "Alphabet type mismatch: was %s, but current HMM says %s",
+	       esl_abc_DecodeType((*ret_abc)->type), esl_abc_DecodeType(r->abc->type));
+    }
+  else hmm->abc = *ret_abc;
+
+  if (r->abc) esl_alphabet_Destroy(r->abc);
+  r->abc = NULL;
+  if (status != eslOK) { p7_hmm_Destroy(hmm); hmm = NULL; }
+
+  readahead_next(ra, ra->head);
+  ra->head = (ra->head + 1) % ra->nslots;
+
+  if (status != eslOK) goto ERROR;
+  if (opt_hmm) *opt_hmm = hmm; else p7_hmm_Destroy(hmm);
+  return eslOK;
+
+ ERROR:
+  if (opt_hmm) *opt_hmm = NULL;
+  return status;
+}
+
+/* readahead_destroy()
+ * Stop the workers and free a read-ahead, with any models it holds.
+ */
+static void
+readahead_destroy(struct p7_readahead_s *ra)
+{
+  int i;
+
+  if (ra == NULL) return;
+  p7_scheduler_Destroy(ra->sch);  /* runs any parses still queued */
+  if (ra->slot)
+    for (i = 0; i < ra->nslots; i++)
+      {
+	p7_hmm_Destroy(ra->slot[i].hmm);
+	if (ra->slot[i].abc) esl_alphabet_Destroy(ra->slot[i].abc);
+	p7_taskgroup_Destroy(ra->slot[i].grp);
+      }
+  if (ra->map) munmap(ra->map, ra->mapsize);
+  free(ra->slot);
+  free(ra);
+}
+#endif /*HMMER_THREADS && HAVE_MMAP*/
 /*---------------- end, private utilities -----------------------*/
 
 
@@ -2269,6 +3090,7 @@ static ESL_OPTIONS options[] = {
   /* name           type      default  env  range toggles reqs incomp  help                                  docgroup*/
   { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",  0 },
   { "-a",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "include time of profile configuration", 0 }, 
+  { "-c",        eslARG_INT,      "0", NULL, "n>=0",NULL,  NULL, NULL, "parse ahead with <n> worker threads (0=serial)", 0 }, 
   { "-v",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "verbose: print model info as they're read", 0 }, 
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
@@ -2299,6 +3121,8 @@ main(int argc, char **argv)
   else if (status == eslEFORMAT)   p7_Fail("File format problem in trying to open HMM file %s.\n%s\n",                hmmfile, errbuf);
   else if (status != eslOK)        p7_Fail("Unexpected error %d in opening HMM file %s.\n%s\n",               status, hmmfile, errbuf);  
 
+  if (esl_opt_GetInteger(go, "-c") > 0) p7_hmmfile_ReadAhead(hfp, esl_opt_GetInteger(go, "-c"));
+
   while ((status = p7_hmmfile_Read(hfp, &abc, &hmm)) == eslOK)
     {
       if (nmodel == 0) {   /* first time initialization, now that alphabet known */
@@ -2348,6 +3172,7 @@ main(int argc, char **argv)
  * 7. Unit tests.
  *****************************************************************/
 #ifdef p7HMMFILE_TESTDRIVE
+#include "esl_random.h"
 
 /* utest_io_30: tests read/write for 3.0 save files.
  *              Caller provides a named tmpfile that we can
@@ -2446,6 +3271,80 @@ utest_io_3a(char *tmpfile, P7_HMM *hmm)
   return eslOK;
 }
 
+
+/* utest_readahead: a multi-model ASCII file read with 
+ *                  p7_hmmfile_ReadAhead() gives the same models, in the
+ *                  same order, with the same disk offsets, as a serial read.
+ */
+static int
+utest_readahead(ESL_RANDOMNESS *r, char *tmpfile, ESL_ALPHABET *abc)
+{
+  FILE         *fp     = NULL;
+  P7_HMMFILE   *hfp    = NULL;
+  P7_HMM      **hmm    = NULL;
+  P7_HMM       *new    = NULL;
+  ESL_ALPHABET *newabc = NULL;
+  int           nhmm   = 23;
+  int           i;
+  int           status;
+  char          msg[] = "read-ahead unit test failed";
+
+  ESL_ALLOC(hmm, sizeof(P7_HMM *) * nhmm);
+  if ((fp = fopen(tmpfile, "w")) == NULL) esl_fatal(msg);
+  for (i = 0; i < nhmm; i++)
+    {
+      if (p7_hmm_Sample(r, 1 + esl_rnd_Roll(r, 100), abc, &new) != eslOK) esl_fatal(msg);
+      if (p7_hmmfile_WriteASCII(fp, -1, new)                    != eslOK) esl_fatal(msg);
+      p7_hmm_Destroy(new);
+    }
+  fclose(fp);
+
+  /* serial read */
+  if (p7_hmmfile_OpenE(tmpfile, NULL, &hfp, NULL) != eslOK)  esl_fatal(msg);
+  for (i = 0; i < nhmm; i++)
+    if (p7_hmmfile_Read(hfp, &newabc, &(hmm[i]))  != eslOK)  esl_fatal(msg);
+  p7_hmmfile_Close(hfp);
+
+  /* read-ahead, starting both on a new file and after the first model */
+  if (p7_hmmfile_OpenE(tmpfile, NULL, &hfp, NULL) != eslOK)  esl_fatal(msg);
+  status = p7_hmmfile_ReadAhead(hfp, 3);
+  if (status != eslOK && status != eslENORESULT)             esl_fatal(msg);
+  for (i = 0; i < nhmm; i++)
+    {
+      if (p7_hmmfile_Read(hfp, &newabc, &new)     != eslOK)  esl_fatal(msg);
+      if (p7_hmm_Compare(hmm[i], new, 0.0001)     != eslOK)  esl_fatal(msg);
+      if (new->offset != hmm[i]->offset)                     esl_fatal(msg);
+      if (new->abc    != newabc)                             esl_fatal(msg);
+      p7_hmm_Destroy(new);
+    }
+  if (p7_hmmfile_Read(hfp, &newabc, &new)         != eslEOF) esl_fatal(msg);
+  p7_hmmfile_Close(hfp);
+
+  if (p7_hmmfile_OpenE(tmpfile, NULL, &hfp, NULL) != eslOK)  esl_fatal(msg);
+  if (p7_hmmfile_Read(hfp, &newabc, &new)         != eslOK)  esl_fatal(msg);
+  p7_hmm_Destroy(new);
+  status = p7_hmmfile_ReadAhead(hfp, 2);
+  if (status != eslOK && status != eslENORESULT)             esl_fatal(msg);
+  for (i = 1; i < nhmm; i++)
+    {
+      if (p7_hmmfile_Read(hfp, &newabc, &new)     != eslOK)  esl_fatal(msg);
+      if (p7_hmm_Compare(hmm[i], new, 0.0001)     != eslOK)  esl_fatal(msg);
+      if (new->offset != hmm[i]->offset)                     esl_fatal(msg);
+      p7_hmm_Destroy(new);
+    }
+  if (p7_hmmfile_Read(hfp, &newabc, &new)         != eslEOF) esl_fatal(msg);
+  p7_hmmfile_Close(hfp);
+
+  for (i = 0; i < nhmm; i++) p7_hmm_Destroy(hmm[i]);
+  free(hmm);
+  esl_alphabet_Destroy(newabc);
+  return eslOK;
+
+ ERROR:
+  esl_fatal(msg);
+  return status;
+}
+
 #endif /*p7HMMFILE_TESTDRIVE*/
 /*-------------------- end, unit tests --------------------------*/
 
@@ -2496,6 +3395,9 @@ main(int argc, char **argv)
   utest_io_3a     (tmpfile, hmm);
   p7_hmm_Destroy(hmm);
 
+  utest_readahead(r, tmpfile, aa_abc);
+  utest_readahead(r, tmpfile, nt_abc);
+
   esl_alphabet_Destroy(aa_abc);
   esl_alphabet_Destroy(nt_abc);
   esl_randomness_Destroy(r);
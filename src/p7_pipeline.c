@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h> 
+#include <math.h>
 
 #include "easel.h"
 #include "esl_exponential.h"
@@ -34,6 +35,26 @@ typedef struct {
 } P7_PIPELINE_LONGTARGET_OBJS;
 
 
+/* Quick rejection at the filter stages. A bit score <sc> below a
+ * threshold's score cutoff (see p7_pipeline_Create()) fails it
+ * without computing its P-value. The margin, in bits, covers roundoff
+ * in the cutoff: scores close to it still get the exact P-value test,
+ * so the result is the same as without this shortcut.
+ */
+#define p7_PLI_CUTOFF_MARGIN 0.01
+
+static inline int
+gumbel_fails(float sc, float mu, float lambda, double g)
+{
+  return (sc < mu + g / lambda - p7_PLI_CUTOFF_MARGIN);
+}
+
+static inline int
+exp_fails(float sc, float tau, float lambda, double e)
+{
+  return (sc < tau + e / lambda - p7_PLI_CUTOFF_MARGIN);
+}
+
 /*****************************************************************
  * 1. The P7_PIPELINE object: allocation, initialization, destruction.
  *****************************************************************/
@@ -229,6 +250,15 @@ p7_pipeline_Create(ESL_GETOPTS *go, int M_hint, int L_hint, int long_targets, en
     }
   if (go && esl_opt_GetBoolean(go, "--nonull2")) pli->do_null2      = FALSE;
   if (go && esl_opt_GetBoolean(go, "--nobias"))  pli->do_biasfilter = FALSE;
+
+  /* The filter thresholds as score cutoffs, less the per-model
+   * parameters: a Gumbel survival P(S > x) <= F at x >= mu + g/lambda,
+   * g = -log(-log(1-F)); an exponential one at x >= mu + e/lambda,
+   * e = -log F. A threshold of 1 rejects nothing.
+   */
+  pli->F1_g = (pli->F1 < 1.0) ? -log(-log1p(-pli->F1)) : -eslINFINITY;
+  pli->F2_g = (pli->F2 < 1.0) ? -log(-log1p(-pli->F2)) : -eslINFINITY;
+  pli->F3_e = (pli->F3 < 1.0) ? -log(pli->F3)          : -eslINFINITY;
   
 
   /* Accounting as we collect results */
@@ -248,6 +278,7 @@ p7_pipeline_Create(ESL_GETOPTS *go, int M_hint, int L_hint, int long_targets, en
   pli->show_accessions = (go && esl_opt_GetBoolean(go, "--acc")   ? TRUE  : FALSE);
   pli->show_alignments = (go && esl_opt_GetBoolean(go, "--noali") ? FALSE : TRUE);
   pli->hfp             = NULL;
+  pli->olen.L          = -1;
   pli->errbuf[0]       = '\0';
 
   return pli;
@@ -570,6 +601,11 @@ p7_pli_NewModelThresholds(P7_PIPELINE *pli, const P7_OPROFILE *om)
  * Purpose:   Caller has a new sequence <sq>. Prepare the pipeline <pli>
  *            to receive this model as either a query or a target.
  *
+ *            In a "scan" pipeline, every target model is configured
+ *            for the length of query <sq>, so the length parameters
+ *            are computed here once, in <pli->olen>, for
+ *            <p7_oprofile_SetLength()>.
+ *
  * Returns:   <eslOK> on success.
  */
 int
@@ -578,6 +614,7 @@ p7_pli_NewSeq(P7_PIPELINE *pli, const ESL_SQ *sq)
   if (!pli->long_targets) pli->nseqs++; // if long_targets, sequence counting happens in the serial loop, which can track multiple windows for a single long sequence
   pli->nres += sq->n;
   if (pli->Z_setby == p7_ZSETBY_NTARGETS && pli->mode == p7_SEARCH_SEQS) pli->Z = pli->nseqs;
+  if (pli->mode == p7_SCAN_MODELS) p7_oprofile_ComputeLength(&(pli->olen), sq->n);
   return eslOK;
 }
 
@@ -638,6 +675,54 @@ p7_pipeline_Merge(P7_PIPELINE *p1, P7_PIPELINE *p2)
   return eslOK;
 }
 
+/* Function:  p7_pli_ScanMSV()
+ * Synopsis:  Run only the MSV filter of a scan pipeline.
+ *
+ * Purpose:   In a scan pipeline, compare the MSV part of a target
+ *            profile, in <om>, against query sequence <sq>, and set
+ *            <*ret_pass> to TRUE if it passes the MSV filter's
+ *            P-value threshold <pli->F1>. <om> is usually a shell
+ *            pointed at a compact MSV profile
+ *            (<p7_oprofile_ShadowMSV()>), with its MSV length already
+ *            set; <bg>'s length must be set to <sq->n>.
+ *
+ *            This lets a caller with a resident database of compact
+ *            MSV profiles look at a target's full profile only when
+ *            it survives: the caller then calls <p7_pli_NewModel()>
+ *            and <p7_Pipeline()> on the full profile, which repeat
+ *            the MSV filter (with the same result) and do all of
+ *            its accounting. For a target that fails, <pli> counts
+ *            it here, as <p7_pli_NewModel()> would have.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_pli_ScanMSV(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, int *ret_pass)
+{
+  float  usc, nullsc;
+  float  seq_score;
+  double P;
+
+  *ret_pass = TRUE;
+  if (sq->n == 0) return eslOK; /* let p7_Pipeline() skip it */
+
+  p7_omx_GrowTo(pli->oxf, om->M, 0, sq->n);
+  p7_bg_NullOne(bg, sq->dsq, sq->n, &nullsc);
+  p7_MSVFilter (sq->dsq, sq->n, om, pli->oxf, &usc);
+  seq_score = (usc - nullsc) / eslCONST_LOG2;
+  if (! gumbel_fails(seq_score, om->evparam[p7_MMU], om->evparam[p7_MLAMBDA], pli->F1_g))
+    {
+      P = esl_gumbel_surv(seq_score,  om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
+      if (P <= pli->F1) return eslOK;
+    }
+
+  pli->nmodels++;
+  pli->nnodes += om->M;
+  if (pli->Z_setby == p7_ZSETBY_NTARGETS) pli->Z = pli->nmodels;
+  *ret_pass = FALSE;
+  return eslOK;
+}
+
 /* Function:  p7_Pipeline()
  * Synopsis:  HMMER3's accelerated seq/profile comparison pipeline.
  *
@@ -692,6 +777,7 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
   /* First level filter: the MSV filter, multihit with <om> */
   p7_MSVFilter(sq->dsq, sq->n, om, pli->oxf, &usc);
   seq_score = (usc - nullsc) / eslCONST_LOG2;
+  if (gumbel_fails(seq_score, om->evparam[p7_MMU], om->evparam[p7_MLAMBDA], pli->F1_g)) return eslOK;
   P = esl_gumbel_surv(seq_score,  om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
   if (P > pli->F1) return eslOK;
   pli->n_past_msv++;
@@ -701,6 +787,7 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
     {
       p7_bg_FilterScore(bg, sq->dsq, sq->n, &filtersc);
       seq_score = (usc - filtersc) / eslCONST_LOG2;
+      if (gumbel_fails(seq_score, om->evparam[p7_MMU], om->evparam[p7_MLAMBDA], pli->F1_g)) return eslOK;
       P = esl_gumbel_surv(seq_score,  om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
       if (P > pli->F1) return eslOK;
     }
@@ -710,8 +797,10 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
   /* In scan mode, if it passes the MSV filter, read the rest of the profile */
   if (pli->mode == p7_SCAN_MODELS)
     {
-      if (pli->hfp) p7_oprofile_ReadRest(pli->hfp, om);
-      p7_oprofile_ReconfigRestLength(om, sq->n);
+      if (pli->hfp && om->base_w == 0 && om->scale_w == 0) // unless another query in a batched scan already read it
+	p7_oprofile_ReadRest(pli->hfp, om);
+      if (pli->olen.L == sq->n) p7_oprofile_SetRestLength(om, &(pli->olen));
+      else                      p7_oprofile_ReconfigRestLength(om, sq->n);
       if ((status = p7_pli_NewModelThresholds(pli, om)) != eslOK) return status; /* pli->errbuf has err msg set */
     }
 
@@ -720,6 +809,7 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
     {
       p7_ViterbiFilter(sq->dsq, sq->n, om, pli->oxf, &vfsc);  
       seq_score = (vfsc-filtersc) / eslCONST_LOG2;
+      if (gumbel_fails(seq_score, om->evparam[p7_VMU], om->evparam[p7_VLAMBDA], pli->F2_g)) return eslOK;
       P  = esl_gumbel_surv(seq_score,  om->evparam[p7_VMU],  om->evparam[p7_VLAMBDA]);
       if (P > pli->F2) return eslOK;
     }
@@ -729,6 +819,7 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
   /* Parse it with Forward and obtain its real Forward score. */
   p7_ForwardParser(sq->dsq, sq->n, om, pli->oxf, &fwdsc);
   seq_score = (fwdsc-filtersc) / eslCONST_LOG2;
+  if (exp_fails(seq_score, om->evparam[p7_FTAU], om->evparam[p7_FLAMBDA], pli->F3_e)) return eslOK;
   P = esl_exp_surv(seq_score,  om->evparam[p7_FTAU],  om->evparam[p7_FLAMBDA]);
   if (P > pli->F3) return eslOK;
   pli->n_past_fwd++;
@@ -0,0 +1,1297 @@
+/* Scheduling target work for the multithreaded search programs.
+ *
+ * Contents:
+ *   1. P7_BLOCKREADER: target sequence blocks bounded by DP cost.
+ *   2. P7_NUMA:        pinning threads to NUMA nodes.
+ *   3. P7_SCHEDULER:   work-stealing task scheduler.
+ *   4. P7_TASKGROUP:   waiting on a set of tasks.
+ *   5. P7_BLOCKPOOL:   reusable target sequence blocks.
+ *   6. Unit tests.
+ *   7. Test driver.
+ */
+#define _GNU_SOURCE		/* cpu_set_t, pthread_setaffinity_np() */
+#include "p7_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#endif
+
+#include "easel.h"
+#include "esl_sq.h"
+#include "esl_sqio.h"
+
+#include "hmmer.h"
+#include "p7_scheduler.h"
+
+/*****************************************************************
+ * 1. P7_BLOCKREADER: target sequence blocks bounded by DP cost.
+ *****************************************************************/
+
+/* sq_swap()
+ * Exchange the contents of two digital sequence objects. Sequences
+ * are moved between blocks by value, without copying residues.
+ */
+static void
+sq_swap(ESL_SQ *sq1, ESL_SQ *sq2)
+{
+  ESL_SQ tmp = *sq1;
+  *sq1 = *sq2;
+  *sq2 = tmp;
+}
+
+/* Function:  p7_blockreader_Create()
+ * Synopsis:  Create a cost-bounded target block reader.
+ *
+ * Purpose:   Create a reader that fills target sequence blocks from
+ *            open digital sequence file <sqfp>, for a query of
+ *            length <M>. At most <nleft> targets are read, or all of
+ *            them if <nleft> is -1 (same as <--restrictdb_n>).
+ *
+ *            The cost of one target of length L is L*M DP cells.
+ *            Blocks are cut when their summed cost reaches
+ *            <p7_BLOCKCELLS>, so a block of long targets holds
+ *            fewer sequences than a block of short ones, and the
+ *            time each worker spends on a block is roughly even.  A
+ *            target that alone costs a quarter of the budget or more
+ *            is put in a block by itself.
+ *
+ * Returns:   ptr to the new reader.
+ *
+ * Throws:    <NULL> on allocation failure.
+ */
+P7_BLOCKREADER *
+p7_blockreader_Create(ESL_SQFILE *sqfp, int M, int nleft)
+{
+  P7_BLOCKREADER *br = NULL;
+  int             status;
+
+  ESL_ALLOC(br, sizeof(P7_BLOCKREADER));
+  br->sqfp       = sqfp;
+  br->held       = NULL;
+  br->nheld      = 0;
+  br->M          = ESL_MAX(1, M);
+  br->max_cells  = p7_BLOCKCELLS;
+  br->long_cells = p7_BLOCKCELLS / 4;
+  br->nleft      = nleft;
+
+  if ((br->held = esl_sq_CreateDigital(sqfp->abc)) == NULL) goto ERROR;
+  return br;
+
+ ERROR:
+  p7_blockreader_Destroy(br);
+  return NULL;
+}
+
+
+/* Function:  p7_blockreader_Read()
+ * Synopsis:  Read the next block of targets.
+ *
+ * Purpose:   Read the next block of target sequences into <block>,
+ *            replacing its contents. The block is filled until it
+ *            holds <block->listSize> sequences, or its DP cost
+ *            reaches the reader's cell budget, or a long target is
+ *            read.
+ *
+ *            A long target that is read behind other sequences ends
+ *            the block without being added to it; it is held by the
+ *            reader and returned by the next call as a block of its
+ *            own. Long targets are therefore dispatched as separate
+ *            work units as soon as they are seen, instead of
+ *            dragging out the runtime of a whole block of short
+ *            ones. The order of targets is otherwise unchanged.
+ *
+ *            The sequences in <block> must have been reset with
+ *            <esl_sq_Reuse()> by whoever processed them, as
+ *            the workers in the search programs do.
+ *
+ * Returns:   <eslOK> on success; <block> contains at least one
+ *            sequence.
+ *
+ *            <eslEOF> if no targets are left; <block->count> is 0.
+ *
+ *            <eslEFORMAT> on a parse error in the sequence file;
+ *            error message is in the <ESL_SQFILE>. Other codes
+ *            propagate from <esl_sqio_Read()>.
+ */
+int
+p7_blockreader_Read(P7_BLOCKREADER *br, ESL_SQ_BLOCK *block)
+{
+  int64_t cells  = 0;
+  int64_t sqcost;
+  int     maxseq = block->listSize;
+  int     status = eslOK;
+  int     i;
+
+  block->count        = 0;
+  block->complete     = TRUE;
+  block->first_seqidx = -1;
+
+  if (br->nheld)
+    {
+      sq_swap(br->held, block->list);
+      br->nheld    = 0;
+      block->count = 1;
+      return eslOK;
+    }
+
+  if (br->nleft >= 0) maxseq = ESL_MIN(maxseq, br->nleft);
+
+  for (i = 0; i < maxseq && cells < br->max_cells; i++)
+    {
+      if ((status = esl_sqio_Read(br->sqfp, block->list + i)) != eslOK) break;
+      if (br->nleft > 0) br->nleft--;
+
+      sqcost = block->list[i].n * br->M;
+      if (sqcost >= br->long_cells && i > 0)
+	{ /* long target behind others: hold it for a block of its own */
+	  sq_swap(block->list + i, br->held);
+	  br->nheld = 1;
+	  break;
+	}
+
+      cells += sqcost;
+      block->count++;
+      if (sqcost >= br->long_cells) break; /* long target at head of the block: it goes alone */
+    }
+
+  if (status == eslEOF && block->count > 0)  status = eslOK;
+  if (status == eslOK  && block->count == 0) status = eslEOF;
+  return status;
+}
+
+
+/* Function:  p7_blockreader_Destroy()
+ * Synopsis:  Free a block reader.
+ *
+ * Purpose:   Free a block reader. The sequence file it reads from is
+ *            not closed; a held long target, if any, is discarded.
+ */
+void
+p7_blockreader_Destroy(P7_BLOCKREADER *br)
+{
+  if (! br) return;
+  if (br->held) esl_sq_Destroy(br->held);
+  free(br);
+}
+/*------------------ end, P7_BLOCKREADER ------------------------*/
+
+
+
+/*****************************************************************
+ * 2. P7_NUMA: pinning threads to NUMA nodes.
+ *****************************************************************/
+#ifdef HMMER_THREADS
+
+static int numa_parse_cpulist(const char *s, int **ret_cpu, int *ret_n);
+
+/* Function:  p7_numa_Create()
+ * Synopsis:  Get the machine's NUMA topology.
+ *
+ * Purpose:   Find the NUMA nodes of this machine and the cpus on
+ *            each, from </sys/devices/system/node/node<n>/cpulist>.
+ *            Nodes without cpus (memory-only nodes) are skipped.
+ *            Where the topology isn't available, the machine is
+ *            treated as one node, and <p7_numa_Bind()> does nothing.
+ *
+ * Returns:   ptr to the new <P7_NUMA>.
+ *
+ * Throws:    <NULL> on allocation failure.
+ */
+P7_NUMA *
+p7_numa_Create(void)
+{
+  P7_NUMA *numa   = NULL;
+  FILE    *fp     = NULL;
+  int      nalloc = 4;
+  int      k;
+  char     path[64];
+  char     line[4096];
+  void    *tmp;
+  int      status;
+
+  ESL_ALLOC(numa, sizeof(P7_NUMA));
+  numa->nnodes = 0;
+  numa->ncpus  = NULL;
+  numa->cpu    = NULL;
+  ESL_ALLOC(numa->ncpus, sizeof(int)   * nalloc);
+  ESL_ALLOC(numa->cpu,   sizeof(int *) * nalloc);
+
+  for (k = 0; ; k++)
+    {
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", k);
+      if ((fp = fopen(path, "r")) == NULL) break;
+      if (fgets(line, sizeof(line), fp) == NULL) line[0] = '\0';
+      fclose(fp);
+
+      if (numa->nnodes == nalloc)
+	{
+	  nalloc *= 2;
+	  ESL_RALLOC(numa->ncpus, tmp, sizeof(int)   * nalloc);
+	  ESL_RALLOC(numa->cpu,   tmp, sizeof(int *) * nalloc);
+	}
+      if ((status = numa_parse_cpulist(line, &(numa->cpu[numa->nnodes]), &(numa->ncpus[numa->nnodes]))) != eslOK) goto ERROR;
+      if (numa->ncpus[numa->nnodes] > 0) numa->nnodes++;
+      else                               free(numa->cpu[numa->nnodes]);
+    }
+
+  if (numa->nnodes == 0)
+    {
+      numa->ncpus[0] = 0;
+      numa->cpu[0]   = NULL;
+      numa->nnodes   = 1;
+    }
+  return numa;
+
+ ERROR:
+  p7_numa_Destroy(numa);
+  return NULL;
+}
+
+
+/* Function:  p7_numa_Bind()
+ * Synopsis:  Pin the calling thread to a NUMA node.
+ *
+ * Purpose:   Restrict the calling thread to the cpus of node
+ *            <node> (taken modulo the number of nodes). Memory the
+ *            thread then allocates and first touches is placed on
+ *            that node by the kernel's first-touch policy.
+ *
+ *            Does nothing if <numa> is <NULL>, if the topology is
+ *            unknown, or if the system has no <pthread_setaffinity_np()>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslESYS> if the affinity call fails.
+ */
+int
+p7_numa_Bind(const P7_NUMA *numa, int node)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+  int       i;
+
+  if (numa == NULL) return eslOK;
+  node %= numa->nnodes;
+  if (numa->ncpus[node] == 0) return eslOK;
+
+  CPU_ZERO(&set);
+  for (i = 0; i < numa->ncpus[node]; i++)
+    if (numa->cpu[node][i] < CPU_SETSIZE) CPU_SET(numa->cpu[node][i], &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) ESL_EXCEPTION(eslESYS, "pthread_setaffinity_np() failed");
+#endif
+  return eslOK;
+}
+
+
+/* Function:  p7_numa_Destroy()
+ * Synopsis:  Free a <P7_NUMA>.
+ */
+void
+p7_numa_Destroy(P7_NUMA *numa)
+{
+  int n;
+
+  if (! numa) return;
+  if (numa->cpu)
+    {
+      for (n = 0; n < numa->nnodes; n++)
+	if (numa->cpu[n]) free(numa->cpu[n]);
+      free(numa->cpu);
+    }
+  if (numa->ncpus) free(numa->ncpus);
+  free(numa);
+}
+
+
+/* numa_parse_cpulist()
+ * Parse a Linux cpu list such as "0-7,16-23" into an allocated array
+ * of cpu ids <*ret_cpu> of length <*ret_n>.
+ */
+static int
+numa_parse_cpulist(const char *s, int **ret_cpu, int *ret_n)
+{
+  int  *cpu    = NULL;
+  int   n      = 0;
+  int   nalloc = 0;
+  long  lo, hi;
+  char *end;
+  void *tmp;
+  int   status;
+
+  while (*s)
+    {
+      if (! isdigit((int) *s)) { s++; continue; }
+      lo = hi = strtol(s, &end, 10);
+      s  = end;
+      if (*s == '-') { hi = strtol(s+1, &end, 10); s = end; }
+
+      for ( ; lo <= hi; lo++)
+	{
+	  if (n == nalloc) {
+	    nalloc = (nalloc == 0) ? 16 : nalloc * 2;
+	    ESL_RALLOC(cpu, tmp, sizeof(int) * nalloc);
+	  }
+	  cpu[n++] = (int) lo;
+	}
+    }
+
+  *ret_cpu = cpu;
+  *ret_n   = n;
+  return eslOK;
+
+ ERROR:
+  if (cpu) free(cpu);
+  *ret_cpu = NULL;
+  *ret_n   = 0;
+  return status;
+}
+
+#endif /*HMMER_THREADS*/
+/*---------------------- end, P7_NUMA ---------------------------*/
+
+
+
+/*****************************************************************
+ * 3. P7_SCHEDULER: work-stealing task scheduler.
+ *****************************************************************/
+#ifdef HMMER_THREADS
+
+struct p7_schedarg_s {
+  P7_SCHEDULER *sch;
+  int           wid;		/* worker index, 0..nworkers-1 */
+};
+
+/* The counters that every submission and every task touch are
+ * updated with atomic builtins (full barriers) instead of under the
+ * scheduler mutex, which is only taken to sleep and to wake.
+ */
+#define SCHED_ATOMIC_ADD(p, v) __sync_add_and_fetch((p), (v))
+#define SCHED_ATOMIC_GET(p)    __sync_add_and_fetch((p), 0)
+
+static int   taskqueue_Init   (P7_TASKQUEUE *tq);
+static int   taskqueue_Push   (P7_TASKQUEUE *tq, const P7_TASK *task);
+static int   taskqueue_Pop    (P7_TASKQUEUE *tq, P7_TASK *ret_task);
+static int   taskqueue_Steal  (P7_TASKQUEUE *tq, P7_TASK *ret_task);
+static void  taskqueue_Destroy(P7_TASKQUEUE *tq);
+static void  taskgroup_Add    (P7_TASKGROUP *grp);
+static void  taskgroup_Done   (P7_TASKGROUP *grp);
+static int   scheduler_next_task(P7_SCHEDULER *sch, int wid, P7_TASK *ret_task);
+static void *scheduler_thread (void *arg);
+
+/* Function:  p7_scheduler_Create()
+ * Synopsis:  Start a pool of worker threads.
+ *
+ * Purpose:   Create a scheduler with <nworkers> worker threads, each
+ *            with its own task deque. Tasks submitted with
+ *            <p7_scheduler_Submit()> are spread over the deques; a
+ *            worker runs the newest task of its own deque first, and
+ *            when that is empty steals the oldest task of another
+ *            before it sleeps. Unlike a single shared work queue, the
+ *            workers never wait for the caller to finish one query
+ *            before starting the work of the next.
+ *
+ *            If <numa> is non-<NULL>, worker <i> is pinned to NUMA
+ *            node <i % numa->nnodes>, and idle workers steal from
+ *            workers on their own node first. <numa> must remain
+ *            valid until the scheduler is destroyed.
+ *
+ *            Each worker thread calls <impl_Init()> before it runs
+ *            any task.
+ *
+ * Returns:   ptr to the new scheduler.
+ *
+ * Throws:    <NULL> on allocation failure, or if a thread can't be
+ *            started.
+ */
+P7_SCHEDULER *
+p7_scheduler_Create(int nworkers, const P7_NUMA *numa)
+{
+  P7_SCHEDULER *sch = NULL;
+  int           i;
+  int           status;
+
+  ESL_ALLOC(sch, sizeof(P7_SCHEDULER));
+  sch->nworkers = 0;
+  sch->nthreads = 0;
+  sch->thread   = NULL;
+  sch->q        = NULL;
+  sch->arg      = NULL;
+  sch->numa     = numa;
+  sch->node     = NULL;
+  sch->nqueued  = 0;
+  sch->nidle    = 0;
+  sch->next     = 0;
+  sch->shutdown = FALSE;
+
+  if (pthread_key_create(&sch->self, NULL) != 0) { free(sch); return NULL; }
+  if (pthread_mutex_init(&sch->mutex, NULL) != 0) { pthread_key_delete(sch->self); free(sch); return NULL; }
+  if (pthread_cond_init (&sch->work,  NULL) != 0) { pthread_mutex_destroy(&sch->mutex); pthread_key_delete(sch->self); free(sch); return NULL; }
+
+  ESL_ALLOC(sch->thread, sizeof(pthread_t)            * nworkers);
+  ESL_ALLOC(sch->arg,    sizeof(struct p7_schedarg_s) * nworkers);
+  ESL_ALLOC(sch->q,      sizeof(P7_TASKQUEUE)         * nworkers);
+  ESL_ALLOC(sch->node,   sizeof(int)                  * nworkers);
+  for (i = 0; i < nworkers; i++)
+    sch->node[i] = (numa ? i % numa->nnodes : 0);
+
+  /* all queues exist before any thread starts looking at them */
+  for (sch->nworkers = 0; sch->nworkers < nworkers; sch->nworkers++)
+    if (taskqueue_Init(&sch->q[sch->nworkers]) != eslOK) goto ERROR;
+
+  for (i = 0; i < nworkers; i++)
+    {
+      sch->arg[i].sch = sch;
+      sch->arg[i].wid = i;
+      if (pthread_create(&sch->thread[i], NULL, scheduler_thread, &sch->arg[i]) != 0) goto ERROR;
+      sch->nthreads++;
+    }
+  return sch;
+
+ ERROR:
+  p7_scheduler_Destroy(sch);
+  return NULL;
+}
+
+
+/* Function:  p7_scheduler_Submit()
+ * Synopsis:  Queue a task for the workers.
+ *
+ * Purpose:   Queue a task that calls <func(arg, workeridx)> on one of
+ *            the workers of <sch>. <workeridx> is the index of the
+ *            worker that runs it, so a task can use per-worker
+ *            state. If <grp> is non-<NULL>, the task is counted in
+ *            that task group until it finishes.
+ *
+ *            A task submitted by another task goes on the deque of
+ *            the worker running it, which runs it next; other
+ *            submissions are spread round-robin, and run oldest
+ *            first, so work submitted for one query is done before
+ *            work submitted for the next.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> on a pthreads
+ *            call failure. The task is not queued.
+ */
+int
+p7_scheduler_Submit(P7_SCHEDULER *sch, P7_TASKGROUP *grp, void (*func)(void *, int), void *arg)
+{
+  struct p7_schedarg_s *sa = (struct p7_schedarg_s *) pthread_getspecific(sch->self);
+  P7_TASK               task;
+  int                   qidx;
+  int                   status;
+
+  task.func = func;
+  task.arg  = arg;
+  task.grp   = grp;
+  task.inner = (sa != NULL);
+
+  if (grp) taskgroup_Add(grp);  /* before it's queued, so it can't finish first */
+
+  if (sa != NULL) qidx = sa->wid;
+  else            qidx = (SCHED_ATOMIC_ADD(&sch->next, 1) - 1) % sch->nworkers;
+  if ((status = taskqueue_Push(&sch->q[qidx], &task)) != eslOK) goto ERROR;
+
+  /* Count the task, then look for a sleeper; a worker going to sleep
+   * counts itself idle, then looks at the count. One of the two sees
+   * the other, so the task isn't left with every worker asleep.
+   */
+  SCHED_ATOMIC_ADD(&sch->nqueued, 1);
+  if (SCHED_ATOMIC_GET(&sch->nidle) > 0)
+    {
+      if (pthread_mutex_lock(&sch->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock failed");
+      pthread_cond_signal(&sch->work);
+      if (pthread_mutex_unlock(&sch->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock failed");
+    }
+  return eslOK;
+
+ ERROR:
+  if (grp) taskgroup_Done(grp);
+  return status;
+}
+
+
+/* Function:  p7_scheduler_Destroy()
+ * Synopsis:  Stop the worker threads and free a scheduler.
+ *
+ * Purpose:   Run any tasks still queued, then stop and join the
+ *            worker threads, and free <sch>.
+ */
+void
+p7_scheduler_Destroy(P7_SCHEDULER *sch)
+{
+  int i;
+
+  if (! sch) return;
+
+  pthread_mutex_lock(&sch->mutex);
+  sch->shutdown = TRUE;
+  pthread_cond_broadcast(&sch->work);
+  pthread_mutex_unlock(&sch->mutex);
+
+  for (i = 0; i < sch->nthreads; i++) pthread_join(sch->thread[i], NULL);
+  for (i = 0; i < sch->nworkers; i++) taskqueue_Destroy(&sch->q[i]);
+
+  pthread_cond_destroy(&sch->work);
+  pthread_mutex_destroy(&sch->mutex);
+  pthread_key_delete(sch->self);
+  if (sch->q)      free(sch->q);
+  if (sch->node)   free(sch->node);
+  if (sch->arg)    free(sch->arg);
+  if (sch->thread) free(sch->thread);
+  free(sch);
+}
+
+
+/* scheduler_thread()
+ * The body of each worker: run tasks until the scheduler shuts down.
+ */
+static void *
+scheduler_thread(void *arg)
+{
+  struct p7_schedarg_s *sa  = (struct p7_schedarg_s *) arg;
+  P7_SCHEDULER         *sch = sa->sch;
+  P7_TASK               task;
+
+  if (sch->numa) p7_numa_Bind(sch->numa, sch->node[sa->wid]);
+  pthread_setspecific(sch->self, sa);
+  impl_Init();
+
+  while (scheduler_next_task(sch, sa->wid, &task) == eslOK)
+    {
+      (*task.func)(task.arg, sa->wid);
+      if (task.grp) taskgroup_Done(task.grp);
+    }
+  return NULL;
+}
+
+
+/* scheduler_next_task()
+ * Get the next task for worker <wid>: from its own deque if it has
+ * one (see taskqueue_Pop()), else the oldest stolen from the next nonempty deque
+ * after it, trying workers on the same NUMA node before the others.
+ * If nothing is queued anywhere, sleep until something is. Returns
+ * <eslOK> and the task in <ret_task>, or <eslEOF> if the scheduler is
+ * shutting down and all the deques are empty.
+ */
+static int
+scheduler_next_task(P7_SCHEDULER *sch, int wid, P7_TASK *ret_task)
+{
+  int pass;
+  int i, v;
+  int status;
+
+  while (1)
+    {
+      for (pass = 0; pass < 2; pass++)
+	for (i = 0; i < sch->nworkers; i++)
+	  {
+	    v = (wid + i) % sch->nworkers;
+	    if ((sch->node[v] == sch->node[wid]) != (pass == 0)) continue;
+	    if (v == wid) status = taskqueue_Pop  (&sch->q[v], ret_task);
+	    else          status = taskqueue_Steal(&sch->q[v], ret_task);
+	    if (status == eslOK)
+	      {
+		SCHED_ATOMIC_ADD(&sch->nqueued, -1);
+		return eslOK;
+	      }
+	  }
+
+      /* The count may briefly be off by the tasks being pushed or
+       * taken right now (even below 0), so a worker may scan again
+       * for nothing, but it never sleeps while one is queued.
+       */
+      pthread_mutex_lock(&sch->mutex);
+      SCHED_ATOMIC_ADD(&sch->nidle, 1);
+      while (SCHED_ATOMIC_GET(&sch->nqueued) <= 0 && ! sch->shutdown)
+	pthread_cond_wait(&sch->work, &sch->mutex);
+      SCHED_ATOMIC_ADD(&sch->nidle, -1);
+      if (SCHED_ATOMIC_GET(&sch->nqueued) <= 0) /* and therefore shutdown */
+	{
+	  pthread_mutex_unlock(&sch->mutex);
+	  return eslEOF;
+	}
+      pthread_mutex_unlock(&sch->mutex);
+    }
+  /*NOTREACHED*/
+  return eslOK;
+}
+
+
+/* taskqueue_*()
+ * One worker's deque of tasks, a circular buffer that grows as
+ * needed. Tasks are pushed at the tail, and thieves steal the oldest
+ * from the head. The owner pops from the tail if the newest task was
+ * submitted by a running task, else from the head: tasks submitted
+ * from outside run oldest first.
+ */
+static int
+taskqueue_Init(P7_TASKQUEUE *tq)
+{
+  int status;
+
+  tq->nalloc = 64;
+  tq->head   = 0;
+  tq->n      = 0;
+  ESL_ALLOC(tq->task, sizeof(P7_TASK) * tq->nalloc);
+  if (pthread_mutex_init(&tq->mutex, NULL) != 0) { free(tq->task); ESL_EXCEPTION(eslESYS, "pthread_mutex_init failed"); }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+static int
+taskqueue_Push(P7_TASKQUEUE *tq, const P7_TASK *task)
+{
+  P7_TASK *tmp = NULL;
+  int      i;
+  int      status;
+
+  if (pthread_mutex_lock(&tq->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock failed");
+  if (tq->n == tq->nalloc)
+    {
+      ESL_ALLOC(tmp, sizeof(P7_TASK) * tq->nalloc * 2);
+      for (i = 0; i < tq->n; i++) tmp[i] = tq->task[(tq->head + i) % tq->nalloc];
+      free(tq->task);
+      tq->task    = tmp;
+      tq->head    = 0;
+      tq->nalloc *= 2;
+    }
+  tq->task[(tq->head + tq->n) % tq->nalloc] = *task;
+  tq->n++;
+  pthread_mutex_unlock(&tq->mutex);
+  return eslOK;
+
+ ERROR:
+  pthread_mutex_unlock(&tq->mutex);
+  return status;
+}
+
+static int
+taskqueue_Pop(P7_TASKQUEUE *tq, P7_TASK *ret_task)
+{
+  int status = eslEOF;
+  int last;
+
+  pthread_mutex_lock(&tq->mutex);
+  if (tq->n > 0)
+    {
+      last = (tq->head + tq->n - 1) % tq->nalloc;
+      if (tq->task[last].inner)
+	*ret_task = tq->task[last];
+      else
+	{
+	  *ret_task = tq->task[tq->head];
+	  tq->head  = (tq->head + 1) % tq->nalloc;
+	}
+      tq->n--;
+      status = eslOK;
+    }
+  pthread_mutex_unlock(&tq->mutex);
+  return status;
+}
+
+static int
+taskqueue_Steal(P7_TASKQUEUE *tq, P7_TASK *ret_task)
+{
+  int status = eslEOF;
+
+  pthread_mutex_lock(&tq->mutex);
+  if (tq->n > 0)
+    {
+      *ret_task = tq->task[tq->head];
+      tq->head  = (tq->head + 1) % tq->nalloc;
+      tq->n--;
+      status    = eslOK;
+    }
+  pthread_mutex_unlock(&tq->mutex);
+  return status;
+}
+
+static void
+taskqueue_Destroy(P7_TASKQUEUE *tq)
+{
+  pthread_mutex_destroy(&tq->mutex);
+  free(tq->task);
+}
+
+#endif /*HMMER_THREADS*/
+/*------------------- end, P7_SCHEDULER -------------------------*/
+
+
+
+/*****************************************************************
+ * 4. P7_TASKGROUP: waiting on a set of tasks.
+ *****************************************************************/
+#ifdef HMMER_THREADS
+
+/* Function:  p7_taskgroup_Create()
+ * Synopsis:  Create an empty task group.
+ *
+ * Returns:   ptr to the new task group.
+ *
+ * Throws:    <NULL> on allocation or pthreads init failure.
+ */
+P7_TASKGROUP *
+p7_taskgroup_Create(void)
+{
+  P7_TASKGROUP *grp = NULL;
+  int           status;
+
+  ESL_ALLOC(grp, sizeof(P7_TASKGROUP));
+  grp->npending = 0;
+  if (pthread_mutex_init(&grp->mutex, NULL) != 0) { free(grp); return NULL; }
+  if (pthread_cond_init (&grp->done,  NULL) != 0) { pthread_mutex_destroy(&grp->mutex); free(grp); return NULL; }
+  return grp;
+
+ ERROR:
+  return NULL;
+}
+
+/* Function:  p7_taskgroup_Wait()
+ * Synopsis:  Wait for all the tasks in a group to finish.
+ *
+ * Purpose:   Block until every task submitted in <grp> has finished.
+ *            The group may then be reused for more tasks.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslESYS> on a pthreads call failure.
+ */
+int
+p7_taskgroup_Wait(P7_TASKGROUP *grp)
+{
+  if (pthread_mutex_lock(&grp->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock failed");
+  while (grp->npending > 0)
+    if (pthread_cond_wait(&grp->done, &grp->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_cond_wait failed");
+  if (pthread_mutex_unlock(&grp->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock failed");
+  return eslOK;
+}
+
+/* Function:  p7_taskgroup_Destroy()
+ * Synopsis:  Free a task group.
+ *
+ * Purpose:   Free <grp>. Caller must have waited on it first.
+ */
+void
+p7_taskgroup_Destroy(P7_TASKGROUP *grp)
+{
+  if (! grp) return;
+  pthread_cond_destroy(&grp->done);
+  pthread_mutex_destroy(&grp->mutex);
+  free(grp);
+}
+
+static void
+taskgroup_Add(P7_TASKGROUP *grp)
+{
+  pthread_mutex_lock(&grp->mutex);
+  grp->npending++;
+  pthread_mutex_unlock(&grp->mutex);
+}
+
+static void
+taskgroup_Done(P7_TASKGROUP *grp)
+{
+  pthread_mutex_lock(&grp->mutex);
+  if (--grp->npending == 0) pthread_cond_broadcast(&grp->done);
+  pthread_mutex_unlock(&grp->mutex);
+}
+
+#endif /*HMMER_THREADS*/
+/*------------------- end, P7_TASKGROUP -------------------------*/
+
+
+
+/*****************************************************************
+ * 5. P7_BLOCKPOOL: reusable target sequence blocks.
+ *****************************************************************/
+#ifdef HMMER_THREADS
+
+/* Function:  p7_blockpool_Create()
+ * Synopsis:  Create a pool of target sequence blocks.
+ *
+ * Purpose:   Create a pool of <nblocks> digital sequence blocks of
+ *            <blocksize> sequences each, in alphabet <abc>. The
+ *            reader takes an empty block from the pool, fills it, and
+ *            hands it to a task; the task puts it back when it's
+ *            searched it. With a fixed number of blocks, the reader
+ *            can't run arbitrarily far ahead of the workers.
+ *
+ * Returns:   ptr to the new pool.
+ *
+ * Throws:    <NULL> on allocation or pthreads init failure.
+ */
+P7_BLOCKPOOL *
+p7_blockpool_Create(int nblocks, int blocksize, const ESL_ALPHABET *abc)
+{
+  P7_BLOCKPOOL *bp = NULL;
+  int           status;
+
+  ESL_ALLOC(bp, sizeof(P7_BLOCKPOOL));
+  bp->block   = NULL;
+  bp->nfree   = 0;
+  bp->nblocks = nblocks;
+  if (pthread_mutex_init(&bp->mutex, NULL) != 0) { free(bp); return NULL; }
+  if (pthread_cond_init (&bp->avail, NULL) != 0) { pthread_mutex_destroy(&bp->mutex); free(bp); return NULL; }
+
+  ESL_ALLOC(bp->block, sizeof(ESL_SQ_BLOCK *) * nblocks);
+  for (bp->nfree = 0; bp->nfree < nblocks; bp->nfree++)
+    if ((bp->block[bp->nfree] = esl_sq_CreateDigitalBlock(blocksize, abc)) == NULL) goto ERROR;
+  return bp;
+
+ ERROR:
+  p7_blockpool_Destroy(bp);
+  return NULL;
+}
+
+/* Function:  p7_blockpool_Get()
+ * Synopsis:  Take an empty block from the pool.
+ *
+ * Purpose:   Take a block from pool <bp>, waiting until one is
+ *            returned if none is free.
+ *
+ * Returns:   ptr to the block.
+ *
+ * Throws:    <NULL> on a pthreads call failure.
+ */
+ESL_SQ_BLOCK *
+p7_blockpool_Get(P7_BLOCKPOOL *bp)
+{
+  ESL_SQ_BLOCK *block;
+
+  if (pthread_mutex_lock(&bp->mutex) != 0) return NULL;
+  while (bp->nfree == 0)
+    if (pthread_cond_wait(&bp->avail, &bp->mutex) != 0) { pthread_mutex_unlock(&bp->mutex); return NULL; }
+  block = bp->block[--bp->nfree];
+  pthread_mutex_unlock(&bp->mutex);
+  return block;
+}
+
+/* Function:  p7_blockpool_Put()
+ * Synopsis:  Return a block to the pool.
+ *
+ * Purpose:   Return <block>, taken from <bp> with
+ *            <p7_blockpool_Get()>, to the pool. Its sequences must
+ *            already have been reset with <esl_sq_Reuse()>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslESYS> on a pthreads call failure.
+ */
+int
+p7_blockpool_Put(P7_BLOCKPOOL *bp, ESL_SQ_BLOCK *block)
+{
+  if (pthread_mutex_lock(&bp->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_lock failed");
+  bp->block[bp->nfree++] = block;
+  pthread_cond_signal(&bp->avail);
+  if (pthread_mutex_unlock(&bp->mutex) != 0) ESL_EXCEPTION(eslESYS, "pthread_mutex_unlock failed");
+  return eslOK;
+}
+
+/* Function:  p7_blockpool_Destroy()
+ * Synopsis:  Free a block pool.
+ *
+ * Purpose:   Free pool <bp> and its blocks. All blocks must have been
+ *            returned to it.
+ */
+void
+p7_blockpool_Destroy(P7_BLOCKPOOL *bp)
+{
+  int i;
+
+  if (! bp) return;
+  if (bp->block) {
+    for (i = 0; i < bp->nfree; i++) esl_sq_DestroyBlock(bp->block[i]);
+    free(bp->block);
+  }
+  pthread_cond_destroy(&bp->avail);
+  pthread_mutex_destroy(&bp->mutex);
+  free(bp);
+}
+
+#endif /*HMMER_THREADS*/
+/*------------------- end, P7_BLOCKPOOL -------------------------*/
+
+
+
+/*****************************************************************
+ * 6. Unit tests.
+ *****************************************************************/
+#ifdef p7SCHEDULER_TESTDRIVE
+
+#include "esl_random.h"
+#include "esl_randomseq.h"
+
+/* utest_blockreader()
+ * Write <N> random protein sequences to a tmpfile, mostly short with
+ * an occasional long one; read them back with a block reader, and
+ * check that every target comes back exactly once, in order; that
+ * no block goes over the cell budget unless it is a lone target; and
+ * that every long target is alone in its block.
+ */
+static void
+utest_blockreader(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, int N)
+{
+  char            msg[]       = "blockreader unit test failed";
+  char            tmpfile[32] = "tmp-hmmerXXXXXX";
+  FILE           *fp          = NULL;
+  ESL_SQFILE     *sqfp        = NULL;
+  ESL_SQ_BLOCK   *block       = esl_sq_CreateDigitalBlock(100, abc);
+  P7_BLOCKREADER *br          = NULL;
+  ESL_SQ         *sq          = esl_sq_CreateDigital(abc);
+  int            *len         = malloc(sizeof(int) * N);
+  int             M           = 200;
+  P7_BG          *bg          = p7_bg_Create(abc);
+  int64_t         longL       = (p7_BLOCKCELLS / 4 + M - 1) / M;
+  int64_t         cells;
+  int             nseen       = 0;
+  int             i;
+  char            name[32];
+  int             status;
+
+  if (len == NULL) esl_fatal(msg);
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  for (i = 0; i < N; i++)
+    {
+      len[i] = (esl_rnd_Roll(rng, 20) == 0) ? longL + esl_rnd_Roll(rng, 1000) : 1 + esl_rnd_Roll(rng, 500);
+      snprintf(name, 32, "seq%d", i);
+      esl_sq_GrowTo(sq, len[i]);
+      esl_rsq_xfIID(rng, bg->f, abc->K, len[i], sq->dsq);
+      sq->n = len[i];
+      esl_sq_SetName(sq, name);
+      if (esl_sqio_Write(fp, sq, eslSQFILE_FASTA, FALSE) != eslOK) esl_fatal(msg);
+      esl_sq_Reuse(sq);
+    }
+  fclose(fp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp) != eslOK) esl_fatal(msg);
+  if ((br = p7_blockreader_Create(sqfp, M, -1)) == NULL)                             esl_fatal(msg);
+
+  while ((status = p7_blockreader_Read(br, block)) == eslOK)
+    {
+      if (block->count < 1) esl_fatal(msg);
+      for (cells = 0, i = 0; i < block->count; i++)
+	{
+	  if (block->list[i].n != len[nseen]) esl_fatal(msg);
+	  if (block->list[i].n >= longL && block->count != 1) esl_fatal(msg);
+	  cells += block->list[i].n * M;
+	  nseen++;
+	}
+      if (block->count > 1 && cells - block->list[block->count-1].n * M >= p7_BLOCKCELLS) esl_fatal(msg);
+
+      for (i = 0; i < block->count; i++) esl_sq_Reuse(block->list + i);
+    }
+  if (status != eslEOF) esl_fatal(msg);
+  if (nseen  != N)      esl_fatal(msg);
+  p7_blockreader_Destroy(br);
+
+  /* With a limit on the number of targets, as in --restrictdb_n */
+  esl_sqfile_Position(sqfp, 0);
+  if ((br = p7_blockreader_Create(sqfp, M, N/2)) == NULL) esl_fatal(msg);
+  nseen = 0;
+  while ((status = p7_blockreader_Read(br, block)) == eslOK)
+    {
+      nseen += block->count;
+      for (i = 0; i < block->count; i++) esl_sq_Reuse(block->list + i);
+    }
+  if (status != eslEOF) esl_fatal(msg);
+  if (nseen  != N/2)    esl_fatal(msg);
+
+  p7_blockreader_Destroy(br);
+  esl_sqfile_Close(sqfp);
+  esl_sq_DestroyBlock(block);
+  esl_sq_Destroy(sq);
+  p7_bg_Destroy(bg);
+  free(len);
+  remove(tmpfile);
+}
+
+#ifdef HMMER_THREADS
+/* utest_taskqueue()
+ * Push <n> tasks on a deque, growing it past its initial size with
+ * the head wrapped around; check that the owner pops them newest
+ * first if they were submitted by a running task, else oldest first,
+ * and that thieves steal them oldest first.
+ */
+static void
+utest_taskqueue(int n)
+{
+  char          msg[] = "taskqueue unit test failed";
+  P7_TASKQUEUE  tq;
+  P7_TASK       task;
+  int          *val   = malloc(sizeof(int) * (n + 1));
+  int           lo, hi;
+  int           i;
+
+  if (val == NULL)                  esl_fatal(msg);
+  if (taskqueue_Init(&tq) != eslOK) esl_fatal(msg);
+  task.func  = NULL;
+  task.grp   = NULL;
+  task.inner = TRUE;
+
+  /* move the head off 0, so the buffer wraps when it grows */
+  for (i = 0; i < 10; i++) {
+    task.arg = val;
+    if (taskqueue_Push (&tq, &task) != eslOK) esl_fatal(msg);
+    if (taskqueue_Steal(&tq, &task) != eslOK) esl_fatal(msg);
+  }
+
+  for (i = 0; i < n; i++) {
+    task.arg = val + i + 1;
+    if (taskqueue_Push(&tq, &task) != eslOK) esl_fatal(msg);
+  }
+
+  /* take from both ends in turn */
+  for (lo = 1, hi = n, i = 0; i < n; i++) {
+    if (i % 2 == 0) { if (taskqueue_Pop  (&tq, &task) != eslOK || (int *) task.arg - val != hi--) esl_fatal(msg); }
+    else            { if (taskqueue_Steal(&tq, &task) != eslOK || (int *) task.arg - val != lo++) esl_fatal(msg); }
+  }
+  if (taskqueue_Pop  (&tq, &task) != eslEOF) esl_fatal(msg);
+  if (taskqueue_Steal(&tq, &task) != eslEOF) esl_fatal(msg);
+
+  /* tasks from outside: both ends take the oldest */
+  task.inner = FALSE;
+  for (i = 0; i < n; i++) {
+    task.arg = val + i + 1;
+    if (taskqueue_Push(&tq, &task) != eslOK) esl_fatal(msg);
+  }
+  for (lo = 1, i = 0; i < n; i++) {
+    if (i % 2 == 0) { if (taskqueue_Pop  (&tq, &task) != eslOK || (int *) task.arg - val != lo++) esl_fatal(msg); }
+    else            { if (taskqueue_Steal(&tq, &task) != eslOK || (int *) task.arg - val != lo++) esl_fatal(msg); }
+  }
+  if (taskqueue_Pop  (&tq, &task) != eslEOF) esl_fatal(msg);
+
+  taskqueue_Destroy(&tq);
+  free(val);
+}
+
+struct utest_task_s {
+  int            ntimes;	/* # of times this task was run                */
+  int            workeridx;	/* which worker ran it                         */
+  P7_SCHEDULER  *sch;		/* if non-NULL, submit <child> to it when run  */
+  P7_TASKGROUP  *grp;		/*   ... in this task group                    */
+  struct utest_task_s *child;
+};
+
+static void
+utest_task(void *arg, int workeridx)
+{
+  struct utest_task_s *t = (struct utest_task_s *) arg;
+  t->ntimes++;
+  t->workeridx = workeridx;
+  if (t->sch != NULL && p7_scheduler_Submit(t->sch, t->grp, utest_task, t->child) != eslOK) esl_fatal("scheduler unit test failed");
+}
+
+/* utest_scheduler()
+ * Submit <ntasks> tasks in two task groups to a scheduler with
+ * <nworkers> workers, pinned to NUMA nodes if <numa> is non-NULL;
+ * each task of the second group submits a child task to it from the
+ * worker. Wait on each group, and check that each of its tasks ran
+ * exactly once, on a valid worker.
+ */
+static void
+utest_scheduler(int nworkers, int ntasks, const P7_NUMA *numa)
+{
+  char                 msg[] = "scheduler unit test failed";
+  P7_SCHEDULER        *sch   = p7_scheduler_Create(nworkers, numa);
+  P7_TASKGROUP        *grp1  = p7_taskgroup_Create();
+  P7_TASKGROUP        *grp2  = p7_taskgroup_Create();
+  struct utest_task_s *t     = malloc(sizeof(struct utest_task_s) * ntasks * 2);
+  int                  i;
+
+  if (sch == NULL || grp1 == NULL || grp2 == NULL || t == NULL) esl_fatal(msg);
+  for (i = 0; i < ntasks * 2; i++)
+    {
+      t[i].ntimes    = 0;
+      t[i].workeridx = -1;
+      t[i].sch       = (i >= ntasks/2 && i < ntasks) ? sch  : NULL;
+      t[i].grp       = grp2;
+      t[i].child     = (i >= ntasks/2 && i < ntasks) ? &t[ntasks + i] : NULL;
+    }
+
+  for (i = 0; i < ntasks; i++)
+    if (p7_scheduler_Submit(sch, (i < ntasks/2) ? grp1 : grp2, utest_task, &t[i]) != eslOK) esl_fatal(msg);
+
+  if (p7_taskgroup_Wait(grp1) != eslOK) esl_fatal(msg);
+  for (i = 0; i < ntasks/2; i++)
+    if (t[i].ntimes != 1 || t[i].workeridx < 0 || t[i].workeridx >= nworkers) esl_fatal(msg);
+
+  if (p7_taskgroup_Wait(grp2) != eslOK) esl_fatal(msg);
+  for (i = ntasks/2; i < ntasks; i++)
+    if (t[i].ntimes != 1 || t[i].workeridx < 0 || t[i].workeridx >= nworkers) esl_fatal(msg);
+  for (i = ntasks + ntasks/2; i < ntasks * 2; i++)
+    if (t[i].ntimes != 1 || t[i].workeridx < 0 || t[i].workeridx >= nworkers) esl_fatal(msg);
+
+  p7_taskgroup_Destroy(grp1);
+  p7_taskgroup_Destroy(grp2);
+  p7_scheduler_Destroy(sch);
+  free(t);
+}
+
+struct utest_order_s {
+  pthread_mutex_t  mutex;
+  pthread_cond_t   go;
+  int              released;	/* TRUE once every task is submitted            */
+  int              nrun;	/* # of tasks run so far                        */
+  int             *order;	/* order[i]: when task i ran, 0..               */
+};
+
+struct utest_ordertask_s {
+  struct utest_order_s     *o;
+  int                       idx;
+  P7_SCHEDULER             *sch;   /* if non-NULL, submit <child> to it when run */
+  P7_TASKGROUP             *grp;   /*   ... in this task group                   */
+  struct utest_ordertask_s *child;
+};
+
+static void
+utest_gate(void *arg, int workeridx)
+{
+  struct utest_order_s *o = (struct utest_order_s *) arg;
+
+  pthread_mutex_lock(&o->mutex);
+  while (! o->released) pthread_cond_wait(&o->go, &o->mutex);
+  pthread_mutex_unlock(&o->mutex);
+}
+
+static void
+utest_ordertask(void *arg, int workeridx)
+{
+  struct utest_ordertask_s *t = (struct utest_ordertask_s *) arg;
+
+  t->o->order[t->idx] = t->o->nrun++;
+  if (t->sch != NULL && p7_scheduler_Submit(t->sch, t->grp, utest_ordertask, t->child) != eslOK) esl_fatal("scheduler order unit test failed");
+}
+
+/* utest_order()
+ * Submit <n> tasks in one task group, then <n> in another, from
+ * outside a one-worker scheduler held back until all are queued. The
+ * first task also submits a child task from inside. The tasks from
+ * outside must run in the order submitted, so the first group
+ * finishes first, and the child must run right after its parent.
+ */
+static void
+utest_order(int n)
+{
+  char                      msg[] = "scheduler order unit test failed";
+  P7_SCHEDULER             *sch   = p7_scheduler_Create(1, NULL);
+  P7_TASKGROUP             *grp1  = p7_taskgroup_Create();
+  P7_TASKGROUP             *grp2  = p7_taskgroup_Create();
+  struct utest_ordertask_s *t     = malloc(sizeof(struct utest_ordertask_s) * (2*n+1));
+  struct utest_order_s      o;
+  int                       i;
+
+  if (sch == NULL || grp1 == NULL || grp2 == NULL || t == NULL) esl_fatal(msg);
+  if ((o.order = malloc(sizeof(int) * (2*n+1))) == NULL)        esl_fatal(msg);
+  if (pthread_mutex_init(&o.mutex, NULL) != 0)                 esl_fatal(msg);
+  if (pthread_cond_init (&o.go,    NULL) != 0)                 esl_fatal(msg);
+  o.released = FALSE;
+  o.nrun     = 0;
+  for (i = 0; i <= 2*n; i++)
+    {
+      o.order[i]  = -1;
+      t[i].o      = &o;
+      t[i].idx    = i;
+      t[i].sch    = (i == 0) ? sch      : NULL;
+      t[i].grp    = grp1;
+      t[i].child  = (i == 0) ? &t[2*n]  : NULL;
+    }
+
+  if (p7_scheduler_Submit(sch, NULL, utest_gate, &o) != eslOK) esl_fatal(msg);
+  for (i = 0; i < 2*n; i++)
+    if (p7_scheduler_Submit(sch, (i < n) ? grp1 : grp2, utest_ordertask, &t[i]) != eslOK) esl_fatal(msg);
+
+  pthread_mutex_lock(&o.mutex);
+  o.released = TRUE;
+  pthread_cond_broadcast(&o.go);
+  pthread_mutex_unlock(&o.mutex);
+
+  if (p7_taskgroup_Wait(grp1) != eslOK) esl_fatal(msg);
+  if (p7_taskgroup_Wait(grp2) != eslOK) esl_fatal(msg);
+
+  for (i = 0; i < 2*n; i++)
+    if (o.order[i] != ((i == 0) ? 0 : i+1)) esl_fatal("%s: task %d ran %dth, not in submission order", msg, i, o.order[i]);
+  if (o.order[2*n] != 1) esl_fatal("%s: child task didn't run right after its parent", msg);
+
+  p7_taskgroup_Destroy(grp1);
+  p7_taskgroup_Destroy(grp2);
+  p7_scheduler_Destroy(sch);
+  pthread_cond_destroy(&o.go);
+  pthread_mutex_destroy(&o.mutex);
+  free(o.order);
+  free(t);
+}
+#endif /*HMMER_THREADS*/
+
+#endif /*p7SCHEDULER_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
+
+
+/*****************************************************************
+ * 7. Test driver.
+ *****************************************************************/
+#ifdef p7SCHEDULER_TESTDRIVE
+
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+
+#include "hmmer.h"
+#include "p7_scheduler.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  { "-s",        eslARG_INT,     "42", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                    0 },
+  { "-N",        eslARG_INT,    "500", NULL, NULL,  NULL,  NULL, NULL, "number of target sequences to sample",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for target work scheduling";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go  = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc = esl_alphabet_Create(eslAMINO);
+  int             N   = esl_opt_GetInteger(go, "-N");
+#ifdef HMMER_THREADS
+  P7_NUMA        *numa = NULL;
+#endif
+
+  fprintf(stderr, "## %s\n", argv[0]);
+  fprintf(stderr, "#  rng seed = %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  utest_blockreader(rng, abc, N);
+#ifdef HMMER_THREADS
+  numa = p7_numa_Create();
+  if (numa == NULL || numa->nnodes < 1) esl_fatal("p7_numa_Create() failed");
+  utest_taskqueue(1000);
+  utest_order(100);
+  utest_scheduler(1, 100,  NULL);
+  utest_scheduler(4, 1000, NULL);
+  utest_scheduler(4, 1000, numa);
+  p7_numa_Destroy(numa);
+#endif
+
+  fprintf(stderr, "#  status = ok\n");
+
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7SCHEDULER_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
@@ -0,0 +1,128 @@
+/* Scheduling target work for the multithreaded search programs.
+ */
+#ifndef P7_SCHEDULER_INCLUDED
+#define P7_SCHEDULER_INCLUDED
+
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#endif
+
+#include "esl_sq.h"
+#include "esl_sqio.h"
+
+/* P7_BLOCKREADER: reads target sequence blocks bounded by DP cost,
+ * not by sequence count. The cost of a comparison is taken to be
+ * the number of DP cells, L * M.
+ */
+typedef struct {
+  ESL_SQFILE *sqfp;		/* open digital target seq file (not owned)       */
+  ESL_SQ     *held;		/* long target read ahead, waiting for own block  */
+  int         nheld;		/* 1 if <held> contains a target; else 0          */
+
+  int64_t     M;		/* query length: a target of length L costs L*M   */
+  int64_t     max_cells;	/* DP cell budget of one block                    */
+  int64_t     long_cells;	/* targets costing >= this are scheduled alone    */
+  int         nleft;		/* # of targets left to read; -1 if no limit      */
+} P7_BLOCKREADER;
+
+extern P7_BLOCKREADER *p7_blockreader_Create (ESL_SQFILE *sqfp, int M, int nleft);
+extern int             p7_blockreader_Read   (P7_BLOCKREADER *br, ESL_SQ_BLOCK *block);
+extern void            p7_blockreader_Destroy(P7_BLOCKREADER *br);
+
+
+#ifdef HMMER_THREADS
+/* P7_NUMA: the machine's NUMA nodes and the cpus on each, for pinning
+ * worker threads to nodes (--numa). Memory a pinned thread allocates
+ * and first touches is then local to its node.
+ */
+typedef struct {
+  int    nnodes;		/* number of nodes; 1 if topology is unknown      */
+  int   *ncpus;			/* ncpus[n]: number of cpus on node n             */
+  int  **cpu;			/* cpu[n][0..ncpus[n]-1]: cpu ids on node n       */
+} P7_NUMA;
+
+extern P7_NUMA *p7_numa_Create (void);
+extern int      p7_numa_Bind   (const P7_NUMA *numa, int node);
+extern void     p7_numa_Destroy(P7_NUMA *numa);
+
+/* P7_TASKGROUP: a set of submitted tasks that a caller can wait on,
+ * such as all the block searches of one query.
+ */
+typedef struct {
+  int             npending;	/* # of tasks submitted but not yet finished      */
+  pthread_mutex_t mutex;
+  pthread_cond_t  done;		/* broadcast when <npending> drops to 0           */
+} P7_TASKGROUP;
+
+typedef struct {
+  void         (*func)(void *arg, int workeridx); /* run by a worker; <workeridx> is 0..nworkers-1 */
+  void          *arg;
+  P7_TASKGROUP  *grp;
+  int            inner;	/* TRUE if submitted by a running task            */
+} P7_TASK;
+
+/* Each worker owns a deque of tasks. Tasks submitted from outside
+ * the scheduler are spread round-robin across the deques, and each
+ * owner takes them oldest first, so the work of an earlier query
+ * finishes before that of the next, and its output isn't held back.
+ * A task submitted by a running task goes on that worker's own
+ * deque, and the owner takes it next (newest first), while its data
+ * is likely still in cache. When its own deque is empty, a worker
+ * steals the oldest task of another's, from workers on its own NUMA
+ * node first.
+ */
+typedef struct {
+  P7_TASK        *task;		/* circular buffer of tasks                       */
+  int             nalloc;	/* allocated size of <task>                       */
+  int             head;		/* index of the oldest task                       */
+  int             n;		/* number of tasks queued                         */
+  pthread_mutex_t mutex;	/* guards this deque only                         */
+} P7_TASKQUEUE;
+
+typedef struct p7_scheduler_s {
+  int              nworkers;	/* number of workers (and task queues)            */
+  int              nthreads;	/* number of worker threads running               */
+  pthread_t       *thread;	/* worker threads [0..nthreads-1]                 */
+  P7_TASKQUEUE    *q;		/* per-worker task queues [0..nworkers-1]         */
+  struct p7_schedarg_s *arg;	/* per-thread startup args [0..nworkers-1]        */
+  const P7_NUMA   *numa;	/* if non-NULL, workers are pinned (not owned)    */
+  int             *node;	/* NUMA node of each worker [0..nworkers-1]       */
+
+  /* Counters updated atomically, without the scheduler mutex */
+  int              nqueued;	/* total # of tasks queued over all <q>           */
+  int              nidle;	/* # of workers asleep, or about to be, on <work> */
+  unsigned int     next;	/* round-robin queue for the next submission      */
+  pthread_key_t    self;	/* each worker thread's startup arg               */
+
+  /* The scheduler mutex only guards sleeping and waking idle workers */
+  int              shutdown;	/* TRUE when workers should exit                  */
+  pthread_mutex_t  mutex;
+  pthread_cond_t   work;	/* signalled when a task is queued, or shutdown   */
+} P7_SCHEDULER;
+
+extern P7_SCHEDULER *p7_scheduler_Create (int nworkers, const P7_NUMA *numa);
+extern int           p7_scheduler_Submit (P7_SCHEDULER *sch, P7_TASKGROUP *grp, void (*func)(void *, int), void *arg);
+extern void          p7_scheduler_Destroy(P7_SCHEDULER *sch);
+
+extern P7_TASKGROUP *p7_taskgroup_Create (void);
+extern int           p7_taskgroup_Wait   (P7_TASKGROUP *grp);
+extern void          p7_taskgroup_Destroy(P7_TASKGROUP *grp);
+
+/* P7_BLOCKPOOL: a fixed set of reusable target sequence blocks,
+ * which bounds how far the reader runs ahead of the workers.
+ */
+typedef struct {
+  ESL_SQ_BLOCK  **block;	/* free blocks [0..nfree-1]                       */
+  int             nfree;	/* # of blocks in the pool now                    */
+  int             nblocks;	/* # of blocks owned by the pool                  */
+  pthread_mutex_t mutex;
+  pthread_cond_t  avail;	/* signalled when a block is returned             */
+} P7_BLOCKPOOL;
+
+extern P7_BLOCKPOOL *p7_blockpool_Create (int nblocks, int blocksize, const ESL_ALPHABET *abc);
+extern ESL_SQ_BLOCK *p7_blockpool_Get    (P7_BLOCKPOOL *bp);
+extern int           p7_blockpool_Put    (P7_BLOCKPOOL *bp, ESL_SQ_BLOCK *block);
+extern void          p7_blockpool_Destroy(P7_BLOCKPOOL *bp);
+#endif /*HMMER_THREADS*/
+
+#endif /*P7_SCHEDULER_INCLUDED*/
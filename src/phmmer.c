@@ -25,21 +25,37 @@
 #ifdef HMMER_THREADS
 #include <unistd.h>
 #include "esl_threads.h"
-#include "esl_workqueue.h"
 #endif
 
 #include "hmmer.h"
+#include "p7_scheduler.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif
   P7_BG            *bg;
   P7_PIPELINE      *pli;
   P7_TOPHITS       *th;
   P7_OPROFILE      *om;
 } WORKER_INFO;
 
+/* QUERY_INFO: one query and the per-worker pipelines its targets are
+ * searched with. With threads, the next query's targets are submitted
+ * before this one's results are collected, so more than one query
+ * can be in flight; each owns its own worker state.
+ */
+typedef struct {
+  ESL_SQ           *qsq;         /* query sequence                          */
+  P7_OPROFILE      *om;          /* optimized query profile                 */
+  int               qidx;        /* query number, 1..nquery                 */
+  int               infocnt;     /* number of workers                       */
+  WORKER_INFO      *info;        /* per-worker state [0..infocnt-1]         */
+  ESL_STOPWATCH    *w;           /* started at setup, stopped at last block */
+#ifdef HMMER_THREADS
+  P7_TASKGROUP     *grp;         /* this query's block search tasks         */
+  int               nblocks;     /* number of blocks submitted              */
+  pthread_mutex_t   wmutex;      /* guards <w> against workers              */
+#endif
+} QUERY_INFO;
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
@@ -149,11 +165,22 @@ struct cfg_s {
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
 static int  serial_loop  (WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs);
 
+static QUERY_INFO *query_Create (ESL_GETOPTS *go, P7_BUILDER *bld, const P7_BG *bg, ESL_SQ *qsq, int qidx, int infocnt);
+static int         query_Output (ESL_GETOPTS *go, QUERY_INFO *qi, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw);
+static void        query_Destroy(QUERY_INFO *qi);
+
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs);
-static void pipeline_thread(void *arg);
+/* BLOCK_TASK: one block of targets to search with one query */
+typedef struct {
+  QUERY_INFO       *qi;
+  ESL_SQ_BLOCK     *block;
+  P7_BLOCKPOOL     *pool;        /* where <block> goes back to when done    */
+} BLOCK_TASK;
+
+static int  thread_loop (P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, QUERY_INFO *qi, ESL_SQFILE *dbfp, int n_targetseqs);
+static void search_block(void *arg, int workeridx);
 #endif 
 
 #ifdef HMMER_MPI
@@ -392,26 +419,23 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ESL_ALPHABET    *abc      = NULL;               /* sequence alphabet                                */
   P7_BG           *bg       = NULL;		  /* null model (copies made of this into threads)    */
   P7_BUILDER      *bld      = NULL;               /* HMM construction configuration                   */
-  ESL_STOPWATCH   *w        = NULL;               /* for timing                                       */
+  QUERY_INFO      *qi       = NULL;               /* query being searched                             */
+  QUERY_INFO      *prevq    = NULL;               /* previous query, possibly still being searched    */
   int              nquery   = 0;
   int              seed;
   int              textw;
   int              status   = eslOK;
   int              qstatus  = eslOK;
   int              sstatus  = eslOK;
-  int              i;
   int              ncpus    = 0;
   int              infocnt  = 0;
-  WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  ESL_SQ_BLOCK    *block    = NULL;
-  ESL_THREADS     *threadObj= NULL;
-  ESL_WORK_QUEUE  *queue    = NULL;
+  P7_SCHEDULER    *sched    = NULL;
+  P7_BLOCKPOOL    *pool     = NULL;
 #endif
 
   /* Initializations */
   abc     = esl_alphabet_Create(eslAMINO);
-  w       = esl_stopwatch_Create();
   textw   = (esl_opt_GetBoolean(go, "--notextw") ? 0 : esl_opt_GetInteger(go, "--textw"));
   bg      = p7_bg_Create(abc);
 
@@ -483,54 +507,28 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ncpus = ESL_MIN( esl_opt_GetInteger(go, "--cpu"), esl_threads_GetCPUCount());
   if (ncpus > 0)
     {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
+      sched = p7_scheduler_Create(ncpus, NULL);
+      if (sched == NULL) p7_Fail("Failed to start worker threads");
+      pool  = p7_blockpool_Create(ncpus * 2, BLOCK_SIZE, abc);
+      if (pool  == NULL) p7_Fail("Failed to allocate sequence blocks");
     }
 #endif
 
   infocnt = (ncpus == 0) ? 1 : ncpus;
-  ESL_ALLOC(info, sizeof(*info) * infocnt);
 
   /* Show header output */
   output_header(ofp, go, cfg->qfile, cfg->dbfile);
 
-  for (i = 0; i < infocnt; ++i)
-    {
-      info[i].pli   = NULL;
-      info[i].th    = NULL;
-      info[i].om    = NULL;
-      info[i].bg    = p7_bg_Clone(bg);
-#ifdef HMMER_THREADS
-      info[i].queue = queue;
-#endif
-    }
-
-#ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
-    {
-      block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-      if (block == NULL) 
-	{
-	  p7_Fail("Failed to allocate sequence block");
-	}
-
-      status = esl_workqueue_Init(queue, block);
-      if (status != eslOK) 
-	{
-	  p7_Fail("Failed to add block to work queue");
-	}
-    }
-#endif
-
-  /* Outer loop over sequence queries */
+  /* Outer loop over sequence queries.
+   * With threads, a query's target blocks are queued behind the
+   * previous query's, and the previous query's results are collected
+   * and output only once this one's are all submitted; the workers
+   * don't idle at the boundary between queries.
+   */
   while ((qstatus = esl_sqio_Read(qfp, qsq)) == eslOK)
     {
-      P7_OPROFILE     *om       = NULL;           /* optimized query profile                  */
-
       nquery++;
-      if (qsq->n == 0) continue; /* skip zero length seqs as if they aren't even present */
-
-      esl_stopwatch_Start(w);
+      if (qsq->n == 0) { esl_sq_Reuse(qsq); continue; } /* skip zero length seqs as if they aren't even present */
 
       /* seqfile may need to be rewound (multiquery mode) */
       if (nquery > 1)
@@ -547,33 +545,16 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
           p7_Fail("Failure setting restrictdb_stkey to %d\n", cfg->firstseq_key);
       }
 
-
-      if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->acc[0]  != '\0' && fprintf(ofp, "Accession:   %s\n", qsq->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->desc[0] != '\0' && fprintf(ofp, "Description: %s\n", qsq->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
-
-
-      /* Build the model */
-      p7_SingleBuilder(bld, qsq, info[0].bg, NULL, NULL, NULL, &om); /* bypass HMM - only need model */
-
-      for (i = 0; i < infocnt; ++i)
-      {
-        /* Create processing pipeline and hit list */
-        info[i].th  = p7_tophits_Create();
-        info[i].om  = p7_oprofile_Clone(om);
-        info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
-        p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
+      /* Build the model; create processing pipelines and hit lists. <qi> takes over <qsq>. */
+      qi  = query_Create(go, bld, bg, qsq, nquery, infocnt);
+      if (qi == NULL) p7_Fail("Failed to set up query %s: allocation failed", qsq->name);
+      qsq = esl_sq_CreateDigital(abc);
 
 #ifdef HMMER_THREADS
-        if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
-#endif
-      }
-
-#ifdef HMMER_THREADS
-      if (ncpus > 0) sstatus = thread_loop(threadObj, queue, dbfp, cfg->n_targetseq);
-      else           sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      if (ncpus > 0) sstatus = thread_loop(sched, pool, qi, dbfp, cfg->n_targetseq);
+      else           sstatus = serial_loop(qi->info, dbfp, cfg->n_targetseq);
 #else
-      sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      sstatus = serial_loop(qi->info, dbfp, cfg->n_targetseq);
 #endif
       switch(sstatus)
       {
@@ -588,66 +569,35 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
         p7_Fail("Unexpected error %d reading sequence file %s",
             sstatus, dbfp->filename);
       }
+#ifdef HMMER_THREADS
+      if (ncpus == 0 || qi->nblocks == 0) esl_stopwatch_Stop(qi->w);
+#else
+      esl_stopwatch_Stop(qi->w);
+#endif
 
-
-      /* merge the results of the search results */
-      for (i = 1; i < infocnt; ++i)
-      {
-        p7_tophits_Merge(info[0].th, info[i].th);
-        p7_pipeline_Merge(info[0].pli, info[i].pli);
-
-        p7_pipeline_Destroy(info[i].pli);
-        p7_tophits_Destroy(info[i].th);
-        p7_oprofile_Destroy(info[i].om);
-      }
-
-      /* Print the results.  */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-  
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
-
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
-      if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      fflush(ofp);
-
-      /* Output the results in an MSA (-A option) */
-      if (afp) {
-	ESL_MSA *msa = NULL;
-
-	if ( p7_tophits_Alignment(info->th, abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK) 
-	  {
-	    esl_msa_SetName     (msa, om->name, -1);   // don't use qsq->name; it's optional in a ESL_SQ, and SingleBuilder took care of naming model.
-	    if (qsq->acc[0]  != '\0') esl_msa_SetAccession(msa, qsq->acc,  -1);
-	    if (qsq->desc[0] != '\0') esl_msa_SetDesc     (msa, qsq->desc, -1);
-	    esl_msa_FormatAuthor(msa, "phmmer (HMMER %s)", HMMER_VERSION);
-
-	    if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
-	    else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
-
-	    if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  }
-	else if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  
-	esl_msa_Destroy(msa);
-      }
-
-      p7_tophits_Destroy(info->th);
-      p7_pipeline_Destroy(info->pli);
-      p7_oprofile_Destroy(info->om);
-      p7_oprofile_Destroy(om);
-      esl_sq_Reuse(qsq);
+      /* Print the results of the previous query, now that this one's
+       * are queued behind it.
+       */
+      if (prevq)
+	{
+	  if ((status = query_Output(go, prevq, ofp, afp, tblfp, domtblfp, pfamtblfp, textw)) != eslOK) goto ERROR;
+	  query_Destroy(prevq);
+	}
+      prevq = qi;
+      qi    = NULL;
     } /* end outer loop over query sequences */
   if      (qstatus == eslEFORMAT) p7_Fail("Parse failed (sequence file %s):\n%s\n",
 					    qfp->filename, esl_sqfile_GetErrorBuf(qfp));
   else if (qstatus != eslEOF)     p7_Fail("Unexpected error %d reading sequence file %s",
 					    qstatus, qfp->filename);
 
+  if (prevq)
+    {
+      if ((status = query_Output(go, prevq, ofp, afp, tblfp, domtblfp, pfamtblfp, textw)) != eslOK) goto ERROR;
+      query_Destroy(prevq);
+      prevq = NULL;
+    }
+
 
   /* Terminate outputs - any last words?
    */
@@ -658,24 +608,13 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   /* Cleanup - prepare for successful exit
    */
-  for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
-
 #ifdef HMMER_THREADS
-  if (ncpus > 0)
-    {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
-    }
+  p7_scheduler_Destroy(sched);
+  p7_blockpool_Destroy(pool);
 #endif
 
-  free(info);
   esl_sqfile_Close(dbfp);
   esl_sqfile_Close(qfp);
-  esl_stopwatch_Destroy(w);
   esl_sq_Destroy(qsq);
   p7_bg_Destroy(bg);
   p7_builder_Destroy(bld);
@@ -692,6 +631,160 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return status;
 }
 
+/* query_Create()
+ * Build the model for query sequence <qsq> (number <qidx>), and create
+ * the pipelines, hit lists and profile clones for <infocnt> workers,
+ * each with its own copy of null model <bg>. The new QUERY_INFO takes
+ * ownership of <qsq>. Starts the query's stopwatch. Returns NULL on
+ * allocation failure, and <qsq> is then still the caller's; other
+ * errors are fatal.
+ */
+static QUERY_INFO *
+query_Create(ESL_GETOPTS *go, P7_BUILDER *bld, const P7_BG *bg, ESL_SQ *qsq, int qidx, int infocnt)
+{
+  QUERY_INFO *qi = NULL;
+  int         i;
+  int         status;
+
+  ESL_ALLOC(qi, sizeof(QUERY_INFO));
+  qi->qsq     = qsq;
+  qi->om      = NULL;
+  qi->qidx    = qidx;
+  qi->infocnt = infocnt;
+  qi->info    = NULL;
+  qi->w       = esl_stopwatch_Create();
+  esl_stopwatch_Start(qi->w);
+
+  /* Each query has its own null models: p7_pli_NewModel() sets their
+   * bias filter from the query, and the previous query's blocks may
+   * still be in flight.
+   */
+  ESL_ALLOC(qi->info, sizeof(WORKER_INFO) * infocnt);
+  for (i = 0; i < infocnt; ++i)
+    qi->info[i].bg = p7_bg_Clone(bg);
+
+  /* Build the model */
+  p7_SingleBuilder(bld, qsq, qi->info[0].bg, NULL, NULL, NULL, &(qi->om)); /* bypass HMM - only need model */
+
+  for (i = 0; i < infocnt; ++i)
+    {
+      /* Create processing pipeline and hit list */
+      qi->info[i].th  = p7_tophits_Create();
+      qi->info[i].om  = p7_oprofile_Clone(qi->om);
+      qi->info[i].pli = p7_pipeline_Create(go, qi->om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+      p7_pli_NewModel(qi->info[i].pli, qi->info[i].om, qi->info[i].bg);
+    }
+
+#ifdef HMMER_THREADS
+  qi->nblocks = 0;
+  if ((qi->grp = p7_taskgroup_Create()) == NULL) p7_Fail("Failed to create task group");
+  if (pthread_mutex_init(&qi->wmutex, NULL) != 0) p7_Fail("Failed to create mutex");
+#endif
+  return qi;
+
+ ERROR:
+  if (qi)
+    {
+      if (qi->info) free(qi->info);
+      esl_stopwatch_Destroy(qi->w);
+      free(qi);
+    }
+  return NULL;
+}
+
+
+/* query_Output()
+ * Wait for all of query <qi>'s targets to be searched, merge the
+ * workers' results, and output them.
+ */
+static int
+query_Output(ESL_GETOPTS *go, QUERY_INFO *qi, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw)
+{
+  ESL_SQ      *qsq  = qi->qsq;
+  WORKER_INFO *info = qi->info;
+  int          i;
+
+#ifdef HMMER_THREADS
+  if (p7_taskgroup_Wait(qi->grp) != eslOK) p7_Fail("Failed waiting for search tasks");
+#endif
+
+  /* merge the results of the search results */
+  for (i = 1; i < qi->infocnt; ++i)
+    {
+      p7_tophits_Merge(info[0].th, info[i].th);
+      p7_pipeline_Merge(info[0].pli, info[i].pli);
+    }
+
+  if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (qsq->acc[0]  != '\0' && fprintf(ofp, "Accession:   %s\n", qsq->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (qsq->desc[0] != '\0' && fprintf(ofp, "Description: %s\n", qsq->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
+
+  /* Print the results.  */
+  p7_tophits_SortBySortkey(info->th);
+  p7_tophits_Threshold(info->th, info->pli);
+  p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  
+  if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (qi->qidx == 1));
+  if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (qi->qidx == 1));
+  if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
+
+  p7_pli_Statistics(ofp, info->pli, qi->w);
+  if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  fflush(ofp);
+
+  /* Output the results in an MSA (-A option) */
+  if (afp) {
+    ESL_MSA *msa = NULL;
+
+    if ( p7_tophits_Alignment(info->th, qi->om->abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK) 
+      {
+	esl_msa_SetName     (msa, qi->om->name, -1);   // don't use qsq->name; it's optional in a ESL_SQ, and SingleBuilder took care of naming model.
+	if (qsq->acc[0]  != '\0') esl_msa_SetAccession(msa, qsq->acc,  -1);
+	if (qsq->desc[0] != '\0') esl_msa_SetDesc     (msa, qsq->desc, -1);
+	esl_msa_FormatAuthor(msa, "phmmer (HMMER %s)", HMMER_VERSION);
+
+	if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
+	else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
+
+	if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      }
+    else if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  
+    esl_msa_Destroy(msa);
+  }
+  return eslOK;
+}
+
+
+/* query_Destroy()
+ * Free a query and all its worker state. Its search tasks must have
+ * finished; see query_Output().
+ */
+static void
+query_Destroy(QUERY_INFO *qi)
+{
+  int i;
+
+  if (! qi) return;
+  for (i = 0; i < qi->infocnt; ++i)
+    {
+      p7_pipeline_Destroy(qi->info[i].pli);
+      p7_tophits_Destroy(qi->info[i].th);
+      p7_oprofile_Destroy(qi->info[i].om);
+      p7_bg_Destroy(qi->info[i].bg);
+    }
+#ifdef HMMER_THREADS
+  p7_taskgroup_Destroy(qi->grp);
+  pthread_mutex_destroy(&qi->wmutex);
+#endif
+  free(qi->info);
+  p7_oprofile_Destroy(qi->om);
+  esl_sq_Destroy(qi->qsq);
+  esl_stopwatch_Destroy(qi->w);
+  free(qi);
+}
+
 #ifdef HMMER_MPI
 
 /* Define common tags used by the MPI master/slave processes */
@@ -1422,112 +1515,82 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
 }
 
 #ifdef HMMER_THREADS
+/* thread_loop()
+ * Read the targets for query <qi> in blocks taken from <pool>, and
+ * submit a search task for each block to the scheduler. Returns as
+ * soon as the last block is submitted, without waiting for the
+ * searches; see query_Output().
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs)
+thread_loop(P7_SCHEDULER *sched, P7_BLOCKPOOL *pool, QUERY_INFO *qi, ESL_SQFILE *dbfp, int n_targetseqs)
 {
-  int  status  = eslOK;
-  int  sstatus = eslOK;
-  int  eofCount = 0;
-  ESL_SQ_BLOCK *block;
-  void         *newBlock;
+  int             sstatus = eslOK;
+  ESL_SQ_BLOCK   *block;
+  BLOCK_TASK     *task;
+  P7_BLOCKREADER *br;
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+  br = p7_blockreader_Create(dbfp, qi->om->M, n_targetseqs);
+  if (br == NULL) p7_Fail("Failed to create target block reader");
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
-      
   /* Main loop: */
   while (sstatus == eslOK)
     {
-      block = (ESL_SQ_BLOCK *) newBlock;
-
-      if (n_targetseqs == 0)
-      {
-        block->count = 0;
-        sstatus = eslEOF;
-      } else {
-        sstatus = esl_sqio_ReadBlock(dbfp, block, -1, n_targetseqs, FALSE);
-        n_targetseqs -= block->count;
-      }
-
-      if (sstatus == eslEOF)
-      {
-        if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-        ++eofCount;
-      }
-	  
-      if (sstatus == eslOK)
-      {
-        status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-        if (status != eslOK) p7_Fail("Work queue reader failed");
-      }
-    }
+      block = p7_blockpool_Get(pool);
+      if (block == NULL) p7_Fail("Failed to get a sequence block");
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
+      sstatus = p7_blockreader_Read(br, block);
+      if (sstatus != eslOK)
+	{
+	  p7_blockpool_Put(pool, block);
+	  break;
+	}
 
-  if (sstatus == eslEOF)
-    {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      if ((task = malloc(sizeof(BLOCK_TASK))) == NULL) p7_Fail("malloc failed");
+      task->qi    = qi;
+      task->block = block;
+      task->pool  = pool;
+      if (p7_scheduler_Submit(sched, qi->grp, search_block, task) != eslOK) p7_Fail("Failed to submit search task");
+      qi->nblocks++;
     }
 
+  p7_blockreader_Destroy(br);
   return sstatus;
 }
 
+/* search_block()
+ * Task: search one block of targets with one query, using the
+ * pipeline and hit list of worker <workeridx>.
+ */
 static void 
-pipeline_thread(void *arg)
+search_block(void *arg, int workeridx)
 {
-  int i;
-  int status;
-  int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-  ESL_SQ_BLOCK  *block = NULL;
-  void          *newBlock;
-  
-  impl_Init();
-
-  obj = (ESL_THREADS *) arg;
-  esl_threads_Started(obj, &workeridx);
-
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
-
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
-  if (status != eslOK) p7_Fail("Work queue worker failed");
+  BLOCK_TASK   *task  = (BLOCK_TASK *) arg;
+  QUERY_INFO   *qi    = task->qi;
+  WORKER_INFO  *info  = &(qi->info[workeridx]);
+  ESL_SQ_BLOCK *block = task->block;
+  int           i;
 
-  /* loop until all blocks have been processed */
-  block = (ESL_SQ_BLOCK *) newBlock;
-  while (block->count > 0)
+  for (i = 0; i < block->count; ++i)
     {
-      /* Main loop: */
-      for (i = 0; i < block->count; ++i)
-	{
-	  ESL_SQ *dbsq = block->list + i;
+      ESL_SQ *dbsq = block->list + i;
 
-	  p7_pli_NewSeq(info->pli, dbsq);
-	  p7_bg_SetLength(info->bg, dbsq->n);
-	  p7_oprofile_ReconfigLength(info->om, dbsq->n);
+      p7_pli_NewSeq(info->pli, dbsq);
+      p7_bg_SetLength(info->bg, dbsq->n);
+      p7_oprofile_ReconfigLength(info->om, dbsq->n);
 	  
-	  p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
+      p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
 	  
-	  esl_sq_Reuse(dbsq);
-	  p7_pipeline_Reuse(info->pli);
-	}
-
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
-      if (status != eslOK) p7_Fail("Work queue worker failed");
-
-      block = (ESL_SQ_BLOCK *) newBlock;
+      esl_sq_Reuse(dbsq);
+      p7_pipeline_Reuse(info->pli);
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
-  if (status != eslOK) p7_Fail("Work queue worker failed");
+  /* the query's elapsed time runs until its last block is done */
+  pthread_mutex_lock(&qi->wmutex);
+  esl_stopwatch_Stop(qi->w);
+  pthread_mutex_unlock(&qi->wmutex);
 
-  esl_threads_Finished(obj, workeridx);
-  return;
+  if (p7_blockpool_Put(task->pool, block) != eslOK) p7_Fail("Failed to return sequence block");
+  free(task);
 }
 #endif   /* HMMER_THREADS */
 
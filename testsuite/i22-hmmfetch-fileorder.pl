@@ -0,0 +1,76 @@
+#! /usr/bin/perl
+
+# Test that hmmfetch -f --fileorder, with an SSI index, retrieves
+# HMMs in the order of the HMM file rather than of the key file;
+# that plain hmmfetch -f with an index follows the key file; and
+# that --fileorder without an index warns, and still gives file
+# order.
+#
+# Usage:   ./i22-hmmfetch-fileorder.pl <builddir> <srcdir> <tmpfile prefix>
+# Example: ./i22-hmmfetch-fileorder.pl ..         ..       tmpfoo
+#
+
+BEGIN {
+    $builddir  = shift;
+    $srcdir    = shift;
+    $tmppfx    = shift;
+    $verbose   = shift;  # if arg not given, defaults to false (zero)
+}
+
+# The test creates the following files:
+# $tmppfx.hmm         four HMMs:  M1, RRM_1, Caudal_act, LuxC
+# $tmppfx.hmm.ssi     its SSI index
+# $tmppfx.noidx.hmm   a copy of $tmppfx.hmm, without an index
+# $tmppfx.key         the keys, in a different order from the HMM file
+
+if (! -x "$builddir/src/hmmfetch") { die "FAIL: didn't find hmmfetch executable in $builddir/src\n"; }
+
+@fileorder = ("M1", "RRM_1", "Caudal_act", "LuxC");
+@keyorder  = ("LuxC", "M1", "Caudal_act", "RRM_1");
+
+unlink "$tmppfx.hmm.ssi";
+do_cmd("cat $srcdir/testsuite/M1.hmm $srcdir/testsuite/RRM_1.hmm $srcdir/testsuite/Caudal_act.hmm $srcdir/testsuite/LuxC.hmm > $tmppfx.hmm");
+do_cmd("cp $tmppfx.hmm $tmppfx.noidx.hmm");
+
+open(KEYFILE, ">$tmppfx.key") || die "FAIL: couldn't open $tmppfx.key for writing";
+foreach $key (@keyorder) { print KEYFILE "$key\n"; }
+close KEYFILE;
+
+do_cmd("$builddir/src/hmmfetch --index $tmppfx.hmm 2>&1");
+if ($? != 0) { die "FAIL: hmmfetch --index failed\n"; }
+
+$output = do_cmd("$builddir/src/hmmfetch -f --fileorder $tmppfx.hmm $tmppfx.key 2>&1");
+if ($? != 0)                      { die "FAIL: hmmfetch -f --fileorder failed\n"; }
+if ($output =~ /Warning/)         { die "FAIL: hmmfetch -f --fileorder warned, with an index\n"; }
+check_order($output, @fileorder);
+
+$output = do_cmd("$builddir/src/hmmfetch -f $tmppfx.hmm $tmppfx.key 2>&1");
+if ($? != 0)                      { die "FAIL: hmmfetch -f failed\n"; }
+check_order($output, @keyorder);
+
+$output = do_cmd("$builddir/src/hmmfetch -f --fileorder $tmppfx.noidx.hmm $tmppfx.key 2>&1");
+if ($? != 0)                      { die "FAIL: hmmfetch -f --fileorder failed without an index\n"; }
+if ($output !~ /Warning: no SSI index/) { die "FAIL: hmmfetch -f --fileorder didn't warn about the missing index\n"; }
+check_order($output, @fileorder);
+
+print "ok\n";
+unlink "$tmppfx.hmm";
+unlink "$tmppfx.hmm.ssi";
+unlink "$tmppfx.noidx.hmm";
+unlink "$tmppfx.key";
+exit 0;
+
+
+sub check_order {
+    my ($output, @expected) = @_;
+    my @names = ($output =~ /^NAME\s+(\S+)/mg);
+    if (join(" ", @names) ne join(" ", @expected)) {
+	die "FAIL: hmmfetch gave HMMs in order @names, expected @expected\n";
+    }
+}
+
+sub do_cmd {
+    $cmd = shift;
+    print "$cmd\n" if $verbose;
+    return `$cmd`;
+}